@@ -56,6 +56,8 @@ class ApiIF {
         // Override as needed
 	virtual bool isBusy() const { return false; }
 	virtual void checkResponse() { }
+	// true if send() never blocks, e.g. hands its request to the shared curlMultiSender
+	virtual bool async() const { return false; }
 
   protected:
 	Channel::Ptr channel() { return _ch; }
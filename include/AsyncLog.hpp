@@ -0,0 +1,75 @@
+/**
+ * AsyncLog - hands the log lines of all threads to one writer thread
+ *
+ * print() formats a line in the calling thread and pushes it to a lock-free queue.
+ * The writer thread wakes up every flush_ms, or at once for errors, and outputs all
+ * queued lines in one batch with a single flush. The line buffers go back to the
+ * producers through a second queue, so logging doesn't allocate once warmed up.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __ASYNC_LOG_HPP_
+#define __ASYNC_LOG_HPP_
+
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+
+class AsyncLog {
+  public:
+	// where a line goes besides the logfile
+	enum { CONSOLE = 1, STDERR = 2 };
+
+	struct Line {
+		std::string text; // incl. the newline
+		int flags;
+	};
+	// outputs a batch, called from the writer thread only
+	typedef void (*write_func)(std::vector<Line> &lines, void *arg);
+
+	AsyncLog(write_func func, void *arg, int flush_ms = 1000, size_t capacity = 8192);
+	~AsyncLog(); // stop()s
+	AsyncLog(const AsyncLog &) = delete;
+	AsyncLog &operator=(const AsyncLog &) = delete;
+
+	void start();
+	void stop(); // writes the queued lines and joins the writer thread
+
+	// thread-safe and never blocks. Takes the content of line and leaves an empty, recycled
+	// buffer in it. Returns false if the queue is full, line is unchanged then.
+	bool write(std::string &line, int flags, bool urgent = false);
+
+	static const size_t RECYCLE_MAX = 1024; // larger buffers are freed, not recycled
+
+  private:
+	static void *thread(void *arg);
+	void run();
+	void drain();
+	void wakeup();
+
+	write_func _func;
+	void *_arg;
+	int _flush_ms;
+
+	BoundedQueue<Line> _queue;
+	BoundedQueue<std::string> _free; // empty buffers for the producers
+	std::vector<Line> _batch;        // writer thread only
+
+	int _wakefd;                      // eventfd, signaled for urgent lines and stop()
+	std::atomic<bool> _wakeupPending; // _wakefd is signaled already
+	std::atomic<bool> _stop;
+	std::atomic<unsigned long> _dropped; // lines lost as the queue was full
+	pthread_t _thread;
+	bool _thread_running;
+};
+
+// var to a global/single instance, NULL if logging synchronously. initialized in main()
+extern AsyncLog *asyncLog;
+
+#endif
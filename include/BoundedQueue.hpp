@@ -0,0 +1,102 @@
+/**
+ * BoundedQueue - fixed size lock-free multi-producer/multi-consumer queue
+ *
+ * Each cell carries a sequence number telling whether it's free for the producer
+ * or filled for the consumer of a given position (D. Vyukov's bounded queue).
+ * push() and pop() never block and never allocate, push() fails if the queue is full.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __BOUNDED_QUEUE_HPP_
+#define __BOUNDED_QUEUE_HPP_
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <utility>
+
+template <typename T> class BoundedQueue {
+  public:
+	explicit BoundedQueue(size_t capacity) {
+		_head.pos.store(0, std::memory_order_relaxed);
+		_tail.pos.store(0, std::memory_order_relaxed);
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		_mask = size - 1;
+		_cells.reset(new Cell[size]);
+		for (size_t i = 0; i < size; i++)
+			_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+	BoundedQueue(const BoundedQueue &) = delete;
+	BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+	size_t capacity() const { return _mask + 1; }
+
+	bool push(T &&v) {
+		size_t pos = _head.pos.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;) {
+			cell = &_cells[pos & _mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+			if (diff == 0) {
+				if (_head.pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false; // full
+			} else {
+				pos = _head.pos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = std::move(v);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T &v) {
+		size_t pos = _tail.pos.load(std::memory_order_relaxed);
+		Cell *cell;
+		for (;;) {
+			cell = &_cells[pos & _mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+			if (diff == 0) {
+				if (_tail.pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (diff < 0) {
+				return false; // empty
+			} else {
+				pos = _tail.pos.load(std::memory_order_relaxed);
+			}
+		}
+		v = std::move(cell->data);
+		cell->data = T(); // don't keep references (e.g. shared_ptr) alive in free cells
+		cell->seq.store(pos + _mask + 1, std::memory_order_release);
+		return true;
+	}
+
+  private:
+	struct Cell {
+		std::atomic<size_t> seq;
+		T data;
+	};
+
+	// a position on a cache line of its own. Padded rather than alignas(64), the classes
+	// owning a queue would need an aligned operator new for that before C++17.
+	struct Position {
+		char before[64];
+		std::atomic<size_t> pos;
+		char after[64 - sizeof(std::atomic<size_t>)];
+	};
+
+	std::unique_ptr<Cell[]> _cells;
+	size_t _mask;
+	Position _head; // next position to push
+	Position _tail; // next position to pop
+};
+
+#endif
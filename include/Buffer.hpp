@@ -1,5 +1,5 @@
 /**
- * Circular buffer (double linked, threadsafe)
+ * Circular buffer (preallocated ring, threadsafe)
  *
  * Used to store recent readings and buffer in case of net inconnectivity
  *
@@ -28,7 +28,8 @@
 #ifndef _BUFFER_H_
 #define _BUFFER_H_
 
-#include <list>
+#include <iterator>
+#include <vector>
 #ifdef VZ_USE_THREADS
 # include <pthread.h>
 #endif // VZ_USE_THREADS
@@ -38,16 +39,76 @@
 
 class Buffer {
 
+	/**
+	 * Iterator over the ring in logical (oldest first) order
+	 */
+	template <class B, class S> class ring_iterator {
+	  public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef S value_type;
+		typedef ptrdiff_t difference_type;
+		typedef S *pointer;
+		typedef S &reference;
+
+		ring_iterator() : _buf(0), _pos(0) {}
+		ring_iterator(B *buf, size_t pos) : _buf(buf), _pos(pos) {}
+
+		reference operator*() const { return _buf->at(_pos); }
+		pointer operator->() const { return &_buf->at(_pos); }
+
+		ring_iterator &operator++() {
+			_pos++;
+			return *this;
+		}
+		ring_iterator operator++(int) {
+			ring_iterator tmp(*this);
+			_pos++;
+			return tmp;
+		}
+		ring_iterator &operator--() {
+			_pos--;
+			return *this;
+		}
+		ring_iterator operator--(int) {
+			ring_iterator tmp(*this);
+			_pos--;
+			return tmp;
+		}
+
+		bool operator==(const ring_iterator &rhs) const {
+			return _buf == rhs._buf && _pos == rhs._pos;
+		}
+		bool operator!=(const ring_iterator &rhs) const { return !(*this == rhs); }
+
+	  private:
+		B *_buf;
+		size_t _pos; // logical index, 0 is the oldest sample
+	};
+
   public:
 	typedef vz::shared_ptr<Buffer> Ptr;
-	typedef std::list<Reading>::iterator iterator;
-	typedef std::list<Reading>::const_iterator const_iterator;
+	typedef ring_iterator<Buffer, Sample> iterator;
+	typedef ring_iterator<const Buffer, const Sample> const_iterator;
+
+	enum aggmode { NONE, MAX, AVG, SUM, MIN, FIRST, LAST, COUNT, STDDEV };
 
-	enum aggmode { NONE, MAX, AVG, SUM };
+	/**
+	 * What push() does if the ring is full:
+	 *  SPILL:       grow the ring (unbounded, the historic behaviour)
+	 *  DROP_OLDEST: overwrite the oldest sample
+	 *  BLOCK:       wait until the sender has made room
+	 */
+	enum overflow { SPILL, DROP_OLDEST, BLOCK };
 
-	Buffer();
+	Buffer(size_t capacity = 64, overflow policy = SPILL);
 	virtual ~Buffer();
 
+	/**
+	 * Finish the current aggregation period
+	 *
+	 * For aggmode != NONE push() only updates running values, so this
+	 * emits a single sample in O(1) and starts the next period.
+	 */
 	void aggregate(int aggtime, bool aggFixedInterval);
 	void push(const Reading &rd);
 	void clean(bool deleted_only = true);
@@ -55,11 +116,13 @@ class Buffer {
 	void shrink(/*size_t keep = 0*/);
 	std::string dump();
 
-	inline iterator begin() { return _sent.begin(); }
-	inline iterator end() { return _sent.end(); }
+	inline iterator begin() { return iterator(this, 0); }
+	inline iterator end() { return iterator(this, _count); }
+	inline const_iterator begin() const { return const_iterator(this, 0); }
+	inline const_iterator end() const { return const_iterator(this, _count); }
 	inline size_t size() {
 		lock();
-		size_t s = _sent.size();
+		size_t s = _count;
 		unlock();
 		return s;
 	}
@@ -71,6 +134,9 @@ class Buffer {
 	inline void lock() { pthread_mutex_lock(&_mutex); }
 	inline void unlock() { pthread_mutex_unlock(&_mutex); }
 	inline void wait(pthread_cond_t *condition) { pthread_cond_wait(condition, &_mutex); }
+
+	// condition the sender waits on, signalled if a BLOCKing push needs room
+	inline void consumer(pthread_cond_t *condition) { _consumer = condition; }
 #else // VZ_USE_THREADS
 	inline void lock() { _locked = true; }
 	inline void unlock() { _locked = false; }
@@ -81,11 +147,51 @@ class Buffer {
 	inline void set_aggmode(Buffer::aggmode m) { _aggmode = m; }
 	inline aggmode get_aggmode() const { return _aggmode; }
 
+	void set_capacity(size_t capacity);
+	inline size_t capacity() const { return _ring.size(); }
+	inline void set_overflow(Buffer::overflow o) { _overflow = o; }
+	inline overflow get_overflow() const { return _overflow; }
+	inline size_t dropped() const { return _dropped; }
+
   private:
 	Buffer(const Buffer &);            // don't allow copy constructor
 	Buffer &operator=(const Buffer &); // and no assignment op.
 
-	std::list<Reading> _sent;
+	inline Sample &at(size_t i) { return _ring[index(i)]; }
+	inline const Sample &at(size_t i) const { return _ring[index(i)]; }
+	inline size_t index(size_t i) const {
+		size_t idx = _head + i;
+		return (idx >= _ring.size()) ? idx - _ring.size() : idx;
+	}
+	void grow(size_t capacity);
+	void store(const Sample &s);
+	void accumulate(const Sample &s);
+
+	/**
+	 * Running values of the current aggregation period
+	 */
+	struct Accumulator {
+		size_t count;
+		double sum;
+		double min;
+		double max;
+		double mean;     // Welford's running mean and
+		double m2;       // sum of squared differences, for STDDEV
+		double integral; // time weighted sum of values [value * s], for AVG
+		double timespan; // [s]
+		Sample first;    // earliest sample
+		Sample last;     // most recent sample
+
+		void reset();
+	};
+	Accumulator _acc;
+
+	std::vector<Sample> _ring; // preallocated sample storage
+	size_t _head;              // physical index of the oldest sample
+	size_t _count;             // number of samples in use
+	size_t _dropped;           // samples lost due to overflow policy
+	Buffer::overflow _overflow;
+
 	bool _newValues;
 
 	Buffer::aggmode _aggmode;
@@ -94,12 +200,14 @@ class Buffer {
 
 #ifdef VZ_USE_THREADS
 	pthread_mutex_t _mutex;
+	pthread_cond_t _space;     // signalled by clean() when samples have been removed
+	pthread_cond_t *_consumer; // see consumer()
 #else // VZ_USE_THREADS
         bool _locked;
 #endif // VZ_USE_THREADS
 
-	Reading
-		*_last_avg; // keeps value and time from last reading from aggregate call for aggmode AVG
+	Sample _last_avg; // keeps value and time from last reading from aggregate call for aggmode AVG
+	bool _have_last_avg;
 };
 
 #endif /* _BUFFER_H_ */
@@ -34,6 +34,9 @@
 
 #include "Buffer.hpp"
 #include "Reading.hpp"
+#ifndef VZ_PICO
+#include "Metrics.hpp"
+#endif // VZ_PICO
 #include <Options.hpp>
 #include <VZException.hpp>
 
@@ -63,13 +66,9 @@ class Channel {
 
 #ifdef VZ_USE_THREADS
 	// Doesn't touch the object, could also be static, but static breaks google mock.
-	void start(Ptr this_shared) {
-		// Copy the owner's shared pointer for the logging_thread into this member.
-		this_shared->_this_forthread = this_shared;
-		// .. and pass the raw Channel*
-		pthread_create(&this_shared->_thread, NULL, &logging_thread, (void *)this_shared.get());
-		this_shared->_thread_running = true;
-	}
+	// No logging_thread is started for APIs sending asynchronously (see async()), they send
+	// from the reading thread or, if it exists, from the sendReactor.
+	void start(Ptr this_shared);
 
 	void join() {
 		if (_thread_running) {
@@ -82,9 +81,12 @@ class Channel {
 	void cancel() {
 		if (running())
 			pthread_cancel(_thread);
+		if (_send_shared)
+			leave_sendReactor();
 	}
 
 	bool running() const { return _thread_running; }
+	bool send_shared() const { return _send_shared; }
 #endif // VZ_USE_THREADS
 
         void sendData(Ptr this_shared);
@@ -116,6 +118,8 @@ class Channel {
 		_buffer->lock();
 		pthread_cond_broadcast(&condition);
 		_buffer->unlock();
+		if (_send_shared)
+			schedule_send();
 	}
 	inline void wait() {
 		_buffer->lock();
@@ -128,13 +132,25 @@ class Channel {
 #endif // VZ_USE_THREADS
 
 	int duplicates() const { return _duplicates; }
+	int local_retention() const { return _local_retention; } // in s, -1: global setting
+	int push_slot() const { return _push_slot; }             // in pushDataList, -1: none yet
+	void push_slot(int v) { _push_slot = v; }
+#ifndef VZ_PICO
+	Metrics::Gauge *depth() const { return _depth; } // readings in the buffer after sending
+#endif // VZ_PICO
         bool isBusy() const;
         void checkResponse();
+        bool async() const; // api never blocks in send(), no logging_thread needed
 
   private:
 	static int instances;
 #ifdef VZ_USE_THREADS
 	bool _thread_running; // flag if thread is started
+	bool _send_shared;    // async, sent by sendReactor instead of the reading thread
+
+	void schedule_send();
+	void leave_sendReactor();
+	static void send_scheduled(void *arg);
 #endif // VZ_USE_THREADS
 
 	int id;            // only for internal usage & debugging
@@ -155,6 +171,11 @@ class Channel {
 	std::string _uuid;        // unique identifier for middleware
 	std::string _apiProtocol; // protocol of api to use for logging
 	int _duplicates;          // how to handle duplicate values (see conf)
+	int _local_retention;     // in seconds; history kept by the local store
+	int _push_slot;           // see PushDataList::slot()
+#ifndef VZ_PICO
+	Metrics::Gauge *_depth;
+#endif // VZ_PICO
 };
 
 #endif /* _CHANNEL_H_ */
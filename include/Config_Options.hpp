@@ -37,6 +37,7 @@
 #include <Options.hpp>
 #ifndef VZ_PICO
 # include <PushData.hpp>
+# include <Spool.hpp>
 #endif // VZ_PICO
 #include <meter_protocol.hpp>
 
@@ -71,11 +72,28 @@ class Config_Options {
 	const std::string &config() const { return _config; }
 	const std::string &log() const { return _log; }
 	FILE *logfd() { return _logfd; }
+	bool log_async() const { return _log_async; }
+	int log_flush() const { return _log_flush; }
 	const int &port() const { return _port; }
 	const int &verbosity() const { return _verbosity; }
 	const int &comet_timeout() const { return _comet_timeout; }
 	const int &buffer_length() const { return _buffer_length; }
 	int retry_pause() const { return _retry_pause; }
+	bool sender_async() const { return _sender_async; }
+	int sender_connections() const { return _sender_connections; }
+	bool sender_batch() const { return _sender_batch; }
+	int sender_batch_window() const { return _sender_batch_window; }
+	int sender_batch_tuples() const { return _sender_batch_tuples; }
+	int sender_batch_bytes() const { return _sender_batch_bytes; }
+	bool reactor() const { return _reactor; }
+#ifndef VZ_PICO
+	const std::string &spool_dir() const { return _spool_dir; }
+	size_t spool_max_size() const { return _spool_max_size; }
+	size_t spool_segment_size() const { return _spool_segment_size; }
+	Spool::fsync_policy spool_fsync() const { return _spool_fsync; }
+	const std::string &local_store() const { return _local_store; }
+	int local_retention() const { return _local_retention; }
+#endif // VZ_PICO
 
 	bool channel_index() const { return _channel_index; }
 	bool local() const { return _local; }
@@ -91,8 +109,10 @@ class Config_Options {
 	void logfd(FILE *fd) { _logfd = fd; }
 	void port(const int v) { _port = v; }
 	void verbosity(int v) {
-		if (v >= 0)
+		if (v >= 0) {
 			_verbosity = v;
+			print_verbosity() = v;
+		}
 	}
 
 	void local(const bool v) { _local = v; }
@@ -121,6 +141,19 @@ class Config_Options {
 	int _comet_timeout; // in seconds;
 	int _buffer_length; // in seconds; how long to buffer readings for local interfalce
 	int _retry_pause;   // in seconds; how long to pause after an unsuccessful HTTP request
+	int _log_flush;     // in ms; how often the log writer thread writes, see log_async
+	int _sender_connections; // max. parallel connections per middleware for the shared sender
+	int _sender_batch_window; // in ms; how often batched requests are sent
+	int _sender_batch_tuples; // max. tuples per batched request
+	int _sender_batch_bytes;  // max. body size of a batched request
+#ifndef VZ_PICO
+	std::string _spool_dir;      // persistent spool for unsent readings, disabled if empty
+	size_t _spool_max_size;      // in bytes, per api target
+	size_t _spool_segment_size;  // in bytes
+	Spool::fsync_policy _spool_fsync;
+	std::string _local_store;    // persistent history for the local interface, disabled if empty
+	int _local_retention;        // in seconds; how long the history is kept
+#endif // VZ_PICO
 
 	// boolean bitfields, padding at the end of struct
 	int _channel_index : 1;  // give a index of all available channels via local interface
@@ -128,6 +161,10 @@ class Config_Options {
 	int _foreground : 1;     // don't daemonize
 	int _doRegistration : 1; // FIXME
 	int _time_machine : 1;   // accept readings from before smart-metering existed
+	int _sender_async : 1;   // send api requests via one shared, non-blocking sender
+	int _sender_batch : 1;   // one request for all channels of a middleware
+	int _reactor : 1;        // read pollable meters from one event loop thread
+	int _log_async : 1;      // log from a writer thread instead of the calling one
 };
 
 /**
@@ -0,0 +1,182 @@
+/**
+ * CurlMultiSender - shared, non-blocking HTTP sender based on one curl multi handle
+ *
+ * All requests are multiplexed by a single event loop thread over a small pool of
+ * keep-alive connections. Callers submit a request and poll it for completion later
+ * or get called back from the event loop, they never block on the network.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __CURL_MULTI_SENDER_
+#define __CURL_MULTI_SENDER_
+
+#include <atomic>
+#include <curl/curl.h>
+#include <list>
+#include <stdint.h>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include <common.h>
+
+#include "Metrics.hpp"
+
+class CurlRequest {
+  public:
+	typedef vz::shared_ptr<CurlRequest> Ptr;
+	typedef void (*done_func)(void *arg);
+
+	// the headers are copied, the caller keeps ownership of its list
+	CurlRequest(const std::string &url, const std::string &body, const struct curl_slist *headers,
+				long timeout);
+	~CurlRequest();
+
+	// optional debug output, data is passed as CURLOPT_DEBUGDATA
+	void debug(curl_debug_callback func, void *data) {
+		_debugfunc = func;
+		_debugdata = data;
+	}
+
+	// optional HTTP basic authentication
+	void basic_auth(const std::string &username, const std::string &password) {
+		_username = username;
+		_password = password;
+	}
+	void verify_peer(bool verify) { _verify_peer = verify; }
+	// optional, observes the time from sending until the completion
+	void duration(Metrics::Histogram *h) { _duration = h; }
+
+	// optional, func(arg) is called from the event loop thread once the request completed
+	// (not if it gets aborted by stop()). Set it before submit().
+	void on_done(done_func func, void *arg) {
+		_on_done = func;
+		_on_done_arg = arg;
+	}
+	// thread-safe, waits for a running callback, none is called after it returned
+	void cancel_on_done();
+
+	// thread-safe, the results below are only valid once done() returned true
+	bool done() const { return _done; }
+
+	CURLcode curlCode() const { return _curl_code; }
+	long httpCode() const { return _http_code; }
+	const std::string &response() const { return _response; }
+	const std::string &url() const { return _url; }
+
+  private:
+	friend class CurlMultiSender;
+
+	static size_t write_callback(void *ptr, size_t size, size_t nmemb, void *data);
+	void complete(CURLcode curl_code, long http_code);
+	void notify_done();
+
+	std::string _url;
+	std::string _body;
+	struct curl_slist *_headers;
+	long _timeout; // in seconds, 0 = no timeout
+
+	curl_debug_callback _debugfunc;
+	void *_debugdata;
+	std::string _username;
+	std::string _password;
+	bool _verify_peer;
+	Metrics::Histogram *_duration;
+	int64_t _started_us; // monotonic, when added to the multi handle
+
+	CURLcode _curl_code;
+	long _http_code;
+	std::string _response;
+	std::atomic<bool> _done;
+
+	pthread_mutex_t _on_done_mutex; // held while the callback runs
+	done_func _on_done;
+	void *_on_done_arg;
+};
+
+class CurlMultiSender {
+  public:
+	typedef void (*timer_func)(void *arg);
+
+	// non thread safe:
+	CurlMultiSender(int connections = 4);
+	~CurlMultiSender();
+
+	void start(); // start the event loop thread
+	void stop();  // abort pending requests and join the event loop thread
+
+	// thread-safe functions:
+	void submit(CurlRequest::Ptr req); // never blocks, req->done() signals completion
+	size_t pending();                  // number of submitted but not yet completed requests
+
+	// call func(arg) every interval_ms from the event loop thread until stop(). After
+	// remove_timers() returned, the callback is not called anymore.
+	void every(int interval_ms, timer_func func, void *arg);
+	// func(arg) once after delay_ms, replaces a pending one of the same func and arg
+	void after(int delay_ms, timer_func func, void *arg);
+	void remove_timers(void *arg);
+
+  private:
+	static void *thread(void *arg);
+	void run();
+
+	CURL *get_handle(); // from the idle pool, only called from the event loop
+	void wakeup();
+	int run_timers(); // returns ms until the next timer is due
+
+	struct Timer {
+		int interval_ms; // 0: once
+		bool fired;
+		timer_func func;
+		void *arg;
+		int64_t next_ms; // monotonic
+	};
+
+	CURLM *_multi;
+	int _connections; // max. parallel connections per host
+
+	pthread_t _thread;
+	bool _thread_running;
+	std::atomic<bool> _stop;
+	std::atomic<size_t> _pending;
+
+	pthread_mutex_t _mutex;                   // protects _queue
+	std::list<CurlRequest::Ptr> _queue;       // submitted, not yet added to the multi handle
+	pthread_mutex_t _timer_mutex;             // protects _timers, held during the callbacks
+	std::vector<Timer> _timers;
+	std::map<CURL *, CurlRequest::Ptr> _busy; // in the multi handle, event loop only
+	std::vector<CURL *> _idle;                // easy handles for reuse, event loop only
+};
+
+/**
+ * Pause before retrying after failed requests: options.retry_pause() after the first failure,
+ * doubled with every further one up to MAX_FACTOR times that, until a request succeeds.
+ */
+class RetryBackoff {
+  public:
+	static const int MAX_FACTOR = 16;
+
+	RetryBackoff() : _pause(0), _until_us(0) {}
+
+	int failed(int base); // returns the pause in seconds
+	void reset() {
+		_pause = 0;
+		_until_us = 0;
+	}
+	bool waiting() const { return Metrics::now_us() < _until_us; }
+	int remaining_ms() const; // until the pause is over, 0 if not waiting
+	int pause() const { return _pause; }
+
+  private:
+	int _pause;        // in seconds, 0 after success
+	int64_t _until_us; // monotonic
+};
+
+// var to a global/single instance. needs to be initialzed e.g. in main()
+extern CurlMultiSender *curlMultiSender;
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * LocalBuffer - time ordered store of the tuples of one channel for the local interface
+ *
+ * Timestamps and values are kept in separate arrays, split into chunks of CHUNK tuples.
+ * Expired tuples are dropped by moving the start of the first chunk and freeing whole
+ * chunks, range queries are binary searches.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __LOCAL_BUFFER_HPP_
+#define __LOCAL_BUFFER_HPP_
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class LocalBuffer {
+  public:
+	static const size_t CHUNK = 1024;
+
+	// one tuple of a downsampled range
+	struct Group {
+		int64_t time_ms; // start of the group
+		double avg;
+		double min;
+		double max;
+		size_t count;
+	};
+
+	LocalBuffer() : _size(0) {}
+
+	void push(int64_t time_ms, double value); // out of order tuples are inserted in place
+	void erase_before(int64_t time_ms);       // drop all tuples older than time_ms
+	void keep_last(size_t n);                 // drop the oldest tuples until n are left
+	void clear();
+
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	int64_t front_time() const; // only if !empty()
+	int64_t back_time() const;  // only if !empty()
+
+	// number of tuples with from <= time <= to, and the times of the first and last of them
+	size_t range(int64_t from, int64_t to, int64_t *first = NULL, int64_t *last = NULL) const;
+
+	// calls f(time_ms, value) for all tuples with from <= time <= to
+	template <typename F> void for_each(int64_t from, int64_t to, F f) const {
+		for (Pos p = lower_bound(from); p.chunk < _chunks.size(); p.chunk++, p.idx = 0) {
+			const Chunk &c = _chunks[p.chunk];
+			if (!p.idx)
+				p.idx = c.begin;
+			for (; p.idx < c.t.size(); p.idx++) {
+				if (c.t[p.idx] > to)
+					return;
+				f(c.t[p.idx], c.v[p.idx]);
+			}
+		}
+	}
+
+	// calls f(const Group &) with min/max/avg of the tuples with from <= time <= to in
+	// groups of group_ms, starting at origin + n * group_ms
+	template <typename F>
+	void for_each_group(int64_t from, int64_t to, int64_t group_ms, int64_t origin, F f) const {
+		Downsampler d(group_ms, origin);
+		Group g;
+		for_each(from, to, [&](int64_t t, double v) {
+			if (d.add(t, v, g))
+				f(static_cast<const Group &>(g));
+		});
+		if (d.finish(g))
+			f(static_cast<const Group &>(g));
+	}
+
+	// groups tuples added in time order, see for_each_group()
+	class Downsampler {
+	  public:
+		Downsampler(int64_t group_ms, int64_t origin)
+			: _group_ms(group_ms), _origin(origin), _sum(0) {
+			_g.count = 0;
+		}
+		bool add(int64_t t, double v, Group &done); // true if done is a completed group
+		bool finish(Group &done);                  // true if done is the last group
+
+	  private:
+		int64_t _group_ms;
+		int64_t _origin;
+		Group _g;
+		double _sum;
+	};
+
+  private:
+	struct Chunk {
+		std::vector<int64_t> t;
+		std::vector<double> v;
+		size_t begin; // tuples before begin are erased already
+	};
+	struct Pos {
+		size_t chunk;
+		size_t idx;
+	};
+
+	Pos lower_bound(int64_t time_ms) const; // first tuple with time >= time_ms
+	Pos upper_bound(int64_t time_ms) const; // first tuple with time > time_ms
+
+	std::deque<Chunk> _chunks;
+	size_t _size;
+};
+
+#endif
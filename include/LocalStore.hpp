@@ -0,0 +1,114 @@
+/**
+ * LocalStore - persistent, append-only history of one channel for the local interface
+ *
+ * Tuples are collected into chunks of up to CHUNK tuples or CHUNK_MS. Complete chunks are
+ * compressed (delta-of-delta timestamps, XOR'ed doubles as in Facebook's Gorilla) and
+ * appended to segment files <dir>/<seq>.tsdb, one segment per segment_ms. Each chunk
+ * carries a crc32, so a torn write at the end of the last segment is cut off on startup.
+ * Segments are read via mmap, the time ranges of their chunks are kept in memory.
+ * Segments completely older than the retention time are deleted.
+ *
+ * Not thread-safe.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __LOCAL_STORE_HPP_
+#define __LOCAL_STORE_HPP_
+
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class LocalStore {
+  public:
+	static const size_t CHUNK = 1024;       // max. tuples per chunk
+	static const int64_t CHUNK_MS = 3600000; // max. time span of a chunk
+
+	LocalStore(const std::string &dir, int64_t retention_ms);
+	~LocalStore(); // writes the open chunk
+	LocalStore(const LocalStore &) = delete;
+	LocalStore &operator=(const LocalStore &) = delete;
+
+	// appends a tuple. Returns false for tuples older than the last one, it's append only.
+	bool push(int64_t time_ms, double value);
+	void flush();                // write the open chunk
+	void expire(int64_t now_ms); // delete the segments older than now_ms - retention
+
+	size_t size() const { return _size; } // tuples
+	bool empty() const { return _size == 0; }
+	size_t bytes() const; // on disk
+	int64_t front_time() const; // only if !empty()
+	int64_t back_time() const;  // only if !empty()
+
+	// number of tuples with from <= time <= to, and the times of the first and last of them
+	size_t range(int64_t from, int64_t to, int64_t *first = NULL, int64_t *last = NULL) const;
+
+	// calls f(time_ms, value) for all tuples with from <= time <= to, in time order
+	template <typename F> void for_each(int64_t from, int64_t to, F f) const {
+		std::vector<int64_t> t;
+		std::vector<double> v;
+		for (size_t s = first_segment(from); s < _segments.size(); s++) {
+			const Segment &seg = _segments[s];
+			for (size_t c = first_chunk(seg, from); c < seg.chunks.size(); c++) {
+				if (seg.chunks[c].first > to)
+					return;
+				if (!decode(seg, seg.chunks[c], t, v))
+					continue;
+				for (size_t i = 0; i < t.size(); i++)
+					if (t[i] >= from && t[i] <= to)
+						f(t[i], v[i]);
+			}
+		}
+		for (size_t i = 0; i < _open_t.size(); i++)
+			if (_open_t[i] >= from && _open_t[i] <= to)
+				f(_open_t[i], _open_v[i]);
+	}
+
+	// compression of n tuples into out, appended. Exposed for tests.
+	static void encode(const int64_t *t, const double *v, size_t n, std::vector<uint8_t> &out);
+	static bool decode(const uint8_t *data, size_t len, int64_t first, size_t n,
+					   std::vector<int64_t> &t, std::vector<double> &v);
+
+  private:
+	struct ChunkRef {
+		int64_t first; // time of the first tuple
+		int64_t last;  // .. and the last one
+		uint32_t count;
+		size_t offset; // of the chunk header in the segment
+		uint32_t length; // of the compressed data following the header
+	};
+	struct Segment {
+		uint64_t seq;
+		size_t size; // valid bytes
+		std::vector<ChunkRef> chunks;
+		mutable const uint8_t *map; // of mapped bytes, remapped when the segment grew
+		mutable size_t mapped;
+	};
+
+	std::string path(uint64_t seq) const;
+	void recover();
+	void scan(Segment &seg, bool last);
+	const uint8_t *map(const Segment &seg) const;
+	void unmap(const Segment &seg) const;
+	size_t first_segment(int64_t from) const;                 // first one with tuples >= from
+	size_t first_chunk(const Segment &seg, int64_t from) const; // .. chunk in seg
+	bool decode(const Segment &seg, const ChunkRef &c, std::vector<int64_t> &t,
+				std::vector<double> &v) const;
+
+	std::string _dir;
+	int64_t _retention_ms;
+	int64_t _segment_ms; // time span of a segment
+
+	std::deque<Segment> _segments; // oldest first, back() is written to
+	int _fd;                       // back() segment
+	size_t _size;                  // tuples, including the open chunk
+
+	std::vector<int64_t> _open_t; // the open chunk, not written yet
+	std::vector<double> _open_v;
+};
+
+#endif
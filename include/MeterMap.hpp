@@ -39,12 +39,16 @@
 #ifdef VZ_USE_THREADS
 # include <pthread.h>
 #endif // VZ_USE_THREADS
+#include <unordered_map>
 #include <vector>
 
 #include <Channel.hpp>
 #include <Meter.hpp>
 #include <Options.hpp>
 #include <common.h>
+#ifndef VZ_PICO
+# include <Metrics.hpp>
+#endif // VZ_PICO
 
 /**
 	 The MeterMap is intend to keep the list of all configured channel for a given meter.
@@ -55,15 +59,19 @@ class MeterMap {
 	typedef std::vector<Channel::Ptr>::iterator iterator;
 	typedef std::vector<Channel::Ptr>::const_iterator const_iterator;
 
-	MeterMap(const std::list<Option> &options) : _meter(new Meter(options)) {
+	MeterMap(const std::list<Option> &options) : _meter(new Meter(options)), _indexed(0) {
 #ifdef VZ_USE_THREADS
 		_thread_running = false;
                 first_reading = true;
+		_in_reactor = false;
+		_reactor_fd = -1;
+		_reactor_timer = false;
 #endif // VZ_USE_THREADS
 	}
-	MeterMap(Meter *m) : _meter(m)
+	MeterMap(Meter *m) : _meter(m), _indexed(0)
 #ifdef VZ_USE_THREADS
-                             , _thread_running(false)
+                             , _thread_running(false), _in_reactor(false), _reactor_fd(-1),
+                               _reactor_timer(false)
 #endif // VZ_USE_THREADS
        {};
 	~MeterMap(){};
@@ -95,7 +103,7 @@ class MeterMap {
 	inline size_t size() { return _channels.size(); }
 
 #ifdef VZ_USE_THREADS
-	bool running() const { return _thread_running; }
+	bool running() const { return _thread_running || _in_reactor; }
 #else // VZ_USE_THREADS
         int  isDueIn();
         bool readyToSend();
@@ -106,13 +114,38 @@ class MeterMap {
         void printStatistics(log_level_t logLevel);
 
   private:
+	void build_index();
+	void dispatch(std::vector<Reading> &rds, size_t n);
+
+#ifdef VZ_USE_THREADS
+	// reading from the reactor instead of a reading_thread, see Reactor.hpp:
+	void start_reactor();
+	void stop_reactor();
+	void poll();
+	void update_fd();
+	void schedule_poll();
+	static void reactor_readable(int fd, void *arg);
+	static void reactor_timer(void *arg);
+	static void reactor_deferred(void *arg);
+#endif // VZ_USE_THREADS
+
 	Meter::Ptr _meter;
 	std::vector<Channel::Ptr> _channels;
 
+	// channels by interned identifier, so read() looks up each reading only once
+	std::unordered_multimap<ReadingIdentifier::Id, Channel::Ptr> _index;
+	size_t _indexed; // number of channels in _index
+
 #ifdef VZ_USE_THREADS
 	bool _thread_running; // flag if thread is started
 	pthread_t _thread;    // Thread data for meter (reading)
         bool first_reading;
+
+	bool _in_reactor;          // read by the reactor instead of _thread
+	int _reactor_fd;           // descriptor registered with the reactor, -1 if none
+	bool _reactor_timer;       // timer registered with the reactor
+	std::vector<Reading> _rds; // readings of the telegram being received
+	time_t _aggIntEnd;
 #else // VZ_USE_THREADS
         time_t nextDue;
 #endif // VZ_USE_THREADS
@@ -120,7 +153,14 @@ class MeterMap {
         // Statistics counters
         uint accTimeRead;
         uint accTimeSend;
+        uint64_t accTimeDispatch; // usecs
         uint numUsed;
+#ifndef VZ_PICO
+	// by protocol, registered in start()
+	Metrics::Histogram *_read_time = NULL;
+	Metrics::Histogram *_dispatch_time = NULL;
+	Metrics::Histogram *_aggregate_time = NULL;
+#endif // VZ_PICO
 };
 
 /**
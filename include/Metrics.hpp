@@ -0,0 +1,137 @@
+/**
+ * Metrics - runtime instrumentation, exported in the Prometheus text format
+ *
+ * Counters, gauges and histograms are registered once, e.g. when a meter starts, and
+ * updated with relaxed atomics afterwards. So the reading threads never contend on a
+ * lock, the registry mutex is only taken to register and to export.
+ * Histograms have fixed buckets: durations are observed in us and exported in seconds,
+ * sizes are observed and exported as is.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __METRICS_HPP_
+#define __METRICS_HPP_
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+class Metrics {
+  public:
+	class Metric {
+	  public:
+		virtual ~Metric() {}
+		virtual void write(std::string &out, const std::string &name,
+						   const std::string &labels) const = 0;
+	};
+
+	class Counter : public Metric {
+	  public:
+		Counter() : _v(0) {}
+		void inc(uint64_t n = 1) { _v.fetch_add(n, std::memory_order_relaxed); }
+		uint64_t value() const { return _v.load(std::memory_order_relaxed); }
+		void write(std::string &out, const std::string &name,
+				   const std::string &labels) const override;
+
+	  private:
+		std::atomic<uint64_t> _v;
+	};
+
+	class Gauge : public Metric {
+	  public:
+		Gauge() : _v(0) {}
+		void set(int64_t v) { _v.store(v, std::memory_order_relaxed); }
+		int64_t value() const { return _v.load(std::memory_order_relaxed); }
+		void write(std::string &out, const std::string &name,
+				   const std::string &labels) const override;
+
+	  private:
+		std::atomic<int64_t> _v;
+	};
+
+	class Histogram : public Metric {
+	  public:
+		static const int BUCKETS = 16;
+
+		// bounds: BUCKETS ascending upper bounds, exported multiplied by scale
+		Histogram(const int64_t *bounds, double scale);
+		void observe(int64_t v);
+		uint64_t count() const;
+		int64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+		void write(std::string &out, const std::string &name,
+				   const std::string &labels) const override;
+
+	  private:
+		const int64_t *_bounds;
+		double _scale;
+		std::atomic<uint64_t> _buckets[BUCKETS + 1]; // not cumulative, the last one is +Inf
+		std::atomic<int64_t> _sum;
+	};
+
+	Metrics();
+	~Metrics();
+	Metrics(const Metrics &) = delete;
+	Metrics &operator=(const Metrics &) = delete;
+
+	// thread-safe. Registering the same name and labels again returns the same metric.
+	// labels is e.g. label("api", "influxdb"), the returned pointers stay valid.
+	Counter *counter(const char *name, const char *help, const std::string &labels = "");
+	Gauge *gauge(const char *name, const char *help, const std::string &labels = "");
+	Histogram *durations(const char *name, const char *help, const std::string &labels = "");
+	Histogram *sizes(const char *name, const char *help, const std::string &labels = "");
+
+	// vzlogger_dropped_readings_total{source=...}, readings lost as a queue was full
+	Counter *dropped(const char *source);
+
+	void write(std::string &out) const; // all metrics in the Prometheus text format
+
+	static std::string label(const char *key, const std::string &value); // key="value"
+	static int64_t now_us();                                               // monotonic
+
+  private:
+	struct Family {
+		std::string help;
+		const char *type; // "counter", "gauge", "histogram" (durations) or "sizes"
+		std::list<std::pair<std::string, std::unique_ptr<Metric>>> series; // by labels
+	};
+
+	Metric *get(const char *name, const char *help, const char *type, const std::string &labels);
+
+	mutable pthread_mutex_t _mutex;          // protects _families, not the values
+	std::map<std::string, Family> _families; // by name
+};
+
+// observes the time until it goes out of scope, if h is not NULL
+class MetricsTimer {
+  public:
+	explicit MetricsTimer(Metrics::Histogram *h) : _h(h), _start(h ? Metrics::now_us() : 0) {}
+	~MetricsTimer() {
+		if (_h)
+			_h->observe(Metrics::now_us() - _start);
+	}
+
+  private:
+	Metrics::Histogram *_h;
+	int64_t _start;
+};
+
+// the metrics of one of the HTTP APIs, labeled api="<api>"
+struct ApiMetrics {
+	explicit ApiMetrics(const char *api);
+
+	Metrics::Histogram *request; // round trip of one HTTP request
+	Metrics::Histogram *encode;  // encoding the JSON request body
+	Metrics::Counter *retries;   // failed requests, their data is sent again later
+};
+
+// the global instance
+extern Metrics metrics;
+
+#endif
@@ -45,6 +45,7 @@ class Obis {
 	const std::string toString();
 
 	bool operator==(const Obis &rhs) const;
+	size_t hash() const; // equal for equal Obis, all 6 groups
 
 	bool isManufacturerSpecific() const;
 	bool isAllNotGiven() const; // check whether all are not given (=DC/255)
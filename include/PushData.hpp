@@ -5,57 +5,118 @@
 #ifndef __push_data_hpp_
 #define __push_data_hpp_
 
+#include <atomic>
 #include <cstdint>
-#include <list>
+#include <curl/curl.h>
+#include <deque>
 #include <pthread.h>
 #include <queue>
 #include <string>
 #include <unordered_map>
 #include <utility> // for std::pair
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "api/JsonWriter.hpp"
+#include "common.h"
 
 // PushDataList provides a thread safe list
+// The meter threads add readings to a lock-free ring of {slot, time, value}, the slot
+// of a channel is assigned once by slot(). The push thread is woken once per batch via
+// an eventfd and waits delay_ms for more readings before it takes all of them.
 class PushDataList {
   public:
 	typedef std::pair<int64_t, double> DataTuple;
 	typedef std::queue<DataTuple> DataQueue;
 	typedef std::unordered_map<std::string, DataQueue> DataMap;
 
-	PushDataList();
+	PushDataList(size_t capacity = 4096, int delay_ms = 0);
 	~PushDataList();
-	void add(const std::string &uuid, const int64_t &time_ms, const double &value);
-	DataMap *waitForData(); // blocks infinite until data is available. returned object is owned by
+	PushDataList(const PushDataList &) = delete;
+	PushDataList &operator=(const PushDataList &) = delete;
+
+	unsigned slot(const std::string &uuid);                 // assigns a slot to uuid, takes a mutex
+	bool add(unsigned slot, int64_t time_ms, double value); // never blocks. false if full
+	void add(const std::string &uuid, const int64_t &time_ms, const double &value) {
+		add(slot(uuid), time_ms, value);
+	}
+	DataMap *waitForData(); // blocks max. 5s until data is available. returned object is owned by
 							// caller! must be deleted after usage!
+	int fd() const { return _wakefd; } // readable when waitForData() wouldn't block
   protected:
-	DataMap *_next;
-	pthread_mutex_t _map_mutex;
-	pthread_cond_t _cond;
+	struct Record {
+		unsigned slot;
+		int64_t time_ms;
+		double value;
+	};
+
+	BoundedQueue<Record> _queue;
+	int _delay_ms;                    // min. time to collect readings before sending
+	int _wakefd;                      // eventfd, signaled once per batch
+	std::atomic<bool> _wakeupPending; // _wakefd is signaled already
+	std::atomic<size_t> _dropped;     // readings lost as the ring was full
+	pthread_mutex_t _slot_mutex;      // protects _uuids
+	std::deque<std::string> _uuids;   // by slot
 };
 
 // var to a global/single instance. needs to be initialzed e.g. in main()
 extern PushDataList *pushDataList;
 
+// Sends the data to all middlewares in parallel. Each middleware has its own timeout and
+// queue of unsent data, which is retried with the next data. New data goes out to each idle
+// middleware right away, a busy one sends it once its request is done, so a slow middleware
+// doesn't hold back the others. A middleware failing BREAKER_FAILURES times in a row is
+// skipped for BREAKER_MS (circuit breaker).
 class PushDataServer {
   public:
+	static const int BREAKER_FAILURES = 3;
+	static const int BREAKER_MS = 60000;
+	static const size_t QUEUE_MAX = 64; // unsent requests per middleware
+
 	PushDataServer(struct json_object *option);
 	PushDataServer(const PushDataServer &) = delete; // no copy constructor!
 	~PushDataServer();
+	// waits for new data or progress of the requests in flight (max. 5s), false if a
+	// middleware failed or was skipped meanwhile
 	bool waitAndSendOnceToAll();
+	int delay() const { return _delay_ms; } // min. time to collect readings, in ms
+	void printStatistics(log_level_t logLevel);
 
   protected:
-	typedef struct {
-		char *data;
-		size_t size;
-	} CURLresponse;
+	struct Target {
+		std::string url;
+		long timeout_ms;
+		std::deque<std::string> queue; // unsent requests, oldest first
+		CURL *curl;                    // kept for the connection reuse
+		bool busy;                     // queue.front() is being sent
+		std::string response;
+		int64_t started_ms;
+		int failures;          // in a row
+		int64_t open_until_ms; // skipped until then
+
+		// statistics
+		unsigned long sent;
+		unsigned long failed;
+		unsigned long skipped; // while the circuit breaker was open
+		unsigned long dropped; // queue full
+		int64_t latency_sum_ms;
+		int64_t latency_max_ms;
+	};
 
-	std::string generateJson(PushDataList::DataMap &dataMap);
-	bool send(const std::string &middleware, const std::string &datastr);
+	const char *generateJson(PushDataList::DataMap &dataMap); // valid until the next call
+	void start(Target &t, int64_t now_ms);
+	bool complete(Target &t, CURLcode curl_code, int64_t now_ms); // true if sent
+	bool perform(); // drives the requests in flight, false if one of them failed
+	int busy() const;
 	friend class PushDataServerTest;
 
 	static size_t curl_custom_write_callback(void *ptr, size_t size, size_t nmemb, void *data);
 
-	typedef std::list<std::string> MiddlewareList;
-	MiddlewareList _middlewareList;
+	std::vector<Target> _targets; // not resized after construction, see CURLOPT_PRIVATE
+	CURLM *_multi;
 	struct curl_slist *_headers;
+	JsonWriter _json;
+	int _delay_ms;
 };
 
 void *push_data_thread(void *arg);
@@ -0,0 +1,82 @@
+/**
+ * Reactor - one event loop thread for all meters that can be read without blocking
+ *
+ * Meters register their file descriptor (serial port, socket, inotify) and/or a timer.
+ * The callbacks are called from the event loop thread and must never block, so the
+ * number of threads doesn't grow with the number of meters.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef __REACTOR_HPP_
+#define __REACTOR_HPP_
+
+#include <atomic>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+class Reactor {
+  public:
+	typedef void (*io_func)(int fd, void *arg);
+	typedef void (*timer_func)(void *arg);
+
+	// non thread safe:
+	Reactor();
+	~Reactor();
+
+	void start(); // start the event loop thread
+	void stop();  // join the event loop thread, registrations are kept
+
+	// thread-safe functions. After remove()/remove_timers() returned, the callback
+	// is not called anymore, they may be called from within a callback as well.
+	void add(int fd, io_func func, void *arg); // func(fd, arg) whenever fd is readable,
+											   // updates an existing registration
+	void remove(int fd);
+	void every(int interval_ms, timer_func func, void *arg);
+	// func(arg) once after delay_ms, replaces a pending one of the same func and arg
+	void after(int delay_ms, timer_func func, void *arg);
+	void remove_timers(void *arg);
+	size_t size(); // number of registered file descriptors
+
+  private:
+	static void *thread(void *arg);
+	void run();
+
+	void wakeup();
+	int run_timers(); // returns ms until the next timer is due
+
+	struct Handler {
+		io_func func;
+		void *arg;
+	};
+
+	struct Timer {
+		int interval_ms; // 0: once
+		bool fired;
+		timer_func func;
+		void *arg;
+		int64_t next_ms; // monotonic
+	};
+
+	int _epfd;
+	int _wakefd; // eventfd to interrupt epoll_wait
+
+	pthread_t _thread;
+	bool _thread_running;
+	std::atomic<bool> _stop;
+
+	pthread_mutex_t _mutex; // recursive, held while callbacks run
+	std::map<int, Handler> _handlers;
+	std::vector<Timer> _timers;
+};
+
+// var to a global/single instance. only exists if enabled by the configuration
+extern Reactor *reactor;
+// sends for all channels with an async api, created together with reactor and curlMultiSender
+extern Reactor *sendReactor;
+
+#endif
@@ -29,6 +29,7 @@
 #include <sstream>
 #include <string>
 
+#include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
 
@@ -42,12 +43,29 @@
 class ReadingIdentifier {
   public:
 	typedef vz::shared_ptr<ReadingIdentifier> Ptr;
+	typedef uint32_t Id; // interned identifier, 0 = none
 	virtual ~ReadingIdentifier(){};
 
 	virtual size_t unparse(char *buffer, size_t n) = 0;
 	bool operator==(ReadingIdentifier const &cmp) const;
 	bool compare(ReadingIdentifier const *lhs, ReadingIdentifier const *rhs) const;
 
+	/**
+	 * Equal identifiers have equal hashes. Used to index channels by identifier,
+	 * matches still have to be confirmed with operator==.
+	 */
+	virtual size_t hash() const { return 0; }
+
+	/**
+	 * Interning: each distinct identifier is stored once in a global table and referred to
+	 * by a small integer id. Readings carry the id, so copying and comparing them doesn't
+	 * touch the identifier objects. Entries are never removed.
+	 */
+	static Id intern(const Ptr &rid);
+	static Id intern(const Obis &obis);  // doesn't allocate if already known
+	static Id intern(const char *string); // StringIdentifier, doesn't allocate if already known
+	static Ptr lookup(Id id);
+
 	virtual const std::string toString() = 0;
 
   protected:
@@ -69,6 +87,7 @@ class ObisIdentifier : public ReadingIdentifier {
 
 	size_t unparse(char *buffer, size_t n);
 	bool operator==(ObisIdentifier const &cmp) const;
+	size_t hash() const { return _obis.hash(); }
 	const std::string toString() {
 		std::ostringstream oss;
 		oss << "ObisIdentifier:" << _obis.toString();
@@ -94,6 +113,10 @@ class StringIdentifier : public ReadingIdentifier {
 	void parse(const char *buffer);
 	size_t unparse(char *buffer, size_t n);
 	bool operator==(StringIdentifier const &cmp) const;
+	size_t hash() const { return hash(_string.data(), _string.size()); }
+	static size_t hash(const char *s, size_t n);
+
+	const std::string &string() const { return _string; }
 	const std::string toString() {
 		std::ostringstream oss;
 		oss << "StringIdentifier: " << _string;
@@ -113,6 +136,7 @@ class ChannelIdentifier : public ReadingIdentifier {
 	void parse(const char *string);
 	size_t unparse(char *buffer, size_t n);
 	bool operator==(ChannelIdentifier const &cmp) const;
+	size_t hash() const { return (size_t)_channel; }
 	const std::string toString() {
 		std::ostringstream oss;
 		oss << "ChannelIdentifier:";
@@ -137,6 +161,8 @@ class NilIdentifier : public ReadingIdentifier {
   private:
 };
 
+class Sample;
+
 class Reading {
 
   public:
@@ -145,6 +171,7 @@ class Reading {
 	Reading(ReadingIdentifier::Ptr pIndentifier);
 	Reading(double pValue, struct timeval pTime, ReadingIdentifier::Ptr pIndentifier);
 	Reading(const Reading &orig);
+	Reading(const Sample &orig); // no identifier, samples belong to the buffer's channel
 	Reading &operator=(const Reading &orig);
 
 	bool deleted() const { return _deleted; }
@@ -172,9 +199,13 @@ class Reading {
 	// not needed yet: void time_from_ms( int64_t &ms );
 	void time_from_double(double const &d);
 
-	void identifier(ReadingIdentifier::Ptr rid) { _identifier = rid; }
-	void identifier(ReadingIdentifier *rid) { _identifier.reset(rid); }
-	const ReadingIdentifier::Ptr identifier() { return _identifier; }
+	void identifier(ReadingIdentifier::Ptr rid) { _identifier = ReadingIdentifier::intern(rid); }
+	void identifier(ReadingIdentifier *rid) { identifier(ReadingIdentifier::Ptr(rid)); }
+	void identifier(ReadingIdentifier::Id id) { _identifier = id; }
+	const ReadingIdentifier::Ptr identifier() const {
+		return ReadingIdentifier::lookup(_identifier);
+	}
+	ReadingIdentifier::Id identifier_id() const { return _identifier; }
 
 	/**
 	 * Print identifier to buffer for debugging/dump
@@ -192,7 +223,44 @@ class Reading {
 	bool _deleted;
 	double _value;
 	struct timeval _time;
-	ReadingIdentifier::Ptr _identifier;
+	ReadingIdentifier::Id _identifier;
+};
+
+/**
+ * Compact reading as stored in a channel's Buffer
+ *
+ * Plain old data (no identifier, no heap), so buffers can keep them in
+ * contiguous preallocated memory. The interface mimics Reading so that
+ * the api senders can iterate a Buffer as before.
+ */
+class Sample {
+
+  public:
+	enum { FLAG_DELETED = 0x01 };
+
+	Sample() : _time_ms(0), _value(0), _flags(0) {}
+	Sample(const Reading &rd)
+		: _time_ms(rd.time_ms()), _value(rd.value()),
+		  _flags(rd.deleted() ? FLAG_DELETED : 0) {}
+
+	bool deleted() const { return _flags & FLAG_DELETED; }
+	void mark_delete() { _flags |= FLAG_DELETED; }
+	void reset() { _flags &= ~FLAG_DELETED; }
+
+	void value(const double &v) { _value = v; }
+	double value() const { return _value; }
+
+	int64_t time_ms() const { return _time_ms; }
+	long time_s() const { return (long)(_time_ms / 1000); } // always rounding down
+	void time(struct timeval const &v) {
+		_time_ms = ((int64_t)v.tv_sec) * 1000 + (v.tv_usec / 1000);
+	}
+	void time_ms(int64_t ms) { _time_ms = ms; }
+
+  protected:
+	int64_t _time_ms;
+	double _value;
+	uint8_t _flags;
 };
 
 /**
@@ -0,0 +1,84 @@
+/**
+ * Spool - persistent write-ahead queue of readings not yet acknowledged by an api
+ *
+ * Readings are appended to fixed-record segment files <dir>/<seq>.spool before they
+ * are sent. Each record carries a crc32, so a torn write at the end of the last segment
+ * is detected and cut off on startup. Acknowledged records are skipped via the head file,
+ * completely acknowledged segments are deleted.
+ *
+ * Not thread-safe, each api target owns its spool.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef _SPOOL_H_
+#define _SPOOL_H_
+
+#include <deque>
+#include <list>
+#include <stdint.h>
+#include <string>
+
+#include "Reading.hpp"
+#include <common.h>
+
+class Spool {
+  public:
+	typedef vz::shared_ptr<Spool> Ptr;
+
+	enum fsync_policy {
+		FSYNC_NEVER,   // leave it to the kernel
+		FSYNC_SEGMENT, // when a segment is complete
+		FSYNC_ALWAYS   // after each append and ack
+	};
+
+	Spool(const std::string &dir, size_t segment_size, size_t max_size, fsync_policy policy);
+	~Spool();
+
+	// append readings at the end, drops the oldest not yet loaded segment if max_size is reached
+	void append(const std::list<Reading> &values);
+
+	// append up to n readings following the loaded ones to values, returns the number added.
+	// Corrupt records are added as deleted readings, they count for ack() but aren't sent.
+	size_t load(std::list<Reading> &values, size_t n);
+
+	// the n oldest readings are acknowledged, they need to be loaded before
+	void ack(size_t n);
+
+	size_t size() const;        // records not yet acknowledged
+	size_t loaded() const;      // of these loaded
+	size_t dropped() const { return _dropped; } // records lost due to max_size
+	const std::string &dir() const { return _dir; }
+
+	static fsync_policy fsync_policy_from_string(const char *s);
+	static uint32_t crc32(const void *data, size_t len); // IEEE 802.3, as zlib's
+
+  private:
+	struct Segment {
+		uint64_t seq;
+		size_t records;
+	};
+
+	std::string path(uint64_t seq) const;
+	void recover();
+	void rotate();
+	void write_head();
+	void sync(int fd);
+
+	std::string _dir;
+	size_t _segment_records; // records per segment
+	size_t _max_records;     // records of all segments
+	fsync_policy _fsync;
+
+	std::deque<Segment> _segments; // oldest first, back() is written to
+	size_t _head;                  // acknowledged records in _segments.front()
+	size_t _load_segment;          // index into _segments of the next record to load
+	size_t _load;                  // .. and the record in that segment
+	int _fd;                       // back() segment
+	int _head_fd;
+	size_t _dropped;
+};
+
+#endif /* _SPOOL_H_ */
@@ -31,14 +31,22 @@
 #define _InfluxDB_hpp_
 
 #include <ApiIF.hpp>
+#include <CurlMultiSender.hpp>
 #include <Options.hpp>
+#include <Spool.hpp>
 #include <api/CurlIF.hpp>
 #include <api/CurlResponse.hpp>
 #include <common.h>
 #include <curl/curl.h>
+#include <list>
+#include <map>
+#include <pthread.h>
 
 namespace vz {
 namespace api {
+
+class InfluxDBBatch;
+
 class InfluxDB : public ApiIF {
   public:
 	typedef vz::shared_ptr<ApiIF> Ptr;
@@ -50,14 +58,25 @@ class InfluxDB : public ApiIF {
 
 	void register_device();
 
+	// one line of line protocol, false if value can't be represented (nan/inf)
+	bool append_line(std::string &body, int64_t timestamp, double value) const;
+
+	// gzip encodes in into out (Content-Encoding: gzip), false if not supported or failed
+	static bool gzip(const std::string &in, std::string &out);
+
   private:
 	CurlResponse *response() { return _response.get(); }
+	bool keep(const Sample &r); // duplicates filter, true if r has to be sent
+	void collect_values();      // batch mode: move the new readings from the buffer to _values
+	void ack_values(size_t n);  // batch mode: remove the n oldest values after they were written
 
   private:
 	std::string _host;
 	std::string _username;
 	std::string _token;
-	struct curl_slist *_token_header;
+	struct curl_slist *_headers; // token and content encoding
+	bool _gzip;
+	std::string _line_prefix; // <measurement>[,uuid=<uuid>][,<tags>] value=
 	std::string _organization;
 	std::string _password;
 	std::string _database;
@@ -69,13 +88,20 @@ class InfluxDB : public ApiIF {
 	unsigned int _curl_timeout;
 	bool _send_uuid;
 	bool _ssl_verifypeer;
-	std::list<Reading> _values;
+	std::list<Reading> _values; // loaded from _spool
+	Spool::Ptr _spool;
 	CurlResponse::Ptr _response;
 
 	int64_t _last_timestamp; /* remember last timestamp */
 	// duplicates support:
 	Reading *_lastReadingSent;
 
+	// batch mode: _values are sent together with the other channels writing to the same url
+	friend class InfluxDB_Test;
+	friend class InfluxDBBatch;
+	vz::shared_ptr<InfluxDBBatch> _batch;
+	size_t _inflight; // number of _values in the pending batch request
+
 	typedef struct {
 		CURL *curl;
 		struct curl_slist *headers;
@@ -83,6 +109,62 @@ class InfluxDB : public ApiIF {
 	api_handle_t _api;
 }; // class InfluxDB
 
+/**
+ * Shared writer for all channels sending to the same InfluxDB url with the same credentials.
+ * Their lines are sent as one (gzip encoded) line protocol body per flush window, or earlier
+ * once enough lines are waiting. Flushed from the curlMultiSender thread, the channels only
+ * hand over their values.
+ */
+class InfluxDBBatch {
+  public:
+	typedef vz::shared_ptr<InfluxDBBatch> Ptr;
+
+	// one instance per url and credentials, created on first use
+	static Ptr get(const std::string &url, const struct curl_slist *headers,
+				   const std::string &username, const std::string &password, long timeout,
+				   bool ssl_verifypeer, bool gzip);
+	~InfluxDBBatch();
+
+	void add(InfluxDB *api);
+	void remove(InfluxDB *api);
+
+	// protects the _values of all participating channels
+	void lock() { pthread_mutex_lock(&_mutex); }
+	void unlock() { pthread_mutex_unlock(&_mutex); }
+
+	bool full() const; // called with lock held, enough lines waiting to flush early
+	void flush();
+
+  private:
+	InfluxDBBatch(const std::string &url, const struct curl_slist *headers,
+				  const std::string &username, const std::string &password, long timeout,
+				  bool ssl_verifypeer, bool gzip);
+
+	friend class InfluxDB_Test;
+	static void flush_timer(void *arg);
+	void processResponse(CURLcode curl_code, long http_code, const std::string &response);
+
+	std::string _url;
+	struct curl_slist *_headers;
+	std::string _username;
+	std::string _password;
+	long _timeout;
+	bool _ssl_verifypeer;
+	bool _gzip;
+	size_t _max_lines;
+	size_t _max_bytes;
+
+	pthread_mutex_t _mutex;
+	std::list<InfluxDB *> _apis;
+	CurlRequest::Ptr _request;
+	time_t _retry_after;
+	std::string _body; // request body, reused
+	std::string _gz;
+
+	static std::map<std::string, Ptr> _batches;
+	static pthread_mutex_t _batches_mutex;
+};
+
 } // namespace api
 } // namespace vz
 #endif // _InfluxDB_hpp_
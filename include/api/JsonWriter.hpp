@@ -0,0 +1,88 @@
+/**
+ * JsonWriter - streaming JSON serializer into a reusable byte buffer
+ *
+ * Used on the send path instead of building json-c object trees: values are formatted
+ * directly into one growable buffer that keeps its capacity between requests, so
+ * encoding a batch of tuples doesn't allocate once the buffer has warmed up.
+ * Doubles are written in the shortest form that reads back to the same value.
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#ifndef _JSON_WRITER_H_
+#define _JSON_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class JsonWriter {
+  public:
+	// position to roll back to, see mark() and rollback()
+	struct Mark {
+		size_t size;
+		int depth;
+		bool comma;
+	};
+
+	JsonWriter(size_t capacity = 1024);
+	JsonWriter(const JsonWriter &) = delete;
+	JsonWriter &operator=(const JsonWriter &) = delete;
+	~JsonWriter();
+
+	// empties the buffer but keeps the allocated capacity
+	void clear();
+
+	JsonWriter &begin_object();
+	JsonWriter &end_object();
+	JsonWriter &begin_array();
+	JsonWriter &end_array();
+
+	// object member name, followed by exactly one value or begin_*()
+	JsonWriter &key(const char *name);
+
+	JsonWriter &value(const char *s); // escaped string
+	JsonWriter &value(int64_t v);
+	JsonWriter &value(int v) { return value((int64_t)v); }
+	JsonWriter &value(double v); // shortest round-trip, null for nan/inf
+	JsonWriter &value(bool v);
+	JsonWriter &null();
+
+	// [<ts>,<value>] as used by the middleware
+	JsonWriter &tuple(int64_t ts, double v);
+	JsonWriter &tuple(int64_t ts, int64_t v);
+
+	Mark mark() const;
+	void rollback(const Mark &m); // drop everything written after m
+
+	const char *c_str() const { return _buf; } // always null terminated
+	size_t size() const { return _size; }
+	size_t capacity() const { return _capacity; }
+	bool empty() const { return _size == 0; }
+
+	// formats v into buf (at least 32 bytes), returns the length. Exposed for tests.
+	static size_t format_double(char *buf, double v);
+	static size_t format_int(char *buf, int64_t v);
+
+  private:
+	static const int MAX_DEPTH = 32;
+
+	void reserve(size_t n) {
+		if (_size + n + 1 > _capacity)
+			grow(_size + n + 1);
+	}
+	void grow(size_t min);
+	void put(char c) { _buf[_size++] = c; }
+	void separator();
+	void string(const char *s);
+	void terminate() { _buf[_size] = '\0'; }
+
+	char *_buf;
+	size_t _size;
+	size_t _capacity;
+	int _depth;
+	bool _comma[MAX_DEPTH]; // a value has been written at this depth already
+};
+
+#endif /* _JSON_WRITER_H_ */
@@ -34,6 +34,7 @@
 #define _MySmartGrid_hpp_
 
 #include <ApiIF.hpp>
+#include <api/JsonWriter.hpp>
 #include <Options.hpp>
 #include <Reading.hpp>
 #include <api/CurlIF.hpp>
@@ -71,15 +72,16 @@ class MySmartGrid : public ApiIF {
 	json_object *_apiDevice(Buffer::Ptr buf);
 
 	/**
-	 *  api configured as sensor
+	 *  api configured as sensor, writes the message to _json
+	 *  @return false if there is nothing to send
 	 */
-	json_object *_apiSensor(Buffer::Ptr buf);
+	bool _apiSensor(Buffer::Ptr buf);
 
 	json_object *_json_object_registration();
 	json_object *_json_object_heartbeat();
 	json_object *_json_object_event(Buffer::Ptr buf);
 	json_object *_json_object_sensor(const std::string &sensorName);
-	json_object *_json_object_measurements(Buffer::Ptr buf);
+	bool _json_measurements(Buffer::Ptr buf);
 
 	void _api_header();
 
@@ -107,6 +109,7 @@ class MySmartGrid : public ApiIF {
 
 	// Volatil
 	std::list<Reading> _values;
+	JsonWriter _json; // measurements message, reused
 
 	time_t _first_ts;
 	long _first_counter;
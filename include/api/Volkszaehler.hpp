@@ -37,12 +37,15 @@
 # include "LwipIF.hpp"
 #else // VZ_PICO
 # include <curl/curl.h>
+# include "CurlMultiSender.hpp"
+# include "Spool.hpp"
 #endif // VZ_PICO
 
 #include <json-c/json.h>
 #include <stdint.h>
 
 #include "Buffer.hpp"
+#include "api/JsonWriter.hpp"
 #include <ApiIF.hpp>
 #include <Options.hpp>
 
@@ -59,6 +62,8 @@ typedef struct {
 	CURL *curl;
 	struct curl_slist *headers;
 } api_handle_t;
+
+class VolkszaehlerBatch;
 #endif // VZ_PICO
 
 class Volkszaehler : public ApiIF {
@@ -69,9 +74,10 @@ class Volkszaehler : public ApiIF {
 	~Volkszaehler();
 
 	void send();
-#ifdef VZ_PICO // Otherwise use base-class method
         bool isBusy() const;
         void checkResponse();
+#ifndef VZ_PICO
+	bool async() const { return curlMultiSender != 0; }
 #endif // VZ_PICO
 
 	void register_device();
@@ -84,14 +90,38 @@ class Volkszaehler : public ApiIF {
 	std::string _url;
 
 	/**
-	 * Create JSON object of tuples
+	 * Move the new readings from the buffer to _values
+	 *
+	 * @param buf	the buffer our readings are stored in (required for mutex)
+	 */
+	void api_collect_values(Buffer::Ptr buf);
+
+	/**
+	 * Remove the n oldest values after the middleware acknowledged them
+	 */
+	void ack_values(size_t n);
+
+	/**
+	 * Find the value with timestamp ts (the first one if ts < 0) among the n oldest
+	 *
+	 * @return _values.end() if there is none
+	 */
+	std::list<Reading>::iterator find_sent(int64_t ts, size_t n);
+
+	/**
+	 * Drop a value the middleware rejected as duplicate, the others are sent again
+	 */
+	void reject_value(std::list<Reading>::iterator it);
+
+	/**
+	 * Encode the oldest values as JSON tuples into outputData
 	 *
 	 * @param buf	the buffer our readings are stored in (required for mutex)
-	 * @return the json_object (has to be free'd)
+	 * @return false if there is nothing to send, outputData is empty then
 	 */
-	json_object *api_json_tuples(Buffer::Ptr buf);
+	bool api_json_tuples(Buffer::Ptr buf);
 
-        std::string  outputData;
+        JsonWriter   outputData; // request body, keeps its capacity between sends
 	CURLresponse response;
         std::string  errMsg;
 
@@ -106,6 +136,25 @@ class Volkszaehler : public ApiIF {
 	vz::api::LwipIF * _api;
 #else // VZ_PICO
 	api_handle_t _api;
+	// sending via curlMultiSender, completions are handled from its thread:
+	mutable pthread_mutex_t _mutex; // protects _values, _request and _backoff then
+	CurlRequest::Ptr _request;      // pending request
+	RetryBackoff _backoff;          // no new request before the pause after a failure is over
+	bool _closing;                  // no new request from the callbacks anymore
+
+	/**
+	 * Send the oldest values unless a request is pending, called with _mutex held
+	 */
+	void post_values();
+	static void request_done(void *arg);
+	static void retry_timer(void *arg);
+
+	// batch mode: _values are sent together with the other channels of the middleware
+	friend class VolkszaehlerBatch;
+	vz::shared_ptr<VolkszaehlerBatch> _batch;
+	size_t _inflight; // number of _values in the pending batch request
+
+	Spool::Ptr _spool; // persistent copy of _values and what didn't fit into memory
 #endif // VZ_PICO
 
 	// Volatil
@@ -113,6 +162,7 @@ class Volkszaehler : public ApiIF {
 	int64_t _last_timestamp; /**< remember last timestamp */
 	// duplicate support:
 	Reading *_lastReadingSent;
+	size_t _sent; // number of _values in the last request
 
         void processResponse(long int http_code, uint errCode);
 
@@ -120,6 +170,59 @@ class Volkszaehler : public ApiIF {
 
 #ifdef VZ_PICO
 #else // VZ_PICO
+/**
+ * Coalesces the readings of all channels sending to the same middleware into one
+ * request per flush window: POST <middleware>/data.json with
+ * [{"uuid":..,"tuples":[[ts,value],..]},..]
+ * Flushed from the curlMultiSender thread, the channels only hand over their values.
+ */
+class VolkszaehlerBatch {
+  public:
+	typedef vz::shared_ptr<VolkszaehlerBatch> Ptr;
+
+	// one instance per middleware, created on first use
+	static Ptr get(const std::string &middleware, const struct curl_slist *headers, long timeout);
+	~VolkszaehlerBatch();
+
+	void add(Volkszaehler *api);
+	void remove(Volkszaehler *api);
+
+	// protects the _values of all participating channels
+	void lock() { pthread_mutex_lock(&_mutex); }
+	void unlock() { pthread_mutex_unlock(&_mutex); }
+
+  private:
+	VolkszaehlerBatch(const std::string &middleware, const struct curl_slist *headers,
+					  long timeout);
+
+	friend class Volkszaehler_Test;
+
+	static void flush_timer(void *arg);
+	void flush();
+	void processResponse(CURLcode curl_code, long http_code, const std::string &response);
+	void reject_duplicate(const std::string &message);
+
+	std::string _url;
+	struct curl_slist *_headers;
+	long _timeout;
+	size_t _max_tuples;
+	size_t _max_bytes;
+
+	pthread_mutex_t _mutex;
+	std::list<Volkszaehler *> _apis;
+	CurlRequest::Ptr _request;
+	RetryBackoff _backoff;
+	JsonWriter _json; // request body, reused
+
+	// after a duplicate of an unknown channel the next _split flushes send one channel
+	// each (starting with _apis[_split_pos]), so the middleware's answer identifies it
+	size_t _split;
+	size_t _split_pos;
+
+	static std::map<std::string, Ptr> _batches;
+	static pthread_mutex_t _batches_mutex;
+};
+
 /**
  * Reformat CURLs debugging output
  */
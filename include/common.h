@@ -1,6 +1,7 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <atomic>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,4 +37,26 @@ typedef enum { parity_8n1, parity_7n1, parity_7e1, parity_7o1 } parity_type_t;
 /* prototypes */
 void print(log_level_t lvl, const char *format, const char *id, ...);
 
+/* messages above this level are compiled out by VZ_PRINT(), see config.hpp */
+#ifndef VZ_LOG_MAX_LEVEL
+#define VZ_LOG_MAX_LEVEL 15 /* log_finest */
+#endif
+
+/* the verbosity, kept up to date by Config_Options. Allows everything until it is known. */
+inline std::atomic<int> &print_verbosity() {
+	static std::atomic<int> verbosity(log_finest);
+	return verbosity;
+}
+
+/*
+ * print() that checks the level first, so the arguments are only evaluated if the
+ * message is written. Use it in hot paths for log_debug and log_finest.
+ */
+#define VZ_PRINT(lvl, ...)                                                                         \
+	do {                                                                                           \
+		if ((lvl) <= VZ_LOG_MAX_LEVEL &&                                                           \
+			(lvl) <= print_verbosity().load(std::memory_order_relaxed))                            \
+			print((lvl), __VA_ARGS__);                                                             \
+	} while (0)
+
 #endif /* _COMMON_H_ */
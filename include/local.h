@@ -38,6 +38,12 @@ using MHD_RESULT = MHD_Result;
 using MHD_RESULT = int;
 #endif
 
+class MapContainer;
+
+// starts the httpd on port. Returns NULL on failure.
+struct MHD_Daemon *local_start(int port, MapContainer *mappings);
+void local_stop(struct MHD_Daemon *d); // resumes pending comet requests and stops the httpd
+
 MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const char *url,
 						  const char *method, const char *version, const char *upload_data,
 						  size_t *upload_data_size, void **con_cls);
@@ -6,11 +6,14 @@
 #ifndef __mqtt_hpp_
 #define __mqtt_hpp_
 
+#include "BoundedQueue.hpp"
 #include "Channel.hpp"
 #include "Reading.hpp"
-#include <mutex>
+#include <atomic>
+#include <list>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 struct mosquitto; // forward decl. to avoid pulling the header here
@@ -23,13 +26,22 @@ class MqttClient {
 	~MqttClient();
 	bool isConfigured() const;
 
-	void publish(Channel::Ptr ch, Reading &rds,
-				 bool aggregate = false); // thread safe, non blocking
+	// thread safe, lock-free and non blocking. Only queues the reading for the
+	// mqtt_client_thread. Returns false if the queue is full and the reading was dropped.
+	bool publish(Channel::Ptr ch, Reading &rds, bool aggregate = false);
+	unsigned long dropped() const { return _dropped; } // readings dropped so far
+
   protected:
 	friend void *mqtt_client_thread(void *);
 	void connect_callback(struct mosquitto *mosq, int result);
 	void disconnect_callback(struct mosquitto *mosq, int result);
 	void message_callback(struct mosquitto *mosq, const struct mosquitto_message *msg);
+	void publish_callback(struct mosquitto *mosq, int mid);
+
+	// called from mqtt_client_thread only:
+	void drain();          // move the queued readings to _pending
+	void send_pending();   // publish _pending as far as _maxInflight allows
+	int loop(int timeout); // wait for the socket or new readings, like mosquitto_loop
 
 	bool _enabled;
 	std::string _host;
@@ -48,11 +60,35 @@ class MqttClient {
 	std::string _id;
 	int _qos = 0;
 	bool _timestamp = false;
+	int _queueSize = 1024;
+	int _maxInflight = 20;
 
 	bool _isConnected = false;
 
 	struct mosquitto *_mcs = nullptr; // mosquitto client session data
 
+	struct Item {
+		Channel::Ptr ch;
+		int64_t time_ms;
+		double value;
+		bool aggregate;
+	};
+	std::unique_ptr<BoundedQueue<Item>> _queue; // readings from the meter/logging threads
+	int _wakefd = -1;                           // eventfd to interrupt loop()
+	std::atomic<bool> _wakeupPending;
+	std::atomic<unsigned long> _dropped;
+	unsigned long _droppedReported = 0;
+
+	struct Message {
+		std::string topic;
+		std::string payload;
+	};
+	std::list<Message> _pending; // to be published, in order
+	// retain: the pending message per topic, a newer value replaces it
+	std::unordered_map<std::string, std::list<Message>::iterator> _pendingTopics;
+	std::unordered_set<int> _inflight; // mids of published messages not acked/written yet
+	void add_pending(const std::string &topic, std::string &&payload);
+
 	struct ChannelEntry {
 		bool _announced = false;
 		bool _sendRaw = true;
@@ -63,8 +99,7 @@ class MqttClient {
 		std::vector<std::pair<std::string, std::string>> _announceValues;
 		void generateNames(const std::string &prefix, Channel &ch);
 	};
-	std::mutex _chMapMutex;
-	std::unordered_map<std::string, ChannelEntry> _chMap;
+	std::unordered_map<std::string, ChannelEntry> _chMap; // mqtt_client_thread only
 };
 
 extern MqttClient *mqttClient;
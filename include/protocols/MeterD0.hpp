@@ -47,6 +47,12 @@ class MeterD0 : public vz::protocol::Protocol {
 		return _pull.size() ? true : false;
 	} // only allow conf setting interval if pull is set (otherwise meter sends autom.)
 
+	virtual bool pollable() const { return true; }
+	virtual int fd() const { return _fd; }
+	virtual void poll_request();
+	virtual ssize_t poll(std::vector<Reading> &rds, size_t n);
+	virtual int poll_timeout() const;
+
 	const char *host() const { return _host.c_str(); }
 	const char *device() const { return _device.c_str(); }
 
@@ -70,6 +76,66 @@ class MeterD0 : public vz::protocol::Protocol {
 	FILE *_dump_fd;
 	struct termios _oldtio; /* required to reset port */
 
+	// parser state, kept across calls so that poll() can resume within a telegram
+	enum CONTEXT {
+		START,
+		VENDOR,
+		BAUDRATE,
+		IDENTIFICATION,
+		ACK,
+		START_LINE,
+		OBIS_CODE,
+		VALUE,
+		UNIT,
+		END_LINE,
+		END
+	};
+	enum PARSE_RESULT { PARSE_MORE, PARSE_DONE, PARSE_ERROR };
+
+	static const int VENDOR_LEN = 3;
+	static const int IDENTIFICATION_LEN = 16;
+	static const int OBIS_LEN = 16;
+	static const int VALUE_LEN = 32;
+	static const int UNIT_LEN = 16;
+	static const int RX_LEN = 4096; // bytes read with one syscall
+
+	CONTEXT _context;
+	char _vendor[VENDOR_LEN + 1];                 // 3 upper case vendor + '\0' termination
+	char _identification[IDENTIFICATION_LEN + 1]; // 16 meter specific + '\0' termination
+	char _obis_code[OBIS_LEN + 1];                // A-B:C.D.E*F, see DIN-EN-62056-61
+	char _value[VALUE_LEN + 1];                   // value, i.e. the actual reading
+	char _unit[UNIT_LEN + 1];                     // the unit of the value, e.g. kWh, V, ...
+	char _baudrate_id;                            // baudrate character of the identification
+	char _endseq[2 + 1];                          // Endsequence ! not ?!
+	char _lastbyte;
+	int _byte_iterator;
+	size_t _number_of_tuples;
+
+	// receive buffer, bytes left after a telegram are kept for the next one
+	char _rx[RX_LEN];
+	size_t _rx_pos;
+	size_t _rx_len;
+	time_t _last_progress;
+	int _sync_skipped; // bytes skipped while waiting for wait_sync_end
+
+	// read by the reactor: instead of sleeping, the next step is left for a later poll()
+	enum PENDING { PENDING_NONE, PENDING_PULL, PENDING_ACK, PENDING_BAUDRATE };
+	bool _polled;
+	PENDING _pending;
+	int64_t _pending_ms; // monotonic time the pending step is due
+
+	void _reset();
+	void _sendPull();
+	void _writePull();
+	void _sendAck();
+	void _setReadBaudrate();
+	void _defer(PENDING step, int delay_ms);
+	bool _runPending(); // runs the due step, false if it left another one
+	bool _sync(char byte); // true while still waiting for wait_sync_end
+	PARSE_RESULT _parse(char byte, std::vector<Reading> &rds, size_t max_readings);
+	PARSE_RESULT _consume(std::vector<Reading> &rds, size_t max_readings); // parse buffered _rx
+	ssize_t _fill(); // refill _rx, returns bytes read, 0 if none available, -1 on error/EOF
+
 	/**
 	 * Open socket
 	 *
@@ -85,7 +151,6 @@ class MeterD0 : public vz::protocol::Protocol {
 	int _dump_pos;
 	void dump_file(DUMP_MODE mode, const char *str);
 	void dump_file(DUMP_MODE mode, const char *buf, size_t len);
-	void dump_file(const char &c) { dump_file(DUMP_IN, &c, 1); };
 };
 
 #endif /* _D0_H_ */
@@ -38,6 +38,10 @@ class MeterFile : public vz::protocol::Protocol {
 	int close();
 	ssize_t read(std::vector<Reading> &rds, size_t n);
 
+	// read() doesn't block on an inotify event or at an interval on a regular file
+	virtual bool pollable() const { return _regular; }
+	virtual int fd() const { return _notify_fd; }
+
 	const char *path() { return _path.c_str(); }
 	const char *format() { return _format.c_str(); }
 
@@ -49,6 +53,7 @@ class MeterFile : public vz::protocol::Protocol {
 
 	FILE *_fd;
 	int _notify_fd;
+	bool _regular;
 };
 
 #endif /* _FILE_H_ */
@@ -11,7 +11,9 @@
 #define _meteroms_hpp_
 
 #include <mbus/mbus.h>
+#include <openssl/evp.h>
 #include <protocols/Protocol.hpp>
+#include <vector>
 
 class MeterOMS : public vz::protocol::Protocol {
   public:
@@ -55,17 +57,33 @@ class MeterOMS : public vz::protocol::Protocol {
 	virtual int open();
 	virtual int close();
 	virtual ssize_t read(std::vector<Reading> &rds, size_t n);
-	bool aes_decrypt(unsigned char *data, int data_len, unsigned char *key, unsigned char *iv);
+	// ctx is set up with the key already, only the iv is set per call
+	bool aes_decrypt(EVP_CIPHER_CTX *ctx, unsigned char *data, int data_len,
+					 const unsigned char *iv);
 
   protected:
+	// one meter received through the interface
+	struct OMSDevice {
+		bool any;                      // single meter mode: accept frames from all meters
+		unsigned char id[4];           // identification number as transmitted (BCD, LSB first)
+		unsigned char manufacturer[2]; // M-field as transmitted, 0/0 = any manufacturer
+		unsigned char channel;         // B group of the obis identifiers of its readings
+		EVP_CIPHER_CTX *ctx;           // AES-128-CBC with the key of the meter, reused per frame
+		double last_timestamp;
+	};
+
 	double get_record_value(mbus_data_record *) const;
+	void add_device(const std::string &key, const char *id, const char *manufacturer,
+					unsigned char channel);
+	OMSDevice *find_device(const mbus_frame &frame);
+	void add_reading(std::vector<Reading> &rds, size_t &ret, size_t n, const OMSDevice &device,
+					 unsigned char c, unsigned char d, double value, double timeFromMeter);
 
 	OMSHWif *_hwif;
-	unsigned char *_aes_key;
+	std::vector<OMSDevice> _devices;
 	std::string _device;
 	bool _mbus_debug;
 	bool _use_local_time;
-	double _last_timestamp;
 };
 
 #endif
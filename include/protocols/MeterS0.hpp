@@ -30,6 +30,8 @@
 #include <termios.h>
 #include <thread>
 
+#include "BoundedQueue.hpp"
+#include "Metrics.hpp"
 #include <protocols/Protocol.hpp>
 
 // some helper functions. might need a namespace
@@ -48,6 +50,13 @@ class MeterS0 : public vz::protocol::Protocol {
 		virtual bool waitForImpulse(bool &timeout) = 0; // blocking interface
 		virtual int status() = 0; // non blocking IO status (<0 = ERR, 0 = low, 1 = high)
 		virtual bool is_blocking() const = 0;
+		// blocking interface for hwifs that get debounced rising edges with their time
+		// (CLOCK_REALTIME) from the kernel. Used instead of waitForImpulse if has_timestamps()
+		virtual bool waitForEdge(bool &timeout, struct timespec &ts) {
+			timeout = false;
+			return false;
+		}
+		virtual bool has_timestamps() const { return false; }
 	};
 
 	class HWIF_UART : public HWIF {
@@ -105,6 +114,38 @@ class MeterS0 : public vz::protocol::Protocol {
 		void *_gpio_base;
 	};
 
+	// GPIO character device (/dev/gpiochipN, linux >= 5.10) with kernel timestamped edge events
+	class HWIF_GPIOCHIP : public HWIF {
+	  public:
+		// edges: request rising edge events, otherwise the line is only read by status()
+		HWIF_GPIOCHIP(int line, const std::list<Option> &options, bool edges);
+		virtual ~HWIF_GPIOCHIP();
+
+		virtual bool _open();
+		virtual bool _close();
+		virtual bool waitForImpulse(bool &timeout) {
+			struct timespec ts;
+			return waitForEdge(timeout, ts);
+		}
+		virtual int status();
+		virtual bool is_blocking() const { return true; }
+		virtual bool waitForEdge(bool &timeout, struct timespec &ts);
+		virtual bool has_timestamps() const { return _edges; }
+
+	  protected:
+		std::string _chip;
+		int _line;
+		bool _edges;
+		int _debounce_us;
+		int _fd;         // line request
+		bool _monotonic; // kernel < 5.11 has no realtime event timestamps
+
+		static const int EVENTS = 16; // read with one syscall
+		int64_t _events_ns[EVENTS];
+		int _events_n;
+		int _events_next;
+	};
+
   public:
 	MeterS0(std::list<Option> options, HWIF *hwif = 0, HWIF *hwif_dir = 0);
 	virtual ~MeterS0();
@@ -117,7 +158,15 @@ class MeterS0 : public vz::protocol::Protocol {
 	} // don't allow interval setting in conf file with S0
 
   protected:
+	struct Impulse {
+		struct timespec time;
+		bool neg;
+		bool after_gap; // the impulses before were lost as the ring was full
+	};
+
 	void counter_thread();
+	void impulse(const struct timespec &ts);
+	ssize_t read_powers(std::vector<Reading> &rds, ssize_t ret, size_t n);
 	void check_ref_for_overflow();
 
 	HWIF *_hwif;
@@ -138,6 +187,15 @@ class MeterS0 : public vz::protocol::Protocol {
 	std::atomic<unsigned long> _ms_last_impulse; // ms of last impulse relative to _time_last_ref
 	struct timespec _time_last_impulse_returned; // timestamp of last impulse returned
 	bool _first_impulse;
+
+	// timestamps of the impulses, written by counter_thread, only if _power_impulses > 0
+	int _power_impulses; // one Power reading per n impulses, 0 = averaged once a second
+	BoundedQueue<Impulse> _timestamps;
+	bool _timestamps_lost; // counter_thread only
+	Metrics::Counter *_dropped;
+	struct timespec _power_ref[2]; // last impulse a Power was calculated to, per direction
+	bool _power_ref_valid[2];
+	int _power_count[2]; // impulses since _power_ref
 };
 
 #endif /* _S0_H_ */
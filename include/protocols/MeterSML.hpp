@@ -37,6 +37,8 @@
 
 #include "Obis.hpp"
 #include <protocols/Protocol.hpp>
+#include <protocols/SmlDecoder.hpp>
+#include <protocols/SmlFramer.hpp>
 
 class MeterSML : public vz::protocol::Protocol {
 
@@ -55,6 +57,10 @@ class MeterSML : public vz::protocol::Protocol {
 		return false;
 	} // don't allow conf setting interval with sml
 
+	virtual bool pollable() const { return _pull.empty(); } // a pull is sent by read() only
+	virtual int fd() const { return _fd; }
+	virtual ssize_t poll(std::vector<Reading> &rds, size_t n);
+
 	const char *host() const { return _host.c_str(); }
 	const char *device() const { return _device.c_str(); }
 
@@ -71,6 +77,14 @@ class MeterSML : public vz::protocol::Protocol {
 
 	const int BUFFER_LEN;
 
+	// for poll(): the frame collected so far and what has been received beyond it
+	SmlFramer _framer;
+	unsigned char _rx[512];
+	size_t _rx_pos;
+	size_t _rx_len;
+
+	SmlDecoder _decoder; // tried before libsml, keeps its memory between telegrams
+
 	/**
 	 * @brief reopen the underlying device. We do this to workaround issue #362
 	 * @return true if reopen was successful. False otherwise.
@@ -85,6 +99,15 @@ class MeterSML : public vz::protocol::Protocol {
 	 * @return true if it is a valid entry
 	 */
 	bool _parse(sml_list *list, Reading *rd);
+	bool _parse(const SmlDecoder::Entry &entry, Reading *rd);
+
+	/**
+	 * Parses a SML file as received by sml_transport_read
+	 * with the native decoder, or with libsml if that doesn't understand it
+	 *
+	 * @return number of readings stored to rds
+	 */
+	size_t _parse_frame(unsigned char *buffer, size_t bytes, std::vector<Reading> &rds, size_t n);
 
 	/**
 	 * Open serial port by device
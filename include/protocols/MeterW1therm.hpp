@@ -10,6 +10,8 @@
 #ifndef _meterw1therm_hpp_
 #define _meterw1therm_hpp_
 
+#include <map>
+#include <mutex>
 #include <protocols/Protocol.hpp>
 
 class MeterW1therm : public vz::protocol::Protocol {
@@ -23,20 +25,43 @@ class MeterW1therm : public vz::protocol::Protocol {
 		virtual bool scanW1devices() = 0; // scan for w1 devices
 		virtual const std::list<std::string> &
 		W1devices() const = 0; // return current list of devices
+		// in parallel mode called for different devices from several threads at once
 		virtual bool readTemp(const std::string &dev, double &value) = 0;
+
+		// optional: start the conversion on all sensors at once. Returns true if
+		// readConverted() returns the results of that conversion now.
+		virtual bool bulkConvert() { return false; }
+		virtual bool readConverted(const std::string &dev, double &value) {
+			return readTemp(dev, value);
+		}
 	};
 
 	class W1sysHWif : public W1HWif {
 	  public:
 		W1sysHWif(){};
-		virtual ~W1sysHWif(){};
+		virtual ~W1sysHWif();
 
 		virtual bool scanW1devices();
 		virtual const std::list<std::string> &W1devices() const { return _devices; }
 		virtual bool readTemp(const std::string &device, double &value);
 
+		virtual bool bulkConvert(); // via therm_bulk_read of the bus masters
+		virtual bool readConverted(const std::string &device, double &value);
+
 	  protected:
+		// the sysfs files of a sensor stay open, each pread() at offset 0 reads them again
+		struct Sensor {
+			Sensor() : slave_fd(-1), temperature_fd(-1) {}
+			int slave_fd;       // w1_slave
+			int temperature_fd; // temperature
+		};
+		ssize_t read_cached(const std::string &device, bool temperature, char *buf,
+							size_t len);
+
 		std::list<std::string> _devices;
+		std::list<std::string> _bulk_read; // therm_bulk_read of all bus masters, if supported
+		std::mutex _mutex;                 // protects _sensors
+		std::map<std::string, Sensor> _sensors;
 	};
 
 	MeterW1therm(const std::list<Option> &options,
@@ -49,7 +74,14 @@ class MeterW1therm : public vz::protocol::Protocol {
 	virtual ssize_t read(std::vector<Reading> &rds, size_t n);
 
   protected:
+	void read_parallel(const std::list<std::string> &list, std::vector<double> &values,
+					   std::vector<char> &ok);
+
 	W1HWif *_hwif;
+	bool _parallel;  // convert/read all sensors at once instead of one after the other
+	int _threads;    // workers reading concurrently if there is no bulk conversion
+	int _rescan;     // seconds between scans for new or removed sensors, 0 = only on open
+	time_t _scanned; // monotonic time of the last scan
 };
 
 #endif
@@ -53,6 +53,22 @@ class Protocol {
 		return true;
 	} // default we allow interval (but S0 e.g disallows)
 
+	/**
+	 * Support for the reactor (event loop) mode, see Reactor.hpp.
+	 * A protocol returning true here is not read by a thread calling read() but by
+	 * poll() whenever fd() is readable. Without a descriptor (fd() < 0) poll() is
+	 * called every interval instead. poll() must never block and returns the number of
+	 * readings of a complete telegram, 0 if there is none yet and <0 on fatal errors.
+	 * A telegram may span several calls, rds is the same vector until it is complete.
+	 * Instead of sleeping, poll() and poll_request() leave a step for later and return
+	 * in poll_timeout() the ms until poll() has to be called for it, -1 if nothing waits.
+	 */
+	virtual bool pollable() const { return false; }
+	virtual int fd() const { return -1; }
+	virtual void poll_request() {} // called every interval, e.g. to send a pull sequence
+	virtual ssize_t poll(std::vector<Reading> &rds, size_t n) { return read(rds, n); }
+	virtual int poll_timeout() const { return -1; }
+
 	const std::string &name() const { return _name; }
 
   private:
@@ -0,0 +1,91 @@
+/**
+ * Native SML decoder for GetListResponse telegrams
+ *
+ * Decodes the list entries of a complete SML file (as collected by SmlFramer or
+ * sml_transport_read()) in place, without building the libsml object graph. The entries
+ * are kept in a vector that is reused for each telegram, so once warmed up decoding
+ * doesn't allocate. Telegrams it doesn't understand are left to libsml.
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SML_DECODER_H_
+#define _SML_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "Obis.hpp"
+
+class SmlDecoder {
+  public:
+	enum Result {
+		OK,
+		BAD_CRC,    // the checksum of the transport frame doesn't match
+		UNSUPPORTED // malformed or not understood, try libsml
+	};
+
+	// one entry of the valList of a GetListResponse
+	struct Entry {
+		Obis obis;
+		double value; // unscaled
+		int8_t scaler;
+		bool has_scaler;
+		bool is_string; // octet string value, value is 0
+		bool has_time;
+		uint32_t time; // valTime from the meter, seconds
+	};
+
+	/**
+	 * Decode one SML file including start and end sequence
+	 *
+	 * @return OK if entries() contains all list entries of the telegram
+	 */
+	Result decode(const unsigned char *frame, size_t len);
+
+	const std::vector<Entry> &entries() const { return _entries; }
+
+	// CRC16 as used by the SML transport (CCITT, reflected, X.25)
+	static uint16_t crc16(const unsigned char *data, size_t len);
+
+	// 10^scaler from a table, for all scalers SML can transmit
+	static double power_of_ten(int8_t scaler);
+
+  private:
+	bool message();
+	bool get_list_response();
+	bool list_entry();
+	bool time(Entry &e);
+	bool value(Entry &e);
+
+	bool tl(int &type, size_t &len);
+	bool unsigned_value(uint64_t &v);
+	bool number(int type, size_t len, double &v);
+	bool skip(int depth = 0);
+	bool optional(); // consumes an omitted optional field
+
+	const unsigned char *_p; // read position in the current telegram
+	const unsigned char *_end;
+	std::vector<Entry> _entries; // cleared, but not freed, for each telegram
+};
+
+#endif /* _SML_DECODER_H_ */
@@ -0,0 +1,59 @@
+/**
+ * Incremental SML transport framing
+ *
+ * Collects the bytes of one SML file from a stream without blocking, the same way
+ * sml_transport_read() does it with blocking reads:
+ * start: 1b1b1b1b 01010101, then 4 byte blocks until the end 1b1b1b1b 1aXXYYYY.
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SML_FRAMER_H_
+#define _SML_FRAMER_H_
+
+#include <stddef.h>
+#include <vector>
+
+class SmlFramer {
+  public:
+	SmlFramer(size_t max_len);
+
+	/**
+	 * Consume bytes until a frame is complete
+	 *
+	 * @return number of bytes consumed, the rest belongs to the next frame
+	 */
+	size_t feed(const unsigned char *data, size_t len);
+
+	// the complete frame including start and end sequence, as from sml_transport_read()
+	bool complete() const { return _complete; }
+	const unsigned char *frame() const { return &_buf[0]; }
+	size_t size() const { return _len; }
+
+	void reset(); // start searching for the next frame
+
+  private:
+	std::vector<unsigned char> _buf;
+	size_t _len;
+	bool _complete;
+};
+
+#endif /* _SML_FRAMER_H_ */
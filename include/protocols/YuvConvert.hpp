@@ -0,0 +1,50 @@
+/**
+ * YUV 4:2:2 (YUYV) to 32bpp RGB conversion for V4L2 frames
+ *
+ * Writes leptonica's 32bpp layout (little endian bytes A B G R, i.e. 0xRRGGBBAA words)
+ * directly from the mmapped capture buffer. Fixed point integer math (BT.601 full range,
+ * 9 bit coefficients), vectorised with SSE2 or NEON if the target has them. All variants
+ * produce the same bytes.
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _YUV_CONVERT_H_
+#define _YUV_CONVERT_H_
+
+#include <stdint.h>
+
+/**
+ * Convert the window (x, y, width, height) of a YUYV frame to the same window of dst
+ *
+ * @param src_stride, dst_stride line lengths in pixels (2 resp. 4 bytes each)
+ * An odd x or width is widened to the enclosing pixel pairs, but not past the end of the
+ * lines; the unpaired last pixel of an odd stride is left out. Pixels outside the window
+ * are not touched.
+ */
+void YUV422toRGBA888(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int x, int y,
+					 int width, int height);
+
+// same without SIMD, for tests and benchmarks
+void YUV422toRGBA888_scalar(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int x,
+							int y, int width, int height);
+
+#endif /* _YUV_CONVERT_H_ */
@@ -0,0 +1,121 @@
+/**
+ * AsyncLog - hands the log lines of all threads to one writer thread
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "AsyncLog.hpp"
+#include "common.h"
+#include <VZException.hpp>
+
+AsyncLog *asyncLog = 0;
+
+AsyncLog::AsyncLog(write_func func, void *arg, int flush_ms, size_t capacity)
+	: _func(func), _arg(arg), _flush_ms(flush_ms > 0 ? flush_ms : 1), _queue(capacity),
+	  _free(capacity), _wakeupPending(false), _stop(false), _dropped(0), _thread_running(false) {
+	_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_wakefd < 0)
+		throw vz::VZException(std::string("AsyncLog: eventfd failed: ") + strerror(errno));
+}
+
+AsyncLog::~AsyncLog() {
+	stop();
+	close(_wakefd);
+}
+
+void AsyncLog::start() {
+	if (_thread_running)
+		return;
+	_stop = false;
+	if (pthread_create(&_thread, NULL, &AsyncLog::thread, this) != 0)
+		throw vz::VZException("AsyncLog: cannot create writer thread.");
+	_thread_running = true;
+}
+
+void AsyncLog::stop() {
+	if (!_thread_running)
+		return;
+	_stop = true;
+	wakeup();
+	pthread_join(_thread, NULL);
+	_thread_running = false;
+}
+
+bool AsyncLog::write(std::string &line, int flags, bool urgent) {
+	Line l;
+	l.text.swap(line);
+	l.flags = flags;
+	if (!_queue.push(std::move(l))) {
+		line.swap(l.text); // not moved if full
+		_dropped++;        // reported by the writer thread
+		wakeup();
+		return false;
+	}
+	_free.pop(line); // stays empty if there is no buffer to recycle
+	if (urgent)
+		wakeup();
+	return true;
+}
+
+void AsyncLog::wakeup() {
+	// one wakeup per batch. The writer resets _wakeupPending before taking the lines:
+	if (!_wakeupPending.exchange(true)) {
+		uint64_t one = 1;
+		if (::write(_wakefd, &one, sizeof(one)) < 0) {
+			// only fails if the counter overflows, the thread is awake then anyhow
+		}
+	}
+}
+
+void *AsyncLog::thread(void *arg) {
+	static_cast<AsyncLog *>(arg)->run();
+	return NULL;
+}
+
+void AsyncLog::run() {
+	struct pollfd fd;
+	fd.fd = _wakefd;
+	fd.events = POLLIN;
+	while (!_stop) {
+		fd.revents = 0;
+		if (poll(&fd, 1, _flush_ms) > 0) {
+			uint64_t cnt;
+			if (read(_wakefd, &cnt, sizeof(cnt)) < 0) {
+				// EAGAIN, nothing to do
+			}
+		}
+		_wakeupPending.exchange(false); // lines added from now on wake us up again
+		drain();
+	}
+	drain();
+}
+
+void AsyncLog::drain() {
+	unsigned long dropped = _dropped.exchange(0);
+	if (dropped) // queued with the other lines
+		print(log_warning, "Log queue full, lost %lu messages", "log", dropped);
+
+	Line l;
+	while (_queue.pop(l))
+		_batch.push_back(std::move(l));
+	if (_batch.empty())
+		return;
+
+	_func(_batch, _arg);
+
+	for (std::vector<Line>::iterator it = _batch.begin(); it != _batch.end(); ++it) {
+		if (it->text.capacity() > RECYCLE_MAX)
+			continue; // e.g. a request body at log_debug, don't keep that much memory
+		it->text.clear();
+		_free.push(std::move(it->text));
+	}
+	_batch.clear();
+}
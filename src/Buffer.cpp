@@ -1,5 +1,5 @@
 /**
- * Circular buffer (double linked)
+ * Circular buffer (preallocated ring)
  *
  * Used to store recent readings and buffer in case of net inconnectivity
  *
@@ -27,6 +27,8 @@
 
 #include "common.h"
 #include "float.h" /* double min max */
+#include <algorithm>
+#include <math.h>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -35,163 +37,234 @@
 #include <string.h>
 
 #include "Buffer.hpp"
+#ifndef VZ_PICO
+#include "Metrics.hpp"
+#endif // VZ_PICO
 
-Buffer::Buffer() : _keep(32), _last_avg(0) {
+// samples lost due to the overflow policy, of this buffer and in total for the metrics
+static void count_dropped(size_t &dropped) {
+	dropped++;
+#ifndef VZ_PICO
+	static Metrics::Counter *total = metrics.dropped("buffer");
+	total->inc();
+#endif // VZ_PICO
+}
+
+Buffer::Buffer(size_t capacity, overflow policy)
+	: _ring(capacity > 0 ? capacity : 1), _head(0), _count(0), _dropped(0), _overflow(policy),
+	  _keep(32), _have_last_avg(false) {
 	_newValues = false;
 #ifdef VZ_USE_THREADS
 	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_space, NULL);
+	_consumer = NULL;
 #endif // VZ_USE_THREADS
 	_aggmode = NONE;
+	_acc.reset();
 }
 
 void Buffer::push(const Reading &rd) {
 	lock();
-	_sent.push_back(rd);
+	if (_aggmode != NONE) {
+		// aggregated channels don't need the single readings
+		if (!rd.deleted())
+			accumulate(Sample(rd));
+	} else {
+		store(Sample(rd));
+	}
+	unlock();
+}
+
+// expects the lock to be held
+void Buffer::store(const Sample &s) {
+	if (_count == _ring.size()) {
+		switch (_overflow) {
+		case SPILL:
+			grow(2 * _ring.size());
+			break;
+
+		case DROP_OLDEST:
+			_head = index(1);
+			_count--;
+			count_dropped(_dropped);
+			break;
+
+		case BLOCK:
+#ifdef VZ_USE_THREADS
+			while (_count == _ring.size()) {
+				// hand over what we have, otherwise the sender might never wake up
+				_newValues = true;
+				if (_consumer)
+					pthread_cond_broadcast(_consumer);
+				pthread_cond_wait(&_space, &_mutex);
+			}
+#else  // VZ_USE_THREADS
+			// nobody could make room while we wait, so lose the new one
+			count_dropped(_dropped);
+			return;
+#endif // VZ_USE_THREADS
+			break;
+		}
+	}
+	at(_count++) = s;
+}
+
+void Buffer::set_capacity(size_t capacity) {
+	lock();
+	if (capacity < 1)
+		capacity = 1;
+	while (_count > capacity) { // keep the most recent ones
+		_head = index(1);
+		_count--;
+		count_dropped(_dropped);
+	}
+	grow(capacity);
 	unlock();
 }
 
+// expects the lock to be held. Linearizes the ring, oldest sample first.
+void Buffer::grow(size_t capacity) {
+	std::vector<Sample> ring(capacity);
+	for (size_t i = 0; i < _count; i++) {
+		ring[i] = at(i);
+	}
+	_ring.swap(ring);
+	_head = 0;
+}
+
+void Buffer::Accumulator::reset() {
+	count = 0;
+	sum = 0;
+	min = DBL_MAX;
+	max = -DBL_MAX;
+	mean = 0;
+	m2 = 0;
+	integral = 0;
+	timespan = 0;
+}
+
+// expects the lock to be held
+void Buffer::accumulate(const Sample &s) {
+	double value = s.value();
+
+	if (_acc.count == 0 || s.time_ms() < _acc.first.time_ms())
+		_acc.first = s;
+	if (_acc.count == 0 || s.time_ms() >= _acc.last.time_ms())
+		_acc.last = s;
+
+	_acc.count++;
+	_acc.sum += value;
+	_acc.min = std::min(_acc.min, value);
+	_acc.max = std::max(_acc.max, value);
+
+	double delta = value - _acc.mean;
+	_acc.mean += delta / _acc.count;
+	_acc.m2 += delta * (value - _acc.mean);
+
+	// AVG needs to handle tuples with different distances properly:
+	// so we need to consider the last tuple from last aggregate call as well
+	// and use this value as the starting point.
+	// we assume readings are pushed sorted by time here!
+	if (_have_last_avg) {
+		double timespan = ((double)(s.time_ms() - _last_avg.time_ms())) / 1000.0;
+		_acc.integral += _last_avg.value() * timespan; // timespan between prev. and this one
+		_acc.timespan += timespan;
+	}
+	_last_avg = s;
+	_have_last_avg = true;
+
+	VZ_PRINT(log_finest, "[%d] %f @ %lld", "AGG", _acc.count, value, s.time_ms());
+}
+
 void Buffer::aggregate(int aggtime, bool aggFixedInterval) {
 	if (_aggmode == NONE)
 		return;
 
 	lock();
-	if (_aggmode == MAX) {
-		Reading *latest = NULL;
-		double aggvalue = -DBL_MAX;
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				if (!latest) {
-					latest = &*it;
-				} else {
-					if (it->time_ms() > latest->time_ms()) {
-						latest = &*it;
-					}
-				}
-				aggvalue = std::max(aggvalue, it->value());
-				print(log_debug, "%f @ %lld", "MAX", it->value(), it->time_ms());
-			}
-		}
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				if (&*it == latest) {
-					it->value(aggvalue);
-					print(log_debug, "RESULT %f @ %lld", "MAX", it->value(), it->time_ms());
-				} else {
-					it->mark_delete();
-				}
-			}
-		}
-	} else if (_aggmode == AVG) {
-		// AVG needs to handle tuples with different distances properly:
-		// so we need to consider the last tuple from last aggregate call as well
-		// and use this value as the starting point.
-		// we assume buffer values are already sorted by time here! TODO: is this always true?
-		// otherwise a sort by time would be needed but this might conflict with _last_avg
-
-		Reading *latest = NULL;
-		double aggvalue = 0;
-		double aggtimespan = 0.0;
-		unsigned int aggcount = 0;
-		Reading *previous = _last_avg;
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				if (!latest) {
-					latest = &*it;
-				} else {
-					if (it->time_ms() > latest->time_ms()) {
-						latest = &*it;
-					}
-				}
-				print(log_debug, "[%d] %f @ %lld", "AVG", aggcount, it->value(), it->time_ms());
-				if (previous) {
-					double timespan = ((double)(it->time_ms() - previous->time_ms())) / 1000.0;
-					aggvalue += previous->value() * timespan; // timespan between prev. and this one
-					aggtimespan += timespan;
-				}
-				previous = &*it;
-				aggcount++;
-			}
-		}
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				if (&*it == latest) {
-					// store the last value before we modify it.
-					if (!_last_avg)
-						_last_avg = new Reading(*it);
-					else
-						*_last_avg = *it;
-
-					if (aggtimespan > 0.0)
-						it->value(aggvalue / aggtimespan);
-					// else keep current value (if no previous and just single value)
-					print(log_debug, "[%d] RESULT %f @ %lld", "AVG", aggcount, it->value(),
-						  it->time_ms());
-				} else {
-					it->mark_delete();
-				}
-			}
-		}
-	} else if (_aggmode == SUM) {
-		Reading *latest = NULL;
-		double aggvalue = 0;
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				if (!latest) {
-					latest = &*it;
-				} else {
-					if (it->time_ms() > latest->time_ms()) {
-						latest = &*it;
-					}
-				}
-				aggvalue = aggvalue + it->value();
-				print(log_debug, "%f @ %lld", "SUM", it->value(), it->time_ms());
-			}
-		}
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				if (&*it == latest) {
-					it->value(aggvalue);
-					print(log_debug, "RESULT %f @ %lld", "SUM", it->value(), it->time_ms());
-				} else {
-					it->mark_delete();
-				}
-			}
-		}
+	if (_acc.count == 0) { // nothing read during this period
+		unlock();
+		return;
+	}
+
+	Sample result = _acc.last; // aggregated value has the timestamp of the latest reading
+	switch (_aggmode) {
+	case MAX:
+		result.value(_acc.max);
+		break;
+	case MIN:
+		result.value(_acc.min);
+		break;
+	case SUM:
+		result.value(_acc.sum);
+		break;
+	case AVG:
+		if (_acc.timespan > 0.0)
+			result.value(_acc.integral / _acc.timespan);
+		// else keep current value (if no previous and just single value)
+		break;
+	case FIRST:
+		result.value(_acc.first.value());
+		break;
+	case LAST:
+		break;
+	case COUNT:
+		result.value(_acc.count);
+		break;
+	case STDDEV:
+		result.value(sqrt(_acc.m2 / _acc.count));
+		break;
+	case NONE:
+		break;
 	}
+	VZ_PRINT(log_debug, "[%d] RESULT %f @ %lld", "AGG", _acc.count, result.value(),
+			 result.time_ms());
+	_acc.reset();
+
 	/* fix timestamp if aggFixedInterval set */
 	if ((aggFixedInterval == true) && (aggtime > 0)) {
 		struct timeval tv;
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (!it->deleted()) {
-				tv.tv_usec = 0;
-				tv.tv_sec = aggtime * (long int)((it->time_ms() / 1000) / aggtime);
-				it->time(tv);
-			}
-		}
+		tv.tv_usec = 0;
+		tv.tv_sec = aggtime * (long int)((result.time_ms() / 1000) / aggtime);
+		result.time(tv);
 	}
+	store(result);
 	unlock();
+
 	clean();
 	return;
 }
 
 void Buffer::clean(bool deleted_only) {
 	lock();
+	size_t before = _count;
 	if (deleted_only) {
-		for (iterator it = _sent.begin(); it != _sent.end(); it++) {
-			if (it->deleted()) {
-				it = _sent.erase(it);
-				it--;
+		// compact in place, keeping the order
+		size_t kept = 0;
+		for (size_t i = 0; i < _count; i++) {
+			if (!at(i).deleted()) {
+				if (kept != i)
+					at(kept) = at(i);
+				kept++;
 			}
 		}
+		_count = kept;
 	} else {
-		_sent.clear();
+		_count = 0;
 	}
+	if (_count == 0)
+		_head = 0;
+#ifdef VZ_USE_THREADS
+	if (_count < before)
+		pthread_cond_broadcast(&_space);
+#else  // VZ_USE_THREADS
+	(void)before;
+#endif // VZ_USE_THREADS
 	unlock();
 }
 
 void Buffer::undelete() {
 	lock();
-	for (iterator it = _sent.begin(); it != _sent.end(); it++) {
+	for (iterator it = begin(); it != end(); it++) {
 		it->reset();
 	}
 	unlock();
@@ -203,11 +276,11 @@ std::string Buffer::dump() {
 
 	lock();
 	o << std::setprecision(4);
-	for (iterator it = _sent.begin(); it != _sent.end(); it++) {
+	for (iterator it = begin(); it != end(); it++) {
 		o << it->value();
 
 		/* indicate last sent reading */
-		if (_sent.end() == it) {
+		if (end() == it) {
 			o << '!';
 		} else {
 			/* add seperator between values */
@@ -221,8 +294,7 @@ std::string Buffer::dump() {
 
 Buffer::~Buffer() {
 #ifdef VZ_USE_THREADS
+	pthread_cond_destroy(&_space);
 	pthread_mutex_destroy(&_mutex);
 #endif // VZ_USE_THREADS
-	if (_last_avg)
-		delete _last_avg;
 }
@@ -52,17 +52,23 @@
 #include <api/Volkszaehler.hpp>
 
 #include <Config_Options.hpp>
+#include <Reactor.hpp>
 
 int Channel::instances = 0;
 
 Channel::Channel(const std::list<Option> &pOptions, const std::string apiProtocol,
 				 const std::string uuid, ReadingIdentifier::Ptr pIdentifier) :
 #ifdef VZ_USE_THREADS
-          _thread_running(false),
+          _thread_running(false), _send_shared(false),
 #endif // VZ_USE_THREADS
           _options(pOptions), _buffer(new Buffer()), _identifier(pIdentifier),
-	  _uuid(uuid), _apiProtocol(apiProtocol), _duplicates(0) {
+	  _uuid(uuid), _apiProtocol(apiProtocol), _duplicates(0), _local_retention(-1),
+	  _push_slot(-1) {
 	id = instances++;
+#ifndef VZ_PICO
+	_depth = metrics.gauge("vzlogger_buffer_depth", "Readings in the buffer of a channel",
+						   Metrics::label("uuid", uuid));
+#endif // VZ_PICO
 
 	// set channel name
 	std::stringstream oss;
@@ -80,6 +86,16 @@ Channel::Channel(const std::list<Option> &pOptions, const std::string apiProtoco
 			_buffer->set_aggmode(Buffer::AVG);
 		} else if (strcasecmp(aggmode_str, "sum") == 0) {
 			_buffer->set_aggmode(Buffer::SUM);
+		} else if (strcasecmp(aggmode_str, "min") == 0) {
+			_buffer->set_aggmode(Buffer::MIN);
+		} else if (strcasecmp(aggmode_str, "first") == 0) {
+			_buffer->set_aggmode(Buffer::FIRST);
+		} else if (strcasecmp(aggmode_str, "last") == 0) {
+			_buffer->set_aggmode(Buffer::LAST);
+		} else if (strcasecmp(aggmode_str, "count") == 0) {
+			_buffer->set_aggmode(Buffer::COUNT);
+		} else if (strcasecmp(aggmode_str, "stddev") == 0) {
+			_buffer->set_aggmode(Buffer::STDDEV);
 		} else if (strcasecmp(aggmode_str, "none") == 0) {
 			_buffer->set_aggmode(Buffer::NONE);
 		} else {
@@ -95,6 +111,42 @@ Channel::Channel(const std::list<Option> &pOptions, const std::string apiProtoco
 		throw;
 	}
 
+	try {
+		// buffer_capacity: number of readings preallocated for the sender
+		int capacity = optlist.lookup_int(pOptions, "buffer_capacity");
+		if (capacity < 1)
+			throw vz::VZException("buffer_capacity < 1 not allowed");
+		_buffer->set_capacity(capacity);
+	} catch (vz::OptionNotFoundException &e) {
+		// using default value if not specified
+	} catch (vz::VZException &e) {
+		std::stringstream oss;
+		oss << e.what();
+		print(log_alert, "Invalid parameter buffer_capacity (%s)", name(), oss.str().c_str());
+		throw;
+	}
+
+	try {
+		// buffer_overflow: what to do if the sender can't keep up
+		const char *overflow_str = optlist.lookup_string(pOptions, "buffer_overflow");
+		if (strcasecmp(overflow_str, "spill") == 0) {
+			_buffer->set_overflow(Buffer::SPILL);
+		} else if (strcasecmp(overflow_str, "drop_oldest") == 0) {
+			_buffer->set_overflow(Buffer::DROP_OLDEST);
+		} else if (strcasecmp(overflow_str, "block") == 0) {
+			_buffer->set_overflow(Buffer::BLOCK);
+		} else {
+			throw vz::VZException("buffer_overflow unknown.");
+		}
+	} catch (vz::OptionNotFoundException &e) {
+		// using default value if not specified
+	} catch (vz::VZException &e) {
+		std::stringstream oss;
+		oss << e.what();
+		print(log_alert, "Invalid parameter buffer_overflow (%s)", name(), oss.str().c_str());
+		throw;
+	}
+
 	try {
 		_duplicates = optlist.lookup_int(pOptions, "duplicates");
 		if (_duplicates < 0)
@@ -108,8 +160,22 @@ Channel::Channel(const std::list<Option> &pOptions, const std::string apiProtoco
 		throw;
 	}
 
+	try {
+		_local_retention = optlist.lookup_int(pOptions, "local_retention");
+		if (_local_retention < 0)
+			throw vz::VZException("local_retention < 0 not allowed");
+	} catch (vz::OptionNotFoundException &e) {
+		// using the global retention of the local store
+	} catch (vz::VZException &e) {
+		std::stringstream oss;
+		oss << e.what();
+		print(log_alert, "Invalid parameter local_retention (%s)", name(), oss.str().c_str());
+		throw;
+	}
+
 #ifdef VZ_USE_THREADS
 	pthread_cond_init(&condition, NULL); // initialize thread syncronization helpers
+	_buffer->consumer(&condition);
 #endif // VZ_USE_THREADS
   print(log_debug, "Created channel (%x).", name(), this);
 }
@@ -123,6 +189,94 @@ Channel::~Channel() {
 }
 
 // Send data - taken from threads.cpp
+#ifdef VZ_USE_THREADS
+void Channel::start(Ptr this_shared)
+{
+  // create the api now to know whether it needs a logging_thread at all
+  if(this_shared->api == NULL)
+  {
+    try
+    {
+      this_shared->api = this_shared->connect(this_shared);
+    }
+    catch (std::exception &e)
+    {
+      // the logging_thread retries via sendData()
+      print(log_alert, "Creating api failed due to: %s", name(), e.what());
+    }
+  }
+
+  if(this_shared->async())
+  {
+    // the reading thread or the sendReactor sends, nobody would make room while the
+    // reading thread waits for it
+    if (this_shared->_buffer->get_overflow() == Buffer::BLOCK) {
+      print(log_warning, "buffer_overflow \"block\" not possible with async sender, using \"spill\"",
+            name());
+      this_shared->_buffer->set_overflow(Buffer::SPILL);
+    }
+    if (sendReactor)
+    {
+      // send() never blocks, so it may run from the reactor
+      print(log_debug, "Sending asynchronously from the shared sending thread.", name());
+      this_shared->_this_forthread = this_shared;
+      this_shared->_send_shared = true;
+    }
+    else
+    {
+      print(log_debug, "Sending asynchronously, no logging thread needed.", name());
+    }
+    return;
+  }
+
+  // Copy the owner's shared pointer for the logging_thread into this member.
+  this_shared->_this_forthread = this_shared;
+
+  // .. and pass the raw Channel*
+  pthread_create(&this_shared->_thread, NULL, &logging_thread, (void *)this_shared.get());
+  this_shared->_thread_running = true;
+}
+
+void Channel::schedule_send()
+{
+  // repeated notifications before it runs are sent at once
+  sendReactor->after(0, &Channel::send_scheduled, this);
+}
+
+void Channel::leave_sendReactor()
+{
+  // waits for a send in progress, the reactor holds its lock during callbacks
+  sendReactor->remove_timers(this);
+  _send_shared = false;
+  _this_forthread.reset();
+}
+
+/**
+	Called by the sendReactor, does what the logging_thread does after wait().
+*/
+void Channel::send_scheduled(void *arg)
+{
+  Channel *ch = static_cast<Channel *>(arg);
+  ch->_buffer->lock();
+  bool newValues = ch->_buffer->newValues();
+  ch->_buffer->clear_newValues();
+  ch->_buffer->unlock();
+  if (!newValues)
+  {
+    return;
+  }
+
+  try
+  {
+    ch->sendData(ch->_this_forthread);
+  }
+  catch (std::exception &e)
+  {
+    print(log_alert, "Sending failed due to: %s", ch->name(), e.what());
+  }
+}
+#endif // VZ_USE_THREADS
+
 void Channel::sendData(Ptr this_shared)
 {
   extern Config_Options options;
@@ -184,4 +338,5 @@ vz::shared_ptr<vz::ApiIF> Channel::connect(Ptr this_shared)
 
 bool Channel::isBusy() const  { return (api && api->isBusy()); }
 void Channel::checkResponse() { if(api) { api->checkResponse(); } }
+bool Channel::async() const   { return (api && api->async()); }
 
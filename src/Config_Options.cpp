@@ -45,9 +45,17 @@ Config_Options::Config_Options()
           _pds(0),
 #endif // VZ_PICO
           _port(8080), _verbosity(0),
-	  _comet_timeout(30), _buffer_length(-1), _retry_pause(15), _local(false), _foreground(false),
-	  _time_machine(false) {
+	  _comet_timeout(30), _buffer_length(-1), _retry_pause(15), _log_flush(1000),
+	  _sender_connections(4), _sender_batch_window(1000), _sender_batch_tuples(1024), _sender_batch_bytes(65536),
+	  _local(false), _foreground(false), _time_machine(false), _sender_async(false),
+	  _sender_batch(false), _reactor(false), _log_async(false) {
 	_logfd = NULL;
+#ifndef VZ_PICO
+	_spool_max_size = 64 * 1024 * 1024;
+	_spool_segment_size = 1024 * 1024;
+	_spool_fsync = Spool::FSYNC_SEGMENT;
+	_local_retention = 7 * 24 * 3600;
+#endif // VZ_PICO
 }
 
 Config_Options::Config_Options(const std::string filename)
@@ -56,9 +64,17 @@ Config_Options::Config_Options(const std::string filename)
           _pds(0),
 #endif // VZ_PICO
           _port(8080), _verbosity(0), _comet_timeout(30),
-	  _buffer_length(-1), _retry_pause(15), _local(false), _foreground(false),
-	  _time_machine(false) {
+	  _buffer_length(-1), _retry_pause(15), _log_flush(1000), _sender_connections(4),
+	  _sender_batch_window(1000), _sender_batch_tuples(1024), _sender_batch_bytes(65536),
+	  _local(false), _foreground(false), _time_machine(false), _sender_async(false),
+	  _sender_batch(false), _reactor(false), _log_async(false) {
 	_logfd = NULL;
+#ifndef VZ_PICO
+	_spool_max_size = 64 * 1024 * 1024;
+	_spool_segment_size = 1024 * 1024;
+	_spool_fsync = Spool::FSYNC_SEGMENT;
+	_local_retention = 7 * 24 * 3600;
+#endif // VZ_PICO
 }
 
 struct json_object * Config_Options::parseConfigFile() const
@@ -160,11 +176,70 @@ void Config_Options::config_parse(MapContainer &mappings, const char * configStr
 				}
 			} else if (strcmp(key, "log") == 0 && type == json_type_string) {
 				_log = json_object_get_string(value);
+			} else if (strcmp(key, "log_async") == 0 && type == json_type_boolean) {
+				_log_async = json_object_get_boolean(value);
+			} else if (strcmp(key, "log_flush") == 0 && type == json_type_int &&
+					   json_object_get_int(value) > 0) {
+				_log_flush = json_object_get_int(value);
 			} else if (strcmp(key, "retry") == 0 && type == json_type_int) {
 				_retry_pause = json_object_get_int(value);
 			} else if (strcmp(key, "verbosity") == 0 && type == json_type_int) {
 				_verbosity = json_object_get_int(value);
-			} else if (strcmp(key, "local") == 0) {
+				print_verbosity() = _verbosity;
+			} else if (strcmp(key, "sender") == 0 && type == json_type_object) {
+				json_object_object_foreach(value, key, sender_value) {
+					enum json_type sender_type = json_object_get_type(sender_value);
+
+					if (strcmp(key, "async") == 0 && sender_type == json_type_boolean) {
+						_sender_async = json_object_get_boolean(sender_value);
+					} else if (strcmp(key, "connections") == 0 && sender_type == json_type_int &&
+							   json_object_get_int(sender_value) > 0) {
+						_sender_connections = json_object_get_int(sender_value);
+					} else if (strcmp(key, "batch") == 0 && sender_type == json_type_boolean) {
+						_sender_batch = json_object_get_boolean(sender_value);
+					} else if (strcmp(key, "batch_window") == 0 &&
+							   sender_type == json_type_int &&
+							   json_object_get_int(sender_value) > 0) {
+						_sender_batch_window = json_object_get_int(sender_value);
+					} else if (strcmp(key, "batch_tuples") == 0 &&
+							   sender_type == json_type_int &&
+							   json_object_get_int(sender_value) > 0) {
+						_sender_batch_tuples = json_object_get_int(sender_value);
+					} else if (strcmp(key, "batch_bytes") == 0 &&
+							   sender_type == json_type_int &&
+							   json_object_get_int(sender_value) > 0) {
+						_sender_batch_bytes = json_object_get_int(sender_value);
+					} else {
+						print(log_alert, "Ignoring invalid field or type: %s=%s (%s)", NULL, key,
+							  json_object_get_string(sender_value),
+							  option_type_str[sender_type]);
+					}
+				}
+			}
+#ifndef VZ_PICO
+			else if (strcmp(key, "spool") == 0 && type == json_type_object) {
+				json_object_object_foreach(value, key, spool_value) {
+					enum json_type spool_type = json_object_get_type(spool_value);
+
+					if (strcmp(key, "dir") == 0 && spool_type == json_type_string) {
+						_spool_dir = json_object_get_string(spool_value);
+					} else if (strcmp(key, "max_size") == 0 && spool_type == json_type_int &&
+							   json_object_get_int(spool_value) > 0) {
+						_spool_max_size = (size_t)json_object_get_int(spool_value) * 1024 * 1024;
+					} else if (strcmp(key, "segment_size") == 0 && spool_type == json_type_int &&
+							   json_object_get_int(spool_value) > 0) {
+						_spool_segment_size = (size_t)json_object_get_int(spool_value) * 1024;
+					} else if (strcmp(key, "fsync") == 0 && spool_type == json_type_string) {
+						_spool_fsync =
+							Spool::fsync_policy_from_string(json_object_get_string(spool_value));
+					} else {
+						print(log_alert, "Ignoring invalid field or type: %s=%s (%s)", NULL, key,
+							  json_object_get_string(spool_value), option_type_str[spool_type]);
+					}
+				}
+			}
+#endif // VZ_PICO
+			else if (strcmp(key, "local") == 0) {
 				json_object_object_foreach(value, key, local_value) {
 					enum json_type local_type = json_object_get_type(local_value);
 
@@ -181,6 +256,12 @@ void Config_Options::config_parse(MapContainer &mappings, const char * configStr
 								-1; // 0 makes no sense, use size based mode with 1 element
 					} else if (strcmp(key, "index") == 0 && local_type == json_type_boolean) {
 						_channel_index = json_object_get_boolean(local_value);
+#ifndef VZ_PICO
+					} else if (strcmp(key, "store") == 0 && local_type == json_type_string) {
+						_local_store = json_object_get_string(local_value);
+					} else if (strcmp(key, "retention") == 0 && local_type == json_type_int) {
+						_local_retention = json_object_get_int(local_value);
+#endif // VZ_PICO
 					} else {
 						print(log_alert, "Ignoring invalid field or type: %s=%s (%s)", NULL, key,
 							  json_object_get_string(local_value), option_type_str[local_type]);
@@ -220,6 +301,8 @@ void Config_Options::config_parse(MapContainer &mappings, const char * configStr
 #endif
 			else if ((strcmp(key, "i_have_a_time_machine") == 0) && type == json_type_boolean) {
 				_time_machine = json_object_get_boolean(value);
+			} else if (strcmp(key, "reactor") == 0 && type == json_type_boolean) {
+				_reactor = json_object_get_boolean(value);
 			} else {
 				print(log_alert, "Ignoring invalid field or type: %s=%s (%s)", NULL, key,
 					  json_object_get_string(value), option_type_str[type]);
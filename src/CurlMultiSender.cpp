@@ -0,0 +1,366 @@
+/**
+ * CurlMultiSender - shared, non-blocking HTTP sender based on one curl multi handle
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include "CurlMultiSender.hpp"
+#include "common.h"
+#include <time.h>
+#include <VZException.hpp>
+
+// curl_multi_poll() and curl_multi_wakeup() exist since 7.68.0. Older versions poll
+// the multi handle with a short timeout instead to pick up newly submitted requests.
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define VZ_CURL_HAVE_MULTI_POLL 1
+#endif
+
+static const int POLL_TIMEOUT_MS = 1000;
+static const int POLL_TIMEOUT_NOWAKEUP_MS = 100;
+
+static int64_t monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+CurlRequest::CurlRequest(const std::string &url, const std::string &body,
+						 const struct curl_slist *headers, long timeout)
+	: _url(url), _body(body), _headers(NULL), _timeout(timeout), _debugfunc(NULL),
+	  _debugdata(NULL), _verify_peer(true), _duration(NULL), _started_us(0), _curl_code(CURLE_OK),
+	  _http_code(0), _done(false), _on_done(NULL), _on_done_arg(NULL) {
+	pthread_mutex_init(&_on_done_mutex, NULL);
+	for (const struct curl_slist *h = headers; h; h = h->next)
+		_headers = curl_slist_append(_headers, h->data);
+}
+
+CurlRequest::~CurlRequest() {
+	curl_slist_free_all(_headers);
+	pthread_mutex_destroy(&_on_done_mutex);
+}
+
+void CurlRequest::cancel_on_done() {
+	pthread_mutex_lock(&_on_done_mutex);
+	_on_done = NULL;
+	pthread_mutex_unlock(&_on_done_mutex);
+}
+
+void CurlRequest::notify_done() {
+	pthread_mutex_lock(&_on_done_mutex);
+	if (_on_done)
+		_on_done(_on_done_arg);
+	pthread_mutex_unlock(&_on_done_mutex);
+}
+
+size_t CurlRequest::write_callback(void *ptr, size_t size, size_t nmemb, void *data) {
+	size_t realsize = size * nmemb;
+	CurlRequest *req = static_cast<CurlRequest *>(data);
+	req->_response.append(static_cast<const char *>(ptr), realsize);
+	return realsize;
+}
+
+void CurlRequest::complete(CURLcode curl_code, long http_code) {
+	_curl_code = curl_code;
+	_http_code = http_code;
+	if (_duration && _started_us)
+		_duration->observe(Metrics::now_us() - _started_us);
+	_done = true; // publishes the results above to the submitter
+}
+
+int RetryBackoff::failed(int base) {
+	int max = base * MAX_FACTOR;
+	_pause = _pause <= 0 ? base : (_pause < max / 2 ? 2 * _pause : max);
+	_until_us = Metrics::now_us() + (int64_t)_pause * 1000000;
+	return _pause;
+}
+
+int RetryBackoff::remaining_ms() const {
+	int64_t left = _until_us - Metrics::now_us();
+	return left > 0 ? (int)((left + 999) / 1000) : 0;
+}
+
+CurlMultiSender::CurlMultiSender(int connections)
+	: _multi(NULL), _connections(connections > 0 ? connections : 1), _thread_running(false),
+	  _stop(false), _pending(0) {
+	_mutex = PTHREAD_MUTEX_INITIALIZER;
+	// recursive, the timer callbacks may (re)arm timers:
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&_timer_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	curl_global_init(CURL_GLOBAL_ALL);
+
+	_multi = curl_multi_init();
+	if (!_multi)
+		throw vz::VZException("CURL: cannot create multi handle.");
+
+	// requests to the same middleware queue up for one of these connections and reuse them
+	curl_multi_setopt(_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)_connections);
+	curl_multi_setopt(_multi, CURLMOPT_MAXCONNECTS, (long)(_connections * 4));
+#ifdef CURLPIPE_MULTIPLEX
+	curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+}
+
+CurlMultiSender::~CurlMultiSender() {
+	stop();
+	for (std::vector<CURL *>::iterator it = _idle.begin(); it != _idle.end(); ++it)
+		curl_easy_cleanup(*it);
+	curl_multi_cleanup(_multi);
+	curl_global_cleanup();
+	pthread_mutex_destroy(&_mutex);
+	pthread_mutex_destroy(&_timer_mutex);
+}
+
+void CurlMultiSender::start() {
+	if (_thread_running)
+		return;
+	_stop = false;
+	if (pthread_create(&_thread, NULL, &CurlMultiSender::thread, (void *)this))
+		throw vz::VZException("CURL: cannot start sender thread.");
+	_thread_running = true;
+	VZ_PRINT(log_debug, "Started curl sender with max. %d connections per host.", "curl",
+			 _connections);
+}
+
+void CurlMultiSender::stop() {
+	if (!_thread_running)
+		return;
+	_stop = true;
+	wakeup();
+	pthread_join(_thread, NULL);
+	_thread_running = false;
+
+	// abort whatever has not completed yet:
+	for (std::map<CURL *, CurlRequest::Ptr>::iterator it = _busy.begin(); it != _busy.end();
+		 ++it) {
+		curl_multi_remove_handle(_multi, it->first);
+		curl_easy_cleanup(it->first);
+		it->second->complete(CURLE_ABORTED_BY_CALLBACK, 0);
+	}
+	_busy.clear();
+
+	pthread_mutex_lock(&_mutex);
+	for (std::list<CurlRequest::Ptr>::iterator it = _queue.begin(); it != _queue.end(); ++it)
+		(*it)->complete(CURLE_ABORTED_BY_CALLBACK, 0);
+	_queue.clear();
+	pthread_mutex_unlock(&_mutex);
+	_pending = 0;
+	VZ_PRINT(log_debug, "Stopped curl sender.", "curl");
+}
+
+void CurlMultiSender::submit(CurlRequest::Ptr req) {
+	pthread_mutex_lock(&_mutex);
+	_queue.push_back(req);
+	_pending++;
+	pthread_mutex_unlock(&_mutex);
+	wakeup();
+}
+
+size_t CurlMultiSender::pending() { return _pending; }
+
+void CurlMultiSender::every(int interval_ms, timer_func func, void *arg) {
+	Timer t;
+	t.interval_ms = interval_ms > 0 ? interval_ms : 1;
+	t.fired = false;
+	t.func = func;
+	t.arg = arg;
+	t.next_ms = monotonic_ms() + t.interval_ms;
+	pthread_mutex_lock(&_timer_mutex);
+	_timers.push_back(t);
+	pthread_mutex_unlock(&_timer_mutex);
+	wakeup();
+}
+
+void CurlMultiSender::after(int delay_ms, timer_func func, void *arg) {
+	int64_t next_ms = monotonic_ms() + (delay_ms > 0 ? delay_ms : 0);
+	pthread_mutex_lock(&_timer_mutex);
+	std::vector<Timer>::iterator it;
+	for (it = _timers.begin(); it != _timers.end(); ++it)
+		if (it->interval_ms == 0 && !it->fired && it->func == func && it->arg == arg)
+			break;
+	if (it == _timers.end()) {
+		Timer t;
+		t.interval_ms = 0;
+		t.func = func;
+		t.arg = arg;
+		it = _timers.insert(_timers.end(), t);
+	}
+	it->fired = false;
+	it->next_ms = next_ms;
+	pthread_mutex_unlock(&_timer_mutex);
+	wakeup();
+}
+
+void CurlMultiSender::remove_timers(void *arg) {
+	pthread_mutex_lock(&_timer_mutex);
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end();) {
+		if (it->arg == arg)
+			it = _timers.erase(it);
+		else
+			++it;
+	}
+	pthread_mutex_unlock(&_timer_mutex);
+}
+
+int CurlMultiSender::run_timers() {
+	int64_t now = monotonic_ms();
+	int next = POLL_TIMEOUT_MS;
+
+	pthread_mutex_lock(&_timer_mutex);
+	std::vector<Timer> due;
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end(); ++it) {
+		if (it->fired)
+			continue;
+		if (it->next_ms <= now) {
+			due.push_back(*it);
+			if (it->interval_ms == 0) {
+				it->fired = true; // removed after the callbacks
+				continue;
+			}
+			// don't try to catch up missed periods:
+			while (it->next_ms <= now)
+				it->next_ms += it->interval_ms;
+		}
+		if (it->next_ms - now < next)
+			next = (int)(it->next_ms - now);
+	}
+
+	// _queue has its own lock, the callbacks may submit() new requests:
+	for (std::vector<Timer>::iterator it = due.begin(); it != due.end(); ++it) {
+		// an earlier callback might have removed this one:
+		bool registered = false;
+		for (std::vector<Timer>::iterator t = _timers.begin(); t != _timers.end(); ++t)
+			if (t->func == it->func && t->arg == it->arg && t->interval_ms == it->interval_ms)
+				registered = true;
+		if (registered)
+			it->func(it->arg);
+	}
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end();) {
+		if (it->fired)
+			it = _timers.erase(it);
+		else
+			++it;
+	}
+	// callbacks may have added timers due earlier than computed above:
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end(); ++it)
+		if (it->next_ms - now < next)
+			next = it->next_ms > now ? (int)(it->next_ms - now) : 0;
+	pthread_mutex_unlock(&_timer_mutex);
+
+	// the callbacks took time as well:
+	int64_t spent = monotonic_ms() - now;
+	return next > spent ? (int)(next - spent) : 0;
+}
+
+void CurlMultiSender::wakeup() {
+#ifdef VZ_CURL_HAVE_MULTI_POLL
+	curl_multi_wakeup(_multi);
+#endif
+}
+
+void *CurlMultiSender::thread(void *arg) {
+	static_cast<CurlMultiSender *>(arg)->run();
+	return NULL;
+}
+
+CURL *CurlMultiSender::get_handle() {
+	if (_idle.empty())
+		return curl_easy_init();
+	CURL *eh = _idle.back();
+	_idle.pop_back();
+	curl_easy_reset(eh); // keeps the connection and dns cache of the multi handle
+	return eh;
+}
+
+void CurlMultiSender::run() {
+	while (!_stop) {
+		// move newly submitted requests into the multi handle:
+		std::list<CurlRequest::Ptr> queue;
+		pthread_mutex_lock(&_mutex);
+		queue.swap(_queue);
+		pthread_mutex_unlock(&_mutex);
+
+		for (std::list<CurlRequest::Ptr>::iterator it = queue.begin(); it != queue.end(); ++it) {
+			CurlRequest::Ptr req = *it;
+			CURL *eh = get_handle();
+			if (!eh) {
+				print(log_alert, "CURL: cannot create handle.", "curl");
+				req->complete(CURLE_FAILED_INIT, 0);
+				_pending--;
+				req->notify_done();
+				continue;
+			}
+
+			curl_easy_setopt(eh, CURLOPT_URL, req->_url.c_str());
+			curl_easy_setopt(eh, CURLOPT_HTTPHEADER, req->_headers);
+			curl_easy_setopt(eh, CURLOPT_POSTFIELDS, req->_body.c_str());
+			curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, (long)req->_body.size());
+			curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, &CurlRequest::write_callback);
+			curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void *)req.get());
+			curl_easy_setopt(eh, CURLOPT_TIMEOUT, req->_timeout);
+			curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1L);
+			curl_easy_setopt(eh, CURLOPT_TCP_KEEPALIVE, 1L);
+			curl_easy_setopt(eh, CURLOPT_SSL_VERIFYPEER, req->_verify_peer ? 1L : 0L);
+			if (!req->_username.empty()) {
+				curl_easy_setopt(eh, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+				curl_easy_setopt(eh, CURLOPT_USERNAME, req->_username.c_str());
+				curl_easy_setopt(eh, CURLOPT_PASSWORD, req->_password.c_str());
+			}
+			if (req->_debugfunc) {
+				curl_easy_setopt(eh, CURLOPT_VERBOSE, 1L);
+				curl_easy_setopt(eh, CURLOPT_DEBUGFUNCTION, req->_debugfunc);
+				curl_easy_setopt(eh, CURLOPT_DEBUGDATA, req->_debugdata);
+			}
+
+			req->_started_us = Metrics::now_us();
+			_busy[eh] = req;
+			curl_multi_add_handle(_multi, eh);
+		}
+
+		int running = 0;
+		CURLMcode mc = curl_multi_perform(_multi, &running);
+		if (mc != CURLM_OK)
+			print(log_error, "CURL: multi perform failed: %s", "curl", curl_multi_strerror(mc));
+
+		// hand back completed transfers:
+		CURLMsg *msg;
+		int left;
+		while ((msg = curl_multi_info_read(_multi, &left))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			CURL *eh = msg->easy_handle;
+			long http_code = 0;
+			curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &http_code);
+			CURLcode curl_code = msg->data.result;
+			curl_multi_remove_handle(_multi, eh);
+
+			std::map<CURL *, CurlRequest::Ptr>::iterator it = _busy.find(eh);
+			if (it != _busy.end()) {
+				VZ_PRINT(log_finest, "Request to %s completed: %d (%s)", "curl",
+						 it->second->_url.c_str(), http_code, curl_easy_strerror(curl_code));
+				CurlRequest::Ptr req = it->second;
+				req->complete(curl_code, http_code);
+				_busy.erase(it);
+				_pending--;
+				req->notify_done(); // may submit() the next request
+			}
+			_idle.push_back(eh);
+		}
+
+		int timeout = run_timers();
+#ifdef VZ_CURL_HAVE_MULTI_POLL
+		curl_multi_poll(_multi, NULL, 0, timeout, NULL);
+#else
+		curl_multi_wait(_multi, NULL, 0,
+						timeout < POLL_TIMEOUT_NOWAKEUP_MS ? timeout : POLL_TIMEOUT_NOWAKEUP_MS,
+						NULL);
+#endif
+	}
+}
+
+// global var:
+CurlMultiSender *curlMultiSender = 0;
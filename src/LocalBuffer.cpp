@@ -0,0 +1,155 @@
+/**
+ * LocalBuffer - time ordered store of the tuples of one channel for the local interface
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include <algorithm>
+
+#include "LocalBuffer.hpp"
+
+void LocalBuffer::push(int64_t time_ms, double value) {
+	if (empty() || time_ms >= back_time()) {
+		if (_chunks.empty() || _chunks.back().t.size() >= CHUNK) {
+			_chunks.push_back(Chunk());
+			Chunk &c = _chunks.back();
+			c.t.reserve(CHUNK);
+			c.v.reserve(CHUNK);
+			c.begin = 0;
+		}
+		_chunks.back().t.push_back(time_ms);
+		_chunks.back().v.push_back(value);
+	} else {
+		// e.g. the clock was set back. Rare, so the chunk may grow beyond CHUNK here.
+		Pos p = upper_bound(time_ms);
+		Chunk &c = _chunks[p.chunk];
+		c.t.insert(c.t.begin() + p.idx, time_ms);
+		c.v.insert(c.v.begin() + p.idx, value);
+	}
+	_size++;
+}
+
+void LocalBuffer::erase_before(int64_t time_ms) {
+	while (!_chunks.empty() && _chunks.front().t.back() < time_ms) {
+		_size -= _chunks.front().t.size() - _chunks.front().begin;
+		_chunks.pop_front();
+	}
+	if (_chunks.empty())
+		return;
+
+	Chunk &c = _chunks.front();
+	size_t idx = std::lower_bound(c.t.begin() + c.begin, c.t.end(), time_ms) - c.t.begin();
+	_size -= idx - c.begin;
+	c.begin = idx;
+}
+
+void LocalBuffer::keep_last(size_t n) {
+	while (_size > n) {
+		Chunk &c = _chunks.front();
+		size_t avail = c.t.size() - c.begin;
+		if (_size - avail >= n) {
+			_size -= avail;
+			_chunks.pop_front();
+		} else {
+			c.begin += _size - n;
+			_size = n;
+		}
+	}
+}
+
+void LocalBuffer::clear() {
+	_chunks.clear();
+	_size = 0;
+}
+
+int64_t LocalBuffer::front_time() const {
+	const Chunk &c = _chunks.front();
+	return c.t[c.begin];
+}
+
+int64_t LocalBuffer::back_time() const { return _chunks.back().t.back(); }
+
+size_t LocalBuffer::range(int64_t from, int64_t to, int64_t *first, int64_t *last) const {
+	if (from > to)
+		return 0;
+	Pos a = lower_bound(from);
+	Pos b = upper_bound(to); // one behind the last
+	if (a.chunk == b.chunk && a.idx == b.idx)
+		return 0;
+
+	size_t n = 0;
+	if (a.chunk == b.chunk) {
+		n = b.idx - a.idx;
+	} else {
+		n = _chunks[a.chunk].t.size() - a.idx;
+		for (size_t i = a.chunk + 1; i < b.chunk; i++)
+			n += _chunks[i].t.size() - _chunks[i].begin;
+		if (b.chunk < _chunks.size())
+			n += b.idx - _chunks[b.chunk].begin;
+	}
+
+	if (first)
+		*first = _chunks[a.chunk].t[a.idx];
+	if (last) {
+		if (b.chunk < _chunks.size() && b.idx > _chunks[b.chunk].begin)
+			*last = _chunks[b.chunk].t[b.idx - 1];
+		else
+			*last = _chunks[b.chunk - 1].t.back(); // b is the start of chunk b.chunk
+	}
+	return n;
+}
+
+LocalBuffer::Pos LocalBuffer::lower_bound(int64_t time_ms) const {
+	// first chunk with a tuple >= time_ms:
+	size_t ci = std::partition_point(_chunks.begin(), _chunks.end(),
+									 [time_ms](const Chunk &c) { return c.t.back() < time_ms; }) -
+				_chunks.begin();
+	if (ci == _chunks.size())
+		return Pos{ci, 0};
+	const Chunk &c = _chunks[ci];
+	return Pos{ci,
+			   (size_t)(std::lower_bound(c.t.begin() + c.begin, c.t.end(), time_ms) - c.t.begin())};
+}
+
+LocalBuffer::Pos LocalBuffer::upper_bound(int64_t time_ms) const {
+	size_t ci = std::partition_point(_chunks.begin(), _chunks.end(),
+									 [time_ms](const Chunk &c) { return c.t.back() <= time_ms; }) -
+				_chunks.begin();
+	if (ci == _chunks.size())
+		return Pos{ci, 0};
+	const Chunk &c = _chunks[ci];
+	return Pos{ci,
+			   (size_t)(std::upper_bound(c.t.begin() + c.begin, c.t.end(), time_ms) - c.t.begin())};
+}
+
+bool LocalBuffer::Downsampler::add(int64_t t, double v, Group &done) {
+	int64_t start = t - _origin;
+	start = _origin + (start >= 0 ? start : start - _group_ms + 1) / _group_ms * _group_ms;
+
+	bool completed = false;
+	if (_g.count && start != _g.time_ms)
+		completed = finish(done);
+	if (!_g.count) {
+		_g.time_ms = start;
+		_g.min = _g.max = v;
+		_sum = 0;
+	} else if (v < _g.min) {
+		_g.min = v;
+	} else if (v > _g.max) {
+		_g.max = v;
+	}
+	_sum += v;
+	_g.count++;
+	return completed;
+}
+
+bool LocalBuffer::Downsampler::finish(Group &done) {
+	if (!_g.count)
+		return false;
+	done = _g;
+	done.avg = _sum / _g.count;
+	_g.count = 0;
+	return true;
+}
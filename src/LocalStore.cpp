@@ -0,0 +1,524 @@
+/**
+ * LocalStore - persistent, append-only history of one channel for the local interface
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "LocalStore.hpp"
+#include "Spool.hpp"
+#include <VZException.hpp>
+
+namespace {
+
+// chunk header on disk, native byte order as the store never leaves the device
+struct ChunkHeader {
+	uint32_t magic;
+	uint32_t count;
+	int64_t first;
+	int64_t last;
+	uint32_t length; // of the compressed data following
+	uint32_t crc;    // over the header up to here and the data
+};
+
+const uint32_t MAGIC = 0x53545a56; // "VZTS"
+
+uint32_t chunk_crc(const ChunkHeader &h, const uint8_t *data) {
+	std::vector<uint8_t> buf(offsetof(ChunkHeader, crc) + h.length);
+	memcpy(&buf[0], &h, offsetof(ChunkHeader, crc));
+	if (h.length)
+		memcpy(&buf[offsetof(ChunkHeader, crc)], data, h.length);
+	return Spool::crc32(&buf[0], buf.size());
+}
+
+class BitWriter {
+  public:
+	BitWriter(std::vector<uint8_t> &out) : _out(out), _bit(0) {}
+
+	void put(uint64_t v, int n) { // the n lowest bits of v, msb first
+		while (n > 0) {
+			if (!_bit)
+				_out.push_back(0);
+			int room = 8 - _bit;
+			int take = n < room ? n : room;
+			uint8_t part = (v >> (n - take)) & ((1u << take) - 1);
+			_out.back() |= part << (room - take);
+			_bit = (_bit + take) & 7;
+			n -= take;
+		}
+	}
+
+  private:
+	std::vector<uint8_t> &_out;
+	int _bit; // used bits of _out.back()
+};
+
+class BitReader {
+  public:
+	BitReader(const uint8_t *data, size_t len) : _data(data), _len(len), _pos(0), _error(false) {}
+
+	uint64_t get(int n) {
+		uint64_t v = 0;
+		while (n > 0) {
+			if (_pos >= _len * 8) {
+				_error = true;
+				return 0;
+			}
+			int bit = _pos & 7;
+			int room = 8 - bit;
+			int take = n < room ? n : room;
+			uint8_t part = (_data[_pos >> 3] >> (room - take)) & ((1u << take) - 1);
+			v = (v << take) | part;
+			_pos += take;
+			n -= take;
+		}
+		return v;
+	}
+	bool error() const { return _error; }
+
+  private:
+	const uint8_t *_data;
+	size_t _len;
+	size_t _pos; // in bits
+	bool _error;
+};
+
+uint64_t bits(double v) {
+	uint64_t b;
+	memcpy(&b, &v, sizeof(b));
+	return b;
+}
+
+double from_bits(uint64_t b) {
+	double v;
+	memcpy(&v, &b, sizeof(v));
+	return v;
+}
+
+// delta-of-delta buckets: prefix, prefix length, value bits
+struct Bucket {
+	uint64_t prefix;
+	int prefix_bits;
+	int bits;
+};
+const Bucket BUCKETS[] = {{0x2, 2, 14}, {0x6, 3, 17}, {0xe, 4, 20}, {0xf, 4, 64}};
+
+} // namespace
+
+LocalStore::LocalStore(const std::string &dir, int64_t retention_ms)
+	: _dir(dir), _retention_ms(retention_ms), _fd(-1), _size(0) {
+	// segments of a quarter of the retention time, between one hour and one day
+	_segment_ms = std::min(std::max(retention_ms / 4, (int64_t)3600000), (int64_t)86400000);
+
+	size_t slash = _dir.rfind('/');
+	if (slash != std::string::npos && slash > 0)
+		mkdir(_dir.substr(0, slash).c_str(), 0755); // the store dir itself, may exist
+	if (mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST)
+		throw vz::VZException("LocalStore: cannot create directory " + _dir + ": " +
+							  strerror(errno));
+
+	_open_t.reserve(CHUNK);
+	_open_v.reserve(CHUNK);
+	recover();
+	print(log_info, "LocalStore %s: %zu tuples in %zu segments (%zu bytes)", "local",
+		  _dir.c_str(), size(), _segments.size(), bytes());
+}
+
+LocalStore::~LocalStore() {
+	flush();
+	if (_fd >= 0)
+		close(_fd);
+	for (size_t i = 0; i < _segments.size(); i++)
+		unmap(_segments[i]);
+}
+
+std::string LocalStore::path(uint64_t seq) const {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.tsdb", (unsigned long long)seq);
+	return _dir + name;
+}
+
+void LocalStore::recover() {
+	std::vector<uint64_t> seqs;
+	DIR *d = opendir(_dir.c_str());
+	if (!d)
+		throw vz::VZException("LocalStore: cannot read directory " + _dir + ": " +
+							  strerror(errno));
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		unsigned long long seq;
+		char ext[8];
+		if (sscanf(de->d_name, "%16llx.%7s", &seq, ext) == 2 && strcmp(ext, "tsdb") == 0)
+			seqs.push_back(seq);
+	}
+	closedir(d);
+	std::sort(seqs.begin(), seqs.end());
+
+	for (size_t i = 0; i < seqs.size(); i++) {
+		Segment seg;
+		seg.seq = seqs[i];
+		seg.size = 0;
+		seg.map = NULL;
+		seg.mapped = 0;
+		scan(seg, i + 1 == seqs.size());
+		if (seg.chunks.empty()) {
+			unmap(seg);
+			unlink(path(seg.seq).c_str());
+			continue;
+		}
+		for (size_t c = 0; c < seg.chunks.size(); c++)
+			_size += seg.chunks[c].count;
+		_segments.push_back(seg);
+	}
+}
+
+void LocalStore::scan(Segment &seg, bool last) {
+	struct stat st;
+	if (stat(path(seg.seq).c_str(), &st) != 0)
+		return;
+	seg.size = st.st_size;
+	const uint8_t *data = map(seg);
+
+	size_t pos = 0;
+	int64_t prev = INT64_MIN;
+	while (data && pos + sizeof(ChunkHeader) <= seg.size) {
+		ChunkHeader h;
+		memcpy(&h, data + pos, sizeof(h));
+		if (h.magic != MAGIC || !h.count || h.first > h.last || h.first < prev ||
+			pos + sizeof(h) + h.length > seg.size ||
+			h.crc != chunk_crc(h, data + pos + sizeof(h)))
+			break;
+		ChunkRef c = {h.first, h.last, h.count, pos, h.length};
+		seg.chunks.push_back(c);
+		prev = h.last;
+		pos += sizeof(h) + h.length;
+	}
+
+	if (pos < seg.size) {
+		print(log_warning, "LocalStore %s: cutting off %zu invalid bytes of %s", "local",
+			  _dir.c_str(), seg.size - pos, path(seg.seq).c_str());
+		if (!last) {
+			// the following segments are newer, keep what is valid before
+		} else if (truncate(path(seg.seq).c_str(), pos) != 0) {
+			print(log_warning, "LocalStore %s: cannot truncate: %s", "local", _dir.c_str(),
+				  strerror(errno));
+		}
+		seg.size = pos;
+	}
+}
+
+const uint8_t *LocalStore::map(const Segment &seg) const {
+	if (seg.map && seg.mapped >= seg.size)
+		return seg.map;
+	unmap(seg);
+	if (!seg.size)
+		return NULL;
+
+	int fd = open(path(seg.seq).c_str(), O_RDONLY);
+	if (fd < 0) {
+		print(log_warning, "LocalStore %s: cannot open %s: %s", "local", _dir.c_str(),
+			  path(seg.seq).c_str(), strerror(errno));
+		return NULL;
+	}
+	void *p = mmap(NULL, seg.size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		print(log_warning, "LocalStore %s: cannot map %s: %s", "local", _dir.c_str(),
+			  path(seg.seq).c_str(), strerror(errno));
+		return NULL;
+	}
+	seg.map = static_cast<const uint8_t *>(p);
+	seg.mapped = seg.size;
+	return seg.map;
+}
+
+void LocalStore::unmap(const Segment &seg) const {
+	if (seg.map)
+		munmap(const_cast<uint8_t *>(seg.map), seg.mapped);
+	seg.map = NULL;
+	seg.mapped = 0;
+}
+
+bool LocalStore::push(int64_t time_ms, double value) {
+	if (!empty() && time_ms < back_time())
+		return false;
+	if (!_open_t.empty() && (_open_t.size() >= CHUNK || time_ms - _open_t[0] >= CHUNK_MS))
+		flush();
+	_open_t.push_back(time_ms);
+	_open_v.push_back(value);
+	_size++;
+	return true;
+}
+
+void LocalStore::flush() {
+	if (_open_t.empty())
+		return;
+
+	std::vector<uint8_t> buf(sizeof(ChunkHeader));
+	encode(&_open_t[0], &_open_v[0], _open_t.size(), buf);
+	ChunkHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = MAGIC;
+	h.count = _open_t.size();
+	h.first = _open_t.front();
+	h.last = _open_t.back();
+	h.length = buf.size() - sizeof(h);
+	h.crc = chunk_crc(h, &buf[sizeof(h)]);
+	memcpy(&buf[0], &h, sizeof(h));
+
+	// one segment per _segment_ms, continue the last one after a restart:
+	if (_segments.empty() || _segments.back().chunks.empty() ||
+		h.first - _segments.back().chunks.front().first >= _segment_ms) {
+		if (_fd >= 0) {
+			close(_fd);
+			_fd = -1;
+		}
+		Segment seg;
+		seg.seq = _segments.empty() ? 0 : _segments.back().seq + 1;
+		seg.size = 0;
+		seg.map = NULL;
+		seg.mapped = 0;
+		_segments.push_back(seg);
+	}
+	Segment &seg = _segments.back();
+	if (_fd < 0)
+		_fd = open(path(seg.seq).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	ssize_t n = _fd < 0 ? -1 : write(_fd, &buf[0], buf.size());
+	if (n != (ssize_t)buf.size()) {
+		print(log_error, "LocalStore %s: writing %s failed: %s", "local", _dir.c_str(),
+			  path(seg.seq).c_str(), n < 0 ? strerror(errno) : "short write");
+		// cut a partial chunk, it would hide all following ones
+		if (n > 0 && ftruncate(_fd, seg.size) != 0)
+			print(log_warning, "LocalStore %s: cannot truncate: %s", "local", _dir.c_str(),
+				  strerror(errno));
+		if (seg.chunks.empty()) { // segments always have chunks
+			if (_fd >= 0)
+				close(_fd);
+			_fd = -1;
+			unlink(path(seg.seq).c_str());
+			_segments.pop_back();
+		}
+		if (_open_t.size() >= CHUNK) { // don't grow without bounds
+			_size -= _open_t.size();
+			_open_t.clear();
+			_open_v.clear();
+		}
+		// else the open chunk is kept and retried with the next tuple
+		return;
+	}
+
+	ChunkRef c = {h.first, h.last, h.count, seg.size, h.length};
+	seg.chunks.push_back(c);
+	seg.size += buf.size();
+	_open_t.clear();
+	_open_v.clear();
+}
+
+void LocalStore::expire(int64_t now_ms) {
+	int64_t min_t = now_ms - _retention_ms;
+	// the segment written to stays, the next chunk starts a new one once it's old enough
+	while (_segments.size() > 1 && _segments.front().chunks.back().last < min_t) {
+		Segment &seg = _segments.front();
+		for (size_t c = 0; c < seg.chunks.size(); c++)
+			_size -= seg.chunks[c].count;
+		unmap(seg);
+		if (unlink(path(seg.seq).c_str()) != 0)
+			print(log_warning, "LocalStore %s: cannot delete %s: %s", "local", _dir.c_str(),
+				  path(seg.seq).c_str(), strerror(errno));
+		_segments.pop_front();
+	}
+}
+
+size_t LocalStore::bytes() const {
+	size_t n = 0;
+	for (size_t i = 0; i < _segments.size(); i++)
+		n += _segments[i].size;
+	return n;
+}
+
+int64_t LocalStore::front_time() const {
+	return _segments.empty() ? _open_t.front() : _segments.front().chunks.front().first;
+}
+
+int64_t LocalStore::back_time() const {
+	return _open_t.empty() ? _segments.back().chunks.back().last : _open_t.back();
+}
+
+size_t LocalStore::range(int64_t from, int64_t to, int64_t *first, int64_t *last) const {
+	size_t n = 0;
+	std::vector<int64_t> t;
+	std::vector<double> v;
+	auto count = [&](int64_t time) {
+		if (!n && first)
+			*first = time;
+		if (last)
+			*last = time;
+		n++;
+	};
+
+	for (size_t s = first_segment(from); s < _segments.size(); s++) {
+		const Segment &seg = _segments[s];
+		for (size_t c = first_chunk(seg, from); c < seg.chunks.size(); c++) {
+			const ChunkRef &ref = seg.chunks[c];
+			if (ref.first > to)
+				return n;
+			if (ref.first >= from && ref.last <= to) {
+				// completely in the range, no need to decode
+				if (!n && first)
+					*first = ref.first;
+				if (last)
+					*last = ref.last;
+				n += ref.count;
+			} else if (decode(seg, ref, t, v)) {
+				for (size_t i = 0; i < t.size(); i++)
+					if (t[i] >= from && t[i] <= to)
+						count(t[i]);
+			}
+		}
+	}
+	for (size_t i = 0; i < _open_t.size(); i++)
+		if (_open_t[i] >= from && _open_t[i] <= to)
+			count(_open_t[i]);
+	return n;
+}
+
+size_t LocalStore::first_segment(int64_t from) const {
+	return std::partition_point(
+			   _segments.begin(), _segments.end(),
+			   [from](const Segment &seg) { return seg.chunks.back().last < from; }) -
+		   _segments.begin();
+}
+
+size_t LocalStore::first_chunk(const Segment &seg, int64_t from) const {
+	return std::partition_point(seg.chunks.begin(), seg.chunks.end(),
+								[from](const ChunkRef &c) { return c.last < from; }) -
+		   seg.chunks.begin();
+}
+
+bool LocalStore::decode(const Segment &seg, const ChunkRef &c, std::vector<int64_t> &t,
+						std::vector<double> &v) const {
+	const uint8_t *data = map(seg);
+	if (!data)
+		return false;
+	if (!decode(data + c.offset + sizeof(ChunkHeader), c.length, c.first, c.count, t, v)) {
+		print(log_warning, "LocalStore %s: corrupt chunk at %zu of %s", "local", _dir.c_str(),
+			  c.offset, path(seg.seq).c_str());
+		return false;
+	}
+	return true;
+}
+
+void LocalStore::encode(const int64_t *t, const double *v, size_t n, std::vector<uint8_t> &out) {
+	if (!n)
+		return;
+	BitWriter w(out);
+	uint64_t prev = bits(v[0]);
+	w.put(prev, 64);
+	int64_t prev_delta = 0;
+	int lead = -1; // of the current xor window, -1: none yet
+	int trail = 0;
+
+	for (size_t i = 1; i < n; i++) {
+		// timestamp: delta of the delta to the previous one
+		int64_t delta = t[i] - t[i - 1];
+		int64_t dod = delta - prev_delta;
+		prev_delta = delta;
+		if (!dod) {
+			w.put(0, 1);
+		} else {
+			for (const Bucket &b : BUCKETS) {
+				if (b.bits == 64 ||
+					(dod >= -(INT64_C(1) << (b.bits - 1)) && dod < (INT64_C(1) << (b.bits - 1)))) {
+					w.put(b.prefix, b.prefix_bits);
+					w.put((uint64_t)dod, b.bits);
+					break;
+				}
+			}
+		}
+
+		// value: xor to the previous one, only the meaningful bits
+		uint64_t cur = bits(v[i]);
+		uint64_t x = cur ^ prev;
+		prev = cur;
+		if (!x) {
+			w.put(0, 1);
+			continue;
+		}
+		int l = __builtin_clzll(x);
+		int tr = __builtin_ctzll(x);
+		if (l > 31)
+			l = 31; // 5 bits
+		if (lead >= 0 && l >= lead && tr >= trail) {
+			w.put(0x2, 2); // fits into the previous window
+			w.put(x >> trail, 64 - lead - trail);
+		} else {
+			int meaningful = 64 - l - tr;
+			w.put(0x3, 2);
+			w.put(l, 5);
+			w.put(meaningful & 63, 6); // 64 as 0
+			w.put(x >> tr, meaningful);
+			lead = l;
+			trail = tr;
+		}
+	}
+}
+
+bool LocalStore::decode(const uint8_t *data, size_t len, int64_t first, size_t n,
+						std::vector<int64_t> &t, std::vector<double> &v) {
+	t.clear();
+	v.clear();
+	if (!n)
+		return true;
+	t.reserve(n);
+	v.reserve(n);
+
+	BitReader r(data, len);
+	uint64_t prev = r.get(64);
+	t.push_back(first);
+	v.push_back(from_bits(prev));
+	int64_t delta = 0;
+	int lead = 0;
+	int trail = 0;
+
+	for (size_t i = 1; i < n && !r.error(); i++) {
+		if (r.get(1)) {
+			int b = 0; // prefix 10, 110, 1110 or 1111
+			while (b < 3 && r.get(1))
+				b++;
+			uint64_t u = r.get(BUCKETS[b].bits);
+			int64_t dod = (int64_t)u;
+			if (BUCKETS[b].bits < 64 && u >= (UINT64_C(1) << (BUCKETS[b].bits - 1)))
+				dod -= INT64_C(1) << BUCKETS[b].bits; // sign
+			delta += dod;
+		}
+		t.push_back(t.back() + delta);
+
+		if (r.get(1)) {
+			if (r.get(1)) {
+				lead = r.get(5);
+				int meaningful = r.get(6);
+				if (!meaningful)
+					meaningful = 64;
+				trail = 64 - lead - meaningful;
+				if (trail < 0)
+					return false;
+			}
+			prev ^= r.get(64 - lead - trail) << trail;
+		}
+		v.push_back(from_bits(prev));
+	}
+	return !r.error() && t.size() == n;
+}
@@ -33,7 +33,9 @@
  * You should have received a copy of the GNU General Public License
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
+#include <fcntl.h>
 #include <math.h>
+#include <sys/time.h>
 
 #ifdef LOCAL_SUPPORT
 # include "local.h"
@@ -42,6 +44,9 @@
 #include <Config_Options.hpp>
 #include <ApiIF.hpp>
 #include <MeterMap.hpp>
+#ifdef VZ_USE_THREADS
+# include <Reactor.hpp>
+#endif // VZ_USE_THREADS
 
 extern Config_Options options; /* global application options */
 
@@ -49,6 +54,25 @@ extern Config_Options options; /* global application options */
 	If the meter is enabled, start the meter and all its channels.
 */
 void MeterMap::start() {
+  accTimeRead = 0;
+  accTimeSend = 0;
+  accTimeDispatch = 0;
+  numUsed = 0;
+
+  // before any readings arrive from the reading thread or the reactor:
+  build_index();
+
+#ifndef VZ_PICO
+  std::string protocol = Metrics::label("protocol", meter_get_details(_meter->protocolId())->name);
+  _read_time = metrics.durations("vzlogger_meter_read_duration_seconds",
+                                 "Time spent in one read of a meter", protocol);
+  _dispatch_time = metrics.durations("vzlogger_dispatch_duration_seconds",
+                                     "Time to hand the readings of one read to the channels",
+                                     protocol);
+  _aggregate_time = metrics.durations("vzlogger_aggregate_duration_seconds",
+                                      "Time to aggregate the buffer of one channel", protocol);
+#endif // VZ_PICO
+
 	if (_meter->isEnabled()) {
 		try {
 			_meter->open();
@@ -63,15 +87,19 @@ void MeterMap::start() {
 
 		print(log_info, "Meter connection established", _meter->name());
 #ifdef VZ_USE_THREADS
-		pthread_create(&_thread, NULL, &reading_thread, (void *)this);
-		print(log_debug, "Meter thread started", _meter->name());
+		if (reactor && _meter->protocol()->pollable()) {
+			start_reactor();
+		} else {
+			pthread_create(&_thread, NULL, &reading_thread, (void *)this);
+			print(log_debug, "Meter thread started", _meter->name());
+			_thread_running = true;
+		}
 
 		print(log_debug, "Meter is opened. Starting channels.", _meter->name());
 		for (iterator it = _channels.begin(); it != _channels.end(); it++) {
 			(*it)->start(*it);
 			print(log_debug, "Logging thread started", (*it)->name());
 		}
-		_thread_running = true;
 #else // VZ_USE_THREADS
   nextDue = time(NULL) + _meter->interval();
 #endif // VZ_USE_THREADS
@@ -79,9 +107,22 @@ void MeterMap::start() {
 		print(log_info, "Meter for protocol '%s' is disabled. Skipping.", _meter->name(),
 			  _meter->protocol()->name().c_str());
 	}
-  accTimeRead = 0;
-  accTimeSend = 0;
-  numUsed = 0;
+}
+
+void MeterMap::build_index()
+{
+  _index.clear();
+  for (iterator ch = _channels.begin(); ch != _channels.end(); ch++)
+  {
+    ReadingIdentifier::Id id = ReadingIdentifier::intern((*ch)->identifier());
+    if (id == 0)
+    {
+      continue;
+    }
+    _index.insert(std::make_pair(id, *ch));
+  }
+  _indexed = _channels.size();
+  print(log_debug, "Indexed %d channels by identifier", _meter->name(), _index.size());
 }
 
 void MeterMap::cancel() { // is called from MapContainer::quit which is called from sigint handler
@@ -98,10 +139,14 @@ void MeterMap::cancel() { // is called from MapContainer::quit which is called f
 			(*it)->cancel(); // stops the logging_thread via pthread_cancel
 			(*it)->join();
 		}
-		print(log_finest, "MeterMap::cancel wait for readingthread", _meter->name());
-		pthread_cancel(_thread); // readingthread
-		pthread_join(_thread, NULL);
-		_thread_running = false;
+		if (_in_reactor) {
+			stop_reactor();
+		} else {
+			print(log_finest, "MeterMap::cancel wait for readingthread", _meter->name());
+			pthread_cancel(_thread); // readingthread
+			pthread_join(_thread, NULL);
+			_thread_running = false;
+		}
 #endif // VZ_USE_THREADS
 		print(log_finest, "MeterMap::cancel wait for meter::close", _meter->name());
 		_meter->close();
@@ -146,8 +191,8 @@ void MeterMap::read()
 
   std::vector<Reading> rds(details->max_readings, Reading(mtr->identifier()));
 
-  print(log_debug, "Max number of readings: %d", mtr->name(), details->max_readings);
-  print(log_debug, "Config.local: %d", mtr->name(), options.local());
+  VZ_PRINT(log_debug, "Max number of readings: %d", mtr->name(), details->max_readings);
+  VZ_PRINT(log_debug, "Config.local: %d", mtr->name(), options.local());
 
   aggIntEnd = time(NULL);
 
@@ -169,104 +214,302 @@ void MeterMap::read()
     first_reading = false;
 #endif // VZ_USE_THREADS
 
-    print(log_debug, "Querying meter ...", mtr->name());
+    VZ_PRINT(log_debug, "Querying meter ...", mtr->name());
 
     /* aggregate loop */
     /* fetch readings from meter and calculate delta */
-    n = mtr->read(rds, details->max_readings);
+    {
+#ifndef VZ_PICO
+      MetricsTimer timer(_read_time);
+#endif // VZ_PICO
+      n = mtr->read(rds, details->max_readings);
+    }
+
+    VZ_PRINT(log_debug, "Got %i new readings from meter:", mtr->name(), n);
+
+    dispatch(rds, n);
+  } while ((mtr->aggtime() > 0) && (time(NULL) < aggIntEnd)); /* default aggtime is -1 */
+
+  VZ_PRINT(log_debug, "Reading data complete. Publishing ...", mtr->name());
+
+#ifndef VZ_PICO
+  // Sending from here not on RPi Pico - will be called from main loop
+  this->sendData();
+#endif // VZ_PICO
+
+  accTimeRead += (time(NULL) - tStart);
+  numUsed++;
+}
+
+/**
+	Log and sanity check the readings of one telegram and add them to the channels.
+*/
+void MeterMap::dispatch(std::vector<Reading> &rds, size_t n)
+{
+  Meter::Ptr mtr = this->meter();
 
-    print(log_debug, "Got %i new readings from meter:", mtr->name(), n);
+  /* dumping meter output */
+  if (VZ_LOG_MAX_LEVEL > log_debug && options.verbosity() > log_debug)
+  {
+    char identifier[MAX_IDENTIFIER_LEN];
+    for (size_t i = 0; i < n; i++)
+    {
+      rds[i].unparse(/*mtr->protocolId(),*/ identifier, MAX_IDENTIFIER_LEN);
+      VZ_PRINT(log_debug, "Reading: id=%s/%s value=%.2f ts=%lld", mtr->name(),
+               identifier, rds[i].identifier()->toString().c_str(), rds[i].value(),
+               rds[i].time_ms());
+    }
+  }
 
-    /* dumping meter output */
-    if (options.verbosity() > log_debug)
+  if (n > 0 && !options.haveTimeMachine())
+  {
+    for (size_t i = 0; i < n; i++)
     {
-      char identifier[MAX_IDENTIFIER_LEN];
-      for (size_t i = 0; i < n; i++)
+      if (rds[i].time_s() < 631152000)
       {
-        rds[i].unparse(/*mtr->protocolId(),*/ identifier, MAX_IDENTIFIER_LEN);
-        print(log_debug, "Reading: id=%s/%s value=%.2f ts=%lld", mtr->name(),
-              identifier, rds[i].identifier()->toString().c_str(), rds[i].value(),
-              rds[i].time_ms());
+        // 1990-01-01 00:00:00
+        print(log_error, "meter returned readings with a timestamp before 1990, IGNORING.", mtr->name());
+        print(log_error, "most likely your meter is misconfigured,", mtr->name());
+        print(log_error, "for sml meters, set `\"use_local_time\": true` in vzlogger.conf"
+              " (meter section),", mtr->name());
+        print(log_error, "to override this check, set `\"i_have_a_time_machine\": true`"
+              " in vzlogger.conf.", mtr->name());
+        // note: we do NOT throw an exception or such,
+        // because this might be a spurious error,
+        // the next reading might be valid again.
+        n = 0;
       }
     }
+  }
 
-    if (n > 0 && !options.haveTimeMachine())
+  /* insert readings into channel queues */
+  if (n > 0)
+  {
+    struct timeval tv_start, tv_end;
+    gettimeofday(&tv_start, NULL);
+
+    if (_indexed != _channels.size())
     {
-      for (size_t i = 0; i < n; i++)
-      {
-        if (rds[i].time_s() < 631152000)
-        {
-          // 1990-01-01 00:00:00
-          print(log_error, "meter returned readings with a timestamp before 1990, IGNORING.", mtr->name());
-          print(log_error, "most likely your meter is misconfigured,", mtr->name());
-          print(log_error, "for sml meters, set `\"use_local_time\": true` in vzlogger.conf"
-                " (meter section),", mtr->name());
-          print(log_error, "to override this check, set `\"i_have_a_time_machine\": true`"
-                " in vzlogger.conf.", mtr->name());
-          // note: we do NOT throw an exception or such,
-          // because this might be a spurious error,
-          // the next reading might be valid again.
-          n = 0;
-        }
-      }
+      build_index(); // channels added after start()
     }
 
-    /* insert readings into channel queues */
-    if (n > 0)
+    for (size_t i = 0; i < n; i++)
     {
-      for (MeterMap::iterator ch = this->begin(); ch != this->end(); ch++)
+      // two channels can have the same identifier:
+      typedef std::unordered_multimap<ReadingIdentifier::Id, Channel::Ptr>::iterator
+          index_iterator;
+      std::pair<index_iterator, index_iterator> range =
+          _index.equal_range(rds[i].identifier_id());
+      for (index_iterator it = range.first; it != range.second; it++)
       {
-        print(log_debug, "Check channel %s, n=%d", mtr->name(), (*ch)->name(), n);
+        const Channel::Ptr &ch = it->second;
 
-        for (size_t i = 0; i < n; i++)
+        if (ch->time_ms() < rds[i].time_ms())
         {
-          // printf("TGE Rd ID %s\n", (*rds[i].identifier().get()).toString().c_str());
-          // printf("TGE Ch ID %s\n", (*(*ch)->identifier().get()).toString().c_str());
-          if (*rds[i].identifier().get() == *(*ch)->identifier().get())
-          {
-            // print(log_debug, "found channel", mtr->name());
-            if ((*ch)->time_ms() < rds[i].time_ms())
-            {
-              (*ch)->last(rds[i]);
-            }
+          ch->last(rds[i]);
+        }
 
-            print(log_info, "Adding reading to queue (value=%.2f ts=%lld)",
-                  (*ch)->name(), rds[i].value(), rds[i].time_ms());
-            (*ch)->push(rds[i]);
+        VZ_PRINT(log_info, "Adding reading to queue (value=%.2f ts=%lld)",
+                 ch->name(), rds[i].value(), rds[i].time_ms());
+        ch->push(rds[i]);
 
 #ifndef VZ_PICO
-            // provide data to push data server:
-            if (pushDataList)
-            {
-              const std::string uuid = (*ch)->uuid();
-              pushDataList->add(uuid, rds[i].time_ms(), rds[i].value());
-              print(log_finest, "added to uuid %s", "push", uuid.c_str());
-            }
+        // provide data to push data server:
+        if (pushDataList)
+        {
+          if (ch->push_slot() < 0)
+            ch->push_slot(pushDataList->slot(ch->uuid()));
+          pushDataList->add(ch->push_slot(), rds[i].time_ms(), rds[i].value());
+          VZ_PRINT(log_finest, "added to uuid %s", "push", ch->uuid());
+        }
 #endif // VZ_PICO
 #ifdef ENABLE_MQTT
-            // update mqtt values as well:
-            if (mqttClient)
-            {
-              mqttClient->publish((*ch), rds[i]);
-            }
-#endif
-          }
+        // update mqtt values as well:
+        if (mqttClient)
+        {
+          mqttClient->publish(ch, rds[i]);
         }
-      } // channel loop
-    }
-  } while ((mtr->aggtime() > 0) && (time(NULL) < aggIntEnd)); /* default aggtime is -1 */
-
-  print(log_debug, "Reading data complete. Publishing ...", mtr->name());
+#endif
+      }
+    } // reading loop
 
+    gettimeofday(&tv_end, NULL);
+    int64_t usecs = (tv_end.tv_sec - tv_start.tv_sec) * 1000000LL +
+                    (tv_end.tv_usec - tv_start.tv_usec);
+    accTimeDispatch += usecs;
 #ifndef VZ_PICO
-  // Sending from here not on RPi Pico - will be called from main loop
-  this->sendData();
+    if (_dispatch_time)
+    {
+      _dispatch_time->observe(usecs);
+    }
 #endif // VZ_PICO
+  }
+}
 
+#ifdef VZ_USE_THREADS
+/**
+	Let the reactor read the meter: on each readable fd and/or every interval.
+*/
+void MeterMap::start_reactor()
+{
+  Meter::Ptr mtr = this->meter();
+  const meter_details_t * details = meter_get_details(mtr->protocolId());
+
+  _rds.assign(details->max_readings, Reading(mtr->identifier()));
+  _aggIntEnd = time(NULL) + mtr->aggtime();
+
+  // first request right away, then every interval:
+  mtr->protocol()->poll_request();
+  if (mtr->protocol()->fd() < 0)
+  {
+    poll(); // nothing registered yet, so we can read from this thread
+  }
+
+  _in_reactor = true;
+  if (mtr->interval() > 0)
+  {
+    reactor->every(mtr->interval() * 1000, &MeterMap::reactor_timer, this);
+    _reactor_timer = true;
+  }
+  update_fd();
+  schedule_poll();
+
+  VZ_PRINT(log_debug, "Meter is read by the reactor (fd=%d, interval=%d)", mtr->name(),
+           _reactor_fd, mtr->interval());
+}
+
+void MeterMap::stop_reactor()
+{
+  reactor->remove_timers(this);
+  _reactor_timer = false;
+  if (_reactor_fd >= 0)
+  {
+    reactor->remove(_reactor_fd);
+    _reactor_fd = -1;
+  }
+  _in_reactor = false;
+}
+
+/**
+	Keep the registration in line with the protocol's descriptor, it changes on reconnects.
+*/
+void MeterMap::update_fd()
+{
+  if (!_in_reactor)
+  {
+    return;
+  }
+  int fd = _meter->protocol()->fd();
+
+  if (fd != _reactor_fd && _reactor_fd >= 0)
+  {
+    reactor->remove(_reactor_fd);
+    _reactor_fd = -1;
+  }
+
+  if (fd >= 0)
+  {
+    // poll() must not block:
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && !(flags & O_NONBLOCK))
+    {
+      fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    // also if unchanged: a reopened connection might have got the same number again
+    reactor->add(fd, &MeterMap::reactor_readable, this);
+    _reactor_fd = fd;
+  }
+  else if (!_reactor_timer)
+  {
+    // nothing to wait for, read (or try to reopen) every second
+    reactor->every(1000, &MeterMap::reactor_timer, this);
+    _reactor_timer = true;
+  }
+}
+
+/**
+	Call poll() again when the protocol has a step waiting, e.g. the d0 reaction time.
+*/
+void MeterMap::schedule_poll()
+{
+  if (!_in_reactor)
+  {
+    return;
+  }
+  int ms = _meter->protocol()->poll_timeout();
+  if (ms >= 0)
+  {
+    reactor->after(ms, &MeterMap::reactor_deferred, this);
+  }
+}
+
+/**
+	Called from the reactor, one readout without blocking.
+*/
+void MeterMap::poll()
+{
+  Meter::Ptr mtr = this->meter();
+  time_t tStart = time(NULL);
+
+  ssize_t n;
+  {
+    MetricsTimer timer(_read_time);
+    n = mtr->protocol()->poll(_rds, _rds.size());
+  }
+  if (n < 0)
+  {
+    print(log_alert, "Reading failed, stopped reading this meter.", mtr->name());
+    stop_reactor();
+    return;
+  }
+
+  if (n > 0)
+  {
+    VZ_PRINT(log_debug, "Got %i new readings from meter:", mtr->name(), n);
+    dispatch(_rds, n);
+    numUsed++;
+
+    // send at the end of each aggregation period, or after each readout if aggtime is not used:
+    if (mtr->aggtime() <= 0 || time(NULL) >= _aggIntEnd)
+    {
+      do
+      {
+        _aggIntEnd += mtr->aggtime();
+      } while ((_aggIntEnd < time(NULL)) && (mtr->aggtime() > 0));
+      this->sendData();
+    }
+  }
+
+  update_fd();
+  schedule_poll();
   accTimeRead += (time(NULL) - tStart);
-  numUsed++;
 }
 
+void MeterMap::reactor_readable(int fd, void *arg)
+{
+  static_cast<MeterMap *>(arg)->poll();
+}
+
+void MeterMap::reactor_timer(void *arg)
+{
+  MeterMap *mapping = static_cast<MeterMap *>(arg);
+  mapping->meter()->protocol()->poll_request();
+  if (mapping->_reactor_fd < 0)
+  {
+    mapping->poll();
+  }
+  else
+  {
+    mapping->schedule_poll();
+  }
+}
+
+void MeterMap::reactor_deferred(void *arg)
+{
+  static_cast<MeterMap *>(arg)->poll();
+}
+#endif // VZ_USE_THREADS
+
 #ifndef VZ_USE_THREADS
 int MeterMap::isDueIn()
 {
@@ -275,11 +518,11 @@ int MeterMap::isDueIn()
   int due = (nextDue - time(NULL));
   if(due <= 0)
   {
-    print(log_debug, "Meter is due.", meter()->name());
+    VZ_PRINT(log_debug, "Meter is due.", meter()->name());
   }
   else
   {
-    print(log_finest, "Meter is not due - in %dsecs ....", meter()->name(), due);
+    VZ_PRINT(log_finest, "Meter is not due - in %dsecs ....", meter()->name(), due);
   }
   return due;
 }
@@ -288,17 +531,17 @@ bool MeterMap::readyToSend()
 {
   if(! _meter->isEnabled()) { return false; }
 
-  print(log_finest, "Checking for sendable meter data ...", meter()->name());
+  VZ_PRINT(log_finest, "Checking for sendable meter data ...", meter()->name());
   for (MeterMap::iterator ch = this->begin(); ch != this->end(); ch++)
   {
     uint numSamples = (*ch)->size();
     if(numSamples > 0)
     {
-      print(log_finest, "%d readings ready for sending.",(*ch)->name(), numSamples);
+      VZ_PRINT(log_finest, "%d readings ready for sending.",(*ch)->name(), numSamples);
       return true;
     }
   }
-  print(log_finest, "No waiting data, not sending ...", meter()->name());
+  VZ_PRINT(log_finest, "No waiting data, not sending ...", meter()->name());
   return false;
 }
 
@@ -310,11 +553,11 @@ bool MeterMap::isBusy()
   {
     if((*ch)->isBusy())
     {
-      print(log_debug, "Network I/O busy.", meter()->name());
+      VZ_PRINT(log_debug, "Network I/O busy.", meter()->name());
       return true;
     }
   }
-  print(log_finest, "Network not busy.", meter()->name());
+  VZ_PRINT(log_finest, "Network not busy.", meter()->name());
   return false;
 }
 
@@ -333,16 +576,24 @@ void MeterMap::sendData()
   if(! _meter->isEnabled()) { return; }
 
   time_t tStart = time(NULL);
-  print(log_debug, "Sending data ...", meter()->name());
+  VZ_PRINT(log_debug, "Sending data ...", meter()->name());
   for (MeterMap::iterator ch = this->begin(); ch != this->end(); ch++)
   {
     /* aggregate buffer values if aggmode != NONE */
-    (*ch)->buffer()->aggregate(meter()->aggtime(), meter()->aggFixedInterval());
+    {
+#ifndef VZ_PICO
+      MetricsTimer timer(_aggregate_time);
+#endif // VZ_PICO
+      (*ch)->buffer()->aggregate(meter()->aggtime(), meter()->aggFixedInterval());
+    }
     /* mark buffer "ready" */
     (*ch)->buffer()->have_newValues();
 
     /* shrink buffer */
     (*ch)->buffer()->clean();
+#ifndef VZ_PICO
+    (*ch)->depth()->set((*ch)->buffer()->size());
+#endif // VZ_PICO
 #ifdef LOCAL_SUPPORT
     if (options.local())
     {
@@ -363,7 +614,7 @@ void MeterMap::sendData()
         {
           // this seems dirty. see issue #427
           // the lock()/unlock() should avoid it.
-          Reading &r = *it;
+          Reading r(*it);
           if (!r.deleted())
           {
             mqttClient->publish((*ch), r, true);
@@ -377,8 +628,20 @@ void MeterMap::sendData()
 #ifdef VZ_USE_THREADS
     /* notify webserver and logging thread */
     (*ch)->notify();
+    /* channels without logging thread send from here, this doesn't block */
+    if ((*ch)->async() && !(*ch)->send_shared())
+    {
+      try
+      {
+        (*ch)->sendData(*ch);
+      }
+      catch (std::exception &e)
+      {
+        print(log_alert, "Sending failed due to: %s", (*ch)->name(), e.what());
+      }
+    }
 #else // not VZ_USE_THREADS
-    print(log_debug, "Sending %d readings to channel ...", (*ch)->name(), (*ch)->size());
+    VZ_PRINT(log_debug, "Sending %d readings to channel ...", (*ch)->name(), (*ch)->size());
     (*ch)->sendData(*ch);
 #endif // VZ_USE_THREADS
 
@@ -390,11 +653,13 @@ void MeterMap::sendData()
     }
   }
   accTimeSend += (time(NULL) - tStart);
-  print(log_debug, "All meter data sent.", meter()->name());
+  VZ_PRINT(log_debug, "All meter data sent.", meter()->name());
 }
 
 void MeterMap::printStatistics(log_level_t logLevel)
 {
-  print(logLevel, "Read %d times, spent %ds reading, %ds sending", meter()->name(), numUsed, accTimeRead, accTimeSend);
+  print(logLevel, "Read %d times, spent %ds reading, %ds sending, %lluus dispatching readings",
+        meter()->name(), numUsed, accTimeRead, accTimeSend,
+        (unsigned long long)accTimeDispatch);
 }
 
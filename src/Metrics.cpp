@@ -0,0 +1,195 @@
+/**
+ * Metrics - runtime instrumentation, exported in the Prometheus text format
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Metrics.hpp"
+
+// 100us .. 10s
+static const int64_t DURATION_BOUNDS[Metrics::Histogram::BUCKETS] = {
+	100,   250,    500,    1000,   2500,    5000,    10000,   25000,
+	50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+// 1 .. 32768
+static const int64_t SIZE_BOUNDS[Metrics::Histogram::BUCKETS] = {
+	1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768};
+
+Metrics metrics;
+
+static void append_sample(std::string &out, const std::string &name, const char *suffix,
+						  const std::string &labels, const char *extra_label, const char *value) {
+	out += name;
+	out += suffix;
+	if (!labels.empty() || extra_label) {
+		out += '{';
+		out += labels;
+		if (extra_label) {
+			if (!labels.empty())
+				out += ',';
+			out += extra_label;
+		}
+		out += '}';
+	}
+	out += ' ';
+	out += value;
+	out += '\n';
+}
+
+void Metrics::Counter::write(std::string &out, const std::string &name,
+							 const std::string &labels) const {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%" PRIu64, value());
+	append_sample(out, name, "", labels, NULL, buf);
+}
+
+void Metrics::Gauge::write(std::string &out, const std::string &name,
+						   const std::string &labels) const {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%" PRId64, value());
+	append_sample(out, name, "", labels, NULL, buf);
+}
+
+Metrics::Histogram::Histogram(const int64_t *bounds, double scale)
+	: _bounds(bounds), _scale(scale), _sum(0) {
+	for (int i = 0; i <= BUCKETS; i++)
+		_buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void Metrics::Histogram::observe(int64_t v) {
+	int i = 0;
+	while (i < BUCKETS && v > _bounds[i])
+		i++;
+	_buckets[i].fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(v, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::Histogram::count() const {
+	uint64_t n = 0;
+	for (int i = 0; i <= BUCKETS; i++)
+		n += _buckets[i].load(std::memory_order_relaxed);
+	return n;
+}
+
+void Metrics::Histogram::write(std::string &out, const std::string &name,
+							   const std::string &labels) const {
+	char le[32], buf[32];
+	uint64_t n = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		n += _buckets[i].load(std::memory_order_relaxed);
+		snprintf(le, sizeof(le), "le=\"%g\"", _bounds[i] * _scale);
+		snprintf(buf, sizeof(buf), "%" PRIu64, n);
+		append_sample(out, name, "_bucket", labels, le, buf);
+	}
+	n += _buckets[BUCKETS].load(std::memory_order_relaxed);
+	snprintf(buf, sizeof(buf), "%" PRIu64, n);
+	append_sample(out, name, "_bucket", labels, "le=\"+Inf\"", buf);
+	snprintf(buf, sizeof(buf), "%.9g", sum() * _scale);
+	append_sample(out, name, "_sum", labels, NULL, buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, n);
+	append_sample(out, name, "_count", labels, NULL, buf);
+}
+
+Metrics::Metrics() { pthread_mutex_init(&_mutex, NULL); }
+
+Metrics::~Metrics() { pthread_mutex_destroy(&_mutex); }
+
+Metrics::Metric *Metrics::get(const char *name, const char *help, const char *type,
+							  const std::string &labels) {
+	pthread_mutex_lock(&_mutex);
+	Family &f = _families[name];
+	if (f.series.empty()) {
+		f.help = help;
+		f.type = type;
+	}
+	Metric *m = NULL;
+	for (auto &s : f.series)
+		if (s.first == labels)
+			m = s.second.get();
+	if (!m) {
+		if (strcmp(f.type, "counter") == 0)
+			m = new Counter();
+		else if (strcmp(f.type, "gauge") == 0)
+			m = new Gauge();
+		else if (strcmp(f.type, "sizes") == 0)
+			m = new Histogram(SIZE_BOUNDS, 1);
+		else
+			m = new Histogram(DURATION_BOUNDS, 1e-6);
+		f.series.push_back(std::make_pair(labels, std::unique_ptr<Metric>(m)));
+	}
+	pthread_mutex_unlock(&_mutex);
+	return m;
+}
+
+Metrics::Counter *Metrics::counter(const char *name, const char *help, const std::string &labels) {
+	return static_cast<Counter *>(get(name, help, "counter", labels));
+}
+
+Metrics::Gauge *Metrics::gauge(const char *name, const char *help, const std::string &labels) {
+	return static_cast<Gauge *>(get(name, help, "gauge", labels));
+}
+
+Metrics::Histogram *Metrics::durations(const char *name, const char *help,
+									   const std::string &labels) {
+	return static_cast<Histogram *>(get(name, help, "histogram", labels));
+}
+
+Metrics::Histogram *Metrics::sizes(const char *name, const char *help,
+								   const std::string &labels) {
+	return static_cast<Histogram *>(get(name, help, "sizes", labels));
+}
+
+Metrics::Counter *Metrics::dropped(const char *source) {
+	return counter("vzlogger_dropped_readings_total", "Readings lost as a queue was full",
+				   label("source", source));
+}
+
+void Metrics::write(std::string &out) const {
+	pthread_mutex_lock(&_mutex);
+	for (auto &f : _families) {
+		out += "# HELP " + f.first + " " + f.second.help + "\n";
+		out += "# TYPE " + f.first + " ";
+		out += strcmp(f.second.type, "sizes") == 0 ? "histogram" : f.second.type;
+		out += "\n";
+		for (auto &s : f.second.series)
+			s.second->write(out, f.first, s.first);
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+std::string Metrics::label(const char *key, const std::string &value) {
+	std::string l = key;
+	l += "=\"";
+	for (char c : value) {
+		if (c == '\\' || c == '"')
+			l += '\\';
+		if (c == '\n')
+			l += "\\n";
+		else
+			l += c;
+	}
+	l += '"';
+	return l;
+}
+
+int64_t Metrics::now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+ApiMetrics::ApiMetrics(const char *api) {
+	std::string l = Metrics::label("api", api);
+	request = metrics.durations("vzlogger_http_request_duration_seconds",
+								"Round trip of one HTTP request to a middleware", l);
+	encode = metrics.durations("vzlogger_json_encode_duration_seconds",
+							   "Time to encode one JSON request or response body", l);
+	retries = metrics.counter("vzlogger_retries_total",
+							  "Failed requests whose data is sent again later", l);
+}
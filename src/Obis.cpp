@@ -27,6 +27,7 @@
 #include <sstream>
 
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -248,6 +249,13 @@ bool Obis::operator==(const Obis &rhs) const {
 	return 1; // equal
 }
 
+size_t Obis::hash() const {
+	uint64_t key = 0;
+	for (int i = 0; i < 6; i++)
+		key = (key << 8) | _obisId._raw[i];
+	return (size_t)(key ^ (key >> 32));
+}
+
 bool Obis::isAllNotGiven() const {
 	return *this == Obis(); // compare this one with empty one from default constructor
 }
@@ -3,12 +3,28 @@
  * */
 
 #include "PushData.hpp"
-#include "CurlSessionProvider.hpp"
+#include "Metrics.hpp"
 #include "vzlogger.h"
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <time.h>
+#include <unistd.h>
 
-PushDataServer::PushDataServer(struct json_object *option) : _headers(0) {
+static int64_t monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static ApiMetrics &api_metrics() {
+	static ApiMetrics m("push");
+	return m;
+}
+
+PushDataServer::PushDataServer(struct json_object *option)
+	: _multi(0), _headers(0), _delay_ms(0) {
 	if (option) {
 		// todo parse param option (is a json_type_array with len>0
 		// expected is each array item to be an object with key "url"
@@ -24,8 +40,23 @@ PushDataServer::PushDataServer(struct json_object *option) : _headers(0) {
 				throw vz::VZException("config: push url not found");
 			if (json_object_get_type(jv) != json_type_string)
 				throw vz::VZException("config: push url no string");
-			std::string url = json_object_get_string(jv);
-			_middlewareList.push_back(url);
+			Target t = Target();
+			t.url = json_object_get_string(jv);
+			t.timeout_ms = 30000;
+			// optional, per middleware:
+			if (json_object_object_get_ex(jso, "timeout", &jv)) {
+				if (json_object_get_type(jv) != json_type_int || json_object_get_int(jv) <= 0)
+					throw vz::VZException("config: push timeout no positive int");
+				t.timeout_ms = 1000L * json_object_get_int(jv);
+			}
+			_targets.push_back(t);
+			// optional, there is one list for all urls so the largest delay is used:
+			if (json_object_object_get_ex(jso, "delay", &jv)) {
+				if (json_object_get_type(jv) != json_type_int || json_object_get_int(jv) < 0)
+					throw vz::VZException("config: push delay no positive int");
+				if (json_object_get_int(jv) > _delay_ms)
+					_delay_ms = json_object_get_int(jv);
+			}
 		}
 
 	} // else for now assume this as the unit testing case and accept it
@@ -39,9 +70,22 @@ PushDataServer::PushDataServer(struct json_object *option) : _headers(0) {
 	_headers = curl_slist_append(_headers, "Content-type: application/json");
 	_headers = curl_slist_append(_headers, "Accept: application/json");
 	_headers = curl_slist_append(_headers, agent);
+
+	_multi = curl_multi_init();
+	if (!_multi)
+		throw vz::VZException("PushDataServer: curl_multi_init failed");
 }
 
 PushDataServer::~PushDataServer() {
+	for (auto &t : _targets) {
+		if (!t.curl)
+			continue;
+		if (t.busy)
+			curl_multi_remove_handle(_multi, t.curl);
+		curl_easy_cleanup(t.curl);
+	}
+	if (_multi)
+		curl_multi_cleanup(_multi);
 	if (_headers)
 		curl_slist_free_all(_headers);
 }
@@ -51,192 +95,273 @@ bool PushDataServer::waitAndSendOnceToAll() {
 		print(log_error, "waitAndSendOnceToAll empty pushDataList!", "push");
 		return false;
 	}
-	PushDataList::DataMap *dataMap = pushDataList->waitForData();
+
+	bool toRet = true;
+	PushDataList::DataMap *dataMap = 0;
+	if (!busy()) {
+		dataMap = pushDataList->waitForData();
+	} else {
+		// requests in flight: wait for their progress and for new data at the same time
+		struct curl_waitfd wfd;
+		wfd.fd = pushDataList->fd();
+		wfd.events = CURL_WAIT_POLLIN;
+		wfd.revents = 0;
+		curl_multi_wait(_multi, &wfd, 1, 1000, NULL);
+		toRet = perform();
+		if (wfd.revents)
+			dataMap = pushDataList->waitForData();
+	}
 	if (!dataMap) {
-		print(log_finest, "waitAndSendOnceToAll empty dataMap (timeout?)",
-			  "push"); // this is no error as it happens each 5s on timeout
-		return false;
+		VZ_PRINT(log_finest, "waitAndSendOnceToAll empty dataMap (timeout?)",
+				 "push"); // this is no error as it happens each 5s on timeout
+		return toRet;
 	}
 
-	std::string json = generateJson(*dataMap);
+	const char *json;
+	{
+		MetricsTimer timer(api_metrics().encode);
+		json = generateJson(*dataMap);
+	}
+	delete dataMap;
 
 	// now send this data to all defined push middlewares:
-	print(log_debug, "push: %s", "push", json.c_str());
+	VZ_PRINT(log_debug, "push: %s", "push", json);
+
+	int64_t now = monotonic_ms();
+	for (auto &t : _targets) {
+		if (t.queue.size() >= QUEUE_MAX) {
+			t.queue.pop_front();
+			t.dropped++;
+			metrics.dropped("push")->inc();
+		}
+		t.queue.push_back(json);
+		if (t.busy)
+			continue; // sent after the request in flight, see perform()
+		if (t.open_until_ms > now) {
+			t.skipped++;
+			toRet = false;
+			continue;
+		}
+		start(t, now);
+	}
+	return perform() && toRet;
+}
 
+bool PushDataServer::perform() {
 	bool toRet = true;
-	// iterate through list of push middlewares:
-	for (auto it = _middlewareList.begin(); it != _middlewareList.end(); ++it) {
-		// use CurlSessionProvider to serialize access to middleware:
-		if (!send(*it, json))
+	int running;
+	curl_multi_perform(_multi, &running);
+
+	CURLMsg *msg;
+	int left;
+	while ((msg = curl_multi_info_read(_multi, &left))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		Target *t = 0;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&t);
+		CURLcode curl_code = msg->data.result; // msg is invalid after removing the handle
+		curl_multi_remove_handle(_multi, msg->easy_handle);
+
+		int64_t now = monotonic_ms();
+		if (!complete(*t, curl_code, now))
 			toRet = false;
+		else if (!t->queue.empty()) // data from previous failures or arrived meanwhile
+			start(*t, now);
 	}
-
-	delete dataMap;
 	return toRet;
 }
 
-std::string PushDataServer::generateJson(PushDataList::DataMap &dataMap) {
-	std::string toRet;
-	struct json_object *jso = json_object_new_object();
-	struct json_object *jsa = json_object_new_array(); // jsa will be the "data" object
-
-	// now add a tuple (uuid, values) for each uuid:
-	for (auto it = dataMap.begin(); it != dataMap.end(); ++it) {
-		struct json_object *jsu = json_object_new_object();
-		json_object_object_add(jsu, "uuid", json_object_new_string((*it).first.c_str()));
-
-		struct json_object *jst = json_object_new_array();
-		// now add the DataTuples to the jst:
-		while (!(*it).second.empty()) {
-			const PushDataList::DataTuple &t = (*it).second.front();
-			struct json_object *jsv = json_object_new_array();
-			json_object_array_add(jsv, json_object_new_int64(t.first));
-			json_object_array_add(jsv, json_object_new_double(t.second));
+int PushDataServer::busy() const {
+	int n = 0;
+	for (auto &t : _targets)
+		n += t.busy;
+	return n;
+}
 
-			json_object_array_add(jst, jsv);
-			(*it).second.pop();
+void PushDataServer::start(Target &t, int64_t now_ms) {
+	if (!t.curl) {
+		t.curl = curl_easy_init();
+		if (!t.curl) {
+			print(log_alert, "send no curl session!", "push");
+			return;
 		}
-
-		json_object_object_add(jsu, "tuples", jst);
-
-		json_object_array_add(jsa, jsu);
+		curl_easy_setopt(t.curl, CURLOPT_URL, t.url.c_str());
+		curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, _headers);
+		// signal-handling in libcurl is NOT thread-safe. so force to deactivated them!
+		curl_easy_setopt(t.curl, CURLOPT_NOSIGNAL, 1);
+		// required if e.g. next router has an ip-change.
+		curl_easy_setopt(t.curl, CURLOPT_TIMEOUT_MS, t.timeout_ms);
+		curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, curl_custom_write_callback);
+		curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, (void *)&t.response);
+		curl_easy_setopt(t.curl, CURLOPT_PRIVATE, (void *)&t);
 	}
 
-	json_object_object_add(jso, "data", jsa);
-	const char *json_str = json_object_to_json_string(jso);
-	toRet = json_str;
-	json_object_put(jso);
-
-	return toRet;
+	t.response.clear();
+	curl_easy_setopt(t.curl, CURLOPT_POSTFIELDSIZE, (long)t.queue.front().size());
+	curl_easy_setopt(t.curl, CURLOPT_POSTFIELDS, t.queue.front().c_str());
+	t.started_ms = now_ms;
+	t.busy = true;
+	curl_multi_add_handle(_multi, t.curl);
 }
 
-bool PushDataServer::send(const std::string &middleware, const std::string &datastr) {
-	bool toRet = true;
-	CURL *curl = curlSessionProvider ? curlSessionProvider->get_easy_session(middleware) : 0;
-	if (!curl) {
-		print(log_alert, "send no curl session!", "push");
-		return false;
-	}
+bool PushDataServer::complete(Target &t, CURLcode curl_code, int64_t now_ms) {
+	long int http_code = 0;
+	curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &http_code);
+	t.busy = false;
 
-	CURLresponse response;
-	response.size = 0;
-	response.data = 0;
-	CURLcode curl_code;
-	long int http_code;
+	int64_t latency = now_ms - t.started_ms;
+	t.latency_sum_ms += latency;
+	if (latency > t.latency_max_ms)
+		t.latency_max_ms = latency;
+	api_metrics().request->observe(latency * 1000);
 
-	curl_easy_setopt(curl, CURLOPT_URL, middleware.c_str());
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, _headers);
-	// curl_easy_setopt(curl, CURLOPT_VERBOSE, options.verbosity());
-	curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, 0);
-	curl_easy_setopt(curl, CURLOPT_DEBUGDATA, 0);
-	// signal-handling in libcurl is NOT thread-safe. so force to deactivated them!
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-
-	// set timeout to 30 sec. required if e.g. next router has an ip-change.
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30);
+	if (curl_code == CURLE_OK && http_code == 200) { // everything is ok
+		VZ_PRINT(log_debug, "CURL Request to %s succeeded with code: %i", "push", t.url.c_str(),
+				 http_code);
+		t.queue.pop_front();
+		t.sent++;
+		t.failures = 0;
+		return true;
+	}
 
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, datastr.c_str());
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_custom_write_callback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
+	if (curl_code != CURLE_OK)
+		print(log_alert, "CURL: %s %s", "push", t.url.c_str(), curl_easy_strerror(curl_code));
+	else
+		print(log_alert, "CURL Error from url %s: %d %s", "push", t.url.c_str(), http_code,
+			  t.response.c_str());
+	t.failed++;
+	api_metrics().retries->inc();
+	// the data stays queued for the next time
+	if (++t.failures >= BREAKER_FAILURES) {
+		t.open_until_ms = now_ms + BREAKER_MS;
+		print(log_warning, "%s failed %d times in a row, skipping it for %ds", "push",
+			  t.url.c_str(), t.failures, BREAKER_MS / 1000);
+	}
+	return false;
+}
 
-	curl_code = curl_easy_perform(curl);
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+void PushDataServer::printStatistics(log_level_t logLevel) {
+	for (auto &t : _targets) {
+		unsigned long n = t.sent + t.failed;
+		print(logLevel,
+			  "%s: sent %lu, failed %lu, skipped %lu, dropped %lu, queued %zu, latency avg %lldms "
+			  "max %lldms",
+			  "push", t.url.c_str(), t.sent, t.failed, t.skipped, t.dropped, t.queue.size(),
+			  (long long)(n ? t.latency_sum_ms / (int64_t)n : 0), (long long)t.latency_max_ms);
+	}
+}
 
-	if (curlSessionProvider)
-		curlSessionProvider->return_session(middleware, curl);
+const char *PushDataServer::generateJson(PushDataList::DataMap &dataMap) {
+	// {"data":[{"uuid":"..","tuples":[[ts,value],..]},..]}
+	_json.clear();
+	_json.begin_object();
+	_json.key("data").begin_array();
 
-	// check response
-	if (curl_code == CURLE_OK && http_code == 200) { // everything is ok
-		print(log_debug, "CURL Request to %s succeeded with code: %i", "push", middleware.c_str(),
-			  http_code);
-	} else { // error
-		if (curl_code != CURLE_OK) {
-			print(log_alert, "CURL: %s %s", "push", middleware.c_str(),
-				  curl_easy_strerror(curl_code));
-			toRet = false;
-		} else if (http_code != 200) {
-			print(log_alert, "CURL Error from url %s: %d %s", "push", middleware.c_str(), http_code,
-				  response.data);
-			toRet = false;
+	// now add a tuple (uuid, values) for each uuid:
+	for (auto it = dataMap.begin(); it != dataMap.end(); ++it) {
+		_json.begin_object();
+		_json.key("uuid").value((*it).first.c_str());
+		_json.key("tuples").begin_array();
+		// now add the DataTuples:
+		while (!(*it).second.empty()) {
+			const PushDataList::DataTuple &t = (*it).second.front();
+			_json.tuple(t.first, t.second);
+			(*it).second.pop();
 		}
+		_json.end_array();
+		_json.end_object();
 	}
 
-	if (response.data)
-		free(response.data);
-	if (toRet)
-		print(log_finest, "send ok to url %s", "push", middleware.c_str());
-	else
-		print(log_debug, "send nok to url %s", "push", middleware.c_str());
-
-	return toRet;
+	_json.end_array();
+	_json.end_object();
+	return _json.c_str();
 }
 
 size_t PushDataServer::curl_custom_write_callback(void *ptr, size_t size, size_t nmemb,
 												  void *data) {
 	size_t realsize = size * nmemb;
-	CURLresponse *response = static_cast<CURLresponse *>(data);
-
-	response->data = (char *)realloc(response->data, response->size + realsize + 1);
-	if (response->data == NULL) { // out of memory!
-		print(log_alert, "Cannot allocate memory data=%p response->size=%zu realsize=%zu", "push",
-			  data, response->size, realsize);
-		exit(EXIT_FAILURE);
-	}
-
-	memcpy(&(response->data[response->size]), ptr, realsize);
-	response->size += realsize;
-	response->data[response->size] = 0;
-
+	static_cast<std::string *>(data)->append(static_cast<const char *>(ptr), realsize);
 	return realsize;
 }
 
-PushDataList::PushDataList() : _next(0), _map_mutex(PTHREAD_MUTEX_INITIALIZER) {
-	pthread_cond_init(&_cond, NULL);
+PushDataList::PushDataList(size_t capacity, int delay_ms)
+	: _queue(capacity), _delay_ms(delay_ms), _wakeupPending(false), _dropped(0),
+	  _slot_mutex(PTHREAD_MUTEX_INITIALIZER) {
+	_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_wakefd < 0)
+		throw vz::VZException(std::string("PushDataList: eventfd failed: ") + strerror(errno));
 }
 
 PushDataList::~PushDataList() {
-	pthread_mutex_lock(&_map_mutex); // todo. wrong thread might own the mutex? But might have been
-									 // cancelled (thread_cancellation so will never unlock!)
-
-	if (_next)
-		delete _next;
-
-	// we keep it locked to prevent race conds at the end
-	pthread_cond_destroy(&_cond);
-	pthread_mutex_destroy(&_map_mutex);
+	close(_wakefd);
+	pthread_mutex_destroy(&_slot_mutex);
 }
 
-void PushDataList::add(const std::string &uuid, const int64_t &time_ms, const double &value) {
-	assert(0 == pthread_mutex_lock(&_map_mutex));
-
-	if (!_next)
-		_next = new DataMap;
-
-	_next->operator[](uuid).push(DataTuple(time_ms, value));
+unsigned PushDataList::slot(const std::string &uuid) {
+	pthread_mutex_lock(&_slot_mutex);
+	unsigned i = 0;
+	while (i < _uuids.size() && _uuids[i] != uuid)
+		i++;
+	if (i == _uuids.size())
+		_uuids.push_back(uuid);
+	pthread_mutex_unlock(&_slot_mutex);
+	return i;
+}
 
-	pthread_cond_broadcast(&_cond);
-	pthread_mutex_unlock(&_map_mutex);
+bool PushDataList::add(unsigned slot, int64_t time_ms, double value) {
+	// take care: this is called from the meter threads for every reading.
+	Record r = {slot, time_ms, value};
+	if (!_queue.push(std::move(r))) {
+		_dropped++; // reported by the push thread
+		static Metrics::Counter *total = metrics.dropped("push");
+		total->inc();
+		return false;
+	}
+	// one wakeup per batch. The push thread resets _wakeupPending before taking the readings:
+	if (!_wakeupPending.exchange(true)) {
+		uint64_t one = 1;
+		if (write(_wakefd, &one, sizeof(one)) < 0) {
+			// only fails if the counter overflows, the thread is awake then anyhow
+		}
+	}
+	return true;
 }
 
 PushDataList::DataMap *PushDataList::waitForData() {
-	DataMap *toRet = 0;
-	assert(0 == pthread_mutex_lock(&_map_mutex));
-	int rc = 0;
-
 	// try max 5s. We need to avoid deadlocking e.g. on program end/termination.
-	struct timespec ts;
-	clock_gettime(CLOCK_REALTIME, &ts);
-	ts.tv_sec += 5;
+	struct pollfd fd;
+	fd.fd = _wakefd;
+	fd.events = POLLIN;
+	fd.revents = 0;
+	if (poll(&fd, 1, 5000) <= 0)
+		return 0;
+
+	if (_delay_ms > 0) { // collect the readings of all meters read at about the same time
+		struct timespec ts;
+		ts.tv_sec = _delay_ms / 1000;
+		ts.tv_nsec = (_delay_ms % 1000) * 1000000L;
+		nanosleep(&ts, NULL);
+	}
 
-	while ((!(_next && !_next->empty())) && rc == 0) {
-		rc = pthread_cond_timedwait(&_cond, &_map_mutex, &ts);
+	uint64_t cnt;
+	if (read(_wakefd, &cnt, sizeof(cnt)) < 0) {
+		// EAGAIN, nothing to do
 	}
+	_wakeupPending.exchange(false); // readings added from now on wake us up again
 
-	if (rc == 0) {
-		toRet = _next;
-		_next = 0; // change ownership to caller. We will create new one on next add()
+	size_t dropped = _dropped.exchange(0);
+	if (dropped)
+		print(log_warning, "Push queue full, dropped %zu readings", "push", dropped);
+
+	DataMap *toRet = 0;
+	Record r;
+	pthread_mutex_lock(&_slot_mutex);
+	while (_queue.pop(r)) {
+		if (!toRet)
+			toRet = new DataMap; // ownership changes to the caller
+		(*toRet)[_uuids[r.slot]].push(DataTuple(r.time_ms, r.value));
 	}
-	pthread_mutex_unlock(&_map_mutex);
+	pthread_mutex_unlock(&_slot_mutex);
 
 	return toRet;
 }
@@ -246,17 +371,23 @@ PushDataList *pushDataList = 0;
 volatile bool endThread = false;
 
 void *push_data_thread(void *arg) {
-	print(log_debug, "Start push_data_thread", "push");
+	VZ_PRINT(log_debug, "Start push_data_thread", "push");
 
 	PushDataServer *pds = static_cast<PushDataServer *>(arg);
 
 	if (pds && pushDataList) {
+		time_t stats = time(NULL);
 		while (!endThread) {
 			pds->waitAndSendOnceToAll();
+			if (time(NULL) - stats >= 3600) {
+				pds->printStatistics(log_info);
+				stats = time(NULL);
+			}
 		}
+		pds->printStatistics(log_info);
 	}
 
-	print(log_debug, "Stopped push_data_thread", "push");
+	VZ_PRINT(log_debug, "Stopped push_data_thread", "push");
 	return 0;
 }
 
@@ -0,0 +1,267 @@
+/**
+ * Reactor - one event loop thread for all meters that can be read without blocking
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include <errno.h>
+#include <exception>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Reactor.hpp"
+#include "common.h"
+#include <VZException.hpp>
+
+static const int MAX_EVENTS = 32;
+static const int POLL_TIMEOUT_MS = 1000;
+
+static int64_t monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Reactor::Reactor() : _epfd(-1), _wakefd(-1), _thread_running(false), _stop(false) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epfd < 0)
+		throw vz::VZException("Reactor: cannot create epoll instance.");
+	_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_wakefd < 0) {
+		::close(_epfd);
+		throw vz::VZException("Reactor: cannot create eventfd.");
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = _wakefd;
+	epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakefd, &ev);
+}
+
+Reactor::~Reactor() {
+	stop();
+	::close(_wakefd);
+	::close(_epfd);
+	pthread_mutex_destroy(&_mutex);
+}
+
+void Reactor::start() {
+	if (_thread_running)
+		return;
+	_stop = false;
+	if (pthread_create(&_thread, NULL, &Reactor::thread, (void *)this))
+		throw vz::VZException("Reactor: cannot start event loop thread.");
+	_thread_running = true;
+	print(log_debug, "Started reactor.", "reactor");
+}
+
+void Reactor::stop() {
+	if (!_thread_running)
+		return;
+	_stop = true;
+	wakeup();
+	pthread_join(_thread, NULL);
+	_thread_running = false;
+	print(log_debug, "Stopped reactor.", "reactor");
+}
+
+void Reactor::add(int fd, io_func func, void *arg) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN; // level triggered, a callback may leave data for the next round
+	ev.data.fd = fd;
+
+	pthread_mutex_lock(&_mutex);
+	int op = _handlers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	int res = epoll_ctl(_epfd, op, fd, &ev);
+	if (res < 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+		// closed and reopened with the same number, epoll forgot about it
+		res = epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev);
+	}
+	if (res < 0) {
+		pthread_mutex_unlock(&_mutex);
+		print(log_alert, "epoll_ctl(%d): %s", "reactor", fd, strerror(errno));
+		throw vz::VZException("Reactor: cannot watch file descriptor.");
+	}
+	Handler h;
+	h.func = func;
+	h.arg = arg;
+	_handlers[fd] = h;
+	pthread_mutex_unlock(&_mutex);
+}
+
+void Reactor::remove(int fd) {
+	pthread_mutex_lock(&_mutex);
+	if (_handlers.erase(fd))
+		epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL); // fails if fd got closed already, that's ok
+	pthread_mutex_unlock(&_mutex);
+}
+
+void Reactor::every(int interval_ms, timer_func func, void *arg) {
+	Timer t;
+	t.interval_ms = interval_ms > 0 ? interval_ms : 1;
+	t.fired = false;
+	t.func = func;
+	t.arg = arg;
+	t.next_ms = monotonic_ms() + t.interval_ms;
+	pthread_mutex_lock(&_mutex);
+	_timers.push_back(t);
+	pthread_mutex_unlock(&_mutex);
+	wakeup();
+}
+
+void Reactor::after(int delay_ms, timer_func func, void *arg) {
+	int64_t next_ms = monotonic_ms() + (delay_ms > 0 ? delay_ms : 0);
+	pthread_mutex_lock(&_mutex);
+	std::vector<Timer>::iterator it;
+	for (it = _timers.begin(); it != _timers.end(); ++it)
+		if (it->interval_ms == 0 && !it->fired && it->func == func && it->arg == arg)
+			break;
+	if (it == _timers.end()) {
+		Timer t;
+		t.interval_ms = 0;
+		t.func = func;
+		t.arg = arg;
+		it = _timers.insert(_timers.end(), t);
+	}
+	it->fired = false;
+	it->next_ms = next_ms;
+	pthread_mutex_unlock(&_mutex);
+	wakeup();
+}
+
+void Reactor::remove_timers(void *arg) {
+	pthread_mutex_lock(&_mutex);
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end();) {
+		if (it->arg == arg)
+			it = _timers.erase(it);
+		else
+			++it;
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+size_t Reactor::size() {
+	pthread_mutex_lock(&_mutex);
+	size_t n = _handlers.size();
+	pthread_mutex_unlock(&_mutex);
+	return n;
+}
+
+void Reactor::wakeup() {
+	uint64_t one = 1;
+	if (::write(_wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		print(log_error, "Reactor: wakeup failed: %s", "reactor", strerror(errno));
+}
+
+void *Reactor::thread(void *arg) {
+	static_cast<Reactor *>(arg)->run();
+	return NULL;
+}
+
+int Reactor::run_timers() {
+	int64_t now = monotonic_ms();
+	int next = POLL_TIMEOUT_MS;
+
+	pthread_mutex_lock(&_mutex);
+	std::vector<Timer> due;
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end(); ++it) {
+		if (it->fired)
+			continue;
+		if (it->next_ms <= now) {
+			due.push_back(*it);
+			if (it->interval_ms == 0) {
+				it->fired = true; // removed after the callbacks
+				continue;
+			}
+			// don't try to catch up missed periods:
+			while (it->next_ms <= now)
+				it->next_ms += it->interval_ms;
+		}
+		if (it->next_ms - now < next)
+			next = (int)(it->next_ms - now);
+	}
+
+	for (std::vector<Timer>::iterator it = due.begin(); it != due.end(); ++it) {
+		// an earlier callback might have removed this one:
+		bool registered = false;
+		for (std::vector<Timer>::iterator t = _timers.begin(); t != _timers.end(); ++t)
+			if (t->func == it->func && t->arg == it->arg && t->interval_ms == it->interval_ms)
+				registered = true;
+		if (!registered)
+			continue;
+		try {
+			it->func(it->arg);
+		} catch (std::exception &e) {
+			print(log_alert, "Reactor timer failed: %s", "reactor", e.what());
+		}
+	}
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end();) {
+		if (it->fired)
+			it = _timers.erase(it);
+		else
+			++it;
+	}
+	// callbacks may have added timers due earlier than computed above:
+	for (std::vector<Timer>::iterator it = _timers.begin(); it != _timers.end(); ++it)
+		if (it->next_ms - now < next)
+			next = it->next_ms > now ? (int)(it->next_ms - now) : 0;
+	pthread_mutex_unlock(&_mutex);
+
+	// the callbacks took time as well:
+	int64_t spent = monotonic_ms() - now;
+	return next > spent ? (int)(next - spent) : 0;
+}
+
+void Reactor::run() {
+	struct epoll_event events[MAX_EVENTS];
+
+	while (!_stop) {
+		int timeout = run_timers();
+		int n = epoll_wait(_epfd, events, MAX_EVENTS, timeout);
+		if (n < 0) {
+			if (errno != EINTR)
+				print(log_error, "epoll_wait: %s", "reactor", strerror(errno));
+			continue;
+		}
+
+		pthread_mutex_lock(&_mutex);
+		for (int i = 0; i < n && !_stop; i++) {
+			int fd = events[i].data.fd;
+			if (fd == _wakefd) {
+				uint64_t count;
+				while (::read(_wakefd, &count, sizeof(count)) > 0) {
+				}
+				continue;
+			}
+			// looked up for each event, an earlier callback might have removed it:
+			std::map<int, Handler>::iterator it = _handlers.find(fd);
+			if (it == _handlers.end())
+				continue;
+			Handler h = it->second;
+			try {
+				h.func(fd, h.arg);
+			} catch (std::exception &e) {
+				print(log_alert, "Reactor callback for fd %d failed: %s", "reactor", fd,
+					  e.what());
+			}
+		}
+		pthread_mutex_unlock(&_mutex);
+	}
+}
+
+// global vars:
+Reactor *reactor = 0;
+Reactor *sendReactor = 0;
@@ -23,33 +23,46 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef VZ_USE_THREADS
+#include <pthread.h>
+#endif // VZ_USE_THREADS
 
 #include "Reading.hpp"
 #include "VZException.hpp"
 
-Reading::Reading() : _deleted(false), _value(0) {
+Reading::Reading() : _deleted(false), _value(0), _identifier(0) {
 	_time.tv_sec = 0;
 	_time.tv_usec = 0;
 }
 
 Reading::Reading(ReadingIdentifier::Ptr pIndentifier)
-	: _deleted(false), _value(0), _identifier(pIndentifier) {
+	: _deleted(false), _value(0), _identifier(ReadingIdentifier::intern(pIndentifier)) {
 	_time.tv_sec = 0;
 	_time.tv_usec = 0;
 }
 Reading::Reading(double pValue, struct timeval pTime, ReadingIdentifier::Ptr pIndentifier)
-	: _deleted(false), _value(pValue), _time(pTime), _identifier(pIndentifier) {}
+	: _deleted(false), _value(pValue), _time(pTime),
+	  _identifier(ReadingIdentifier::intern(pIndentifier)) {}
 
 Reading::Reading(const Reading &orig)
 	: _deleted(orig._deleted), _value(orig._value), _time(orig._time),
 	  _identifier(orig._identifier) {}
 
+Reading::Reading(const Sample &orig)
+	: _deleted(orig.deleted()), _value(orig.value()), _identifier(0) {
+	_time.tv_sec = orig.time_ms() / 1000;
+	_time.tv_usec = (orig.time_ms() % 1000) * 1000;
+}
+
 Reading &Reading::operator=(const Reading &orig) {
 	_deleted = orig._deleted;
 	_value = orig._value;
@@ -125,7 +138,13 @@ size_t Reading::unparse(
 	//	meter_protocol_t protocol,
 	char *buffer, size_t n) {
 
-	return _identifier->unparse(buffer, n);
+	ReadingIdentifier::Ptr rid = ReadingIdentifier::lookup(_identifier);
+	if (!rid) {
+		if (n > 0)
+			buffer[0] = '\0';
+		return 0;
+	}
+	return rid->unparse(buffer, n);
 
 #if 0
 	switch (protocol) {
@@ -153,6 +172,171 @@ size_t Reading::unparse(
 #endif
 }
 
+/* Interning */
+namespace {
+#ifdef VZ_PICO
+const size_t INTERN_SLOTS = 64; // lock-free index, power of 2, filled up to half
+const size_t INTERN_CHUNK = 16; // identifiers per chunk, chunks never move
+const size_t INTERN_CHUNKS = 64;
+#else  // VZ_PICO
+const size_t INTERN_SLOTS = 1024;
+const size_t INTERN_CHUNK = 64;
+const size_t INTERN_CHUNKS = 1024; // up to 64k identifiers
+#endif // VZ_PICO
+
+/**
+ * Readers only take the lock for identifiers they see for the first time: an entry
+ * is completely written before its id is stored (release) into the index, where the
+ * lookups find it (acquire). The mutex serializes the writers.
+ */
+struct InternTable {
+	std::atomic<ReadingIdentifier::Ptr *> chunks[INTERN_CHUNKS]; // id - 1 is the index
+	std::atomic<ReadingIdentifier::Id> slot_ids[INTERN_SLOTS];   // 0 = empty
+	uint32_t slot_hashes[INTERN_SLOTS];                          // valid once the id is set
+	// with the lock held:
+	ReadingIdentifier::Id count;
+	size_t slots_used;
+	std::unordered_multimap<size_t, ReadingIdentifier::Id> by_hash; // the ones not in the index
+#ifdef VZ_USE_THREADS
+	pthread_mutex_t mutex;
+	void lock() { pthread_mutex_lock(&mutex); }
+	void unlock() { pthread_mutex_unlock(&mutex); }
+#else  // VZ_USE_THREADS
+	void lock() {}
+	void unlock() {}
+#endif // VZ_USE_THREADS
+
+	InternTable() : count(0), slots_used(0) {
+		for (size_t i = 0; i < INTERN_CHUNKS; i++)
+			chunks[i].store(NULL, std::memory_order_relaxed);
+		for (size_t i = 0; i < INTERN_SLOTS; i++)
+			slot_ids[i].store(0, std::memory_order_relaxed);
+#ifdef VZ_USE_THREADS
+		pthread_mutex_init(&mutex, NULL);
+#endif // VZ_USE_THREADS
+	}
+
+	const ReadingIdentifier::Ptr &at(ReadingIdentifier::Id id) const {
+		ReadingIdentifier::Ptr *chunk =
+			chunks[(id - 1) / INTERN_CHUNK].load(std::memory_order_acquire);
+		return chunk[(id - 1) % INTERN_CHUNK];
+	}
+
+	// without the lock
+	template <class Match> ReadingIdentifier::Id find(size_t hash, const Match &match) const {
+		for (size_t i = hash & (INTERN_SLOTS - 1);; i = (i + 1) & (INTERN_SLOTS - 1)) {
+			ReadingIdentifier::Id id = slot_ids[i].load(std::memory_order_acquire);
+			if (id == 0)
+				return 0;
+			if (slot_hashes[i] == (uint32_t)hash && match(at(id).get()))
+				return id;
+		}
+	}
+
+	// with the lock held, finds what find() can't see
+	template <class Match> ReadingIdentifier::Id find_locked(size_t hash, const Match &match) {
+		ReadingIdentifier::Id id = find(hash, match);
+		if (id)
+			return id;
+		typedef std::unordered_multimap<size_t, ReadingIdentifier::Id>::const_iterator iterator;
+		std::pair<iterator, iterator> range = by_hash.equal_range(hash);
+		for (iterator it = range.first; it != range.second; ++it) {
+			if (match(at(it->second).get()))
+				return it->second;
+		}
+		return 0;
+	}
+
+	// with the lock held
+	ReadingIdentifier::Id add(size_t hash, const ReadingIdentifier::Ptr &rid) {
+		if (count == INTERN_CHUNK * INTERN_CHUNKS)
+			throw vz::VZException("Too many different reading identifiers.");
+		ReadingIdentifier::Id id = ++count;
+		size_t chunk = (id - 1) / INTERN_CHUNK;
+		ReadingIdentifier::Ptr *entries = chunks[chunk].load(std::memory_order_relaxed);
+		if (!entries) {
+			entries = new ReadingIdentifier::Ptr[INTERN_CHUNK];
+			chunks[chunk].store(entries, std::memory_order_release);
+		}
+		entries[(id - 1) % INTERN_CHUNK] = rid;
+
+		if (slots_used < INTERN_SLOTS / 2) {
+			size_t i = hash & (INTERN_SLOTS - 1);
+			while (slot_ids[i].load(std::memory_order_relaxed) != 0)
+				i = (i + 1) & (INTERN_SLOTS - 1);
+			slot_hashes[i] = (uint32_t)hash;
+			slot_ids[i].store(id, std::memory_order_release); // publishes the entry
+			slots_used++;
+		} else {
+			by_hash.insert(std::make_pair(hash, id)); // only found with the lock
+		}
+		return id;
+	}
+
+	template <class Match, class Make>
+	ReadingIdentifier::Id intern(size_t hash, const Match &match, const Make &make) {
+		ReadingIdentifier::Id id = find(hash, match);
+		if (id)
+			return id;
+		lock();
+		try {
+			id = find_locked(hash, match);
+			if (!id)
+				id = add(hash, make());
+		} catch (...) {
+			unlock();
+			throw;
+		}
+		unlock();
+		return id;
+	}
+};
+
+// constructed on first use, meters may create readings during static initialisation
+InternTable &intern_table() {
+	static InternTable table;
+	return table;
+}
+} // namespace
+
+ReadingIdentifier::Id ReadingIdentifier::intern(const Ptr &rid) {
+	if (!rid)
+		return 0;
+	return intern_table().intern(
+		rid->hash(),
+		[&](const ReadingIdentifier *known) { return known == rid.get() || *known == *rid; },
+		[&]() { return rid; });
+}
+
+ReadingIdentifier::Id ReadingIdentifier::intern(const Obis &obis) {
+	return intern_table().intern(
+		obis.hash(),
+		[&](const ReadingIdentifier *known) {
+			const ObisIdentifier *oid = dynamic_cast<const ObisIdentifier *>(known);
+			return oid && oid->obis() == obis;
+		},
+		[&]() { return Ptr(new ObisIdentifier(obis)); });
+}
+
+ReadingIdentifier::Id ReadingIdentifier::intern(const char *string) {
+	size_t len = strlen(string);
+	return intern_table().intern(
+		StringIdentifier::hash(string, len),
+		[&](const ReadingIdentifier *known) {
+			const StringIdentifier *sid = dynamic_cast<const StringIdentifier *>(known);
+			return sid && sid->string().size() == len &&
+				   memcmp(sid->string().data(), string, len) == 0;
+		},
+		[&]() { return Ptr(new StringIdentifier(string)); });
+}
+
+ReadingIdentifier::Ptr ReadingIdentifier::lookup(Id id) {
+	if (id == 0)
+		return Ptr();
+	// no lock: an id is only known after its entry was published
+	return intern_table().at(id);
+}
+
 bool ReadingIdentifier::operator==(ReadingIdentifier const &cmp) const {
 	return this->compare(this, &cmp);
 }
@@ -193,6 +377,16 @@ size_t ObisIdentifier::unparse(char *buffer, size_t n) { return _obis.unparse(bu
 bool ObisIdentifier::operator==(ObisIdentifier const &cmp) const { return (_obis == cmp.obis()); }
 
 /* StringIdentifier */
+size_t StringIdentifier::hash(const char *s, size_t n) {
+	// FNV-1a, so intern(const char *) can hash without constructing a std::string
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < n; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
 bool StringIdentifier::operator==(StringIdentifier const &cmp) const {
 	return (_string == cmp._string);
 }
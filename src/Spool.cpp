@@ -0,0 +1,368 @@
+/**
+ * Spool - persistent write-ahead queue of readings not yet acknowledged by an api
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Metrics.hpp"
+#include "Spool.hpp"
+#include <VZException.hpp>
+
+namespace {
+
+// one reading on disk, native byte order as the spool never leaves the device
+struct Record {
+	int64_t time_ms;
+	double value;
+	uint32_t crc; // over time_ms and value
+	uint32_t reserved;
+};
+
+// acknowledged position, rewritten in place
+struct Head {
+	uint64_t seq;
+	uint64_t records;
+	uint32_t crc; // over seq and records
+	uint32_t reserved;
+};
+
+const size_t RECORD_SIZE = sizeof(Record);
+const size_t LOAD_CHUNK = 1024; // records read at once
+
+struct Crc32Table {
+	uint32_t t[256];
+};
+
+constexpr Crc32Table crc32_table() {
+	Crc32Table table = {};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		table.t[i] = c;
+	}
+	return table;
+}
+
+// computed at compile time, nothing to initialize when the first threads call crc32()
+constexpr Crc32Table CRC32_TABLE = crc32_table();
+
+bool valid(const Record &r) { return r.crc == Spool::crc32(&r, offsetof(Record, crc)); }
+
+// records lost due to max_size, of this spool and in total for the metrics
+void count_dropped(size_t &dropped, size_t n) {
+	dropped += n;
+	static Metrics::Counter *total = metrics.dropped("spool");
+	total->inc(n);
+}
+
+} // namespace
+
+uint32_t Spool::crc32(const void *data, size_t len) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	uint32_t crc = 0xFFFFFFFF;
+	while (len--)
+		crc = CRC32_TABLE.t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+Spool::Spool(const std::string &dir, size_t segment_size, size_t max_size, fsync_policy policy)
+	: _dir(dir), _segment_records(std::max(segment_size / RECORD_SIZE, (size_t)1)),
+	  _max_records(std::max(max_size / RECORD_SIZE, (size_t)1)), _fsync(policy), _head(0),
+	  _load_segment(0), _load(0), _fd(-1), _head_fd(-1), _dropped(0) {
+	// keep at least two segments: one to drop while the other one is written to
+	if (_max_records < 2 * _segment_records)
+		_max_records = 2 * _segment_records;
+
+	size_t slash = _dir.rfind('/');
+	if (slash != std::string::npos && slash > 0)
+		mkdir(_dir.substr(0, slash).c_str(), 0755); // the spool dir itself, may exist
+	if (mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST)
+		throw vz::VZException("Spool: cannot create directory " + _dir + ": " + strerror(errno));
+
+	_head_fd = open((_dir + "/head").c_str(), O_RDWR | O_CREAT, 0644);
+	if (_head_fd < 0)
+		throw vz::VZException("Spool: cannot open head in " + _dir + ": " + strerror(errno));
+
+	recover();
+	print(log_info, "Spool %s: %zu unacknowledged records in %zu segments", "spool", _dir.c_str(),
+		  size(), _segments.size());
+}
+
+Spool::~Spool() {
+	if (_fd >= 0) {
+		sync(_fd);
+		close(_fd);
+	}
+	if (_head_fd >= 0)
+		close(_head_fd);
+}
+
+Spool::fsync_policy Spool::fsync_policy_from_string(const char *s) {
+	if (strcasecmp(s, "always") == 0)
+		return FSYNC_ALWAYS;
+	if (strcasecmp(s, "segment") == 0)
+		return FSYNC_SEGMENT;
+	if (strcasecmp(s, "never") == 0)
+		return FSYNC_NEVER;
+	throw vz::VZException("Spool: unknown fsync policy");
+}
+
+std::string Spool::path(uint64_t seq) const {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.spool", (unsigned long long)seq);
+	return _dir + name;
+}
+
+void Spool::sync(int fd) {
+	if (_fsync != FSYNC_NEVER)
+		fdatasync(fd);
+}
+
+void Spool::recover() {
+	// find existing segments:
+	std::vector<uint64_t> seqs;
+	DIR *d = opendir(_dir.c_str());
+	if (!d)
+		throw vz::VZException("Spool: cannot read directory " + _dir + ": " + strerror(errno));
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		unsigned long long seq;
+		char ext[8];
+		if (sscanf(de->d_name, "%16llx.%7s", &seq, ext) == 2 && strcmp(ext, "spool") == 0)
+			seqs.push_back(seq);
+	}
+	closedir(d);
+	std::sort(seqs.begin(), seqs.end());
+
+	for (size_t i = 0; i < seqs.size(); i++) {
+		struct stat st;
+		if (stat(path(seqs[i]).c_str(), &st) != 0)
+			continue;
+		Segment s;
+		s.seq = seqs[i];
+		s.records = st.st_size / RECORD_SIZE;
+		_segments.push_back(s);
+	}
+
+	// cut off a torn write at the end of the last segment:
+	if (!_segments.empty()) {
+		Segment &last = _segments.back();
+		int fd = open(path(last.seq).c_str(), O_RDWR);
+		if (fd >= 0) {
+			Record r;
+			while (last.records > 0 &&
+				   (pread(fd, &r, RECORD_SIZE, (last.records - 1) * RECORD_SIZE) !=
+						(ssize_t)RECORD_SIZE ||
+					!valid(r)))
+				last.records--;
+			if (ftruncate(fd, last.records * RECORD_SIZE) != 0)
+				print(log_warning, "Spool %s: cannot truncate: %s", "spool", _dir.c_str(),
+					  strerror(errno));
+			close(fd);
+		}
+	}
+
+	// skip what was acknowledged before:
+	Head h;
+	if (pread(_head_fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+		h.crc == crc32(&h, offsetof(Head, crc))) {
+		while (!_segments.empty() && _segments.front().seq < h.seq) {
+			unlink(path(_segments.front().seq).c_str());
+			_segments.pop_front();
+		}
+		if (!_segments.empty() && _segments.front().seq == h.seq)
+			_head = std::min((size_t)h.records, _segments.front().records);
+	}
+	_load_segment = 0;
+	_load = _head;
+
+	// continue writing to a new segment, the last one may have been cut
+	Segment s;
+	s.seq = _segments.empty() ? 0 : _segments.back().seq + 1;
+	s.records = 0;
+	_segments.push_back(s);
+	_fd = open(path(s.seq).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (_fd < 0)
+		throw vz::VZException("Spool: cannot create segment in " + _dir + ": " + strerror(errno));
+}
+
+void Spool::rotate() {
+	sync(_fd);
+	close(_fd);
+
+	Segment s;
+	s.seq = _segments.back().seq + 1;
+	s.records = 0;
+	_segments.push_back(s);
+	_fd = open(path(s.seq).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (_fd < 0)
+		throw vz::VZException("Spool: cannot create segment in " + _dir + ": " + strerror(errno));
+}
+
+size_t Spool::size() const {
+	size_t n = 0;
+	for (size_t i = 0; i < _segments.size(); i++)
+		n += _segments[i].records;
+	return n - _head;
+}
+
+size_t Spool::loaded() const {
+	size_t n = 0;
+	for (size_t i = 0; i < _load_segment; i++)
+		n += _segments[i].records;
+	return n + _load - _head;
+}
+
+void Spool::append(const std::list<Reading> &values) {
+	std::vector<Record> recs;
+	recs.reserve(values.size());
+	for (std::list<Reading>::const_iterator it = values.begin(); it != values.end(); ++it) {
+		Record r;
+		r.time_ms = it->time_ms();
+		r.value = it->value();
+		r.crc = crc32(&r, offsetof(Record, crc));
+		r.reserved = 0;
+		recs.push_back(r);
+	}
+
+	size_t done = 0;
+	while (done < recs.size()) {
+		// make room by dropping the oldest segment not loaded yet:
+		while (size() + _head >= _max_records) {
+			size_t i = std::max(_load_segment + 1, (size_t)1);
+			if (i >= _segments.size() - 1) {
+				count_dropped(_dropped, recs.size() - done);
+				print(log_warning, "Spool %s full, dropping %zu new readings", "spool",
+					  _dir.c_str(), recs.size() - done);
+				return;
+			}
+			print(log_warning, "Spool %s full, dropping %zu old readings", "spool", _dir.c_str(),
+				  _segments[i].records);
+			count_dropped(_dropped, _segments[i].records);
+			unlink(path(_segments[i].seq).c_str());
+			_segments.erase(_segments.begin() + i);
+		}
+
+		Segment &tail = _segments.back();
+		size_t n = std::min(recs.size() - done, _segment_records - tail.records);
+		ssize_t len = write(_fd, &recs[done], n * RECORD_SIZE);
+		if (len != (ssize_t)(n * RECORD_SIZE)) {
+			// don't leave a partial record behind, it would shift all following ones
+			print(log_error, "Spool %s: write failed: %s", "spool", _dir.c_str(),
+				  len < 0 ? strerror(errno) : "short write");
+			if (ftruncate(_fd, tail.records * RECORD_SIZE) != 0) {
+				print(log_error, "Spool %s: cannot truncate: %s", "spool", _dir.c_str(),
+					  strerror(errno));
+			}
+			count_dropped(_dropped, recs.size() - done);
+			return;
+		}
+		tail.records += n;
+		done += n;
+		if (tail.records >= _segment_records)
+			rotate();
+	}
+	if (_fsync == FSYNC_ALWAYS)
+		fdatasync(_fd);
+}
+
+size_t Spool::load(std::list<Reading> &values, size_t n) {
+	size_t added = 0;
+	Record buf[LOAD_CHUNK];
+
+	while (added < n && _load_segment < _segments.size()) {
+		Segment &s = _segments[_load_segment];
+		if (_load >= s.records) {
+			if (_load_segment + 1 >= _segments.size())
+				break; // nothing more written yet
+			_load_segment++;
+			_load = 0;
+			continue;
+		}
+
+		int fd = open(path(s.seq).c_str(), O_RDONLY);
+		if (fd < 0) {
+			print(log_error, "Spool %s: cannot open segment: %s", "spool", _dir.c_str(),
+				  strerror(errno));
+			break;
+		}
+		while (added < n && _load < s.records) {
+			size_t cnt = std::min(std::min(n - added, s.records - _load), LOAD_CHUNK);
+			ssize_t len = pread(fd, buf, cnt * RECORD_SIZE, _load * RECORD_SIZE);
+			if (len != (ssize_t)(cnt * RECORD_SIZE)) {
+				print(log_error, "Spool %s: read failed", "spool", _dir.c_str());
+				close(fd);
+				return added;
+			}
+			for (size_t i = 0; i < cnt; i++) {
+				struct timeval tv;
+				int64_t ms = buf[i].time_ms;
+				if (!valid(buf[i])) {
+					// returned as deleted to keep the count in sync with ack(), not to be sent
+					print(log_warning, "Spool %s: skipping corrupt record", "spool",
+						  _dir.c_str());
+					ms = 0;
+				}
+				tv.tv_sec = ms / 1000;
+				tv.tv_usec = (ms % 1000) * 1000;
+				Reading r(buf[i].value, tv, ReadingIdentifier::Ptr());
+				if (ms == 0)
+					r.mark_delete();
+				values.push_back(r);
+			}
+			_load += cnt;
+			added += cnt;
+		}
+		close(fd);
+	}
+	return added;
+}
+
+void Spool::ack(size_t n) {
+	while (n > 0 && !_segments.empty()) {
+		Segment &front = _segments.front();
+		size_t take = std::min(n, front.records - _head);
+		_head += take;
+		n -= take;
+		if (_head < front.records || _segments.size() == 1)
+			break;
+		// completely acknowledged, the loaded position is beyond:
+		unlink(path(front.seq).c_str());
+		_segments.pop_front();
+		_head = 0;
+		if (_load_segment > 0)
+			_load_segment--;
+	}
+	write_head();
+}
+
+void Spool::write_head() {
+	Head h;
+	h.seq = _segments.front().seq;
+	h.records = _head;
+	h.crc = crc32(&h, offsetof(Head, crc));
+	h.reserved = 0;
+	if (pwrite(_head_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+		print(log_error, "Spool %s: cannot write head: %s", "spool", _dir.c_str(),
+			  strerror(errno));
+	}
+	if (_fsync == FSYNC_ALWAYS)
+		fdatasync(_head_fd);
+}
@@ -29,19 +29,31 @@
 
 #include "Config_Options.hpp"
 #include "CurlSessionProvider.hpp"
+#include "Metrics.hpp"
 #include <VZException.hpp>
 #include <api/CurlCallback.hpp>
 #include <api/CurlResponse.hpp>
 #include <api/InfluxDB.hpp>
+#include <api/JsonWriter.hpp>
 #include <curl/curl.h>
-#include <iomanip>
-#include <sstream>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 extern Config_Options options;
 
+// shared by all channels and batches
+static ApiMetrics &api_metrics() {
+	static ApiMetrics m("influxdb");
+	return m;
+}
+
 vz::api::InfluxDB::InfluxDB(const Channel::Ptr &ch, const std::list<Option> &pOptions)
-	: ApiIF(ch), _response(new vz::api::CurlResponse()), _last_timestamp(0), _lastReadingSent(0) {
+	: ApiIF(ch), _headers(NULL), _response(new vz::api::CurlResponse()), _last_timestamp(0),
+	  _lastReadingSent(0), _inflight(0) {
 	OptionList optlist;
 	print(log_debug, "InfluxDB API initialize", ch->name());
 
@@ -57,12 +69,10 @@ vz::api::InfluxDB::InfluxDB(const Channel::Ptr &ch, const std::list<Option> &pOp
 		throw;
 	}
 
-	_token_header = NULL;
 	try {
 		_token = optlist.lookup_string(pOptions, "token");
 		print(log_finest, "api InfluxDB using login Token: %s", ch->name(), _token.c_str());
 		_token = "Authorization: Token " + _token;
-		_token_header = curl_slist_append(_token_header, _token.c_str());
 	} catch (vz::OptionNotFoundException &e) {
 		print(log_finest, "api InfluxDB no Token set", ch->name());
 		_token = "";
@@ -207,6 +217,46 @@ vz::api::InfluxDB::InfluxDB(const Channel::Ptr &ch, const std::list<Option> &pOp
 		throw;
 	}
 
+	try {
+		_gzip = optlist.lookup_bool(pOptions, "gzip");
+		print(log_finest, "api InfluxDB using gzip: %s", ch->name(), _gzip ? "true" : "false");
+	} catch (vz::OptionNotFoundException &e) {
+#ifdef HAVE_ZLIB
+		_gzip = true;
+#else
+		_gzip = false; // only warn below if it was asked for
+#endif
+		print(log_finest, "api InfluxDB will use default gzip %s", ch->name(),
+			  _gzip ? "true" : "false");
+	} catch (vz::VZException &e) {
+		print(log_alert, "api InfluxDB requires parameter \"gzip\" as bool!", ch->name());
+		throw;
+	}
+#ifndef HAVE_ZLIB
+	if (_gzip) {
+		print(log_warning, "api InfluxDB built without zlib, sending uncompressed", ch->name());
+		_gzip = false;
+	}
+#endif
+
+	// the token is only used without username
+	if (!_token.empty() && _username.empty())
+		_headers = curl_slist_append(_headers, _token.c_str());
+	if (_gzip)
+		_headers = curl_slist_append(_headers, "Content-Encoding: gzip");
+
+	// everything in front of the value is the same for each line:
+	_line_prefix = _measurement_name;
+	if (_send_uuid) {
+		_line_prefix.append(",uuid=");
+		_line_prefix.append(ch->uuid());
+	}
+	if (!_tags.empty()) {
+		_line_prefix.append(",");
+		_line_prefix.append(_tags);
+	}
+	_line_prefix.append(" value=");
+
 	CURL *curlhelper = curl_easy_init();
 	if (!curlhelper) {
 		throw vz::VZException("CURL: cannot create handle for urlencode.");
@@ -234,10 +284,36 @@ vz::api::InfluxDB::InfluxDB(const Channel::Ptr &ch, const std::list<Option> &pOp
 	_url.append("&precision=ms");
 	print(log_debug, "api InfluxDB using url %s", ch->name(), _url.c_str());
 	curl_free(database_urlencoded);
+
+	if (!options.spool_dir().empty()) {
+		try {
+			_spool = Spool::Ptr(new Spool(options.spool_dir() + "/influxdb-" +
+											  (strlen(ch->uuid()) ? ch->uuid() : ch->name()),
+										  options.spool_segment_size(), options.spool_max_size(),
+										  options.spool_fsync()));
+		} catch (vz::VZException &e) {
+			print(log_alert, "Not spooling: %s", ch->name(), e.what());
+		}
+	}
+
+	if (options.sender_batch()) {
+		if (curlMultiSender) {
+			_batch = InfluxDBBatch::get(_url, _headers, _username, _password, _curl_timeout,
+										_ssl_verifypeer, _gzip);
+			_batch->add(this);
+		} else {
+			print(log_warning, "Batch mode requires the async sender. Sending per channel.",
+				  ch->name());
+		}
+	}
 }
 
 // destructor
-vz::api::InfluxDB::~InfluxDB() { curl_slist_free_all(_token_header); }
+vz::api::InfluxDB::~InfluxDB() {
+	if (_batch)
+		_batch->remove(this);
+	curl_slist_free_all(_headers);
+}
 
 void vz::api::InfluxDB::send() {
 	long int http_code;
@@ -247,6 +323,19 @@ void vz::api::InfluxDB::send() {
 	Buffer::Ptr buf = channel()->buffer();
 	Buffer::iterator it;
 
+	if (_batch) {
+		// Just hand over the readings, the batch sends them with the next flush.
+		_batch->lock();
+		collect_values();
+		VZ_PRINT(log_debug, "%d values waiting for batch transmission", channel()->name(),
+				 _values.size());
+		bool full = _batch->full();
+		_batch->unlock();
+		if (full)
+			_batch->flush(); // don't wait for the timer
+		return;
+	}
+
 	_api.curl =
 		curlSessionProvider ? curlSessionProvider->get_easy_session(_host + channel()->uuid()) : 0;
 
@@ -254,7 +343,7 @@ void vz::api::InfluxDB::send() {
 		throw vz::VZException("CURL: cannot create handle.");
 	}
 
-	print(log_debug, "Buffer has %i items", channel()->name(), buf->size());
+	VZ_PRINT(log_debug, "Buffer has %i items", channel()->name(), buf->size());
 
 	// delete items if the buffer grows too large
 	if (buf->size() > (unsigned)_max_buffer_size) {
@@ -263,6 +352,7 @@ void vz::api::InfluxDB::send() {
 			  channel()->name(), buf->size());
 		unsigned int delta_delete =
 			buf->size() - (unsigned)_max_buffer_size; // number of items to delete from buffer
+		metrics.dropped("influxdb")->inc(delta_delete);
 		buf->lock();
 		it = buf->begin();
 		while (!(
@@ -275,77 +365,29 @@ void vz::api::InfluxDB::send() {
 		}
 		buf->unlock();
 		buf->clean();
-		print(log_debug, "cleaned buffer, now %i items", channel()->name(), buf->size());
+		VZ_PRINT(log_debug, "cleaned buffer, now %i items", channel()->name(), buf->size());
 	}
 
-	int64_t timestamp = 1;
-	const int duplicates = channel()->duplicates();
-	const int duplicates_ms = duplicates * 1000;
+	std::list<Reading> spooled;
+	size_t spooled_lines = 0; // values from _spool in this request, incl. deleted ones
 
-	// build request body from buffer contents
+	// build request body from buffer contents, with a spool all go there first
 	buf->lock();
 	for (it = buf->begin(); it != buf->end(); it++) {
-		if (request_body_lines >= _max_batch_inserts) {
-			print(log_debug, "reached maximum lines for InfluxDB insertion request.",
-				  channel()->name());
+		if (!_spool && request_body_lines >= _max_batch_inserts) {
+			VZ_PRINT(log_debug, "reached maximum lines for InfluxDB insertion request.",
+					 channel()->name());
 			break;
 		}
 
-		bool sendData = false;
-
-		timestamp = it->time_ms();
+		VZ_PRINT(log_finest, "Reading buffer: timestamp %lld value %f", channel()->name(),
+				 it->time_ms(), it->value());
 
-		print(log_finest, "Reading buffer: timestamp %lld value %f", channel()->name(),
-			  it->time_ms(), it->value());
+		bool sendData = keep(*it);
 
-		print(log_debug, "compare: %lld %lld", channel()->name(), _last_timestamp, timestamp);
-		// we can only add/consider a timestamp if the ms resolution is not before than from
-		// previous one:
-		if (_last_timestamp <= timestamp) {
-			if (0 == duplicates) { // send all values
-				sendData = true;
-				_last_timestamp = timestamp;
-			} else {
-				const Reading &r = *it;
-				// duplicates should be ignored
-				// but send at least each <duplicates> seconds
-
-				if (!_lastReadingSent) { // first one from the duplicate consideration -> send it
-					sendData = true;
-					_lastReadingSent = new Reading(r);
-					_last_timestamp = timestamp;
-				} else { // one reading sent already. compare
-					// a) timestamp
-					// b) duplicate value
-					if ((timestamp >= (_last_timestamp + duplicates_ms)) ||
-						(r.value() != _lastReadingSent->value())) {
-						// send the current one:
-						sendData = true;
-						_last_timestamp = timestamp;
-						*_lastReadingSent = r;
-					} else {
-						// ignore it
-					}
-				}
-			}
-		}
-
-		if (sendData) {
-			request_body.append(_measurement_name);
-			if (_send_uuid) {
-				request_body.append(",uuid=");
-				request_body.append(channel()->uuid());
-			}
-			if (!_tags.empty()) {
-				request_body.append(",");
-				request_body.append(_tags);
-			}
-			std::stringstream value_str;
-			value_str << " value=" << std::fixed << std::setprecision(6) << it->value();
-			request_body.append(value_str.str());
-			request_body.append(" ");
-			request_body.append(std::to_string(timestamp));
-			request_body.append("\n"); // each measurement on new line
+		if (sendData && _spool) {
+			spooled.push_back(Reading(*it));
+		} else if (sendData && append_line(request_body, it->time_ms(), it->value())) {
 			request_body_lines++;
 		}
 
@@ -354,8 +396,39 @@ void vz::api::InfluxDB::send() {
 
 	buf->unlock();
 
+	if (_spool) {
+		buf->clean(); // everything is in the spool now
+		if (!spooled.empty())
+			_spool->append(spooled);
+		// (re)fill the values in memory, after a restart this replays the backlog
+		if (_values.size() < (size_t)_max_batch_inserts)
+			_spool->load(_values, _max_batch_inserts - _values.size());
+
+		for (std::list<Reading>::iterator v = _values.begin();
+			 v != _values.end() && spooled_lines < (size_t)_max_batch_inserts; ++v) {
+			spooled_lines++;
+			// corrupt records get acknowledged with the others
+			if (!v->deleted() && append_line(request_body, v->time_ms(), v->value()))
+				request_body_lines++;
+		}
+		if (request_body_lines == 0 && spooled_lines > 0) {
+			for (size_t i = 0; i < spooled_lines; i++)
+				_values.pop_front();
+			_spool->ack(spooled_lines);
+		}
+	}
+
+	std::string gz;
+	if (request_body_lines > 0 && _gzip && !gzip(request_body, gz)) {
+		print(log_error, "Cannot gzip the request body", channel()->name());
+		request_body_lines = 0;
+		if (!_spool)
+			buf->undelete();
+	}
+	const std::string &body = _gzip ? gz : request_body;
+
 	if (request_body_lines > 0) { // there is something to send
-		print(log_finest, "request body is %s", channel()->name(), request_body.c_str());
+		VZ_PRINT(log_finest, "request body is %s", channel()->name(), request_body.c_str());
 
 		_response->clear_response(); // initialize with empty response
 
@@ -364,9 +437,8 @@ void vz::api::InfluxDB::send() {
 			curl_easy_setopt(_api.curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
 			curl_easy_setopt(_api.curl, CURLOPT_USERNAME, _username.c_str());
 			curl_easy_setopt(_api.curl, CURLOPT_PASSWORD, _password.c_str());
-		} else if (_token_header) {
-			curl_easy_setopt(_api.curl, CURLOPT_HTTPHEADER, _token_header);
 		}
+		curl_easy_setopt(_api.curl, CURLOPT_HTTPHEADER, _headers);
 		curl_easy_setopt(_api.curl, CURLOPT_URL, _url.c_str());
 		curl_easy_setopt(_api.curl, CURLOPT_VERBOSE, options.verbosity() > 0);
 		curl_easy_setopt(_api.curl, CURLOPT_SSL_VERIFYPEER, _ssl_verifypeer);
@@ -378,21 +450,33 @@ void vz::api::InfluxDB::send() {
 		curl_easy_setopt(_api.curl, CURLOPT_NOSIGNAL, 1);
 		curl_easy_setopt(_api.curl, CURLOPT_TIMEOUT, _curl_timeout);
 
-		curl_easy_setopt(_api.curl, CURLOPT_POSTFIELDS, request_body.c_str());
+		curl_easy_setopt(_api.curl, CURLOPT_POSTFIELDS, body.data());
+		curl_easy_setopt(_api.curl, CURLOPT_POSTFIELDSIZE, (long)body.size());
 		curl_easy_setopt(_api.curl, CURLOPT_WRITEFUNCTION,
 						 &(vz::api::CurlCallback::write_callback));
 		curl_easy_setopt(_api.curl, CURLOPT_WRITEDATA, response());
 
 		// actually send the request to InfluxDB
-		curl_code = curl_easy_perform(_api.curl);
-		print(log_finest, "Influxdb curl terminated", channel()->name());
+		{
+			MetricsTimer timer(api_metrics().request);
+			curl_code = curl_easy_perform(_api.curl);
+		}
+		VZ_PRINT(log_finest, "Influxdb curl terminated", channel()->name());
 		curl_easy_getinfo(_api.curl, CURLINFO_RESPONSE_CODE, &http_code);
 
 		if (curl_code == CURLE_OK && http_code >= 200 && http_code < 300) { // everything is ok
-			print(log_debug, "InfluxDB CURL success", channel()->name());
-			buf->clean(); // delete the stuff we just sent to InfluxDB from the buffer
+			VZ_PRINT(log_debug, "InfluxDB CURL success", channel()->name());
+			if (_spool) {
+				for (size_t i = 0; i < spooled_lines; i++)
+					_values.pop_front();
+				_spool->ack(spooled_lines);
+			} else {
+				buf->clean(); // delete the stuff we just sent to InfluxDB from the buffer
+			}
 		} else {
-			buf->undelete(); // failure to insert, so dont delete the buffer
+			api_metrics().retries->inc();
+			if (!_spool)
+				buf->undelete(); // failure to insert, so dont delete the buffer
 			if (curl_code != CURLE_OK) {
 				print(log_error, "CURL Error: %s", channel()->name(),
 					  curl_easy_strerror(curl_code));
@@ -413,6 +497,288 @@ void vz::api::InfluxDB::send() {
 	}
 }
 
+bool vz::api::InfluxDB::keep(const Sample &r) {
+	int64_t timestamp = r.time_ms();
+	const int duplicates = channel()->duplicates();
+
+	VZ_PRINT(log_debug, "compare: %lld %lld", channel()->name(), _last_timestamp, timestamp);
+	// we can only add/consider a timestamp if the ms resolution is not before than from
+	// previous one:
+	if (_last_timestamp > timestamp)
+		return false;
+
+	if (0 == duplicates) { // send all values
+		_last_timestamp = timestamp;
+		return true;
+	}
+
+	// duplicates should be ignored
+	// but send at least each <duplicates> seconds
+	if (!_lastReadingSent) { // first one from the duplicate consideration -> send it
+		_lastReadingSent = new Reading(r);
+	} else if ((timestamp >= (_last_timestamp + duplicates * 1000)) ||
+			   (r.value() != _lastReadingSent->value())) {
+		// a) timestamp b) duplicate value: send the current one
+		*_lastReadingSent = r;
+	} else {
+		return false; // ignore it
+	}
+	_last_timestamp = timestamp;
+	return true;
+}
+
+bool vz::api::InfluxDB::append_line(std::string &body, int64_t timestamp, double value) const {
+	if (!isfinite(value))
+		return false; // not supported by the line protocol
+
+	// <measurement>[,uuid=<uuid>][,<tags>] value=<value> <timestamp>\n
+	char buf[64];
+	size_t len = JsonWriter::format_double(buf, value);
+	buf[len++] = ' ';
+	len += JsonWriter::format_int(buf + len, timestamp);
+	buf[len++] = '\n';
+
+	body.append(_line_prefix);
+	body.append(buf, len);
+	return true;
+}
+
+bool vz::api::InfluxDB::gzip(const std::string &in, std::string &out) {
+#ifdef HAVE_ZLIB
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	// 15 + 16: gzip instead of zlib header. Line protocol is very repetitive,
+	// the fastest level already compresses it well.
+	if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	out.resize(deflateBound(&zs, in.size()));
+	zs.next_in = (Bytef *)in.data();
+	zs.avail_in = in.size();
+	zs.next_out = (Bytef *)&out[0];
+	zs.avail_out = out.size();
+	int res = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return res == Z_STREAM_END;
+#else
+	return false;
+#endif
+}
+
+void vz::api::InfluxDB::collect_values() {
+	Buffer::Ptr buf = channel()->buffer();
+
+	// with a spool they go there first
+	std::list<Reading> spooled;
+	std::list<Reading> &values = _spool ? spooled : _values;
+
+	buf->lock();
+	for (Buffer::iterator it = buf->begin(); it != buf->end(); it++) {
+		if (keep(*it))
+			values.push_back(Reading(*it));
+		it->mark_delete();
+	}
+	buf->unlock();
+	buf->clean();
+
+	if (_spool) {
+		if (!spooled.empty())
+			_spool->append(spooled);
+		// (re)fill the values in memory, after a restart this replays the backlog
+		if (_values.size() < (size_t)_max_batch_inserts)
+			_spool->load(_values, _max_batch_inserts - _values.size());
+	} else if (_values.size() > (size_t)_max_buffer_size) {
+		size_t n = _values.size() - _max_buffer_size;
+		print(log_warning,
+			  "Buffer too big (%i items). Deleting items. (This indicates a connection problem)",
+			  channel()->name(), _values.size());
+		for (size_t i = 0; i < n; i++)
+			_values.pop_front();
+		_inflight = _inflight > n ? _inflight - n : 0;
+	}
+}
+
+void vz::api::InfluxDB::ack_values(size_t n) {
+	if (n > _values.size())
+		n = _values.size();
+	for (size_t i = 0; i < n; i++)
+		_values.pop_front();
+	if (_spool)
+		_spool->ack(n);
+}
+
 void vz::api::InfluxDB::register_device() {
 	// TODO: is this needed?
 }
+
+std::map<std::string, vz::api::InfluxDBBatch::Ptr> vz::api::InfluxDBBatch::_batches;
+pthread_mutex_t vz::api::InfluxDBBatch::_batches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+vz::api::InfluxDBBatch::Ptr
+vz::api::InfluxDBBatch::get(const std::string &url, const struct curl_slist *headers,
+							const std::string &username, const std::string &password, long timeout,
+							bool ssl_verifypeer, bool gzip) {
+	// channels can only share a request if it would look the same for each of them
+	std::string key = url + "\n" + username + "\n" + password;
+	for (const struct curl_slist *h = headers; h; h = h->next)
+		key.append("\n").append(h->data);
+	if (!ssl_verifypeer)
+		key.append("\nnoverify");
+
+	pthread_mutex_lock(&_batches_mutex);
+	Ptr &batch = _batches[key];
+	if (!batch) {
+		batch = Ptr(
+			new InfluxDBBatch(url, headers, username, password, timeout, ssl_verifypeer, gzip));
+		curlMultiSender->every(options.sender_batch_window(), &InfluxDBBatch::flush_timer,
+							   batch.get());
+		print(log_info, "Writing batched every %dms to %s", "influxdb",
+			  options.sender_batch_window(), url.c_str());
+	}
+	Ptr toRet = batch;
+	pthread_mutex_unlock(&_batches_mutex);
+	return toRet;
+}
+
+vz::api::InfluxDBBatch::InfluxDBBatch(const std::string &url, const struct curl_slist *headers,
+									  const std::string &username, const std::string &password,
+									  long timeout, bool ssl_verifypeer, bool gzip)
+	: _url(url), _headers(NULL), _username(username), _password(password), _timeout(timeout),
+	  _ssl_verifypeer(ssl_verifypeer), _gzip(gzip), _max_lines(options.sender_batch_tuples()),
+	  _max_bytes(options.sender_batch_bytes()), _retry_after(0) {
+	_mutex = PTHREAD_MUTEX_INITIALIZER;
+	for (const struct curl_slist *h = headers; h; h = h->next)
+		_headers = curl_slist_append(_headers, h->data);
+	_body.reserve(_max_bytes + 256);
+}
+
+vz::api::InfluxDBBatch::~InfluxDBBatch() {
+	curl_slist_free_all(_headers);
+	pthread_mutex_destroy(&_mutex);
+}
+
+void vz::api::InfluxDBBatch::add(InfluxDB *api) {
+	lock();
+	_apis.push_back(api);
+	unlock();
+}
+
+void vz::api::InfluxDBBatch::remove(InfluxDB *api) {
+	lock();
+	_apis.remove(api);
+	unlock();
+}
+
+void vz::api::InfluxDBBatch::flush_timer(void *arg) { static_cast<InfluxDBBatch *>(arg)->flush(); }
+
+bool vz::api::InfluxDBBatch::full() const {
+	size_t waiting = 0;
+	for (std::list<InfluxDB *>::const_iterator it = _apis.begin(); it != _apis.end(); ++it)
+		waiting += (*it)->_values.size() - (*it)->_inflight;
+	return waiting >= _max_lines;
+}
+
+void vz::api::InfluxDBBatch::processResponse(CURLcode curl_code, long http_code,
+											  const std::string &response) {
+	// called with lock held
+	if (curl_code == CURLE_OK && http_code >= 200 && http_code < 300) {
+		VZ_PRINT(log_debug, "InfluxDB CURL success", "influxdb");
+		for (std::list<InfluxDB *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+			(*it)->ack_values((*it)->_inflight);
+			(*it)->_inflight = 0;
+		}
+		return;
+	}
+
+	if (curl_code != CURLE_OK)
+		print(log_error, "CURL Error: %s", "influxdb", curl_easy_strerror(curl_code));
+	print(log_error, "InfluxDB error! - HTTP Status %i", "influxdb", http_code);
+	if (!response.empty())
+		print(log_error, "InfluxDB response was %s", "influxdb", response.c_str());
+	for (std::list<InfluxDB *>::iterator it = _apis.begin(); it != _apis.end(); ++it)
+		(*it)->_inflight = 0;
+
+	api_metrics().retries->inc();
+	print(log_info, "Waiting %i secs for next request due to previous failure", "influxdb",
+		  options.retry_pause());
+	_retry_after = time(NULL) + options.retry_pause();
+}
+
+void vz::api::InfluxDBBatch::flush() {
+	lock();
+	if (_request) {
+		if (!_request->done()) {
+			unlock();
+			return;
+		}
+		CurlRequest::Ptr req = _request;
+		_request.reset();
+		processResponse(req->curlCode(), req->httpCode(), req->response());
+	}
+	if (time(NULL) < _retry_after) {
+		unlock();
+		return;
+	}
+
+	_body.clear();
+	size_t nrLines = 0;
+	size_t nrChannels = 0;
+	bool full = false;
+	for (std::list<InfluxDB *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+		InfluxDB *api = *it;
+		api->_inflight = 0;
+		if (full || api->_values.empty())
+			continue;
+
+		size_t written = 0;
+		for (std::list<Reading>::iterator v = api->_values.begin(); v != api->_values.end();
+			 ++v) {
+			size_t len = _body.size();
+			if (v->deleted() || !api->append_line(_body, v->time_ms(), v->value())) {
+				// corrupt record from the spool or nan, acknowledge it with the others
+				api->_inflight++;
+				continue;
+			}
+			// always send at least one line, even if it alone exceeds max_bytes
+			if (nrLines > 0 && (nrLines >= _max_lines || _body.size() > _max_bytes)) {
+				_body.resize(len);
+				full = true;
+				break;
+			}
+			api->_inflight++;
+			written++;
+			nrLines++;
+		}
+		if (written > 0)
+			nrChannels++;
+	}
+
+	if (nrLines == 0) {
+		for (std::list<InfluxDB *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+			(*it)->ack_values((*it)->_inflight);
+			(*it)->_inflight = 0;
+		}
+		unlock();
+		return;
+	}
+
+	if (_gzip && !InfluxDB::gzip(_body, _gz)) {
+		print(log_error, "Cannot gzip the request body", "influxdb");
+		for (std::list<InfluxDB *>::iterator it = _apis.begin(); it != _apis.end(); ++it)
+			(*it)->_inflight = 0;
+		unlock();
+		return;
+	}
+	const std::string &body = _gzip ? _gz : _body;
+
+	print(log_info, "Writing %d lines of %d channels (%d bytes) ...", "influxdb", nrLines,
+		  nrChannels, body.size());
+	VZ_PRINT(log_finest, "request body is %s", "influxdb", _body.c_str());
+	_request = CurlRequest::Ptr(new CurlRequest(_url, body, _headers, _timeout));
+	if (!_username.empty())
+		_request->basic_auth(_username, _password);
+	_request->verify_peer(_ssl_verifypeer);
+	_request->duration(api_metrics().request);
+	curlMultiSender->submit(_request);
+	unlock();
+}
@@ -0,0 +1,319 @@
+/**
+ * JsonWriter - streaming JSON serializer into a reusable byte buffer
+ *
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+
+#include "api/JsonWriter.hpp"
+
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <VZException.hpp>
+
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+// std::to_chars() for floating point came with gcc 11 and needs C++17. Otherwise values
+// with few decimals take format_decimal(), the others printf, trying 15 significant digits
+// first and 17 only if needed to read back the same.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define VZ_HAVE_TO_CHARS_DOUBLE 1
+#endif
+
+namespace {
+
+const double POW10[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+						1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+/**
+ * Meter readings mostly have a handful of decimals: find the fewest decimals k for which
+ * m / 10^k gives back v. m and 10^k are exact doubles (below 2^53) and the division is
+ * correctly rounded like strtod(), so the digits of m with the point k places from the
+ * right read back as v.
+ *
+ * @return 0 if v needs more than 15 decimals or more than 15 digits
+ */
+size_t format_decimal(char *buf, double v) {
+	const double limit = 9007199254740992.0; // 2^53
+	double a = fabs(v);
+	for (int k = 0; k < 16 && a * POW10[k] < limit; k++) {
+		double m = floor(a * POW10[k] + 0.5);
+		if (m / POW10[k] != a)
+			continue;
+
+		char tmp[24];
+		int n = 0;
+		uint64_t u = (uint64_t)m;
+		do {
+			tmp[n++] = '0' + (char)(u % 10);
+			u /= 10;
+		} while (u);
+		while (n <= k) // at least one digit before the point
+			tmp[n++] = '0';
+		size_t len = 0;
+		if (signbit(v))
+			buf[len++] = '-';
+		while (n) {
+			if (n == k)
+				buf[len++] = '.';
+			buf[len++] = tmp[--n];
+		}
+		return len;
+	}
+	return 0;
+}
+
+} // namespace
+
+JsonWriter::JsonWriter(size_t capacity) : _buf(NULL), _size(0), _capacity(0), _depth(0) {
+	grow(capacity > 0 ? capacity : 1);
+	clear();
+}
+
+JsonWriter::~JsonWriter() { free(_buf); }
+
+void JsonWriter::clear() {
+	_size = 0;
+	_depth = 0;
+	_comma[0] = false;
+	terminate();
+}
+
+void JsonWriter::grow(size_t min) {
+	size_t capacity = _capacity ? _capacity : 64;
+	while (capacity < min)
+		capacity *= 2;
+	char *buf = (char *)realloc(_buf, capacity);
+	if (!buf)
+		throw std::bad_alloc();
+	_buf = buf;
+	_capacity = capacity;
+}
+
+void JsonWriter::separator() {
+	if (_comma[_depth]) {
+		reserve(1);
+		put(',');
+	}
+	_comma[_depth] = true;
+}
+
+JsonWriter &JsonWriter::begin_object() {
+	if (_depth + 1 >= MAX_DEPTH)
+		throw vz::VZException("JsonWriter: nesting too deep");
+	separator();
+	reserve(1);
+	put('{');
+	terminate();
+	_comma[++_depth] = false;
+	return *this;
+}
+
+JsonWriter &JsonWriter::end_object() {
+	reserve(1);
+	put('}');
+	terminate();
+	if (_depth > 0)
+		_depth--;
+	return *this;
+}
+
+JsonWriter &JsonWriter::begin_array() {
+	if (_depth + 1 >= MAX_DEPTH)
+		throw vz::VZException("JsonWriter: nesting too deep");
+	separator();
+	reserve(1);
+	put('[');
+	terminate();
+	_comma[++_depth] = false;
+	return *this;
+}
+
+JsonWriter &JsonWriter::end_array() {
+	reserve(1);
+	put(']');
+	terminate();
+	if (_depth > 0)
+		_depth--;
+	return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *name) {
+	separator();
+	string(name);
+	reserve(1);
+	put(':');
+	terminate();
+	_comma[_depth] = false; // the value follows without separator
+	return *this;
+}
+
+void JsonWriter::string(const char *s) {
+	static const char hex[] = "0123456789abcdef";
+	size_t len = strlen(s);
+	reserve(len + 2);
+	put('"');
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		unsigned char c = *p;
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			put(c);
+			continue;
+		}
+		reserve(6 + len); // worst case \u00XX, keeps room for the rest as well
+		put('\\');
+		switch (c) {
+		case '"':
+		case '\\':
+			put(c);
+			break;
+		case '\n':
+			put('n');
+			break;
+		case '\r':
+			put('r');
+			break;
+		case '\t':
+			put('t');
+			break;
+		default:
+			put('u');
+			put('0');
+			put('0');
+			put(hex[c >> 4]);
+			put(hex[c & 0xf]);
+		}
+	}
+	put('"');
+	terminate();
+}
+
+JsonWriter &JsonWriter::value(const char *s) {
+	if (!s)
+		return null();
+	separator();
+	string(s);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(int64_t v) {
+	separator();
+	reserve(24);
+	_size += format_int(_buf + _size, v);
+	terminate();
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(double v) {
+	separator();
+	reserve(32);
+	_size += format_double(_buf + _size, v);
+	terminate();
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(bool v) {
+	separator();
+	reserve(5);
+	const char *s = v ? "true" : "false";
+	while (*s)
+		put(*s++);
+	terminate();
+	return *this;
+}
+
+JsonWriter &JsonWriter::null() {
+	separator();
+	reserve(4);
+	memcpy(_buf + _size, "null", 4);
+	_size += 4;
+	terminate();
+	return *this;
+}
+
+JsonWriter &JsonWriter::tuple(int64_t ts, double v) {
+	separator();
+	reserve(2 + 24 + 1 + 32);
+	put('[');
+	_size += format_int(_buf + _size, ts);
+	put(',');
+	_size += format_double(_buf + _size, v);
+	put(']');
+	terminate();
+	return *this;
+}
+
+JsonWriter &JsonWriter::tuple(int64_t ts, int64_t v) {
+	separator();
+	reserve(2 + 24 + 1 + 24);
+	put('[');
+	_size += format_int(_buf + _size, ts);
+	put(',');
+	_size += format_int(_buf + _size, v);
+	put(']');
+	terminate();
+	return *this;
+}
+
+JsonWriter::Mark JsonWriter::mark() const {
+	Mark m;
+	m.size = _size;
+	m.depth = _depth;
+	m.comma = _comma[_depth];
+	return m;
+}
+
+void JsonWriter::rollback(const Mark &m) {
+	_size = m.size;
+	_depth = m.depth;
+	_comma[_depth] = m.comma;
+	terminate();
+}
+
+size_t JsonWriter::format_int(char *buf, int64_t v) {
+	char tmp[24];
+	size_t n = 0;
+	// work on the unsigned magnitude, -INT64_MIN doesn't fit into int64_t
+	uint64_t u = v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+	do {
+		tmp[n++] = '0' + (char)(u % 10);
+		u /= 10;
+	} while (u);
+	size_t len = 0;
+	if (v < 0)
+		buf[len++] = '-';
+	while (n)
+		buf[len++] = tmp[--n];
+	return len;
+}
+
+size_t JsonWriter::format_double(char *buf, double v) {
+	if (!isfinite(v)) { // not representable in JSON
+		memcpy(buf, "null", 4);
+		return 4;
+	}
+	size_t decimal = format_decimal(buf, v);
+	if (decimal > 0)
+		return decimal;
+#ifdef VZ_HAVE_TO_CHARS_DOUBLE
+	std::to_chars_result r = std::to_chars(buf, buf + 32, v);
+	return r.ptr - buf;
+#else
+	int len = snprintf(buf, 32, "%.15g", v);
+	if (strtod(buf, NULL) != v)
+		len = snprintf(buf, 32, "%.17g", v);
+	// printf honours the locale, JSON doesn't:
+	for (int i = 0; i < len; i++)
+		if (buf[i] == ',')
+			buf[i] = '.';
+	return len;
+#endif
+}
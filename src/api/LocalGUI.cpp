@@ -88,7 +88,7 @@ void vz::api::LocalGUI::send()
   buf->lock();
   for (Buffer::iterator it = buf->begin(); it != buf->end(); it++)
   {
-    const Reading &r = *it;
+    const Sample &r = *it;
     val = r.value();
     it->mark_delete();
   }
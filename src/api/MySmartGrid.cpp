@@ -152,18 +152,20 @@ void vz::api::MySmartGrid::send() {
 	} else { // _first_ts = 0
 	}
 
+	json_str = NULL;
 	switch (_channelType) {
 	case chn_type_device:
 		json_obj = _apiDevice(channel()->buffer());
+		json_str = json_object_to_json_string(json_obj);
 		break;
 	case chn_type_sensor:
-		json_obj = _apiSensor(channel()->buffer());
+		if (_apiSensor(channel()->buffer()))
+			json_str = _json.c_str();
 		break;
 	}
-	json_str = json_object_to_json_string(json_obj);
 	if (json_str == NULL || strcmp(json_str, "null") == 0) {
 		print(log_debug, "JSON request body is null. Nothing to send now.", channel()->name());
-		json_object_put(json_obj); // TODO untested!
+		json_object_put(json_obj);
 		return;
 	}
 
@@ -363,10 +365,7 @@ json_object *vz::api::MySmartGrid::_apiDevice(Buffer::Ptr buf) {
 	}
 }
 
-json_object *vz::api::MySmartGrid::_apiSensor(Buffer::Ptr buf) {
-
-	return _json_object_measurements(buf);
-}
+bool vz::api::MySmartGrid::_apiSensor(Buffer::Ptr buf) { return _json_measurements(buf); }
 
 /*---------------------------------------------------------------------*/
 /**
@@ -464,14 +463,12 @@ json_object *vz::api::MySmartGrid::_json_object_sensor(const std::string &sensor
 /**
  * @brief MySmartGrid sensor measurements message
  * @param[in] buf
- * @return <ReturnValue>
+ * @return false if there are no measurements to send
  **/
 /*---------------------------------------------------------------------*/
-json_object *vz::api::MySmartGrid::_json_object_measurements(Buffer::Ptr buf) {
+bool vz::api::MySmartGrid::_json_measurements(Buffer::Ptr buf) {
 	//  measurements: [[<timestamp1>,<value1>], [<timestamp2>,<value2>], ... ,[<timestamp n>,<value
 	//  n>]]
-	json_object *json_obj = json_object_new_object();
-	json_object *json_tuples = json_object_new_array();
 	Buffer::iterator it;
 
 	// long last_counter = 0;
@@ -500,19 +497,19 @@ json_object *vz::api::MySmartGrid::_json_object_measurements(Buffer::Ptr buf) {
 
 	// print(log_debug, "Valuescounter: %d", channel()->name(), _values.size());
 
-	for (it = _values.begin(); it != _values.end(); it++) {
+	for (std::list<Reading>::iterator it = _values.begin(); it != _values.end(); it++) {
 		timestamp = it->time_s();
 		value = it->value() * _scaler;
 		print(log_debug, "==> %ld, %lf - %ld", channel()->name(), timestamp, it->value(), value);
 	}
 	if (_values.size() < 1 || (_values.size() < 2 && _first_counter == 0)) {
-		return NULL;
+		return false;
 	}
 
-	for (it = _values.begin(); it != _values.end(); it++) {
-		struct json_object *json_tuple = json_object_new_array();
-
-		// TODO use long int of new json-c version
+	_json.clear();
+	_json.begin_object();
+	_json.key("measurements").begin_array();
+	for (std::list<Reading>::iterator it = _values.begin(); it != _values.end(); it++) {
 		// API requires milliseconds => * 1000
 		long timestamp = it->time_s();
 		long value = it->value() * _scaler;
@@ -523,17 +520,16 @@ json_object *vz::api::MySmartGrid::_json_object_measurements(Buffer::Ptr buf) {
 		} else {
 			if (/*(_last_counter < value)  &&*/ (_first_ts < timestamp)) {
 				_first_ts = timestamp;
-				json_object_array_add(json_tuple, json_object_new_int(timestamp));
-				json_object_array_add(json_tuple, json_object_new_int(value - _first_counter));
-				json_object_array_add(json_tuples, json_tuple);
+				_json.tuple((int64_t)timestamp, (int64_t)(value - _first_counter));
 				_last_counter = value;
 			} // else return NULL;
 		}
 	}
 
-	json_object_object_add(json_obj, "measurements", json_tuples);
+	_json.end_array();
+	_json.end_object();
 
-	return json_obj;
+	return true;
 }
 
 void vz::api::MySmartGrid::_api_header() {
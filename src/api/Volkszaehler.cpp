@@ -45,6 +45,7 @@
 # include <pico/stdlib.h>
 #else // VZ_PICO
 # include "CurlSessionProvider.hpp"
+# include "Metrics.hpp"
 #endif // VZ_PICO
 #include <VZException.hpp>
 #include <api/Volkszaehler.hpp>
@@ -52,12 +53,25 @@
 extern Config_Options options;
 
 const int MAX_CHUNK_SIZE = 64;
+#ifndef VZ_PICO
+const int SPOOL_CHUNK_SIZE = 1024; // replay a backlog from the spool faster
+const size_t SPOOL_WINDOW = 4096;  // values loaded from the spool into memory
+
+// shared by all channels and batches
+static ApiMetrics &api_metrics() {
+	static ApiMetrics m("volkszaehler");
+	return m;
+}
+#endif // VZ_PICO
 
 vz::api::Volkszaehler::Volkszaehler(Channel::Ptr ch, std::list<Option> pOptions)
-	: ApiIF(ch), _last_timestamp(0), _lastReadingSent(0)
+	: ApiIF(ch),
 #ifdef VZ_PICO
-        ,_api(NULL)
+	  _api(NULL),
+#else // VZ_PICO
+	  _closing(false), _inflight(0),
 #endif // VZ_PICO
+	  _last_timestamp(0), _lastReadingSent(0), _sent(0)
 {
 	OptionList optlist;
 	char agent[255];
@@ -137,6 +151,27 @@ vz::api::Volkszaehler::Volkszaehler(Channel::Ptr ch, std::list<Option> pOptions)
 	_api.headers = curl_slist_append(_api.headers, "Content-type: application/json");
 	_api.headers = curl_slist_append(_api.headers, "Accept: application/json");
 	_api.headers = curl_slist_append(_api.headers, agent);
+	pthread_mutex_init(&_mutex, NULL);
+
+	if (!options.spool_dir().empty()) {
+		try {
+			_spool = Spool::Ptr(new Spool(options.spool_dir() + "/volkszaehler-" + channel()->uuid(),
+										  options.spool_segment_size(), options.spool_max_size(),
+										  options.spool_fsync()));
+		} catch (vz::VZException &e) {
+			print(log_alert, "Not spooling: %s", ch->name(), e.what());
+		}
+	}
+
+	if (options.sender_batch()) {
+		if (curlMultiSender) {
+			_batch = VolkszaehlerBatch::get(_middleware, _api.headers, _curlTimeout);
+			_batch->add(this);
+		} else {
+			print(log_warning, "Batch mode requires the async sender. Sending per channel.",
+				  ch->name());
+		}
+	}
 #endif // VZ_PICO
 
   response.size = 0;
@@ -149,6 +184,23 @@ vz::api::Volkszaehler::~Volkszaehler() {
 
 #ifdef VZ_PICO
   delete _api;
+#else // VZ_PICO
+  if (_batch)
+    _batch->remove(this);
+  if (curlMultiSender)
+  {
+    // no callbacks from the curlMultiSender thread after this
+    pthread_mutex_lock(&_mutex);
+    _closing = true;
+    CurlRequest::Ptr req = _request;
+    pthread_mutex_unlock(&_mutex);
+    if (req)
+    {
+      req->cancel_on_done();
+    }
+    curlMultiSender->remove_timers(this);
+  }
+  pthread_mutex_destroy(&_mutex);
 #endif // VZ_PICO
 
   free(response.data);
@@ -161,13 +213,13 @@ void vz::api::Volkszaehler::checkResponse()
   uint state = _api->getState();
   if(state != VZ_SRV_REPLIED)
   {
-    print(log_debug, "Waiting for response ...", channel()->name());
+    VZ_PRINT(log_debug, "Waiting for response ...", channel()->name());
     return;
   }
 
   if(strcmp(channel()->name(), _api->getChannel()) != 0)
   {
-    print(log_debug, "Waiting for other channel '%s' ...", channel()->name(), _api->getChannel());
+    VZ_PRINT(log_debug, "Waiting for other channel '%s' ...", channel()->name(), _api->getChannel());
     return;
   }
 
@@ -189,19 +241,19 @@ void vz::api::Volkszaehler::checkResponse()
   {
     if(resp[0] == '\r' && resp[1] == '\n')
     {
-      print(log_debug, "HTTP empty line", channel()->name());
+      VZ_PRINT(log_debug, "HTTP empty line", channel()->name());
     }
     else if(sscanf(resp, "HTTP/%*d.%*d %d %[^\n]\n", &http_code, buf) == 2)
     {
-      print(log_debug, "HTTP result: %d %s", channel()->name(), http_code, buf);
+      VZ_PRINT(log_debug, "HTTP result: %d %s", channel()->name(), http_code, buf);
     }
     else if((sscanf(resp, "%[a-zA-Z-]: %[^\n]\n", buf, buf2) == 2) && (buf[0] != '{')) // curly brace confuses vi }
     {
-      print(log_debug, "HTTP header: %s %s", channel()->name(), buf, buf2);
+      VZ_PRINT(log_debug, "HTTP header: %s %s", channel()->name(), buf, buf2);
     }
     else
     {
-      print(log_debug, "HTTP response payload: %s", channel()->name(), resp);
+      VZ_PRINT(log_debug, "HTTP response payload: %s", channel()->name(), resp);
       // ORIG response.data = strdup(resp);
       if(response.size <= strlen(resp))
       {
@@ -218,9 +270,83 @@ void vz::api::Volkszaehler::checkResponse()
   this->processResponse(http_code, errCode);
   _api->setState(VZ_SRV_READY);
   return;
+#else // VZ_PICO
+  // Requests via curlMultiSender are handled by request_done() as they complete.
 #endif // VZ_PICO
 }
 
+#ifndef VZ_PICO
+void vz::api::Volkszaehler::request_done(void *arg)
+{
+  // from the curlMultiSender thread
+  Volkszaehler *api = static_cast<Volkszaehler *>(arg);
+  pthread_mutex_lock(&api->_mutex);
+  CurlRequest::Ptr req = api->_request;
+  api->_request.reset();
+
+  const std::string &resp = req->response();
+  api->response.data = (char *) realloc(api->response.data, resp.size() + 1);
+  memcpy(api->response.data, resp.data(), resp.size());
+  api->response.data[resp.size()] = 0;
+  api->response.size = resp.size();
+  api->errMsg = curl_easy_strerror(req->curlCode());
+
+  api->processResponse(req->httpCode(), req->curlCode());
+
+  // continue with what is left or came in meanwhile, after a failure once the pause is over:
+  int retry_ms = api->_backoff.remaining_ms();
+  if (!retry_ms)
+  {
+    api->post_values();
+  }
+  pthread_mutex_unlock(&api->_mutex);
+  if (retry_ms)
+  {
+    curlMultiSender->after(retry_ms, &Volkszaehler::retry_timer, api);
+  }
+}
+
+void vz::api::Volkszaehler::retry_timer(void *arg)
+{
+  Volkszaehler *api = static_cast<Volkszaehler *>(arg);
+  pthread_mutex_lock(&api->_mutex);
+  api->post_values();
+  pthread_mutex_unlock(&api->_mutex);
+}
+
+void vz::api::Volkszaehler::post_values()
+{
+  if (_request || _closing)
+  {
+    VZ_PRINT(log_debug, "Previous request still pending. Cannot send yet ...", channel()->name());
+    return;
+  }
+
+  bool haveData;
+  {
+    MetricsTimer timer(api_metrics().encode);
+    haveData = api_json_tuples(channel()->buffer());
+  }
+  if (!haveData)
+  {
+    VZ_PRINT(log_debug, "No data to send.", channel()->name());
+    return;
+  }
+
+  VZ_PRINT(log_debug, "JSON request body: %s", channel()->name(), outputData.c_str());
+  _request = CurlRequest::Ptr(new CurlRequest(
+      _url, std::string(outputData.c_str(), outputData.size()), _api.headers, _curlTimeout));
+  if (options.verbosity())
+  {
+    _request->debug(curl_custom_debug_callback, channel().get());
+  }
+  _request->duration(api_metrics().request);
+  _request->on_done(&Volkszaehler::request_done, this);
+  curlMultiSender->submit(_request);
+  VZ_PRINT(log_finest, "Volkszaehler API request queued.", channel()->name());
+}
+#endif // VZ_PICO
+
 void vz::api::Volkszaehler::processResponse(long int http_code, uint errCode)
 {
   uint errOK = 0;
@@ -231,19 +357,14 @@ void vz::api::Volkszaehler::processResponse(long int http_code, uint errCode)
   if (errCode == errOK && http_code == 200)
   {
     // everything is ok
-    print(log_debug, "CURL Request succeeded with code: %i", channel()->name(), http_code);
-    if (_values.size() <= (size_t)MAX_CHUNK_SIZE)
-    {
-      print(log_finest, "emptied all (%d) values", channel()->name(), _values.size());
-      _values.clear();
-    }
-    else
-    {
-      // remove only the first MAX_CHUNK_SIZE values:
-      for (int i = 0; i < MAX_CHUNK_SIZE; ++i)
-        _values.pop_front();
-      print(log_finest, "emptied MAX_CHUNK_SIZE values", channel()->name());
-    }
+    VZ_PRINT(log_debug, "CURL Request succeeded with code: %i", channel()->name(), http_code);
+    // remove the values just sent:
+    ack_values(_sent);
+    VZ_PRINT(log_finest, "emptied %d values, %d left", channel()->name(), _sent, _values.size());
+    _sent = 0;
+#ifndef VZ_PICO
+    _backoff.reset();
+#endif // not VZ_PICO
 
     // clear buffer-readings
     // channel()->buffer.sent = last->next;
@@ -266,12 +387,24 @@ void vz::api::Volkszaehler::processResponse(long int http_code, uint errCode)
 #ifndef VZ_PICO
   // householding
   free(response.data);
+  response.data = NULL;
+  response.size = 0;
 
   if ((errCode != errOK || http_code != 200))
   {
-    print(log_info, "Waiting %i secs for next request due to previous failure",
-          channel()->name(), options.retry_pause());
-    sleep(options.retry_pause());
+    api_metrics().retries->inc();
+    if (curlMultiSender)
+    {
+      // don't block, longer pauses while the middleware keeps failing
+      print(log_info, "Waiting %i secs for next request due to previous failure",
+            channel()->name(), _backoff.failed(options.retry_pause()));
+    }
+    else
+    {
+      print(log_info, "Waiting %i secs for next request due to previous failure",
+            channel()->name(), options.retry_pause());
+      sleep(options.retry_pause());
+    }
   }
 #endif // not VZ_PICO
 }
@@ -280,27 +413,26 @@ void vz::api::Volkszaehler::send()
 {
   long int http_code = 0;
   uint errCode = 0;
-  errMsg = "OK";
 
-  print(log_debug, "Volkszaehler API sending data ...", channel()->name());
+  VZ_PRINT(log_debug, "Volkszaehler API sending data ...", channel()->name());
 
 #ifdef VZ_PICO
   // Throws exception
   uint state = _api->getState();
   if((state == VZ_SRV_CONNECTING) && ((time(NULL) - _api->getConnectInit()) > (_curlTimeout * 2)))
   {
-    print(log_debug, "Volkszaehler API connecting timed out (%d).", channel()->name(), (_curlTimeout * 2));
+    VZ_PRINT(log_debug, "Volkszaehler API connecting timed out (%d).", channel()->name(), (_curlTimeout * 2));
     state = VZ_SRV_INIT;
   }
 
   if((state == VZ_SRV_SENDING) && ((time(NULL) - _api->getSendInit()) > (_curlTimeout * 2)))
   {
-    print(log_debug, "Volkszaehler API sending data timed out (%d).", channel()->name(), (_curlTimeout * 2));
+    VZ_PRINT(log_debug, "Volkszaehler API sending data timed out (%d).", channel()->name(), (_curlTimeout * 2));
 
 /* TGE TODO
     // Drop data to avoid duplicates, possibly the data has arrived but the response was lost.
     // There is some duplicate handling in api_parse_exception() but this just drops the first tuple only
-    print(log_debug, "Dropping %d values", channel()->name(), _values.size());
+    VZ_PRINT(log_debug, "Dropping %d values", channel()->name(), _values.size());
     _values.clear();
 */
     state = VZ_SRV_INIT;
@@ -308,14 +440,14 @@ void vz::api::Volkszaehler::send()
 
   if(state == VZ_SRV_CONNECTING || state == VZ_SRV_SENDING)
   {
-    print(log_debug, "Volkszaehler API still in state %d. Cannot send yet ...", channel()->name(), state);
+    VZ_PRINT(log_debug, "Volkszaehler API still in state %d. Cannot send yet ...", channel()->name(), state);
     return;
   }
 
   if(state == VZ_SRV_INIT)
   {
     // May happen, if the server closed the connection or timed out. Reconnect ...
-    print(log_debug, "Volkszaehler API reconnecting ...", channel()->name());
+    VZ_PRINT(log_debug, "Volkszaehler API reconnecting ...", channel()->name());
     _api->reconnect();
 
     // That will happen asynchronously, so cannot send anything right now
@@ -324,28 +456,62 @@ void vz::api::Volkszaehler::send()
 
   if(state == VZ_SRV_READY)
   {
+#else // VZ_PICO
+  if (_batch)
+  {
+    // Just hand over the readings, the batch sends them with the next flush.
+    _batch->lock();
+    api_collect_values(channel()->buffer());
+    VZ_PRINT(log_debug, "%d values waiting for batch transmission", channel()->name(), _values.size());
+    _batch->unlock();
+    return;
+  }
+
+  if (curlMultiSender)
+  {
+    // Hand the request over to the shared sender, request_done() picks up the result.
+    pthread_mutex_lock(&_mutex);
+    if (_backoff.waiting())
+    {
+      VZ_PRINT(log_debug, "Retry pause, not sending for %dms ...", channel()->name(),
+               _backoff.remaining_ms());
+    }
+    else
+    {
+      post_values();
+    }
+    pthread_mutex_unlock(&_mutex);
+    return;
+  }
 #endif // VZ_PICO
 
+    errMsg = "OK";
     if(channel()->buffer()->size() == 0)
     {
-      print(log_debug, "No data to send.", channel()->name());
+      VZ_PRINT(log_debug, "No data to send.", channel()->name());
       return;
     }
 
-    api_json_tuples(channel()->buffer());
-    const char * json_str = outputData.c_str();
-    if (json_str == NULL || strcmp(json_str, "null") == 0)
+    bool haveData;
     {
-      print(log_debug, "JSON request body is null. Nothing to send now.", channel()->name());
+#ifndef VZ_PICO
+      MetricsTimer timer(api_metrics().encode);
+#endif // VZ_PICO
+      haveData = api_json_tuples(channel()->buffer());
+    }
+    if (!haveData)
+    {
+      VZ_PRINT(log_debug, "Nothing to send after filtering duplicates.", channel()->name());
       return;
     }
+    const char * json_str = outputData.c_str();
 
 #ifdef VZ_PICO
     // If we are here, the API is ready and there is something to send - do it
 
     print(log_info, "POSTing %d tuples ...", channel()->name(), _values.size());
     state =_api->postRequest(channel()->name(), json_str, _url.c_str());
-    print(log_debug, "POST request in state %d", channel()->name(), state);
+    VZ_PRINT(log_debug, "POST request in state %d", channel()->name(), state);
 
     // RETRY means, temporarily out-of-mem. Try again.
     if(state == VZ_SRV_RETRY)
@@ -372,7 +538,7 @@ void vz::api::Volkszaehler::send()
   this->checkResponse();
 
 #else // VZ_PICO
-  // If CURL is available (non-PICO), we send synchronously (in thread):
+  // Otherwise we send synchronously (in thread):
 
 	_api.curl = curlSessionProvider ? curlSessionProvider->get_easy_session(_middleware)
 					: 0; // TODO add option to use parallel sessions. Simply add uuid() to the key.
@@ -391,13 +557,17 @@ void vz::api::Volkszaehler::send()
 	// set timeout to 5 sec. required if next router has an ip-change.
 	curl_easy_setopt(_api.curl, CURLOPT_TIMEOUT, _curlTimeout);
 
-	print(log_debug, "JSON request body: %s", channel()->name(), json_str);
+	VZ_PRINT(log_debug, "JSON request body: %s", channel()->name(), json_str);
 
 	curl_easy_setopt(_api.curl, CURLOPT_POSTFIELDS, json_str);
 	curl_easy_setopt(_api.curl, CURLOPT_WRITEFUNCTION, curl_custom_write_callback);
 	curl_easy_setopt(_api.curl, CURLOPT_WRITEDATA, (void *)&response);
 
-	CURLcode curl_code = curl_easy_perform(_api.curl);
+	CURLcode curl_code;
+	{
+		MetricsTimer timer(api_metrics().request);
+		curl_code = curl_easy_perform(_api.curl);
+	}
 	curl_easy_getinfo(_api.curl, CURLINFO_RESPONSE_CODE, &http_code);
 
 	if (curlSessionProvider)
@@ -410,47 +580,58 @@ void vz::api::Volkszaehler::send()
 
 #endif // VZ_PICO
 
-  print(log_finest, "Volkszaehler API sending data complete.", channel()->name());
+  VZ_PRINT(log_finest, "Volkszaehler API sending data complete.", channel()->name());
 }
 
-#ifdef VZ_PICO // Otherwise use base-class method
 bool vz::api::Volkszaehler::isBusy() const
 {
+#ifdef VZ_PICO
   uint state = _api->getState();
   return (state != VZ_SRV_READY && state != VZ_SRV_INIT);
-}
+#else // VZ_PICO
+  pthread_mutex_lock(&_mutex);
+  bool busy = (_request.get() != NULL);
+  pthread_mutex_unlock(&_mutex);
+  return busy;
 #endif // VZ_PICO
+}
 
 void vz::api::Volkszaehler::register_device() {}
 
-json_object *vz::api::Volkszaehler::api_json_tuples(Buffer::Ptr buf) {
+void vz::api::Volkszaehler::api_collect_values(Buffer::Ptr buf) {
 
 	Buffer::iterator it;
 
-	print(log_debug, "==> number of tuples: %d", channel()->name(), buf->size());
+	VZ_PRINT(log_debug, "==> number of tuples: %d", channel()->name(), buf->size());
 	int64_t timestamp = 1;
 	const int duplicates = channel()->duplicates();
 	const int duplicates_ms = duplicates * 1000;
 
-	// copy all values to local buffer queue
+	// copy all values to local buffer queue, with a spool they go there first
+#ifndef VZ_PICO
+	std::list<Reading> spooled;
+	std::list<Reading> &values = _spool ? spooled : _values;
+#else // VZ_PICO
+	std::list<Reading> &values = _values;
+#endif // VZ_PICO
 	buf->lock();
 	for (it = buf->begin(); it != buf->end(); it++) {
 		timestamp = it->time_ms();
-		print(log_debug, "compare: %lld %lld", channel()->name(), _last_timestamp, timestamp);
+		VZ_PRINT(log_debug, "compare: %lld %lld", channel()->name(), _last_timestamp, timestamp);
 		// we can only add/consider a timestamp if the ms resolution is different than from previous
 		// one:
 		if (_last_timestamp < timestamp) {
 			if (0 == duplicates) { // send all values
-				_values.push_back(*it);
+				values.push_back(*it);
 				_last_timestamp = timestamp;
 			} else {
-				const Reading &r = *it;
+				const Sample &r = *it;
 				// duplicates should be ignored
 				// but send at least each <duplicates> seconds
 
 				if (!_lastReadingSent) { // first one from the duplicate consideration -> send it
 					_lastReadingSent = new Reading(r);
-					_values.push_back(r);
+					values.push_back(r);
 					_last_timestamp = timestamp;
 				} else { // one reading sent already. compare
 					// a) timestamp
@@ -458,7 +639,7 @@ json_object *vz::api::Volkszaehler::api_json_tuples(Buffer::Ptr buf) {
 					if ((timestamp >= (_last_timestamp + duplicates_ms)) ||
 						(r.value() != _lastReadingSent->value())) {
 						// send the current one:
-						_values.push_back(r);
+						values.push_back(r);
 						_last_timestamp = timestamp;
 						*_lastReadingSent = r;
 					} else {
@@ -472,45 +653,103 @@ json_object *vz::api::Volkszaehler::api_json_tuples(Buffer::Ptr buf) {
 	buf->unlock();
 	buf->clean();
 
+#ifndef VZ_PICO
+	if (_spool) {
+		if (!spooled.empty())
+			_spool->append(spooled);
+		// (re)fill the window in memory, after a restart this replays the backlog
+		if (_values.size() < SPOOL_WINDOW)
+			_spool->load(_values, SPOOL_WINDOW - _values.size());
+	}
+#endif // VZ_PICO
+}
+
+void vz::api::Volkszaehler::ack_values(size_t n) {
+	if (n > _values.size())
+		n = _values.size();
+	for (size_t i = 0; i < n; i++)
+		_values.pop_front();
+#ifndef VZ_PICO
+	if (_spool)
+		_spool->ack(n);
+#endif // VZ_PICO
+}
+
+std::list<Reading>::iterator vz::api::Volkszaehler::find_sent(int64_t ts, size_t n) {
+	size_t i = 0;
+	for (std::list<Reading>::iterator it = _values.begin(); it != _values.end() && i < n;
+		 ++it, ++i) {
+		if (!it->deleted() && (ts < 0 || it->time_ms() == ts))
+			return it;
+	}
+	return _values.end();
+}
+
+void vz::api::Volkszaehler::reject_value(std::list<Reading>::iterator it) {
+	if (it == _values.begin()) {
+		ack_values(1);
+	} else {
+		// the spool acknowledges in order, so it goes with the values before it
+		it->mark_delete();
+	}
+}
+
+bool vz::api::Volkszaehler::api_json_tuples(Buffer::Ptr buf) {
+
+	api_collect_values(buf);
+
+	outputData.clear();
 	if (_values.size() < 1) {
-		return NULL;
+		return false;
 	}
 
-  print(log_debug, "OutputData capacity: %d", channel()->name(), outputData.capacity());
+  VZ_PRINT(log_debug, "OutputData capacity: %d", channel()->name(), outputData.capacity());
 
-  outputData = "[";
-  int nrTuples = 0;
-  for (it = _values.begin(); it != _values.end(); it++)
+  int chunkSize = MAX_CHUNK_SIZE;
+#ifndef VZ_PICO
+  if (_spool)
   {
-    outputData += "[";
-    outputData += std::to_string(it->time_ms());
-    outputData += ",";
-    outputData += std::to_string(it->value());
-    outputData += "]";
+    chunkSize = SPOOL_CHUNK_SIZE;
+  }
+#endif // VZ_PICO
 
-    if(++nrTuples < _values.size())
+  outputData.begin_array();
+  int nrTuples = 0; // including deleted ones, they get acknowledged with the others
+  for (std::list<Reading>::iterator it = _values.begin(); it != _values.end(); it++)
+  {
+    if (nrTuples >= chunkSize)
     {
-      outputData += ",";
+      break;
     }
-
-    if (nrTuples >= MAX_CHUNK_SIZE)
+    nrTuples++;
+    if (it->deleted())
     {
-      break;
+      continue;
     }
+    outputData.tuple(it->time_ms(), it->value());
   }
-  outputData += "]";
-  print(log_debug, "copied %d/%d values for middleware transmission: %s (%d)", channel()->name(),
-        nrTuples, _values.size(), outputData.c_str(), outputData.capacity());
+  outputData.end_array();
+  _sent = nrTuples;
+  VZ_PRINT(log_debug, "copied %d/%d values for middleware transmission: %s (%d)", channel()->name(),
+           nrTuples, _values.size(), outputData.c_str(), outputData.capacity());
 
-  return NULL;
+  return true;
 }
 
-void vz::api::Volkszaehler::api_parse_exception(CURLresponse response, char *err, size_t n) {
+/**
+ * Parse a JSON encoded middleware exception into err
+ *
+ * @param message if not NULL, gets the exception message
+ * @return true if it reports a duplicate entry
+ */
+static bool parse_middleware_exception(const char *data, size_t size, char *err, size_t n,
+									   std::string *message) {
 	struct json_tokener *json_tok;
 	struct json_object *json_obj;
+	bool duplicate = false;
 
 	json_tok = json_tokener_new();
-	json_obj = json_tokener_parse_ex(json_tok, response.data, response.size);
+	json_obj = json_tokener_parse_ex(json_tok, data, size);
 
 	if (json_tok->err == json_tokener_success) {
 		bool found = json_object_object_get_ex(json_obj, "exception", &json_obj);
@@ -527,15 +766,12 @@ void vz::api::Volkszaehler::api_parse_exception(CURLresponse response, char *err
 			snprintf(err, n, "'%s': '%s'", err_type.c_str(), err_message.c_str());
 			// evaluate error
 			if (err_type == "UniqueConstraintViolationException") {
-				if (err_message.find("Duplicate entry")) {
-					print(log_warning, "Middleware says duplicated value. Removing first entry (out of %d)!",
-						  channel()->name(), _values.size());
-                                        if(_values.size() > 0)
-                                        {
-					  _values.pop_front();
-                                        }
+				if (err_message.find("Duplicate entry") != std::string::npos) {
+					duplicate = true;
 				}
 			}
+			if (message)
+				*message = err_message;
 		} else {
 			strncpy(err, "Missing exception", n);
 		}
@@ -545,9 +781,284 @@ void vz::api::Volkszaehler::api_parse_exception(CURLresponse response, char *err
 
 	json_object_put(json_obj);
 	json_tokener_free(json_tok);
+	return duplicate;
+}
+
+/**
+ * Timestamp of the rejected tuple from the message of a duplicate entry exception:
+ * "... Duplicate entry '<channel id>-<timestamp>' for key ..."
+ *
+ * @return -1 if the message doesn't tell
+ */
+static int64_t duplicate_timestamp(const std::string &message) {
+	static const char entry[] = "Duplicate entry '";
+	size_t start = message.find(entry);
+	if (start == std::string::npos)
+		return -1;
+	start += sizeof(entry) - 1;
+	size_t end = message.find('\'', start);
+	size_t dash = message.rfind('-', end);
+	if (end == std::string::npos || dash == std::string::npos || dash < start || dash + 1 == end)
+		return -1;
+	int64_t ts = 0;
+	for (size_t i = dash + 1; i < end; i++) {
+		if (message[i] < '0' || message[i] > '9')
+			return -1;
+		ts = ts * 10 + (message[i] - '0');
+	}
+	return ts;
+}
+
+void vz::api::Volkszaehler::api_parse_exception(CURLresponse response, char *err, size_t n) {
+	std::string message;
+	if (parse_middleware_exception(response.data, response.size, err, n, &message)) {
+		std::list<Reading>::iterator it = find_sent(duplicate_timestamp(message), _sent);
+		if (it == _values.end())
+			it = find_sent(-1, _sent); // it doesn't say which, the first
+		if (it != _values.end()) {
+			print(log_warning, "Middleware says duplicated value. Removing %lld (out of %d)!",
+				  channel()->name(), (long long)it->time_ms(), _values.size());
+			reject_value(it);
+		}
+	}
 }
 
 #ifndef VZ_PICO
+std::map<std::string, vz::api::VolkszaehlerBatch::Ptr> vz::api::VolkszaehlerBatch::_batches;
+pthread_mutex_t vz::api::VolkszaehlerBatch::_batches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+vz::api::VolkszaehlerBatch::Ptr
+vz::api::VolkszaehlerBatch::get(const std::string &middleware, const struct curl_slist *headers,
+								long timeout) {
+	pthread_mutex_lock(&_batches_mutex);
+	Ptr &batch = _batches[middleware];
+	if (!batch) {
+		batch = Ptr(new VolkszaehlerBatch(middleware, headers, timeout));
+		curlMultiSender->every(options.sender_batch_window(), &VolkszaehlerBatch::flush_timer,
+							   batch.get());
+		print(log_info, "Sending batched every %dms to %s", "batch", options.sender_batch_window(),
+			  batch->_url.c_str());
+	}
+	Ptr toRet = batch;
+	pthread_mutex_unlock(&_batches_mutex);
+	return toRet;
+}
+
+vz::api::VolkszaehlerBatch::VolkszaehlerBatch(const std::string &middleware,
+											  const struct curl_slist *headers, long timeout)
+	: _headers(NULL), _timeout(timeout), _max_tuples(options.sender_batch_tuples()),
+	  _max_bytes(options.sender_batch_bytes()), _json(_max_bytes + 64),
+	  _split(0), _split_pos(0) {
+	_mutex = PTHREAD_MUTEX_INITIALIZER;
+	_url = middleware;
+	_url.append("/data.json");
+	for (const struct curl_slist *h = headers; h; h = h->next)
+		_headers = curl_slist_append(_headers, h->data);
+}
+
+vz::api::VolkszaehlerBatch::~VolkszaehlerBatch() {
+	curl_slist_free_all(_headers);
+	pthread_mutex_destroy(&_mutex);
+}
+
+void vz::api::VolkszaehlerBatch::add(Volkszaehler *api) {
+	lock();
+	_apis.push_back(api);
+	unlock();
+}
+
+void vz::api::VolkszaehlerBatch::remove(Volkszaehler *api) {
+	lock();
+	_apis.remove(api);
+	unlock();
+}
+
+void vz::api::VolkszaehlerBatch::flush_timer(void *arg) {
+	static_cast<VolkszaehlerBatch *>(arg)->flush();
+}
+
+void vz::api::VolkszaehlerBatch::processResponse(CURLcode curl_code, long http_code,
+												 const std::string &response) {
+	// called with lock held
+	if (curl_code == CURLE_OK && http_code == 200) {
+		VZ_PRINT(log_debug, "CURL Request succeeded with code: %i", "batch", http_code);
+		for (std::list<Volkszaehler *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+			(*it)->ack_values((*it)->_inflight);
+			(*it)->_inflight = 0;
+		}
+		_backoff.reset();
+		if (_split > 0) {
+			_split--;
+			_split_pos++;
+		}
+		return;
+	}
+
+	if (curl_code != CURLE_OK) {
+		print(log_alert, "CURL: %s", "batch", curl_easy_strerror(curl_code));
+	} else {
+		char err[255];
+		std::string message;
+		if (parse_middleware_exception(response.c_str(), response.size(), err, sizeof(err),
+									   &message))
+			reject_duplicate(message);
+		print(log_alert, "CURL Error from middleware: %s", "batch", err);
+	}
+	for (std::list<Volkszaehler *>::iterator it = _apis.begin(); it != _apis.end(); ++it)
+		(*it)->_inflight = 0;
+
+	api_metrics().retries->inc();
+	print(log_info, "Waiting %i secs for next request due to previous failure", "batch",
+		  _backoff.failed(options.retry_pause()));
+}
+
+void vz::api::VolkszaehlerBatch::reject_duplicate(const std::string &message) {
+	// called with lock held, before _inflight is reset
+	int64_t ts = duplicate_timestamp(message);
+	Volkszaehler *rejected = NULL;
+	size_t sending = 0;
+	for (std::list<Volkszaehler *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+		if ((*it)->_inflight == 0)
+			continue;
+		sending++;
+		if (message.find((*it)->channel()->uuid()) != std::string::npos) {
+			rejected = *it;
+			break;
+		}
+	}
+	if (!rejected) {
+		// the channel which sent the timestamp, if only one did
+		size_t found = 0;
+		for (std::list<Volkszaehler *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+			Volkszaehler *api = *it;
+			if (api->_inflight == 0)
+				continue;
+			if (sending == 1 ||
+				(ts >= 0 && api->find_sent(ts, api->_inflight) != api->_values.end())) {
+				rejected = api;
+				found++;
+			}
+		}
+		if (found != 1)
+			rejected = NULL;
+	}
+
+	if (!rejected) {
+		print(log_warning,
+			  "Middleware says duplicated value of an unknown channel. Sending them separately!",
+			  "batch");
+		_split = _apis.size();
+		_split_pos = 0;
+		return;
+	}
+
+	std::list<Reading>::iterator it = rejected->find_sent(ts, rejected->_inflight);
+	if (it == rejected->_values.end())
+		it = rejected->find_sent(-1, rejected->_inflight); // it doesn't say which, the first
+	if (it == rejected->_values.end())
+		return;
+	print(log_warning, "Middleware says duplicated value. Removing %lld of %s!", "batch",
+		  (long long)it->time_ms(), rejected->channel()->uuid());
+	rejected->reject_value(it);
+}
+
+void vz::api::VolkszaehlerBatch::flush() {
+	lock();
+	if (_request) {
+		if (!_request->done()) {
+			unlock();
+			return;
+		}
+		CurlRequest::Ptr req = _request;
+		_request.reset();
+		processResponse(req->curlCode(), req->httpCode(), req->response());
+	}
+	if (_backoff.waiting()) {
+		unlock();
+		return;
+	}
+
+	Volkszaehler *only = NULL;
+	while (_split > 0) {
+		if (_split_pos >= _apis.size()) {
+			_split = 0; // channels were removed meanwhile
+			break;
+		}
+		std::list<Volkszaehler *>::iterator it = _apis.begin();
+		std::advance(it, _split_pos);
+		if (!(*it)->_values.empty()) {
+			only = *it;
+			break;
+		}
+		_split--; // nothing to send, no duplicate
+		_split_pos++;
+	}
+
+	// [{"uuid":"..","tuples":[[ts,value],..]},..]
+	int64_t encode_start = Metrics::now_us();
+	_json.clear();
+	_json.begin_array();
+	size_t nrTuples = 0;
+	size_t nrChannels = 0;
+	bool full = false;
+	for (std::list<Volkszaehler *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+		Volkszaehler *api = *it;
+		api->_inflight = 0;
+		if (full || api->_values.empty() || (only && api != only))
+			continue;
+
+		JsonWriter::Mark start = _json.mark();
+		_json.begin_object();
+		_json.key("uuid").value(api->channel()->uuid());
+		_json.key("tuples").begin_array();
+		size_t written = 0;
+		for (std::list<Reading>::iterator v = api->_values.begin(); v != api->_values.end();
+			 ++v) {
+			if (v->deleted()) {
+				// corrupt record from the spool, acknowledge it with the others
+				api->_inflight++;
+				continue;
+			}
+			JsonWriter::Mark tuple = _json.mark();
+			_json.tuple(v->time_ms(), v->value());
+			// always send at least one tuple, even if it alone exceeds max_bytes
+			if (nrTuples > 0 && (nrTuples >= _max_tuples || _json.size() + 4 > _max_bytes)) {
+				_json.rollback(tuple);
+				full = true;
+				break;
+			}
+			api->_inflight++;
+			written++;
+			nrTuples++;
+		}
+		if (written > 0) {
+			_json.end_array().end_object();
+			nrChannels++;
+		} else {
+			_json.rollback(start);
+		}
+	}
+	_json.end_array();
+	api_metrics().encode->observe(Metrics::now_us() - encode_start);
+
+	if (nrTuples == 0) {
+		for (std::list<Volkszaehler *>::iterator it = _apis.begin(); it != _apis.end(); ++it) {
+			(*it)->ack_values((*it)->_inflight);
+			(*it)->_inflight = 0;
+		}
+		unlock();
+		return;
+	}
+
+	print(log_info, "POSTing %d tuples of %d channels ...", "batch", nrTuples, nrChannels);
+	VZ_PRINT(log_debug, "JSON request body: %s", "batch", _json.c_str());
+	_request = CurlRequest::Ptr(
+		new CurlRequest(_url, std::string(_json.c_str(), _json.size()), _headers, _timeout));
+	_request->duration(api_metrics().request);
+	curlMultiSender->submit(_request);
+	unlock();
+}
+
 int vz::api::curl_custom_debug_callback(CURL *curl, curl_infotype type, char *data, size_t size,
 										void *arg) {
 	Channel *ch = static_cast<Channel *>(arg);
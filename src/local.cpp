@@ -23,15 +23,23 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cassert>
 #include <list>
 #include <map>
+#include <memory>
+#include <vector>
 
-#include <json-c/json.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "Channel.hpp"
+#include "LocalBuffer.hpp"
+#include "LocalStore.hpp"
+#include "Metrics.hpp"
+#include "api/JsonWriter.hpp"
 #include "local.h"
 #include "vzlogger.h"
 #include <MeterMap.hpp>
@@ -40,88 +48,528 @@
 
 extern Config_Options options;
 
-class ChannelData {
-  public:
-	ChannelData(const int64_t &t, const double &v) : _t(t), _v(v){};
-	int64_t _t;
-	double _v;
+// the tuples of one uuid. version changes whenever the tuples do.
+// store keeps the longer history on disk for queries, see local_store().
+struct LocalChannel {
+	LocalBuffer tuples;
+	unsigned long version = 0;
+	std::unique_ptr<LocalStore> store;
+	bool store_disabled = false;
 };
+typedef std::map<std::string, LocalChannel> MAP_UUID_ChannelData;
 
-typedef std::list<ChannelData> LIST_ChannelData;
-typedef std::map<std::string, LIST_ChannelData> MAP_UUID_ChannelData;
+// a response built once and queued for every request until the data changes.
+// MHD keeps a reference per queued connection, so replacing it is safe.
+struct Snapshot {
+	unsigned long version = 0;      // of the data it was built from
+	int64_t expires_ms = INT64_MAX; // the oldest tuple leaves the time based buffer
+	struct MHD_Response *response = NULL;
+	int status = MHD_HTTP_OK;
+};
+
+// the query parameters of a request, see parse_query()
+struct Query {
+	int64_t from = INT64_MIN;
+	int64_t to = INT64_MAX;
+	size_t limit = 0;     // max. tuples, more are downsampled. 0: unlimited
+	int64_t group_ms = 0; // downsample to groups of group_ms. 0: no downsampling
+};
+
+// a suspended comet request, waiting for new data or its deadline
+struct Waiter {
+	struct MHD_Connection *connection;
+	std::string uuid; // empty: any channel
+	int64_t deadline_ms;
+	bool waiting;
+};
+
+// protects all of the below
 pthread_mutex_t localbuffer_mutex = PTHREAD_MUTEX_INITIALIZER;
 MAP_UUID_ChannelData localbuffer;
+static unsigned long localbuffer_version = 0; // changes whenever any channel's tuples do
+
+static std::map<std::string, Snapshot> snapshots; // GET /<uuid>
+static Snapshot index_snapshot;                   // GET /
+static Snapshot static_snapshots[2];              // index disabled, unknown uuid
+
+static std::list<Waiter *> waiters; // ordered by deadline as comet_timeout is fixed
+static pthread_cond_t comet_cond;
+static pthread_t comet_thread_handle;
+static bool comet_thread_running = false;
+static bool comet_thread_stop = false;
+
+static int64_t monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// resume outside of localbuffer_mutex, the waiters are not in waiters anymore
+static void resume(std::vector<struct MHD_Connection *> &connections) {
+	for (auto c : connections)
+		MHD_resume_connection(c);
+	connections.clear();
+}
+
+static void shrink_localbuffer_locked() {
+	Reading rnow;
+	rnow.time(); // sets to "now"
+	int64_t minT =
+		rnow.time_ms() - (1000 * options.buffer_length()); // now - time to keep in buffer
+
+	MAP_UUID_ChannelData::iterator it = localbuffer.begin();
+	for (; it != localbuffer.end(); ++it) {
+		LocalBuffer &l = it->second.tuples;
+		if (l.empty() || l.front_time() >= minT)
+			continue;
+		l.erase_before(minT);
+		it->second.version++;
+		localbuffer_version++;
+	}
+}
 
 void shrink_localbuffer() // remove old data in the local buffer
 {
 	if (options.buffer_length() >= 0) { // time based localbuffer. keep buffer_length secs
-		Reading rnow;
-		rnow.time(); // sets to "now"
-		int64_t minT =
-			rnow.time_ms() - (1000 * options.buffer_length()); // now - time to keep in buffer
-
 		pthread_mutex_lock(&localbuffer_mutex);
+		shrink_localbuffer_locked();
+		pthread_mutex_unlock(&localbuffer_mutex);
+	}
+}
 
-		MAP_UUID_ChannelData::iterator it = localbuffer.begin();
-		for (; it != localbuffer.end(); ++it) {
-			LIST_ChannelData &l = it->second;
-			LIST_ChannelData::iterator lit = l.begin();
-
-			while (lit != l.end() && ((lit->_t) < minT))
-				lit = l.erase(lit);
-		}
+// the persistent history of ch, opened on first use. NULL if disabled.
+static LocalStore *local_store(LocalChannel &lc, Channel &ch) {
+	if (lc.store || lc.store_disabled)
+		return lc.store.get();
 
-		pthread_mutex_unlock(&localbuffer_mutex);
+	int retention = ch.local_retention() >= 0 ? ch.local_retention() : options.local_retention();
+	if (options.local_store().empty() || retention <= 0) {
+		lc.store_disabled = true;
+		return NULL;
+	}
+	try {
+		lc.store.reset(new LocalStore(options.local_store() + "/" + ch.uuid(), 1000LL * retention));
+	} catch (vz::VZException &e) {
+		print(log_alert, "Disabling the local store: %s", ch.name(), e.what());
+		lc.store_disabled = true;
 	}
+	return lc.store.get();
 }
 
 void add_ch_to_localbuffer(Channel &ch) {
+	std::vector<struct MHD_Connection *> wakeup;
+
 	pthread_mutex_lock(&localbuffer_mutex);
-	LIST_ChannelData &l = localbuffer[ch.uuid()];
+	LocalChannel &lc = localbuffer[ch.uuid()];
+	LocalBuffer &l = lc.tuples;
+	LocalStore *store = local_store(lc, ch);
 
 	// now add all not-deleted items to the localbuffer:
 	Buffer::Ptr buf = ch.buffer();
 	Buffer::iterator it;
+	size_t added = 0;
 	for (it = buf->begin(); it != buf->end(); ++it) {
-		Reading &r = *it;
+		const Sample &r = *it;
 		if (!r.deleted()) {
-			l.push_back(ChannelData(r.time_ms(), r.value()));
+			l.push(r.time_ms(), r.value());
+			// unsent readings are seen again next time, the store is append only:
+			if (store && (store->empty() || r.time_ms() > store->back_time()))
+				store->push(r.time_ms(), r.value());
+			added++;
 		}
 	}
-	if (options.buffer_length() < 0) { // max size based localbuffer. keep max -buffer_length items
-		while (l.size() > static_cast<unsigned int>(-(options.buffer_length())))
-			l.pop_front();
+	if (store && !store->empty())
+		store->expire(store->back_time());
+	if (options.buffer_length() < 0) // max size based localbuffer. keep max -buffer_length items
+		l.keep_last(static_cast<unsigned int>(-(options.buffer_length())));
+
+	if (added) {
+		lc.version++;
+		localbuffer_version++;
+
+		// wake up the comet requests for this channel:
+		for (auto w = waiters.begin(); w != waiters.end();) {
+			if ((*w)->uuid.empty() || (*w)->uuid == ch.uuid()) {
+				(*w)->waiting = false;
+				wakeup.push_back((*w)->connection);
+				w = waiters.erase(w);
+			} else {
+				++w;
+			}
+		}
 	}
 
 	pthread_mutex_unlock(&localbuffer_mutex);
+	resume(wakeup);
 }
 
-json_object *api_json_tuples(const char *uuid) {
+/**
+ * Write the "tuples" member for the local buffer of uuid, if there are any
+ * Tuples are [time, value], or [time, avg, min, max, count] if downsampled.
+ * Queries are answered from the local store as well, for the time before the buffer.
+ * localbuffer_mutex has to be locked. Returns the time of the oldest tuple in the buffer.
+ */
+static int64_t api_json_tuples(JsonWriter &json, const char *uuid, const Query *q) {
 
 	if (!uuid)
-		return NULL;
+		return INT64_MAX;
+	MAP_UUID_ChannelData::const_iterator lc = localbuffer.find(uuid);
+	if (lc == localbuffer.end())
+		return INT64_MAX;
+	const LocalBuffer &l = lc->second.tuples;
+	const LocalStore *s = q ? lc->second.store.get() : NULL;
+
+	static const Query all;
+	if (!q)
+		q = &all;
+	int64_t first, last;
+	size_t n = l.range(q->from, q->to, &first, &last);
+
+	// the store has the same tuples as the buffer, take the older ones only:
+	int64_t s_to = l.empty() ? q->to : std::min(q->to, l.front_time() - 1);
+	int64_t s_first, s_last;
+	size_t s_n = s ? s->range(q->from, s_to, &s_first, &s_last) : 0;
+	if (s_n) {
+		first = s_first;
+		if (!n)
+			last = s_last;
+		n += s_n;
+	}
+
+	print(log_debug, "==> number of tuples: %d", uuid, n);
+
+	if (n < 1)
+		return INT64_MAX;
+
+	int64_t group_ms = q->group_ms;
+	int64_t origin = 0; // groups aligned to the epoch
+	if (q->limit && n > q->limit) {
+		// at most limit groups, starting at the first tuple:
+		int64_t min_ms = (last - first) / (int64_t)q->limit + 1;
+		if (group_ms < min_ms)
+			group_ms = min_ms;
+		origin = first;
+	}
+
+	json.key("tuples").begin_array();
+	if (group_ms > 0) {
+		LocalBuffer::Downsampler d(group_ms, origin);
+		LocalBuffer::Group g;
+		auto group = [&json, &g]() {
+			json.begin_array();
+			json.value(g.time_ms).value(g.avg).value(g.min).value(g.max);
+			json.value((int64_t)g.count);
+			json.end_array();
+		};
+		auto add = [&d, &g, &group](int64_t t, double v) {
+			if (d.add(t, v, g))
+				group();
+		};
+		if (s_n)
+			s->for_each(q->from, s_to, add);
+		l.for_each(q->from, q->to, add);
+		if (d.finish(g))
+			group();
+	} else {
+		auto add = [&json](int64_t t, double v) { json.tuple(t, v); };
+		if (s_n)
+			s->for_each(q->from, s_to, add);
+		l.for_each(q->from, q->to, add);
+	}
+	json.end_array();
+	return l.empty() ? INT64_MAX : l.front_time();
+}
+
+/**
+ * Read the query parameters of a request:
+ * from, to: time range in ms, relative to now if negative
+ * limit: max. number of tuples, more are downsampled to at most limit groups
+ * group: downsample to groups of this many ms
+ * Returns false if none of them was given.
+ */
+static bool parse_query(struct MHD_Connection *connection, Query &q) {
+	bool given = false;
+	Reading rnow;
+	rnow.time(); // sets to "now"
+
+	const char *names[] = {"from", "to", "limit", "group"};
+	for (int i = 0; i < 4; i++) {
+		const char *s = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, names[i]);
+		if (!s || !*s)
+			continue;
+		char *end;
+		long long v = strtoll(s, &end, 10);
+		if (*end) {
+			print(log_warning, "Ignoring invalid %s=%s", "http", names[i], s);
+			continue;
+		}
+		given = true;
+		switch (i) {
+		case 0:
+			q.from = v < 0 ? rnow.time_ms() + v : v;
+			break;
+		case 1:
+			q.to = v < 0 ? rnow.time_ms() + v : v;
+			break;
+		case 2:
+			q.limit = v > 0 ? v : 0;
+			break;
+		case 3:
+			q.group_ms = v > 0 ? v : 0;
+			break;
+		}
+	}
+	return given;
+}
+
+/**
+ * (Re)build snap for the channels with uuid (all channels if uuid is NULL)
+ * localbuffer_mutex has to be locked. Returns false if there is no such channel.
+ */
+static bool build_snapshot(Snapshot &snap, MapContainer *mappings, const char *uuid,
+						   const char *exception = NULL, const Query *q = NULL) {
+	static JsonWriter json; // keeps its capacity between builds
+	static Metrics::Histogram *encode_time =
+		metrics.durations("vzlogger_json_encode_duration_seconds",
+						  "Time to encode one JSON request or response body",
+						  Metrics::label("api", "local"));
+	MetricsTimer timer(encode_time);
+	bool found = false;
+	int64_t oldest = INT64_MAX;
+
+	json.clear();
+	json.begin_object();
+	json.key("version").value(VERSION);
+	json.key("generator").value(PACKAGE);
+	json.key("data").begin_array();
+
+	if (!exception) {
+		for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
+			 mapping++) {
+			for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+				if (uuid && strcmp((*ch)->uuid(), uuid) != 0)
+					continue;
+				found = true;
+
+				json.begin_object();
+				json.key("uuid").value((*ch)->uuid());
+				json.key("last").value((*ch)->time_ms()); // return here in ms as well
+				json.key("interval").value(mapping->meter()->interval());
+				json.key("protocol").value(
+					meter_get_details(mapping->meter()->protocolId())->name);
+				int64_t t = api_json_tuples(json, (*ch)->uuid(), q);
+				if (t < oldest)
+					oldest = t;
+				json.end_object();
+			}
+		}
+	}
+	json.end_array();
+
+	if (exception) {
+		json.key("exception").begin_object();
+		json.key("message").value(exception);
+		json.key("code").value(0);
+		json.end_object();
+	}
+	json.end_object();
+
+	if (snap.response)
+		MHD_destroy_response(snap.response); // connections still sending it keep their reference
+	// one copy per change of the data, not per request:
+	snap.response = MHD_create_response_from_buffer(
+		json.size(), static_cast<void *>(const_cast<char *>(json.c_str())), MHD_RESPMEM_MUST_COPY);
+	MHD_add_response_header(snap.response, "Content-type", "application/json");
+
+	snap.status = (found || (!uuid && !exception)) ? MHD_HTTP_OK : MHD_HTTP_NOT_FOUND;
+	snap.expires_ms = (oldest != INT64_MAX && options.buffer_length() >= 0)
+						  ? oldest + 1000LL * options.buffer_length()
+						  : INT64_MAX;
+	return found;
+}
+
+/**
+ * The current snapshot for url, rebuilt only if the data changed since
+ * localbuffer_mutex has to be locked.
+ */
+static Snapshot *get_snapshot(MapContainer *mappings, const char *url) {
+	Reading rnow;
+	rnow.time(); // sets to "now"
+
+	if (strcmp(url, "/") == 0) {
+		if (!options.channel_index()) {
+			Snapshot &snap = static_snapshots[0];
+			if (!snap.response)
+				build_snapshot(snap, mappings, NULL, "channel index is disabled");
+			return &snap;
+		}
+
+		if (index_snapshot.expires_ms <= rnow.time_ms())
+			shrink_localbuffer_locked(); // in case the channels return very few/seldom data
+		if (!index_snapshot.response || index_snapshot.version != localbuffer_version) {
+			build_snapshot(index_snapshot, mappings, NULL);
+			index_snapshot.version = localbuffer_version;
+		}
+		return &index_snapshot;
+	}
+
+	const char *uuid = url + 1; // strip leading slash
+	std::map<std::string, Snapshot>::iterator it = snapshots.find(uuid);
+	if (it == snapshots.end()) {
+		Snapshot snap;
+		if (!build_snapshot(snap, mappings, uuid)) {
+			// don't keep snapshots of unknown uuids
+			MHD_destroy_response(snap.response);
+			Snapshot &unknown = static_snapshots[1];
+			if (!unknown.response)
+				build_snapshot(unknown, mappings, "");
+			return &unknown;
+		}
+		MAP_UUID_ChannelData::const_iterator lc = localbuffer.find(uuid);
+		snap.version = lc != localbuffer.end() ? lc->second.version : 0;
+		it = snapshots.insert(std::make_pair(std::string(uuid), snap)).first;
+		return &it->second;
+	}
+
+	Snapshot &snap = it->second;
+	if (snap.expires_ms <= rnow.time_ms())
+		shrink_localbuffer_locked();
+	MAP_UUID_ChannelData::const_iterator lc = localbuffer.find(uuid);
+	unsigned long version = lc != localbuffer.end() ? lc->second.version : 0;
+	if (snap.version != version) {
+		build_snapshot(snap, mappings, uuid);
+		snap.version = version;
+	}
+	return &snap;
+}
+
+static bool is_channel(MapContainer *mappings, const char *uuid) {
+	for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
+		 mapping++) {
+		for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+			if (strcmp((*ch)->uuid(), uuid) == 0)
+				return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Resumes the comet requests once their comet_timeout passed
+ */
+static void *comet_thread(void *arg) {
+	std::vector<struct MHD_Connection *> wakeup;
+
 	pthread_mutex_lock(&localbuffer_mutex);
-	LIST_ChannelData &l = localbuffer[uuid];
+	while (!comet_thread_stop) {
+		int64_t now = monotonic_ms();
+		while (!waiters.empty() && waiters.front()->deadline_ms <= now) {
+			waiters.front()->waiting = false;
+			wakeup.push_back(waiters.front()->connection);
+			waiters.pop_front();
+		}
+		if (wakeup.size()) {
+			pthread_mutex_unlock(&localbuffer_mutex);
+			resume(wakeup);
+			pthread_mutex_lock(&localbuffer_mutex);
+			continue;
+		}
 
-	print(log_debug, "==> number of tuples: %d", uuid, l.size());
+		if (waiters.empty()) {
+			pthread_cond_wait(&comet_cond, &localbuffer_mutex);
+		} else {
+			struct timespec ts;
+			int64_t deadline = waiters.front()->deadline_ms;
+			ts.tv_sec = deadline / 1000;
+			ts.tv_nsec = (deadline % 1000) * 1000000;
+			pthread_cond_timedwait(&comet_cond, &localbuffer_mutex, &ts);
+		}
+	}
+	pthread_mutex_unlock(&localbuffer_mutex);
+	return NULL;
+}
 
-	if (l.size() < 1) {
-		pthread_mutex_unlock(&localbuffer_mutex);
+static void request_completed(void *cls, struct MHD_Connection *connection, void **con_cls,
+							  enum MHD_RequestTerminationCode toe) {
+	Waiter *waiter = static_cast<Waiter *>(*con_cls);
+	if (waiter) {
+		assert(!waiter->waiting);
+		delete waiter;
+		*con_cls = NULL;
+	}
+}
+
+struct MHD_Daemon *local_start(int port, MapContainer *mappings) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&comet_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	comet_thread_stop = false;
+	int ret = pthread_create(&comet_thread_handle, NULL, &comet_thread, NULL);
+	if (ret) {
+		print(log_alert, "Error %d creating comet thread", "http", ret);
+		pthread_cond_destroy(&comet_cond);
 		return NULL;
 	}
+	comet_thread_running = true;
+
+	// one thread for all connections. Requests never block, comet requests are suspended.
+#if MHD_VERSION >= 0x00095300
+	unsigned int flags = MHD_USE_INTERNAL_POLLING_THREAD | MHD_ALLOW_SUSPEND_RESUME;
+	flags |= MHD_is_feature_supported(MHD_FEATURE_EPOLL) == MHD_YES ? MHD_USE_EPOLL : MHD_USE_POLL;
+#else
+	unsigned int flags = MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME;
+#endif
+	struct MHD_Daemon *d =
+		MHD_start_daemon(flags, port, NULL, NULL, &handle_request, (void *)mappings,
+						 MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL, MHD_OPTION_END);
+	if (!d)
+		local_stop(NULL);
+	return d;
+}
 
-	json_object *json_tuples = json_object_new_array();
-	for (LIST_ChannelData::const_iterator cit = l.cbegin(); cit != l.cend(); ++cit) {
-		struct json_object *json_tuple = json_object_new_array();
+void local_stop(struct MHD_Daemon *d) {
+	std::vector<struct MHD_Connection *> wakeup;
 
-		json_object_array_add(json_tuple, json_object_new_int64(cit->_t));
-		json_object_array_add(json_tuple, json_object_new_double(cit->_v));
+	if (comet_thread_running) {
+		pthread_mutex_lock(&localbuffer_mutex);
+		comet_thread_stop = true;
+		pthread_cond_signal(&comet_cond);
+		pthread_mutex_unlock(&localbuffer_mutex);
+		pthread_join(comet_thread_handle, NULL);
+		comet_thread_running = false;
+	}
 
-		json_object_array_add(json_tuples, json_tuple);
+	// MHD requires all connections to be resumed before stopping:
+	pthread_mutex_lock(&localbuffer_mutex);
+	for (auto w : waiters) {
+		w->waiting = false;
+		wakeup.push_back(w->connection);
 	}
+	waiters.clear();
+	pthread_mutex_unlock(&localbuffer_mutex);
+	resume(wakeup);
+
+	if (d)
+		MHD_stop_daemon(d);
+
+	pthread_mutex_lock(&localbuffer_mutex);
+	for (auto &lc : localbuffer)
+		if (lc.second.store)
+			lc.second.store->flush();
 	pthread_mutex_unlock(&localbuffer_mutex);
 
-	return json_tuples;
+	for (auto &s : snapshots)
+		MHD_destroy_response(s.second.response);
+	snapshots.clear();
+	for (Snapshot *s : {&index_snapshot, &static_snapshots[0], &static_snapshots[1]}) {
+		if (s->response)
+			MHD_destroy_response(s->response);
+		*s = Snapshot();
+	}
+	pthread_cond_destroy(&comet_cond);
 }
 
 MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const char *url,
@@ -129,113 +577,84 @@ MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const ch
 						  size_t *upload_data_size, void **con_cls) {
 
 	MHD_RESULT status;
-	int response_code = MHD_HTTP_NOT_FOUND;
+	Waiter *waiter = static_cast<Waiter *>(*con_cls);
 
 	// mapping between meters and channels
 	MapContainer *mappings = static_cast<MapContainer *>(cls);
 
-	struct MHD_Response *response = NULL;
 	const char *mode = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "mode");
 
-	try {
-		print(log_info, "Local request received: method=%s url=%s mode=%s", "http", method, url,
-			  mode);
-
-		if (strcmp(method, "GET") == 0) {
-
-			struct json_object *json_obj = json_object_new_object();
-			struct json_object *json_data = json_object_new_array();
-			struct json_object *json_exception = NULL;
-
-			const char *uuid = url + 1; // strip leading slash
-			const char *json_str;
-			bool show_all = false;
-
-			if (strcmp(url, "/") == 0) {
-				if (options.channel_index()) {
-					show_all = true;
-				} else {
-					json_exception = json_object_new_object();
-
-					json_object_object_add(json_exception, "message",
-										   json_object_new_string("channel index is disabled"));
-					json_object_object_add(json_exception, "code", json_object_new_int(0));
-				}
-			}
-
-			shrink_localbuffer(); // in case the channel return very few/seldom data
-
-			for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
-				 mapping++) {
-				for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
-					if (strcmp((*ch)->uuid(), uuid) == 0 || show_all) {
-						response_code = MHD_HTTP_OK;
-
-						// blocking until new data arrives (comet-like blocking of HTTP response)
-						if (mode && strcmp(mode, "comet") == 0) {
-							// TODO wait only options.comet_timeout()!
-							// gettimeofday(&tp, NULL);
-							// ts.tv_sec = tp.tv_sec + options.comet_timeout();
-							// ts.tv_nsec = tp.tv_usec * 1000;
-
-							// (*ch)->wait(); // TODO not usefull with
-							// 			   // show_all! Wait only if this channel empty?
-						}
-
-						struct json_object *json_ch = json_object_new_object();
-
-						json_object_object_add(json_ch, "uuid",
-											   json_object_new_string((*ch)->uuid()));
-						json_object_object_add(
-							json_ch, "last",
-							json_object_new_int64((*ch)->time_ms())); // return here in ms as well
-						json_object_object_add(json_ch, "interval",
-											   json_object_new_int(mapping->meter()->interval()));
-						json_object_object_add(
-							json_ch, "protocol",
-							json_object_new_string(
-								meter_get_details(mapping->meter()->protocolId())->name));
-
-						struct json_object *json_tuples = api_json_tuples((*ch)->uuid());
-						if (json_tuples)
-							json_object_object_add(json_ch, "tuples", json_tuples);
-
-						json_object_array_add(json_data, json_ch);
-					}
-				}
-			}
-
-			json_object_object_add(json_obj, "version", json_object_new_string(VERSION));
-			json_object_object_add(json_obj, "generator", json_object_new_string(PACKAGE));
-			json_object_object_add(json_obj, "data", json_data);
-
-			if (json_exception) {
-				json_object_object_add(json_obj, "exception", json_exception);
-			}
-
-			json_str = json_object_to_json_string(json_obj);
-			response = MHD_create_response_from_buffer(
-				strlen(json_str), static_cast<void *>(const_cast<char *>(json_str)),
-				MHD_RESPMEM_MUST_COPY);
-			json_object_put(json_obj);
+	if (strcmp(method, "GET") != 0) {
+		static const char not_implemented[] = "not implemented\n";
+		struct MHD_Response *response = MHD_create_response_from_buffer(
+			strlen(not_implemented), static_cast<void *>(const_cast<char *>(not_implemented)),
+			MHD_RESPMEM_PERSISTENT);
+		MHD_add_response_header(response, "Content-type", "text/text");
+		status = MHD_queue_response(connection, MHD_HTTP_METHOD_NOT_ALLOWED, response);
+		MHD_destroy_response(response);
+		return status;
+	}
 
-			MHD_add_response_header(response, "Content-type", "application/json");
-		} else {
-			char *response_str = strdup("not implemented\n");
+	if (strcmp(url, "/metrics") == 0) {
+		// cheap to build, so no snapshot
+		std::string out;
+		metrics.write(out);
+		struct MHD_Response *response = MHD_create_response_from_buffer(
+			out.size(), static_cast<void *>(const_cast<char *>(out.data())),
+			MHD_RESPMEM_MUST_COPY);
+		MHD_add_response_header(response, "Content-type", "text/plain; version=0.0.4");
+		status = MHD_queue_response(connection, MHD_HTTP_OK, response);
+		MHD_destroy_response(response);
+		return status;
+	}
 
-			response = MHD_create_response_from_buffer(
-				strlen(response_str), static_cast<void *>(const_cast<char *>(response_str)),
-				MHD_RESPMEM_MUST_COPY);
-			response_code = MHD_HTTP_METHOD_NOT_ALLOWED;
+	if (!waiter) {
+		print(log_info, "Local request received: method=%s url=%s mode=%s", "http", method, url,
+			  mode);
 
-			MHD_add_response_header(response, "Content-type", "text/text");
+		// comet-like blocking of the HTTP response until new data arrives. The connection
+		// is suspended, add_ch_to_localbuffer() or the comet_thread resume it.
+		bool show_all = strcmp(url, "/") == 0;
+		bool known = show_all ? options.channel_index() : is_channel(mappings, url + 1);
+		if (mode && strcmp(mode, "comet") == 0 && options.comet_timeout() > 0 && known) {
+			waiter = new Waiter;
+			waiter->connection = connection;
+			if (!show_all)
+				waiter->uuid = url + 1;
+			waiter->deadline_ms = monotonic_ms() + 1000LL * options.comet_timeout();
+			waiter->waiting = true;
+			*con_cls = waiter;
+
+			MHD_suspend_connection(connection); // before it can be resumed
+			pthread_mutex_lock(&localbuffer_mutex);
+			waiters.push_back(waiter);
+			if (waiters.size() == 1)
+				pthread_cond_signal(&comet_cond); // new earliest deadline
+			pthread_mutex_unlock(&localbuffer_mutex);
+			return MHD_YES;
 		}
-	} catch (std::exception &e) {
 	}
 
-	status = MHD_queue_response(connection, response_code, response);
+	Query query;
+	bool show_all = strcmp(url, "/") == 0;
+	if (parse_query(connection, query) && (!show_all || options.channel_index())) {
+		// depends on the query, so built for this request only:
+		Snapshot snap;
+		pthread_mutex_lock(&localbuffer_mutex);
+		if (options.buffer_length() >= 0)
+			shrink_localbuffer_locked();
+		build_snapshot(snap, mappings, show_all ? NULL : url + 1, NULL, &query);
+		pthread_mutex_unlock(&localbuffer_mutex);
+		status = MHD_queue_response(connection, snap.status, snap.response);
+		MHD_destroy_response(snap.response);
+		return status;
+	}
 
-	MHD_destroy_response(response);
+	pthread_mutex_lock(&localbuffer_mutex);
+	Snapshot *snap = get_snapshot(mappings, url);
+	// queued under the lock as the snapshot may be replaced afterwards:
+	status = MHD_queue_response(connection, snap->status, snap->response);
+	pthread_mutex_unlock(&localbuffer_mutex);
 
 	return status;
 }
@@ -4,10 +4,14 @@
  * */
 
 #include "mqtt.hpp"
+#include "Metrics.hpp"
 #include "common.h"
 #include "mosquitto.h"
 #include <cassert>
+#include <errno.h>
+#include <poll.h>
 #include <sstream>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 // global var:
@@ -15,7 +19,8 @@ MqttClient *mqttClient = 0;
 volatile bool endMqttClientThread = false;
 
 // class impl.
-MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
+MqttClient::MqttClient(struct json_object *option)
+	: _enabled(false), _wakeupPending(false), _dropped(0) {
 
 	print(log_finest, "MqttClient::MqttClient called", "mqtt");
 	if (option) {
@@ -63,6 +68,19 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				_timestamp = json_object_get_boolean(local_value);
 			} else if (strcmp(key, "id") == 0 && local_type == json_type_string) {
 				_id = json_object_get_string(local_value);
+			} else if (strcmp(key, "queueSize") == 0 && local_type == json_type_int) {
+				_queueSize = json_object_get_int(local_value);
+				if (_queueSize < 2) {
+					print(log_alert, "Ignoring invalid queueSize %d, using 2", "mqtt", _queueSize);
+					_queueSize = 2;
+				}
+			} else if (strcmp(key, "maxInflight") == 0 && local_type == json_type_int) {
+				_maxInflight = json_object_get_int(local_value);
+				if (_maxInflight < 1) {
+					print(log_alert, "Ignoring invalid maxInflight %d, using 1", "mqtt",
+						  _maxInflight);
+					_maxInflight = 1;
+				}
 			} else {
 				print(log_alert, "Ignoring invalid field or type: %s=%s", NULL, key,
 					  json_object_get_string(local_value));
@@ -96,6 +114,16 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 		_enabled = false;
 	}
 
+	if (isConfigured()) {
+		_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_wakefd < 0) {
+			print(log_alert, "eventfd failed: %s. Stopped.", "mqtt", strerror(errno));
+			_enabled = false;
+		} else {
+			_queue.reset(new BoundedQueue<Item>(_queueSize));
+		}
+	}
+
 	if (isConfigured()) {
 		std::ostringstream id;
 
@@ -167,6 +195,9 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				_mcs, [](struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg) {
 					static_cast<MqttClient *>(obj)->message_callback(mosq, msg);
 				});
+			mosquitto_publish_callback_set(_mcs, [](struct mosquitto *mosq, void *obj, int mid) {
+				static_cast<MqttClient *>(obj)->publish_callback(mosq, mid);
+			});
 
 			// now connect. we use sync interface with spe. thread calling mosquitto_loop
 			res = mosquitto_connect(_mcs, _host.c_str(), _port, _keepalive);
@@ -216,6 +247,8 @@ MqttClient::~MqttClient() {
 		}
 		mosquitto_destroy(_mcs);
 	}
+	if (_wakefd >= 0)
+		close(_wakefd);
 	mosquitto_lib_cleanup(); // this assumes nobody else is using libmosquitto!
 }
 
@@ -245,71 +278,157 @@ void MqttClient::ChannelEntry::generateNames(const std::string &prefix, Channel
 		_announceValues.emplace_back("uuid", uuid);
 }
 
-void MqttClient::publish(Channel::Ptr ch, Reading &rds, bool aggregate) {
-	// take care: this function must be thread safe and non-blocking!
-	// for now we do only call this from read_thread and our mqtt_client thread doesn't harm here
-	// mosquitto_publish doesn't seem to be blocking. needs further investigation!
+bool MqttClient::publish(Channel::Ptr ch, Reading &rds, bool aggregate) {
+	// take care: this is called from the meter and logging threads for every reading.
+	// It must never block, so it only queues the reading. Topics and payloads are
+	// built and published by the mqtt_client_thread.
 
 	if (!ch)
-		return;
-	if (!_mcs)
-		return;
-
-	// search for cached values:
-	std::unique_lock<std::mutex> lock(_chMapMutex);
-	auto it = _chMap.find(ch->name());
-	if (it == _chMap.end()) {
-		ChannelEntry entry;
-		entry.generateNames(_topic, (*ch));
-		if (entry._sendAgg && !_rawAndAgg)
-			entry._sendRaw = false;
-
-		it = _chMap.emplace(std::make_pair(ch->name(), entry)).first;
-	}
+		return false;
+	if (!_mcs || !_queue)
+		return false;
 
-	assert(it != _chMap.end());
-	ChannelEntry &entry = (*it).second;
-	// do we need to announce the uuid?
-	if (!entry._announced && entry._announceValues.size()) {
-		for (auto &v : entry._announceValues) {
-			std::string name = entry._announceName + v.first;
-			int res = mosquitto_publish(_mcs, 0, name.c_str(), v.second.length(), v.second.c_str(),
-										_qos, _retain);
-			if (res != MOSQ_ERR_SUCCESS) {
-				print(log_finest, "mosquitto_publish announce \"%s\" failed: %s", "mqtt",
-					  name.c_str(), mosquitto_strerror(res));
-			} else {
-				entry._announced = true; // if one can be announced we treat it successfull
-			}
+	Item item = {ch, rds.time_ms(), rds.value(), aggregate};
+	if (!_queue->push(std::move(item))) {
+		_dropped++; // reported by the mqtt_client_thread
+		static Metrics::Counter *total = metrics.dropped("mqtt");
+		total->inc();
+		return false;
+	}
+	if (!_wakeupPending.exchange(true)) {
+		uint64_t one = 1;
+		if (write(_wakefd, &one, sizeof(one)) < 0) {
+			// only fails if the counter overflows, the thread is awake then anyhow
 		}
 	}
+	return true;
+}
 
-	std::string &topic = aggregate ? entry._fullTopicAgg : entry._fullTopicRaw;
-	if ((entry._sendAgg and aggregate) or (entry._sendRaw && !aggregate)) {
-		lock.unlock(); // we can unlock here already
-		std::string payload;
-		struct json_object *payload_obj = NULL;
+void MqttClient::drain() {
+	// clear before popping, so readings pushed from now on wake us up again:
+	_wakeupPending = false;
+
+	Item item;
+	while (_queue->pop(item)) {
+		// search for cached values:
+		auto it = _chMap.find(item.ch->name());
+		if (it == _chMap.end()) {
+			ChannelEntry entry;
+			entry.generateNames(_topic, (*item.ch));
+			if (entry._sendAgg && !_rawAndAgg)
+				entry._sendRaw = false;
+
+			it = _chMap.emplace(std::make_pair(item.ch->name(), entry)).first;
+		}
+
+		assert(it != _chMap.end());
+		ChannelEntry &entry = (*it).second;
+		// do we need to announce the uuid?
+		if (!entry._announced) {
+			for (auto &v : entry._announceValues)
+				add_pending(entry._announceName + v.first, std::string(v.second));
+			entry._announced = true;
+		}
+
+		if (!((entry._sendAgg and item.aggregate) or (entry._sendRaw && !item.aggregate)))
+			continue;
 
+		std::string payload;
 		if (_timestamp) {
-			payload_obj = json_object_new_object();
-			json_object_object_add(payload_obj, "timestamp", json_object_new_int64(rds.time_ms()));
-			json_object_object_add(payload_obj, "value", json_object_new_double(rds.value()));
+			struct json_object *payload_obj = json_object_new_object();
+			json_object_object_add(payload_obj, "timestamp", json_object_new_int64(item.time_ms));
+			json_object_object_add(payload_obj, "value", json_object_new_double(item.value));
 			payload = json_object_to_json_string(payload_obj);
+			json_object_put(payload_obj);
 		} else {
-			payload = std::to_string(rds.value());
+			payload = std::to_string(item.value);
 		}
+		add_pending(item.aggregate ? entry._fullTopicAgg : entry._fullTopicRaw, std::move(payload));
+	}
+	item.ch.reset();
 
-		print(log_finest, "publish %s=%s", "mqtt", topic.c_str(), payload.c_str());
+	unsigned long dropped = _dropped;
+	if (dropped != _droppedReported) {
+		print(log_warning, "%lu readings dropped so far (queue full or broker too slow)", "mqtt",
+			  dropped);
+		_droppedReported = dropped;
+	}
+}
 
-		int res = mosquitto_publish(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(), _qos,
-									_retain);
+void MqttClient::add_pending(const std::string &topic, std::string &&payload) {
+	if (_retain) {
+		// only the latest value of a retained topic matters:
+		auto it = _pendingTopics.find(topic);
+		if (it != _pendingTopics.end()) {
+			it->second->payload = std::move(payload);
+			return;
+		}
+		_pending.push_back(Message{topic, std::move(payload)});
+		_pendingTopics.emplace(topic, std::prev(_pending.end()));
+	} else {
+		if (_pending.size() >= (size_t)_queueSize) {
+			_pending.pop_front();
+			_dropped++;
+			metrics.dropped("mqtt")->inc();
+		}
+		_pending.push_back(Message{topic, std::move(payload)});
+	}
+}
+
+void MqttClient::send_pending() {
+	while (_isConnected && !_pending.empty() && _inflight.size() < (size_t)_maxInflight) {
+		Message &msg = _pending.front();
+		print(log_finest, "publish %s=%s", "mqtt", msg.topic.c_str(), msg.payload.c_str());
+
+		int mid = 0;
+		int res = mosquitto_publish(_mcs, &mid, msg.topic.c_str(), msg.payload.length(),
+									msg.payload.c_str(), _qos, _retain);
+		if (res == MOSQ_ERR_NO_CONN)
+			break; // keep it for the reconnect
 		if (res != MOSQ_ERR_SUCCESS) {
-			print(log_finest, "mosquitto_publish failed: %s", "mqtt", mosquitto_strerror(res));
+			print(log_finest, "mosquitto_publish \"%s\" failed: %s", "mqtt", msg.topic.c_str(),
+				  mosquitto_strerror(res));
+		} else {
+			_inflight.insert(mid); // until acked (QoS>0) or written (QoS 0)
 		}
-		if (payload_obj != NULL) {
-			json_object_put(payload_obj);
+		if (_retain)
+			_pendingTopics.erase(msg.topic);
+		_pending.pop_front();
+	}
+}
+
+int MqttClient::loop(int timeout) {
+	// like mosquitto_loop but waits for new readings as well
+	int sock = mosquitto_socket(_mcs);
+	if (sock < 0)
+		return MOSQ_ERR_NO_CONN;
+
+	struct pollfd fds[2];
+	fds[0].fd = sock;
+	fds[0].events = POLLIN | (mosquitto_want_write(_mcs) ? POLLOUT : 0);
+	fds[0].revents = 0;
+	fds[1].fd = _wakefd;
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+
+	if (poll(fds, 2, timeout) < 0)
+		return errno == EINTR ? MOSQ_ERR_SUCCESS : MOSQ_ERR_ERRNO;
+
+	if (fds[1].revents & POLLIN) {
+		uint64_t cnt;
+		if (read(_wakefd, &cnt, sizeof(cnt)) < 0) {
+			// EAGAIN, nothing to do
 		}
 	}
+
+	int res = MOSQ_ERR_SUCCESS;
+	if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+		res = mosquitto_loop_read(_mcs, 1);
+	if (res == MOSQ_ERR_SUCCESS && (fds[0].revents & POLLOUT))
+		res = mosquitto_loop_write(_mcs, 1);
+	if (res == MOSQ_ERR_SUCCESS)
+		res = mosquitto_loop_misc(_mcs);
+	return res;
 }
 
 void MqttClient::connect_callback(struct mosquitto *mosq, int result) {
@@ -317,6 +436,9 @@ void MqttClient::connect_callback(struct mosquitto *mosq, int result) {
 	switch (result) {
 	case MOSQ_ERR_SUCCESS:
 		_isConnected = true;
+		// QoS 0 messages not written before the connection was lost are gone:
+		if (!_qos)
+			_inflight.clear();
 		break;
 	default:
 		_isConnected = false;
@@ -333,12 +455,16 @@ void MqttClient::message_callback(struct mosquitto *mosq, const struct mosquitto
 	print(log_finest, "message_callback called", "mqtt");
 }
 
+void MqttClient::publish_callback(struct mosquitto *mosq, int mid) { _inflight.erase(mid); }
+
 void *mqtt_client_thread(void *arg) {
 	print(log_debug, "Start mqtt_client_thread", "mqtt");
 
 	if (mqttClient) {
 		while (!endMqttClientThread) {
-			int res = mosquitto_loop(mqttClient->_mcs, 1000, 1);
+			mqttClient->drain();
+			mqttClient->send_pending();
+			int res = mqttClient->loop(1000);
 			if (res != MOSQ_ERR_SUCCESS) {
 				print(log_warning, "mosquitto_loop failed (trying to reconnect): %s", "mqtt",
 					  mosquitto_strerror(res));
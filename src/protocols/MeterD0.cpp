@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,6 +42,7 @@
 
 // socket
 #include <netdb.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 
 #include "threads.h"
@@ -56,8 +58,10 @@ MeterD0::MeterD0(std::list<Option> &options)
 	: Protocol("d0"), _host(""), _device(""), _auto_ack(false), _wait_sync_end(false),
 	  _read_timeout_s(10), _baudrate_change_delay_ms(0), _reaction_time_ms(200) // default to 200ms
 	  ,
-	  _dump_fd(0), _old_mode(NONE), _dump_pos(0) {
+	  _dump_fd(0), _rx_pos(0), _rx_len(0), _last_progress(0), _sync_skipped(0), _polled(false),
+	  _pending(PENDING_NONE), _pending_ms(0), _old_mode(NONE), _dump_pos(0) {
 	OptionList optlist;
+	_reset();
 
 	// connection
 	try {
@@ -362,469 +366,591 @@ int MeterD0::close() {
 	return ::close(_fd);
 }
 
-ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
-
-	enum {
-		START,
-		VENDOR,
-		BAUDRATE,
-		IDENTIFICATION,
-		ACK,
-		START_LINE,
-		OBIS_CODE,
-		VALUE,
-		UNIT,
-		END_LINE,
-		END
-	} context;
+void MeterD0::_reset() {
+	_context = START;
+	_byte_iterator = 0;
+	_number_of_tuples = 0;
+	_baudrate_id = 0;
+	_lastbyte = 0;
+	_vendor[0] = _identification[0] = _obis_code[0] = _value[0] = _unit[0] = '\0';
+}
 
-	bool error_flag = false;
-	const int VENDOR_LEN = 3;
-	char vendor[VENDOR_LEN + 1] = {0}; // 3 upper case vendor + '\0' termination
-	const int IDENTIFICATION_LEN = 16;
-	char identification[IDENTIFICATION_LEN + 1] = {0}; // 16 meter specific + '\0' termination
-	const int OBIS_LEN = 16;
-	char obis_code[OBIS_LEN + 1]; /* A-B:C.D.E*F
-							 fields A, B, E, F are optional
-							 fields C & D are mandatory
-							 A: energy type; 1: energy
-							 B: channel number; 0: no channel specified
-							 C: data items; 0-89 in COSEM context: IEC 62056-62, Clause D.1; 96:
-							 General service entries 1:  Totel Active power+ 21: L1 Active power+
-							 31: L1 Current
-							 32: L1 Voltage
-							 41: L2 Active power+
-							 51: L2 Current
-							 52: L2 Voltage
-							 61: L3 Active power+
-							 71: L3 Current
-							 72: L3 Voltage
-							 96.1.255: Metering point ID 256 (electricity related)
-							 96.5.5: Meter started status flag
-							 D: types
-							 E: further processing or classification of quantities
-							 F: storage of data
-							 see DIN-EN-62056-61 */
-	const int VALUE_LEN = 32;
-	char value[VALUE_LEN + 1]; // value, i.e. the actual reading
-	const int UNIT_LEN = 16;
-	char unit[UNIT_LEN + 1]; // the unit of the value, e.g. kWh, V, ...
-
-	char baudrate;       // 1 byte for
-	char byte, lastbyte; // we parse our input byte wise
-	int byte_iterator;
-	char endseq[2 + 1]; // Endsequence ! not ?!
-	size_t number_of_tuples;
-	int bytes_read;
-	time_t start_time, end_time;
+void MeterD0::_sendPull() {
 	struct termios tio;
-	int baudrate_connect, baudrate_read; // Baudrates for switching
+	tcgetattr(_fd, &tio);
 
-	dump_file(CTRL, "read");
+	dump_file(CTRL, "TCIOFLUSH and cfsetiospeed");
+	tcflush(_fd, TCIOFLUSH);
+	_rx_pos = _rx_len = 0; // and what we have buffered already
+	cfsetispeed(&tio, _baudrate);
+	cfsetospeed(&tio, _baudrate);
+	// apply new configuration
+	tcsetattr(_fd, TCSANOW, &tio);
+	if (_baudrate_change_delay_ms) {
+		// give some time for baudrate change to be applied
+		if (_polled) {
+			_defer(PENDING_PULL, _baudrate_change_delay_ms);
+			return;
+		}
+		usleep(_baudrate_change_delay_ms * 1000);
+	}
+	_writePull();
+}
 
-	baudrate_connect = _baudrate;
-	baudrate_read = _baudrate_read;
-	tcgetattr(_fd, &tio);
+void MeterD0::_writePull() {
+	int wlen = write(_fd, _pull.c_str(), _pull.size());
+	dump_file(DUMP_OUT, _pull.c_str(), wlen > 0 ? wlen : 0);
+	VZ_PRINT(log_debug, "sending pullsequenz send (len:%d is:%d).", name().c_str(), _pull.size(),
+			 wlen);
+}
 
-	if (_pull.size()) {
-		dump_file(CTRL, "TCIOFLUSH and cfsetiospeed");
-		tcflush(_fd, TCIOFLUSH);
-		cfsetispeed(&tio, baudrate_connect);
-		cfsetospeed(&tio, baudrate_connect);
-		// apply new configuration
-		tcsetattr(_fd, TCSANOW, &tio);
-		if (_baudrate_change_delay_ms)
-			usleep(_baudrate_change_delay_ms *
-				   1000); // give some time for baudrate change to be applied
-		int wlen = write(_fd, _pull.c_str(), _pull.size());
-		dump_file(DUMP_OUT, _pull.c_str(), wlen > 0 ? wlen : 0);
-		print(log_debug, "sending pullsequenz send (len:%d is:%d).", name().c_str(), _pull.size(),
-			  wlen);
+void MeterD0::_sendAck() {
+	if (!_ack.size()) {
+		// calculate the ack seq based on IEC62056-21 mode C data readout:
+		// assuming a meter doesn't change at runtime the baudrate
+		_ack = "\x06\x30\x30\x30\x0d\x0a"; // 063030300d0a
+		// now change based on baudrate:
+		char c = 0;
+		switch (_baudrate_id) {
+		case '1': // 600
+			_baudrate_read = B600;
+			c = _baudrate_id;
+			break;
+		case '2': // 1200
+			_baudrate_read = B1200;
+			c = _baudrate_id;
+			break;
+		case '3': // 2400
+			_baudrate_read = B2400;
+			c = _baudrate_id;
+			break;
+		case '4': // 4800
+			_baudrate_read = B4800;
+			c = _baudrate_id;
+			break;
+		case '5': // 9600
+			_baudrate_read = B9600;
+			c = _baudrate_id;
+			break;
+		case '6': // 19200
+			_baudrate_read = B19200;
+			c = _baudrate_id;
+			break;
+		case '0': // 300 nobreak;
+		default:
+			_baudrate_read = 300; // don't set c
+			break;
+		}
+		if (c != 0)
+			_ack[2] = c;
 	}
 
-	time(&start_time);
-
-	byte_iterator = number_of_tuples = baudrate = 0;
-	byte = lastbyte = 0;
-	context = START; // start with context START
-
-	if (_wait_sync_end) {
-		/* wait once for the sync pattern ("!") at the end of a regular D0 message.
-		   This is intended for D0 meters that start sending data automatically
-		   (e.g. Hager EHZ361).
-		*/
-		int skipped = 0;
-		while (_wait_sync_end && ::read(_fd, &byte, 1)) {
-			dump_file(byte);
-			if (byte == '!') {
-				_wait_sync_end = false;
-				print(log_debug, "found wait_sync_end. skipped %d bytes.", name().c_str(), skipped);
-			} else {
-				skipped++;
-				if (skipped > D0_BUFFER_LENGTH) {
-					_wait_sync_end = false;
-					print(log_error,
-						  "stopped searching for wait_sync_end after %d bytes without success!",
-						  name().c_str(), skipped);
-				}
-			}
+	// we have to send the ack with the old baudrate and change after successfull
+	// transmission:
+	int wlen = write(_fd, _ack.c_str(), _ack.size());
+	dump_file(DUMP_OUT, _ack.c_str(), wlen);
+	VZ_PRINT(log_debug, "Sending ack sequence send (len:%d is:%d,%s).", name().c_str(),
+			 _ack.size(), wlen, _ack.c_str());
+}
+
+void MeterD0::_setReadBaudrate() {
+	if (_baudrate_read == _baudrate)
+		return;
+	struct termios tio;
+	tcgetattr(_fd, &tio);
+	cfsetispeed(&tio, _baudrate_read);
+	cfsetospeed(&tio, _baudrate_read); // we set this as well. might not be needed but
+									   // adapters might not support different speed setups.
+	tcsetattr(_fd, TCSADRAIN, &tio); // TCSADRAIN should not be needed (TCSANOW might be sufficient)
+	if (_baudrate_change_delay_ms)
+		dump_file(CTRL, "usleep cfsetispeed");
+	else
+		dump_file(CTRL, "tcdrain cfsetispeed");
+}
+
+bool MeterD0::_sync(char byte) {
+	/* wait once for the sync pattern ("!") at the end of a regular D0 message.
+	   This is intended for D0 meters that start sending data automatically
+	   (e.g. Hager EHZ361).
+	*/
+	if (!_wait_sync_end)
+		return false;
+	if (byte == '!') {
+		_wait_sync_end = false;
+		VZ_PRINT(log_debug, "found wait_sync_end. skipped %d bytes.", name().c_str(),
+				 _sync_skipped);
+	} else {
+		_sync_skipped++;
+		if (_sync_skipped > D0_BUFFER_LENGTH) {
+			_wait_sync_end = false;
+			print(log_error, "stopped searching for wait_sync_end after %d bytes without success!",
+				  name().c_str(), _sync_skipped);
 		}
 	}
+	return true;
+}
+
+ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
+
+	dump_file(CTRL, "read");
+
+	_polled = false;
+	if (_pull.size())
+		_sendPull();
+
+	_reset(); // start with context START
+	time(&_last_progress);
 
 	while (1) {
-		_safe_to_cancel();
-		// check for timeout
-		time(&end_time);
-		if (difftime(end_time, start_time) > _read_timeout_s) {
+		// parse what is buffered already, a previous call might have left the next telegram
+		switch (_consume(rds, max_readings)) {
+		case PARSE_DONE:
+			return _number_of_tuples;
+		case PARSE_ERROR:
+			print(log_alert, "Something unexpected happened: %s:%i!", name().c_str(), __FUNCTION__,
+				  __LINE__);
+			return _number_of_tuples; // return number of good readings so far.
+		default:
+			break;
+		}
+
+		// wait for more data, the timeout is reset as long as we are making progress
+		time_t now = time(NULL);
+		if (difftime(now, _last_progress) > _read_timeout_s) {
 			print(log_error, "nothing received for more than %d seconds", name().c_str(),
 				  _read_timeout_s);
 			dump_file(CTRL, "timeout!");
 			break;
 		}
-
-		// now read a single byte
-		bytes_read = ::read(_fd, &byte, 1);
-		if (bytes_read == 0 || (bytes_read == -1 && errno == EAGAIN)) {
-			// wait 5ms and read again
-			usleep(5000);
+		int timeout_ms = (_last_progress + _read_timeout_s + 1 - now) * 1000;
+
+		struct pollfd pfd;
+		pfd.fd = _fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int res;
+		CANCELLABLE(res = ::poll(&pfd, 1, timeout_ms));
+		if (res < 0 && errno == EINTR)
 			continue;
-		} else if (bytes_read == -1) {
-			print(log_error, "error reading a byte (%d)", name().c_str(), errno);
+		if (res < 0) {
+			print(log_error, "error waiting for data (%d)", name().c_str(), errno);
 			break;
 		}
-		dump_file(byte);
+		if (res == 0)
+			continue; // timeout is checked above
 
-		// reset timeout if we are making progress
-		if (context != START) {
-			time(&start_time);
+		ssize_t bytes_read = _fill();
+		if (bytes_read < 0)
+			break;
+		if (bytes_read == 0 && (pfd.revents & (POLLHUP | POLLERR))) {
+			print(log_error, "device %s hung up", name().c_str(), device());
+			break;
 		}
+	} // end while
 
-		lastbyte = byte;
-		if ((byte == '/') && (byte_iterator == 0)) {
-			context = VENDOR; // Slash can also be in OBIS String of TD-3511 meter
-		} else if ((byte == '?') || (byte == '!')) {
-			if (context != END) {
-				context = END; // "!" is the identifier for the END
-				byte_iterator = 0;
-			}
+	// Read terminated
+	print(log_alert, "read timed out!, context: %i, bytes read: %i, last byte 0x%x", name().c_str(),
+		  _context, _byte_iterator, _lastbyte);
+	return _number_of_tuples; // in any case return the number of readings. there might be some
+							  // valid ones.
+}
+
+void MeterD0::poll_request() {
+	dump_file(CTRL, "poll");
+	_polled = true;
+	_pending = PENDING_NONE; // a new request replaces what the last one still waits for
+	if (_pull.size())
+		_sendPull();
+	_reset(); // a pending incomplete answer won't be completed anymore
+	time(&_last_progress);
+}
+
+ssize_t MeterD0::poll(std::vector<Reading> &rds, size_t max_readings) {
+	_polled = true;
+	if (_pending != PENDING_NONE) {
+		if (poll_timeout() > 0)
+			return _fill() < 0 ? -1 : 0; // keep what arrives meanwhile, parsed after the step
+		if (!_runPending())
+			return 0;
+	}
+
+	if (_context != START && difftime(time(NULL), _last_progress) > _read_timeout_s) {
+		print(log_error, "incomplete telegram dropped after %d seconds, context: %i",
+			  name().c_str(), _read_timeout_s, _context);
+		dump_file(CTRL, "timeout!");
+		_reset();
+	}
+
+	while (1) {
+		PARSE_RESULT res = _consume(rds, max_readings);
+		if (res == PARSE_MORE) {
+			if (_pending != PENDING_NONE)
+				return 0; // called again when it's due, see poll_timeout()
+			ssize_t bytes_read = _fill();
+			if (bytes_read <= 0)
+				return bytes_read; // 0: wait for the next call
+			continue;
 		}
+		if (res == PARSE_ERROR)
+			print(log_alert, "Something unexpected happened: %s:%i!", name().c_str(), __FUNCTION__,
+				  __LINE__);
+		// the rest of _rx is kept for the next call
+		size_t n = _number_of_tuples;
+		_reset();
+		return n;
+	}
+}
 
-		switch (context) {
-		case START:            // strip the initial "/"
-			if (byte == '/') { // if ((byte != '\r') &&  (byte != '\n')) { 	// allow extra new line
-							   // at the start
-				byte_iterator = number_of_tuples = 0; // start
-				context = VENDOR;                     // set new context: START -> VENDOR
-			} // else ignore the other chars. -> Wait for / (!? is checked above already)
-			break;
+int MeterD0::poll_timeout() const {
+	if (_pending == PENDING_NONE)
+		return -1;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	int64_t ms = _pending_ms - ((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	return ms > 0 ? (int)ms : 0;
+}
 
-		case VENDOR: // VENDOR has 3 Bytes
-			if ((byte == '\r') || (byte == '\n') || (byte == '/')) {
-				byte_iterator = number_of_tuples = 0;
-				break;
-			}
+void MeterD0::_defer(PENDING step, int delay_ms) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	_pending = step;
+	_pending_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + delay_ms;
+}
 
-			if (!isalpha(byte))
-				goto error;                    // Vendor ID needs to be alpha
-			vendor[byte_iterator++] = byte;    // read next byte
-			if (byte_iterator >= VENDOR_LEN) { // after 3rd byte
-				// check for reaction time indicator: (3rd letter lower case)
-				if (islower(vendor[2]))
-					_reaction_time_ms = 20; // lower case indicates 20ms
-				else
-					_reaction_time_ms = 200; // upper case indicates 200ms
+bool MeterD0::_runPending() {
+	PENDING step = _pending;
+	_pending = PENDING_NONE;
+	switch (step) {
+	case PENDING_PULL:
+		_writePull();
+		break;
+	case PENDING_ACK:
+		_sendAck();
+		if (_baudrate_read != _baudrate)
+			_defer(PENDING_BAUDRATE, _baudrate_change_delay_ms);
+		break;
+	case PENDING_BAUDRATE: {
+		// instead of tcdrain(): the ack has to be sent with the old baudrate
+		int queued = 0;
+		if (ioctl(_fd, TIOCOUTQ, &queued) == 0 && queued > 0)
+			_defer(PENDING_BAUDRATE, 10);
+		else
+			_setReadBaudrate();
+		break;
+	}
+	default:
+		break;
+	}
+	return _pending == PENDING_NONE;
+}
 
-				vendor[byte_iterator] = '\0'; // termination
-				byte_iterator = 0;            // reset byte counter
-				context = BAUDRATE;           // set new context: VENDOR -> BAUDRATE
-			}
-			break;
+MeterD0::PARSE_RESULT MeterD0::_consume(std::vector<Reading> &rds, size_t max_readings) {
+	time_t now = time(NULL);
+	while (_rx_pos < _rx_len) {
+		char byte = _rx[_rx_pos++];
+		if (_sync(byte))
+			continue;
+		// reset timeout if we are making progress
+		if (_context != START)
+			_last_progress = now;
+
+		PARSE_RESULT res = _parse(byte, rds, max_readings);
+		if (res != PARSE_MORE)
+			return res;
+		if (_pending != PENDING_NONE)
+			break; // the rest is parsed after the deferred step, like after a sleep
+	}
+	return PARSE_MORE;
+}
 
-		case BAUDRATE:       // BAUDRATE consists of 1 char only
-			baudrate = byte; // with _auto_ack we could check here whether the baudrate changed and
-							 // set _ack to ""
-			byte_iterator = 0;
-			context = IDENTIFICATION; // set new context: BAUDRATE -> IDENTIFICATION
-			break;
+ssize_t MeterD0::_fill() {
+	// keep unparsed bytes, they are only left while a step is pending
+	if (_rx_pos > 0) {
+		memmove(_rx, _rx + _rx_pos, _rx_len - _rx_pos);
+		_rx_len -= _rx_pos;
+		_rx_pos = 0;
+	}
+	if (_rx_len == sizeof(_rx))
+		return 0;
+	ssize_t bytes_read = ::read(_fd, _rx + _rx_len, sizeof(_rx) - _rx_len);
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	} else if (bytes_read < 0) {
+		print(log_error, "error reading (%d)", name().c_str(), errno);
+		return -1;
+	} else if (bytes_read == 0) {
+		if (_host.length() > 0) {
+			print(log_error, "connection closed by %s", name().c_str(), host());
+			return -1;
+		}
+		return 0;
+	}
+	dump_file(DUMP_IN, _rx + _rx_len, bytes_read);
+	_rx_len += bytes_read;
+	return bytes_read;
+}
 
-		case IDENTIFICATION:                          // IDENTIFICATION has 16 bytes
-			if ((byte == '\r') || (byte == '\n')) {   // line end
-				identification[byte_iterator] = '\0'; // termination
-				print(log_debug, "Pull answer (vendor=%s, baudrate=%c, identification=%s)",
-					  name().c_str(), vendor, baudrate, identification);
-				byte_iterator = 0;
-				context = ACK; // set new context: IDENTIFICATION -> ACK (old: OBIS_CODE)
-				// warning we send the ACK only after receiving of next char. This works only as the
-				// ID is ended by \r \n
-			} else {
-				if (!isprint(byte)) {
-					print(log_error, "====> binary character '%x'", name().c_str(), byte);
-					// error_flag=true;
-				} else {
-					if (byte_iterator < IDENTIFICATION_LEN)
-						identification[byte_iterator++] = byte;
-					else
-						print(log_error, "Too much data for identification (byte=0x%X)",
-							  name().c_str(), byte);
-				}
-				// break;
-			}
+MeterD0::PARSE_RESULT MeterD0::_parse(char byte, std::vector<Reading> &rds, size_t max_readings) {
+	bool error_flag = false;
+
+	_lastbyte = byte;
+	if ((byte == '/') && (_byte_iterator == 0)) {
+		_context = VENDOR; // Slash can also be in OBIS String of TD-3511 meter
+	} else if ((byte == '?') || (byte == '!')) {
+		if (_context != END) {
+			_context = END; // "!" is the identifier for the END
+			_byte_iterator = 0;
+		}
+	}
+
+	switch (_context) {
+	case START:            // strip the initial "/"
+		if (byte == '/') { // if ((byte != '\r') &&  (byte != '\n')) { 	// allow extra new line
+						   // at the start
+			_byte_iterator = _number_of_tuples = 0; // start
+			_context = VENDOR;                      // set new context: START -> VENDOR
+		} // else ignore the other chars. -> Wait for / (!? is checked above already)
+		break;
+
+	case VENDOR: // VENDOR has 3 Bytes
+		if ((byte == '\r') || (byte == '\n') || (byte == '/')) {
+			_byte_iterator = _number_of_tuples = 0;
 			break;
+		}
 
-		case ACK:
-			if (_auto_ack || _ack.size()) {
-				// first delay according to min reaction time:
-				usleep(_reaction_time_ms * 1000);
+		if (!isalpha(byte))
+			return PARSE_ERROR;             // Vendor ID needs to be alpha
+		_vendor[_byte_iterator++] = byte;   // read next byte
+		if (_byte_iterator >= VENDOR_LEN) { // after 3rd byte
+			// check for reaction time indicator: (3rd letter lower case)
+			if (islower(_vendor[2]))
+				_reaction_time_ms = 20; // lower case indicates 20ms
+			else
+				_reaction_time_ms = 200; // upper case indicates 200ms
+
+			_vendor[_byte_iterator] = '\0'; // termination
+			_byte_iterator = 0;             // reset byte counter
+			_context = BAUDRATE;            // set new context: VENDOR -> BAUDRATE
+		}
+		break;
 
-				if (!_ack.size()) {
-					// calculate the ack seq based on IEC62056-21 mode C data readout:
-					// assuming a meter doesn't change at runtime the baudrate
-					_ack = "\x06\x30\x30\x30\x0d\x0a"; // 063030300d0a
-					// now change based on baudrate:
-					char c = 0;
-					switch (baudrate) {
-					case '1': // 600
-						baudrate_read = B600;
-						c = baudrate;
-						break;
-					case '2': // 1200
-						baudrate_read = B1200;
-						c = baudrate;
-						break;
-					case '3': // 2400
-						baudrate_read = B2400;
-						c = baudrate;
-						break;
-					case '4': // 4800
-						baudrate_read = B4800;
-						c = baudrate;
-						break;
-					case '5': // 9600
-						baudrate_read = B9600;
-						c = baudrate;
-						break;
-					case '6': // 19200
-						baudrate_read = B19200;
-						c = baudrate;
-						break;
-					case '0': // 300 nobreak;
-					default:
-						baudrate_read = 300; // don't set c
-						break;
-					}
-					_baudrate_read = baudrate_read; // store in member variable as well overriding
-													// the option parameter
-					if (c != 0)
-						_ack[2] = c;
-				}
+	case BAUDRATE:           // BAUDRATE consists of 1 char only
+		_baudrate_id = byte; // with _auto_ack we could check here whether the baudrate changed
+							 // and set _ack to ""
+		_byte_iterator = 0;
+		_context = IDENTIFICATION; // set new context: BAUDRATE -> IDENTIFICATION
+		break;
 
-				// we have to send the ack with the old baudrate and change after successfull
-				// transmission:
-				int wlen = write(_fd, _ack.c_str(), _ack.size());
-				dump_file(DUMP_OUT, _ack.c_str(), wlen);
-				if (!_baudrate_change_delay_ms)
-					tcdrain(_fd); // if no delay is defined we use tcdrain Wait until sent
-				print(log_debug, "Sending ack sequence send (len:%d is:%d,%s).", name().c_str(),
-					  _ack.size(), wlen, _ack.c_str());
+	case IDENTIFICATION:                            // IDENTIFICATION has 16 bytes
+		if ((byte == '\r') || (byte == '\n')) {     // line end
+			_identification[_byte_iterator] = '\0'; // termination
+			VZ_PRINT(log_debug, "Pull answer (vendor=%s, baudrate=%c, identification=%s)",
+					 name().c_str(), _vendor, _baudrate_id, _identification);
+			_byte_iterator = 0;
+			_context = ACK; // set new context: IDENTIFICATION -> ACK (old: OBIS_CODE)
+			// warning we send the ACK only after receiving of next char. This works only as the
+			// ID is ended by \r \n
+		} else {
+			if (!isprint(byte)) {
+				print(log_error, "====> binary character '%x'", name().c_str(), byte);
+				// error_flag=true;
+			} else {
+				if (_byte_iterator < IDENTIFICATION_LEN)
+					_identification[_byte_iterator++] = byte;
+				else
+					print(log_error, "Too much data for identification (byte=0x%X)",
+						  name().c_str(), byte);
+			}
+			// break;
+		}
+		break;
 
+	case ACK:
+		if (_auto_ack || _ack.size()) {
+			if (_polled) {
+				// first delay according to min reaction time, see _runPending()
+				_defer(PENDING_ACK, _reaction_time_ms);
+			} else {
+				usleep(_reaction_time_ms * 1000);
+				_sendAck();
 				if (_baudrate_change_delay_ms)
 					usleep(_baudrate_change_delay_ms * 1000);
-				if (baudrate_read != baudrate_connect) {
-					cfsetispeed(&tio, baudrate_read);
-					cfsetospeed(
-						&tio, baudrate_read); // we set this as well. might not be needed but
-											  // adapters might not support different speed setups.
-					tcsetattr(_fd, TCSADRAIN,
-							  &tio); // TCSADRAIN should not be needed (TCSANOW might be sufficient)
-					if (_baudrate_change_delay_ms)
-						dump_file(CTRL, "usleep cfsetispeed");
-					else
-						dump_file(CTRL, "tcdrain cfsetispeed");
-				}
-			}
-			context = OBIS_CODE;
-			break;
-
-		case START_LINE:
-			break;
-
-		case OBIS_CODE:
-			print((log_level_t)(log_debug + 5), "DEBUG OBIS_CODE byte %c hex= %X ", name().c_str(),
-				  byte, byte);
-			if ((byte != '\n') && (byte != '\r') && (byte != 0x02)) { // exclude STX
-				if (byte == '(') {
-					obis_code[byte_iterator] = '\0';
-					byte_iterator = 0;
-					context = VALUE;
-				} else {
-					if (byte_iterator < OBIS_LEN)
-						obis_code[byte_iterator++] = byte;
-					else
-						print(log_error, "Too much data for obis_code (byte=0x%X)", name().c_str(),
-							  byte);
-				}
+				else
+					tcdrain(_fd); // if no delay is defined we use tcdrain Wait until sent
+				_setReadBaudrate();
 			}
-			break;
+		}
+		_context = OBIS_CODE;
+		break;
 
-		case VALUE:
-			print(((log_level_t)(log_debug + 5)), "DEBUG VALUE byte= %c hex= %x ", name().c_str(),
-				  byte, byte);
-			if ((byte == '*') || (byte == ')')) {
-				value[byte_iterator] = '\0';
-				byte_iterator = 0;
+	case START_LINE:
+		break;
 
-				if (byte == ')') {
-					unit[0] = '\0';
-					context = END_LINE;
-				} else {
-					context = UNIT;
-				}
+	case OBIS_CODE:
+		VZ_PRINT((log_level_t)(log_debug + 5), "DEBUG OBIS_CODE byte %c hex= %X ", name().c_str(),
+				 byte, byte);
+		if ((byte != '\n') && (byte != '\r') && (byte != 0x02)) { // exclude STX
+			if (byte == '(') {
+				_obis_code[_byte_iterator] = '\0';
+				_byte_iterator = 0;
+				_context = VALUE;
 			} else {
-				if (byte_iterator < VALUE_LEN)
-					value[byte_iterator++] = byte;
+				if (_byte_iterator < OBIS_LEN)
+					_obis_code[_byte_iterator++] = byte;
 				else
-					print(log_error, "Too much data for value (byte=0x%X)", name().c_str(), byte);
+					print(log_error, "Too much data for obis_code (byte=0x%X)", name().c_str(),
+						  byte);
 			}
-			break;
+		}
+		break;
+
+	case VALUE:
+		VZ_PRINT((log_level_t)(log_debug + 5), "DEBUG VALUE byte= %c hex= %x ", name().c_str(),
+				 byte, byte);
+		if ((byte == '*') || (byte == ')')) {
+			_value[_byte_iterator] = '\0';
+			_byte_iterator = 0;
 
-		case UNIT:
 			if (byte == ')') {
-				unit[byte_iterator] = '\0';
-				byte_iterator = 0;
-				context = END_LINE;
+				_unit[0] = '\0';
+				_context = END_LINE;
 			} else {
-				if (byte_iterator < UNIT_LEN)
-					unit[byte_iterator++] = byte;
-				else
-					print(log_error, "Too much data for unit (byte=0x%X)", name().c_str(), byte);
+				_context = UNIT;
 			}
-			break;
+		} else {
+			if (_byte_iterator < VALUE_LEN)
+				_value[_byte_iterator++] = byte;
+			else
+				print(log_error, "Too much data for value (byte=0x%X)", name().c_str(), byte);
+		}
+		break;
 
-		case END_LINE:
-			print(log_alert, "logical error in state machine. reached END_LINE", name().c_str());
-			goto error; // this should never happen
-			break;
+	case UNIT:
+		if (byte == ')') {
+			_unit[_byte_iterator] = '\0';
+			_byte_iterator = 0;
+			_context = END_LINE;
+		} else {
+			if (_byte_iterator < UNIT_LEN)
+				_unit[_byte_iterator++] = byte;
+			else
+				print(log_error, "Too much data for unit (byte=0x%X)", name().c_str(), byte);
+		}
+		break;
 
-		case END:
-			// here we stay until we receive either:
-			// a) ! as end indicator
-			// b) ?! as pull seq indicator -> wait for VENDOR
-			// c) how to handle ? with something else? -> ignore (so ??! will be accepted as b)
-			// d) 0x0d 0x0a ? -> ignore, so stay in END state.
-			// above is new! Previous versions ended on all but ? ("assuming !")
-
-			if (byte == '!') {
-				if (byte_iterator == 0) {
-					// case a) ! as end ind.
-					// fallthrough to return number of tuples below.
-				} else {
-					// can only be case b) ?!.
-					if (endseq[0] == '?') {
-						context = VENDOR;
-						byte_iterator = 0;
-						break;
-					} else {
-						error_flag = true; // state machine logic error!
-						print(log_debug, "DEBUG END b2 byte: %x byte_it: %d ", name().c_str(), byte,
-							  byte_iterator);
-					}
-				}
-			} else if (byte == '?') {
-				if (byte_iterator == 0) {
-					// can be start of case b, store it
-					endseq[byte_iterator++] = byte;
+	case END_LINE:
+		print(log_alert, "logical error in state machine. reached END_LINE", name().c_str());
+		return PARSE_ERROR; // this should never happen
+		break;
+
+	case END:
+		// here we stay until we receive either:
+		// a) ! as end indicator
+		// b) ?! as pull seq indicator -> wait for VENDOR
+		// c) how to handle ? with something else? -> ignore (so ??! will be accepted as b)
+		// d) 0x0d 0x0a ? -> ignore, so stay in END state.
+		// above is new! Previous versions ended on all but ? ("assuming !")
+
+		if (byte == '!') {
+			if (_byte_iterator == 0) {
+				// case a) ! as end ind.
+				// fallthrough to return number of tuples below.
+			} else {
+				// can only be case b) ?!.
+				if (_endseq[0] == '?') {
+					_context = VENDOR;
+					_byte_iterator = 0;
 					break;
 				} else {
-					// we simply keep the state. so we accept ??! as well
-					break;
+					error_flag = true; // state machine logic error!
+					VZ_PRINT(log_debug, "DEBUG END b2 byte: %x byte_it: %d ", name().c_str(), byte,
+							 _byte_iterator);
 				}
-			} else if (byte == STX) {
-				// some meter seem to send ? STX ... as start package. (e.g. AS1440)
-				context = OBIS_CODE;
-				byte_iterator = 0;
+			}
+		} else if (byte == '?') {
+			if (_byte_iterator == 0) {
+				// can be start of case b, store it
+				_endseq[_byte_iterator++] = byte;
 				break;
-			} else if (byte == '/') { // go to vendor
-				context = VENDOR;
-				byte_iterator = 0;
+			} else {
+				// we simply keep the state. so we accept ??! as well
 				break;
-			} else { // any other char than ! or ?:
-				if (byte_iterator > 0)
-					byte_iterator = 0; // reset ? reminder
-				break; // but stay in this state and accept that char! (here we ended before!)
-					   // TODO Think about a timeout here?
 			}
+		} else if (byte == STX) {
+			// some meter seem to send ? STX ... as start package. (e.g. AS1440)
+			_context = OBIS_CODE;
+			_byte_iterator = 0;
+			break;
+		} else if (byte == '/') { // go to vendor
+			_context = VENDOR;
+			_byte_iterator = 0;
+			break;
+		} else { // any other char than ! or ?:
+			if (_byte_iterator > 0)
+				_byte_iterator = 0; // reset ? reminder
+			break; // but stay in this state and accept that char! (here we ended before!)
+				   // TODO Think about a timeout here?
+		}
 
-			if (error_flag) {
-				print(log_error, "reading binary values.", name().c_str());
-				goto error;
-			}
+		if (error_flag) {
+			print(log_error, "reading binary values.", name().c_str());
+			return PARSE_ERROR;
+		}
 
-			print(log_debug,
-				  "Read package with %llu tuples (vendor=%s, baudrate=%c, identification=%s)",
-				  name().c_str(), (unsigned long long)number_of_tuples, vendor, baudrate,
-				  identification);
-			return number_of_tuples;
-		} // end switch
-
-		if (END_LINE == context) { // add the data already here (so after the closing bracket) but
-								   // before any \r\n
-			// free slots available and sane content?
-			if ((number_of_tuples < max_readings) && (strlen(obis_code) > 0) &&
-				(strlen(value) > 0)) {
-				switch (obis_code[0]) { // let's check sanity of first char. we can't use isValid()
-										// as here we get incomplete obis_codes as well (e.g. 1.8.0
-										// -> 255-255:1.8.0)
-				case '0':               // nobreak;
-				case '1':               // nobreak;
-				case '2':               // nobreak;
-				case '3':               // nobreak;
-				case '4':               // nobreak;
-				case '5':               // nobreak;
-				case '6':               // nobreak;
-				case '7':               // nobreak;
-				case '8':               // nobreak;
-				case '9':               // nobreak;
-				case 'C':               // nobreak;
-				case 'F':
-					print(log_debug, "Parsed reading (OBIS code=%s, value=%s, unit=%s)",
-						  name().c_str(), obis_code, value, unit);
-					rds[number_of_tuples].value(strtod(value, NULL));
-
-					try {
-						Obis obis(obis_code);
-						ReadingIdentifier *rid(new ObisIdentifier(obis));
-						rds[number_of_tuples].identifier(rid);
-						rds[number_of_tuples].time();
-						number_of_tuples++;
-					} catch (vz::VZException &e) {
-						print(log_alert, "Failed to parse obis code (%s)", name().c_str(),
-							  obis_code);
-					}
-					break;
-				case 'L': // nobreak; // L, P not supported yet
-				case 'P': // nobreak;
-				default:
-					print(log_debug, "Ignored reading (OBIS code=%s, value=%s, unit=%s)",
-						  name().c_str(), obis_code, value, unit);
-					break;
+		VZ_PRINT(log_debug,
+				 "Read package with %llu tuples (vendor=%s, baudrate=%c, identification=%s)",
+				 name().c_str(), (unsigned long long)_number_of_tuples, _vendor, _baudrate_id,
+				 _identification);
+		return PARSE_DONE;
+	} // end switch
+
+	if (END_LINE == _context) { // add the data already here (so after the closing bracket) but
+							   // before any \r\n
+		// free slots available and sane content?
+		if ((_number_of_tuples < max_readings) && (strlen(_obis_code) > 0) &&
+			(strlen(_value) > 0)) {
+			switch (_obis_code[0]) { // let's check sanity of first char. we can't use isValid()
+									// as here we get incomplete obis_codes as well (e.g. 1.8.0
+									// -> 255-255:1.8.0)
+			case '0':               // nobreak;
+			case '1':               // nobreak;
+			case '2':               // nobreak;
+			case '3':               // nobreak;
+			case '4':               // nobreak;
+			case '5':               // nobreak;
+			case '6':               // nobreak;
+			case '7':               // nobreak;
+			case '8':               // nobreak;
+			case '9':               // nobreak;
+			case 'C':               // nobreak;
+			case 'F':
+				VZ_PRINT(log_debug, "Parsed reading (OBIS code=%s, value=%s, unit=%s)",
+						 name().c_str(), _obis_code, _value, _unit);
+				rds[_number_of_tuples].value(strtod(_value, NULL));
+
+				try {
+					Obis obis(_obis_code);
+					rds[_number_of_tuples].identifier(ReadingIdentifier::intern(obis));
+					rds[_number_of_tuples].time();
+					_number_of_tuples++;
+				} catch (vz::VZException &e) {
+					print(log_alert, "Failed to parse obis code (%s)", name().c_str(),
+						  _obis_code);
 				}
+				break;
+			case 'L': // nobreak; // L, P not supported yet
+			case 'P': // nobreak;
+			default:
+				VZ_PRINT(log_debug, "Ignored reading (OBIS code=%s, value=%s, unit=%s)",
+						 name().c_str(), _obis_code, _value, _unit);
+				break;
 			}
-			byte_iterator = 0;
-			context = OBIS_CODE;
 		}
+		_byte_iterator = 0;
+		_context = OBIS_CODE;
+	}
 
-	} // end while
-
-	// Read terminated
-	print(log_alert, "read timed out!, context: %i, bytes read: %i, last byte 0x%x", name().c_str(),
-		  context, byte_iterator, lastbyte);
-	return number_of_tuples; // in any case return the number of readings. there might be some valid
-							 // ones.
-
-error:
-	print(log_alert, "Something unexpected happened: %s:%i!", name().c_str(), __FUNCTION__,
-		  __LINE__);
-	return number_of_tuples; // return number of good readings so far.
+	return PARSE_MORE;
 }
 
 int MeterD0::_openSocket(const char *node, const char *service) {
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -38,7 +39,8 @@
 #include "protocols/MeterFile.hpp"
 #include <VZException.hpp>
 
-MeterFile::MeterFile(std::list<Option> options) : Protocol("file"), _notify_fd(-1) {
+MeterFile::MeterFile(std::list<Option> options)
+	: Protocol("file"), _notify_fd(-1), _regular(false) {
 	OptionList optlist;
 
 	try {
@@ -166,6 +168,10 @@ int MeterFile::open() {
 		return ERR;
 	}
 
+	// reading a fifo or device would block:
+	struct stat st;
+	_regular = fstat(fileno(_fd), &st) == 0 && S_ISREG(st.st_mode);
+
 	return SUCCESS;
 }
 
@@ -258,8 +264,7 @@ ssize_t MeterFile::read(std::vector<Reading> &rds, size_t n) {
 				  timestamp);
 
 			rds[i].value(value);
-			ReadingIdentifier *rid(new StringIdentifier(string ? string : "<null>"));
-			rds[i].identifier(rid);
+			rds[i].identifier(ReadingIdentifier::intern(string ? string : "<null>"));
 			if (found >= 1) {
 				if (timestamp >= 0.0)
 					rds[i].time_from_double(timestamp);
@@ -274,8 +279,7 @@ ssize_t MeterFile::read(std::vector<Reading> &rds, size_t n) {
 		} else { // just reading a value per line
 			rds[i].value(strtod(line, &endptr));
 			rds[i].time();
-			ReadingIdentifier *rid(new StringIdentifier(""));
-			rds[i].identifier(rid);
+			rds[i].identifier(ReadingIdentifier::intern(""));
 
 			if (endptr != line) {
 				i++; // read successfully
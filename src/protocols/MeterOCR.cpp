@@ -57,16 +57,17 @@ affected.
 // #include <stdio.h>
 // #include <stdlib.h>
 // #include <sys/time.h>
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <errno.h>
 
 #include "Options.hpp"
 #include "protocols/MeterOCR.hpp"
+#include "protocols/YuvConvert.hpp"
 #include <VZException.hpp>
 #include <json-c/json.h>
 
-#include <assert.h>
 #include <linux/videodev2.h>
 
 /* install libleptonica:
@@ -800,6 +801,19 @@ MeterOCR::MeterOCR(const std::list<Option> &options)
 		} else {
 			throw vz::OptionNotFoundException("no recognizer given");
 		}
+		if (_autofix_range > 0) {
+			// v4l2 only converts this rectangle. The recognizers crop moved by up to the range
+			// and autofixDetection looks around x/y:
+			_min_x = std::min(_min_x, _autofix_x) - _autofix_range;
+			_min_y = std::min(_min_y, _autofix_y) - _autofix_range;
+			_max_x = std::max(_max_x, _autofix_x + 1) + _autofix_range;
+			_max_y = std::max(_max_y, _autofix_y + 1) + _autofix_range;
+			// but not outside the frame:
+			_min_x = std::max(_min_x, 0);
+			_min_y = std::max(_min_y, 0);
+			_max_x = std::min(_max_x, _v4l2_cap_size_x);
+			_max_y = std::min(_max_y, _v4l2_cap_size_y);
+		}
 	} catch (vz::OptionNotFoundException &e) {
 		// recognizer is mandatory
 		// print(log_alert, "Config parameter 'recognizer' missing!", name().c_str());
@@ -1144,62 +1158,6 @@ bool MeterOCR::initV4L2Dev(unsigned int w, unsigned int h) {
 	return true;
 }
 
-/*
- * YUV422toRGB888 from
- * v4l2grab Version 0.1
- *   Copyright (C) 2009 by Tobias Mueller
- *   Tobias_Mueller@twam.info
- * licensed under gpl v2.
- * modified to handle RGBA and window coordinates and changed to float instead of double and changed
- * to little endianess
- * */
-
-static void YUV422toRGBA888(int stride_s_w, int stride_s_h, int stride_d_w, int stride_d_h, int s_x,
-							int s_y, int width, int height, unsigned char *src,
-							unsigned char *dst) {
-	int line, column;
-	unsigned char *py, *pu, *pv;
-	unsigned char *tmp = dst + (4 * ((stride_d_w * s_y) + s_x));
-
-	unsigned char *ssrc = src + (2 * ((stride_s_w * s_y) + s_x));
-	int skip_per_line_s = stride_s_w - width;
-	int skip_per_line_d = stride_d_w - width;
-	assert(skip_per_line_s % 1 == 0); // must be even!
-	assert(s_x % 1 == 0);
-	assert(width % 1 == 0);
-
-	// In this format each four bytes is two pixels. Each four bytes is two Y's, a Cb and a Cr.
-	// Each Y goes to one of the pixels, and the Cb and Cr belong to both pixels.
-	py = ssrc;
-	pu = ssrc + 1;
-	pv = ssrc + 3;
-
-#define CLIP(x) ((x) >= 0xFF ? 0xFF : ((x) <= 0x00 ? 0x00 : (x)))
-
-	for (line = 0; line < height; ++line) {
-		for (column = 0; column < width; ++column) {
-			*tmp++ = 0; // alpha // for little endianess! TODO doesn't work on big endian! // todo
-						// we are only interested in red anyway. Could ignore B and G.
-			*tmp++ = CLIP((float)*py + 1.772 * ((float)*pu - 128.0)); // B
-			*tmp++ =
-				CLIP((float)*py - 0.344 * ((float)*pu - 128.0) - 0.714 * ((float)*pv - 128.0)); // G
-			*tmp++ = CLIP((float)*py + 1.402 * ((float)*pv - 128.0));                           // R
-			// increase py every time
-			py += 2;
-			// increase pu,pv every second time
-			if ((column & 1) == 1) {
-				pu += 4;
-				pv += 4;
-			}
-		}
-		// skip rest of stride_s_w:
-		py += 2 * skip_per_line_s;
-		pu += 2 * skip_per_line_s;
-		pv += 2 * skip_per_line_s;
-		tmp += 4 * skip_per_line_d;
-	}
-}
-
 bool MeterOCR::readV4l2Frame(Pix *&image, bool first_time) {
 	bool toRet = false;
 	struct v4l2_buffer buf;
@@ -1239,8 +1197,8 @@ bool MeterOCR::readV4l2Frame(Pix *&image, bool first_time) {
 		}
 		return false;
 	}
-	// copy into a Pix image (!would be better if we don't need to copy!)
-	// check that the data is big enough:
+	// convert into a Pix image. leptonica needs 32bpp RGB, so the mmapped buffer can't be used
+	// directly. check that the data is big enough:
 	int32_t w, h, d;
 	pixGetDimensions(image, &w, &h, &d);
 	// image can be smaller than cap_size_x/y in this case render to
@@ -1252,19 +1210,17 @@ bool MeterOCR::readV4l2Frame(Pix *&image, bool first_time) {
 		if (first_time) {
 			// if for the first time we convert the full picture and draw a rectangle around the
 			// area to be searched:
-			YUV422toRGBA888(_v4l2_cap_size_x, _v4l2_cap_size_y, w, h, 0, 0, w, h,
-							(uint8_t *)(_v4l2_buffers[buf.index].start),
-							(uint8_t *)pixGetData(image));
+			YUV422toRGBA888((const uint8_t *)(_v4l2_buffers[buf.index].start), _v4l2_cap_size_x,
+							(uint8_t *)pixGetData(image), w, 0, 0, w, h);
 			// draw rectangle in green:
 			BOX *box = boxCreate(_min_x - 1, _min_y - 1, _max_x - _min_x + 2, _max_y - _min_y + 2);
 			pixRenderBoxArb(image, box, 1, 0, 0xff, 0);
 			boxDestroy(&box);
 		} else {
 			// we only update the interesting rectangle
-			YUV422toRGBA888(_v4l2_cap_size_x, _v4l2_cap_size_y, w, h, _min_x, _min_y,
-							_max_x - _min_x, _max_y - _min_y,
-							(uint8_t *)(_v4l2_buffers[buf.index].start),
-							(uint8_t *)pixGetData(image));
+			YUV422toRGBA888((const uint8_t *)(_v4l2_buffers[buf.index].start), _v4l2_cap_size_x,
+							(uint8_t *)pixGetData(image), w, _min_x, _min_y, _max_x - _min_x,
+							_max_y - _min_y);
 		}
 		toRet = true;
 	}
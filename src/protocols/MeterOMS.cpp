@@ -9,6 +9,8 @@
 
 #include "protocols/MeterOMS.hpp"
 #include <assert.h>
+#include <ctype.h>
+#include <json-c/json.h>
 #include <mbus/mbus.h>
 #include <openssl/conf.h>
 #include <openssl/err.h>
@@ -126,9 +128,18 @@ int MeterOMS::OMSSerialHWif::receive_frame(mbus_frame *frame) {
 	return mbus_serial_recv_frame(_handle, frame);
 }
 
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return 10 + c - 'a';
+	else if (c >= 'A' && c <= 'F')
+		return 10 + c - 'A';
+	return 0;
+}
+
 MeterOMS::MeterOMS(const std::list<Option> &options, OMSHWif *hwif)
-	: Protocol("oms"), _hwif(hwif), _aes_key(0), _mbus_debug(false), _use_local_time(false),
-	  _last_timestamp(0.0) {
+	: Protocol("oms"), _hwif(hwif), _mbus_debug(false), _use_local_time(false) {
 	OptionList optlist;
 	// todo parse from options for tcp or uart... if (!_hwif) ->
 	print(log_debug, "Using libmbus version %s", name().c_str(), mbus_get_current_version());
@@ -180,39 +191,56 @@ MeterOMS::MeterOMS(const std::list<Option> &options, OMSHWif *hwif)
 		// keep default
 	}
 
-	std::string _key;
+	// optional devices: receiver for several meters, each with its own key
+	struct json_object *jso = NULL;
 	try {
-		_key = optlist.lookup_string(options, "key");
-	} catch (vz::VZException &e) {
-		print(log_alert, "Missing path or invalid type", name().c_str());
-		throw;
-	}
-	if (_key.length() != 32) {
-		print(log_alert, "Key length needs to be 32!", name().c_str());
-		throw vz::VZException("OMS key length error");
+		jso = optlist.lookup_json_array(options, "devices");
+	} catch (vz::OptionNotFoundException &e) {
+		// single meter
 	}
 
-	// convert _key into binary _aes_key
-	_aes_key = (unsigned char *)malloc(16);
-	memset(_aes_key, 0, 16);
-	int j = 0;
-	for (int i = 0; i < 32; ++i) {
-		const char c = _key[i];
-		int v = 0;
-		if (c >= '0' && c <= '9')
-			v = c - '0';
-		else if (c >= 'a' && c <= 'f')
-			v = 10 + c - 'a';
-		else if (c >= 'A' && c <= 'F')
-			v = 10 + c - 'A';
-
-		if (i % 2 == 0) {
-			v <<= 4;
-			_aes_key[j] = v;
+	try {
+		if (jso) {
+			int nr_devices = json_object_array_length(jso);
+			for (int i = 0; i < nr_devices; i++) {
+				struct json_object *jd = json_object_array_get_idx(jso, i);
+				struct json_object *key, *id, *value;
+				if (!json_object_object_get_ex(jd, "key", &key) ||
+					!json_object_object_get_ex(jd, "id", &id)) {
+					print(log_alert, "devices[%d]: id and key are required", name().c_str(), i);
+					throw vz::VZException("OMS device without id or key");
+				}
+				const char *manufacturer = NULL;
+				if (json_object_object_get_ex(jd, "manufacturer", &value))
+					manufacturer = json_object_get_string(value);
+				int channel = i + 1;
+				if (json_object_object_get_ex(jd, "channel", &value))
+					channel = json_object_get_int(value);
+				if (channel < 0 || channel > 254) {
+					print(log_alert, "devices[%d]: channel needs to be 0..254", name().c_str(), i);
+					throw vz::VZException("OMS channel error");
+				}
+				add_device(json_object_get_string(key), json_object_get_string(id),
+						   manufacturer, channel);
+			}
+			if (_devices.empty()) {
+				print(log_alert, "devices is empty", name().c_str());
+				throw vz::VZException("OMS no devices");
+			}
 		} else {
-			_aes_key[j] |= v;
-			++j;
+			std::string key;
+			try {
+				key = optlist.lookup_string(options, "key");
+			} catch (vz::VZException &e) {
+				print(log_alert, "Missing path or invalid type", name().c_str());
+				throw;
+			}
+			add_device(key, NULL, NULL, 0xff); // DC, e.g. 1.8.0 as before
 		}
+	} catch (...) {
+		for (auto &d : _devices)
+			EVP_CIPHER_CTX_free(d.ctx);
+		throw;
 	}
 }
 
@@ -220,12 +248,91 @@ MeterOMS::~MeterOMS() {
 	if (_hwif)
 		delete _hwif;
 
+	for (auto &d : _devices)
+		EVP_CIPHER_CTX_free(d.ctx);
+
 	// openssl cleanup:
 	EVP_cleanup();
 	ERR_free_strings();
+}
+
+void MeterOMS::add_device(const std::string &key, const char *id, const char *manufacturer,
+						  unsigned char channel) {
+	OMSDevice d;
+	memset(&d, 0, sizeof(d));
 
-	if (_aes_key)
-		free(_aes_key);
+	if (key.length() != 32) {
+		print(log_alert, "Key length needs to be 32!", name().c_str());
+		throw vz::VZException("OMS key length error");
+	}
+	unsigned char aes_key[16];
+	for (int i = 0; i < 16; ++i)
+		aes_key[i] = hex_digit(key[2 * i]) << 4 | hex_digit(key[2 * i + 1]);
+
+	d.any = (id == NULL);
+	if (id) {
+		if (strlen(id) != 8 || strspn(id, "0123456789abcdefABCDEF") != 8) {
+			print(log_alert, "Id needs to be 8 digits: %s", name().c_str(), id);
+			throw vz::VZException("OMS id error");
+		}
+		for (int i = 0; i < 4; ++i) // as printed on the meter, i.e. MSB first
+			d.id[i] = hex_digit(id[6 - 2 * i]) << 4 | hex_digit(id[7 - 2 * i]);
+	}
+	if (manufacturer) {
+		// three letters, 5 bits each
+		int m = 0;
+		for (int i = 0; i < 3; ++i) {
+			char c = toupper(manufacturer[i]);
+			if (c < 'A' || c > 'Z' || (i == 2 && manufacturer[3])) {
+				print(log_alert, "Manufacturer needs to be 3 letters: %s", name().c_str(),
+					  manufacturer);
+				throw vz::VZException("OMS manufacturer error");
+			}
+			m = (m << 5) | (c - 64);
+		}
+		d.manufacturer[0] = m & 0xff;
+		d.manufacturer[1] = m >> 8;
+	}
+	d.channel = channel;
+
+	// the key schedule is set up once, aes_decrypt() only sets the iv
+	d.ctx = EVP_CIPHER_CTX_new();
+	if (!d.ctx || !EVP_DecryptInit_ex(d.ctx, EVP_aes_128_cbc(), NULL, aes_key, NULL)) {
+		print(log_alert, "EVP_DecryptInit_ex failed", name().c_str());
+		EVP_CIPHER_CTX_free(d.ctx);
+		OPENSSL_cleanse(aes_key, sizeof(aes_key));
+		throw vz::VZException("OMS cipher init failed");
+	}
+	EVP_CIPHER_CTX_set_padding(d.ctx, 0);
+	OPENSSL_cleanse(aes_key, sizeof(aes_key));
+	_devices.push_back(d);
+}
+
+MeterOMS::OMSDevice *MeterOMS::find_device(const mbus_frame &frame) {
+	static const unsigned char any_manufacturer[2] = {0, 0};
+	for (auto &d : _devices) {
+		if (d.any)
+			return &d;
+		if (memcmp(d.id, frame.data, 4) == 0 &&
+			(memcmp(d.manufacturer, any_manufacturer, 2) == 0 ||
+			 memcmp(d.manufacturer, frame.data + 4, 2) == 0))
+			return &d;
+	}
+	return NULL;
+}
+
+void MeterOMS::add_reading(std::vector<Reading> &rds, size_t &ret, size_t n,
+						   const OMSDevice &device, unsigned char c, unsigned char d, double value,
+						   double timeFromMeter) {
+	if (ret >= n)
+		return;
+	rds[ret].identifier(ReadingIdentifier::intern(Obis(0xff, device.channel, c, d, 0, 0xff)));
+	rds[ret].value(value);
+	if (timeFromMeter > 1.0 && !_use_local_time)
+		rds[ret].time_from_double(timeFromMeter);
+	else
+		rds[ret].time();
+	++ret;
 }
 
 int MeterOMS::open() {
@@ -286,6 +393,13 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 				case 0x5b: // 12 byte CMD to device M-bus 4 Ident 2 Manuf Ver Med Acc Status 2
 						   // ConfWord
 				{
+					OMSDevice *device = find_device(frame);
+					if (!device) {
+						VZ_PRINT(log_debug, "ignoring frame from unknown meter %02x%02x%02x%02x",
+								 name().c_str(), frame.data[3], frame.data[2], frame.data[1],
+								 frame.data[0]);
+						break;
+					}
 					// check control word (bytes 10 and 11 (0-based)):
 					u_int8_t controlword_low = frame.data[10];
 					u_int8_t controlword_high = frame.data[11];
@@ -312,7 +426,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 						iv[7] = frame.data[7];
 
 						memset(iv + 8, frame.data[8], 8);
-						aes_decrypt(frame.data + 12, 16 * nr_enc_16byte_blocks, _aes_key, iv);
+						aes_decrypt(device->ctx, frame.data + 12, 16 * nr_enc_16byte_blocks, iv);
 						if (_mbus_debug)
 							mbus_frame_print(&frame);
 						if (frame.length1 <= 14 || frame.data[12] != 0x2f ||
@@ -349,7 +463,8 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 								switch (record->drh.vib.vif) {
 								case 0x6d: // time
 									timeFromMeter = get_record_value(record);
-									if (timeFromMeter > 1.0 && (timeFromMeter == _last_timestamp)) {
+									if (timeFromMeter > 1.0 &&
+										(timeFromMeter == device->last_timestamp)) {
 										// duplicated timestamp received. ignore the remaining
 										// telegram as by spec
 										ignore_telegram = true;
@@ -358,7 +473,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 											  name().c_str(), timeFromMeter);
 									} else {
 										if (timeFromMeter > 1.0)
-											_last_timestamp = timeFromMeter;
+											device->last_timestamp = timeFromMeter;
 									}
 									break;
 								case 0x03:
@@ -366,15 +481,8 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 										print(log_debug, "Obis 1.8.0 %f %s", name().c_str(),
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
-										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("1.8.0"));
-											rds[ret].value(get_record_value(record));
-											if (timeFromMeter > 1.0 && !_use_local_time)
-												rds[ret].time_from_double(timeFromMeter);
-											else
-												rds[ret].time();
-											++ret;
-										}
+										add_reading(rds, ret, n, *device, 1, 8,
+													get_record_value(record), timeFromMeter);
 									}
 									break;
 								case 0x83:
@@ -382,15 +490,8 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 										print(log_debug, "Obis 2.8.0 %f %s", name().c_str(),
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
-										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("2.8.0"));
-											rds[ret].value(get_record_value(record));
-											if (timeFromMeter > 1.0 && !_use_local_time)
-												rds[ret].time_from_double(timeFromMeter);
-											else
-												rds[ret].time();
-											++ret;
-										}
+										add_reading(rds, ret, n, *device, 2, 8,
+													get_record_value(record), timeFromMeter);
 									}
 									break;
 								case 0x2b:
@@ -398,15 +499,8 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 										print(log_debug, "Obis 1.7.0 %f %s", name().c_str(),
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
-										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("1.7.0"));
-											rds[ret].value(get_record_value(record));
-											if (timeFromMeter > 1.0 && !_use_local_time)
-												rds[ret].time_from_double(timeFromMeter);
-											else
-												rds[ret].time();
-											++ret;
-										}
+										add_reading(rds, ret, n, *device, 1, 7,
+													get_record_value(record), timeFromMeter);
 									}
 									break;
 								case 0xab:
@@ -414,15 +508,8 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 										print(log_debug, "Obis 2.7.0 %f %s", name().c_str(),
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
-										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("2.7.0"));
-											rds[ret].value(get_record_value(record));
-											if (timeFromMeter > 1.0 && !_use_local_time)
-												rds[ret].time_from_double(timeFromMeter);
-											else
-												rds[ret].time();
-											++ret;
-										}
+										add_reading(rds, ret, n, *device, 2, 7,
+													get_record_value(record), timeFromMeter);
 									}
 									break;
 								}
@@ -476,57 +563,36 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 	return ret;
 }
 
-bool MeterOMS::aes_decrypt(unsigned char *ciphertext, int ciphertext_len, unsigned char *key,
-						   unsigned char *iv) {
-	/* no keys in logs!
-	printf("iv =");
-	for (int i=0; i<16; ++i)
-			printf("%.2x", iv[i]);
-	printf("\nkey=");
-	for (int i=0; i<16; ++i)
-			printf("%.2x", key[i]);
-	*/
+bool MeterOMS::aes_decrypt(EVP_CIPHER_CTX *ctx, unsigned char *ciphertext, int ciphertext_len,
+						   const unsigned char *iv) {
+	/* no keys or iv in logs! */
 
 	unsigned char *plaintext = ciphertext; // we decrypt directly into the ciphertext
 
-	EVP_CIPHER_CTX *ctx;
-
 	int len = 0;
 	int plaintext_len;
 
-	/* Create and initialise the context */
-	if (!(ctx = EVP_CIPHER_CTX_new())) {
-		print(log_alert, "EVP_CIPHER_CTX_new failed", name().c_str());
-		return false;
-	}
-
-	if (!EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv)) {
+	/* keep cipher and key schedule of the context, just restart with the new iv */
+	if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv)) {
 		print(log_alert, "EVP_DecryptInit_ex failed", name().c_str());
-		EVP_CIPHER_CTX_free(ctx);
 		return false;
 	}
-	EVP_CIPHER_CTX_set_padding(ctx, 0);
 
 	assert(EVP_CIPHER_CTX_iv_length(ctx) == 16);
 	assert(EVP_CIPHER_CTX_key_length(ctx) == 16);
 
 	if (!EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len)) {
 		print(log_alert, "EVP_DecryptUpdate failed (len=%d)", name().c_str(), len);
-		EVP_CIPHER_CTX_free(ctx);
 		return false;
 	}
 	plaintext_len = len;
 
 	if (!EVP_DecryptFinal_ex(ctx, plaintext + len, &len)) {
 		print(log_alert, "EVP_DecryptFinale_ex failed (len=%d)", name().c_str(), len);
-		EVP_CIPHER_CTX_free(ctx);
 		return false;
 	}
 	plaintext_len += len;
 
-	/* Clean up */
-	EVP_CIPHER_CTX_free(ctx);
-
 	return plaintext_len == ciphertext_len;
 }
 
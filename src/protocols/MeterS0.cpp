@@ -28,10 +28,14 @@
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/gpio.h>
+#endif
 
 #include "threads.h"
 
@@ -41,7 +45,9 @@
 
 MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 	: Protocol("s0"), _hwif(hwif), _hwif_dir(hwif_dir), _counter_thread_stop(false),
-	  _send_zero(false), _debounce_delay_ms(0), _nonblocking_delay_ns(1e5), _first_impulse(true) {
+	  _send_zero(false), _debounce_delay_ms(0), _nonblocking_delay_ns(1e5), _first_impulse(true),
+	  _power_impulses(0), _timestamps(1024), _timestamps_lost(false),
+	  _dropped(metrics.dropped("s0")) {
 	OptionList optlist;
 
 	// check which HWIF to use:
@@ -50,6 +56,7 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 	bool use_gpio = false;
 	bool use_mmap = false;
 	std::string mmap;
+	bool use_gpiochip = false;
 	int gpiopin = -1;
 
 	if (!_hwif) {
@@ -62,6 +69,15 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 		}
 
 		if (use_gpio) {
+			try {
+				optlist.lookup_string(options, "gpiochip");
+				use_gpiochip = true;
+			} catch (vz::VZException &e) {
+				// ignore
+			}
+		}
+
+		if (use_gpio && !use_gpiochip) {
 			try {
 				mmap = optlist.lookup_string(options, "mmap");
 				if (mmap == "rpi2" || mmap == "rpi" || mmap == "rpi1") {
@@ -77,6 +93,8 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 				_hwif = new HWIF_MMAP(gpiopin, mmap);
 			} else
 				_hwif = new HWIF_GPIO(gpiopin, options);
+		} else if (use_gpiochip) {
+			_hwif = new HWIF_GPIOCHIP(gpiopin, options, true);
 		} else {
 			_hwif = new HWIF_UART(options);
 		}
@@ -93,7 +111,9 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 			if (gpiodirpin == gpiopin) {
 				throw vz::VZException("gpio_dir must not be equal to gpio");
 			}
-			if (use_mmap) {
+			if (use_gpiochip) {
+				_hwif_dir = new HWIF_GPIOCHIP(gpiodirpin, options, false);
+			} else if (use_mmap) {
 				_hwif_dir = new HWIF_MMAP(gpiodirpin, mmap);
 			} else
 				_hwif_dir = new HWIF_GPIO(gpiodirpin, options);
@@ -141,6 +161,17 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 		print(log_alert, "Failed to parse send_zero", "");
 		throw;
 	}
+
+	try {
+		_power_impulses = optlist.lookup_int(options, "power_impulses");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default 0, averaged Power once a second
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse power_impulses", "");
+		throw;
+	}
+	if (_power_impulses < 0)
+		throw vz::VZException("power_impulses must not be negative.");
 }
 
 MeterS0::~MeterS0() {
@@ -204,12 +235,33 @@ void MeterS0::check_ref_for_overflow() {
 	}
 }
 
+void MeterS0::impulse(const struct timespec &ts) {
+	// check if second hardware interface has caused the event
+	bool neg = _hwif_dir && (_hwif_dir->status() > 0);
+	if (neg)
+		++_impulses_neg;
+	else
+		++_impulses;
+
+	if (_power_impulses > 0) {
+		Impulse imp;
+		imp.time = ts;
+		imp.neg = neg;
+		imp.after_gap = _timestamps_lost;
+		// the counts above stay exact, only the Power readings around the gap are lost:
+		_timestamps_lost = !_timestamps.push(std::move(imp));
+		if (_timestamps_lost)
+			_dropped->inc();
+	}
+}
+
 void MeterS0::counter_thread() {
 	// _hwif exists and open() succeeded
 	print(log_finest, "Counter thread started with %s hwif", name().c_str(),
 		  _hwif->is_blocking() ? "blocking" : "non blocking");
 
 	bool is_blocking = _hwif->is_blocking();
+	bool has_timestamps = _hwif->has_timestamps();
 
 	{ // set thread priority to highest and SCHED_FIFO scheduling class
 		// ignore any errors
@@ -233,7 +285,18 @@ void MeterS0::counter_thread() {
 		(cur_state >= 0) ? cur_state : 0; // use current state if it is valid else assume low edge
 	const int nonblocking_delay_ns = _nonblocking_delay_ns;
 	while (!_counter_thread_stop) {
-		if (is_blocking) {
+		if (has_timestamps) {
+			// debounced by the kernel, each event is a rising edge
+			bool timeout = false;
+			struct timespec ts;
+			if (_hwif->waitForEdge(timeout, ts)) {
+				_ms_last_impulse = timespec_sub_ms(ts, _time_last_ref);
+				impulse(ts);
+			} else if (!timeout) {
+				print(log_warning, "Reading from hardwareinterface failed with %s.",
+					  name().c_str(), strerror(errno));
+			}
+		} else if (is_blocking) {
 			bool timeout = false;
 			if (_hwif->waitForImpulse(timeout)) {
 				// something has happened on the hardwareinterface (hwif)
@@ -258,11 +321,7 @@ void MeterS0::counter_thread() {
 				if (_hwif->status() !=
 					0) { // check if value of gpio is set (or not supported/error (-1) for e.g. UART
 						 // HWIF -> rising edge event (or error in case we accept the trigger)
-					if (_hwif_dir && (_hwif_dir->status() >
-									  0)) // check if second hardware interface has caused the event
-						++_impulses_neg;
-					else // main hardware interface caused the event
-						++_impulses;
+					impulse(temp_ts);
 				}
 			} else {
 				if (!timeout) {
@@ -276,10 +335,9 @@ void MeterS0::counter_thread() {
 				if (last_state == 0) { // low->high edge found
 					//  auch hier muss wahrscheinlich erst das debouncing erfolgen, bevor es zur
 					//  Auswertung kommt !!
-					if (_hwif_dir && (_hwif_dir->status() > 0))
-						++_impulses_neg;
-					else
-						++_impulses;
+					struct timespec temp_ts;
+					clock_gettime(CLOCK_REALTIME, &temp_ts);
+					impulse(temp_ts);
 					if (_debounce_delay_ms > 0) {
 						// nanosleep _debounce_delay_ms
 						struct timespec ts;
@@ -323,6 +381,16 @@ int MeterS0::open() {
 	_ms_last_impulse = 0;
 	_time_last_impulse_returned = _time_last_read;
 
+	Impulse imp;
+	while (_timestamps.pop(imp)) {
+		// from a previous open()
+	}
+	_timestamps_lost = false;
+	for (int d = 0; d < 2; d++) {
+		_power_ref_valid[d] = false;
+		_power_count[d] = 0;
+	}
+
 	// create counter_thread and pass this as param
 	_counter_thread_stop = false;
 	_counter_thread = std::thread(&MeterS0::counter_thread, this);
@@ -416,32 +484,34 @@ ssize_t MeterS0::read(std::vector<Reading> &rds, size_t n) {
 		t2 += 0.000001;
 
 	if (_send_zero || t_imp > 0) {
-		if (!_first_impulse) {
+		if (!_first_impulse && !_power_impulses) {
 			double value = (3600000 / ((t2 - t1) * _resolution)) * t_imp;
-			rds[ret].identifier(new StringIdentifier("Power"));
+			rds[ret].identifier(ReadingIdentifier::intern("Power"));
 			rds[ret].time(req);
 			rds[ret].value(value);
 			++ret;
 		}
-		rds[ret].identifier(new StringIdentifier("Impulse"));
+		rds[ret].identifier(ReadingIdentifier::intern("Impulse"));
 		rds[ret].time(req);
 		rds[ret].value(t_imp);
 		++ret;
 	}
 
 	if (_send_zero || t_imp_neg > 0) {
-		if (!_first_impulse) {
+		if (!_first_impulse && !_power_impulses) {
 			double value = (3600000 / ((t2 - t1) * _resolution)) * t_imp_neg;
-			rds[ret].identifier(new StringIdentifier("Power_neg"));
+			rds[ret].identifier(ReadingIdentifier::intern("Power_neg"));
 			rds[ret].time(req);
 			rds[ret].value(value);
 			++ret;
 		}
-		rds[ret].identifier(new StringIdentifier("Impulse_neg"));
+		rds[ret].identifier(ReadingIdentifier::intern("Impulse_neg"));
 		rds[ret].time(req);
 		rds[ret].value(t_imp_neg);
 		++ret;
 	}
+	if (_power_impulses)
+		ret = read_powers(rds, ret, n);
 	if (_first_impulse && ret > 0)
 		_first_impulse = false;
 
@@ -451,6 +521,38 @@ ssize_t MeterS0::read(std::vector<Reading> &rds, size_t n) {
 	return ret;
 }
 
+ssize_t MeterS0::read_powers(std::vector<Reading> &rds, ssize_t ret, size_t n) {
+	// one Power reading per _power_impulses impulses, at the time of the last one. Impulses
+	// that don't fit into rds stay in the ring for the next read.
+	Impulse imp;
+	while ((size_t)ret < n && _timestamps.pop(imp)) {
+		if (imp.after_gap)
+			_power_ref_valid[0] = _power_ref_valid[1] = false; // the time base is unknown
+		int d = imp.neg ? 1 : 0;
+		if (!_power_ref_valid[d]) {
+			_power_ref[d] = imp.time;
+			_power_ref_valid[d] = true;
+			_power_count[d] = 0;
+			continue;
+		}
+		if (++_power_count[d] < _power_impulses)
+			continue;
+
+		struct timespec dt;
+		timespec_sub(imp.time, _power_ref[d], dt);
+		double t = dt.tv_sec + dt.tv_nsec / 1e9;
+		if (t <= 0)
+			t = 0.000001;
+		rds[ret].identifier(ReadingIdentifier::intern(d ? "Power_neg" : "Power"));
+		rds[ret].time(imp.time);
+		rds[ret].value((3600000 / (t * _resolution)) * _power_count[d]);
+		++ret;
+		_power_ref[d] = imp.time;
+		_power_count[d] = 0;
+	}
+	return ret;
+}
+
 MeterS0::HWIF_UART::HWIF_UART(const std::list<Option> &options) : _fd(-1) {
 	OptionList optlist;
 
@@ -732,7 +834,7 @@ bool MeterS0::HWIF_GPIO::waitForImpulse(bool &timeout) {
 	poll_fd.events = POLLPRI | POLLERR;
 	poll_fd.revents = 0;
 
-	int rv = poll(&poll_fd, 1, 1000); // timeout set to 1s
+	int rv = ::poll(&poll_fd, 1, 1000); // timeout set to 1s
 	print(log_debug, "MeterS0:HWIF_GPIO:first poll returned %d", "S0", rv);
 	if (rv > 0) {
 		if (poll_fd.revents & POLLPRI) {
@@ -752,3 +854,154 @@ bool MeterS0::HWIF_GPIO::waitForImpulse(bool &timeout) {
 	timeout = false;
 	return false;
 }
+
+MeterS0::HWIF_GPIOCHIP::HWIF_GPIOCHIP(int line, const std::list<Option> &options, bool edges)
+	: _line(line), _edges(edges), _debounce_us(0), _fd(-1), _monotonic(false), _events_n(0),
+	  _events_next(0) {
+	OptionList optlist;
+
+	if (_line < 0)
+		throw vz::VZException("invalid (<0) gpio(pin) set");
+#ifndef GPIO_V2_GET_LINE_IOCTL
+	throw vz::VZException("gpiochip not supported, vzlogger was built without linux/gpio.h v2");
+#endif
+
+	_chip = optlist.lookup_string(options, "gpiochip");
+
+	try {
+		_debounce_us = optlist.lookup_int(options, "debounce_delay") * 1000;
+	} catch (vz::OptionNotFoundException &e) {
+		_debounce_us = 30000;
+	}
+}
+
+MeterS0::HWIF_GPIOCHIP::~HWIF_GPIOCHIP() {
+	if (_fd >= 0)
+		_close();
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+
+bool MeterS0::HWIF_GPIOCHIP::_open() {
+	int chip = ::open(_chip.c_str(), O_RDONLY | O_CLOEXEC);
+	if (chip < 0) {
+		print(log_alert, "open(%s): %s", "", _chip.c_str(), strerror(errno));
+		return false;
+	}
+
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = _line;
+	req.num_lines = 1;
+	strncpy(req.consumer, "vzlogger", sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (_edges) {
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+		req.event_buffer_size = 64; // impulses queued in the kernel while we are busy
+		if (_debounce_us > 0) {
+			req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+			req.config.attrs[0].attr.debounce_period_us = _debounce_us;
+			req.config.attrs[0].mask = 1;
+			req.config.num_attrs = 1;
+		}
+	}
+
+	_monotonic = false;
+	int rv = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+	if (rv < 0 && errno == EINVAL && _edges) {
+		// no realtime timestamps before linux 5.11, convert the monotonic ones
+		req.config.flags &= ~GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+		_monotonic = true;
+		rv = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+	}
+	::close(chip);
+	if (rv < 0) {
+		print(log_alert, "request of line %d on %s failed: %s", "", _line, _chip.c_str(),
+			  strerror(errno));
+		return false;
+	}
+
+	_fd = req.fd;
+	_events_n = _events_next = 0;
+	return true;
+}
+
+bool MeterS0::HWIF_GPIOCHIP::_close() {
+	if (_fd < 0)
+		return false;
+
+	::close(_fd);
+	_fd = -1;
+
+	return true;
+}
+
+int MeterS0::HWIF_GPIOCHIP::status() {
+	if (_fd < 0)
+		return -1;
+	struct gpio_v2_line_values values;
+	values.bits = 0;
+	values.mask = 1;
+	if (ioctl(_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+		return -2;
+	return (values.bits & 1) ? 1 : 0;
+}
+
+bool MeterS0::HWIF_GPIOCHIP::waitForEdge(bool &timeout, struct timespec &ts) {
+	timeout = false;
+	if (_fd < 0)
+		return false;
+
+	if (_events_next >= _events_n) {
+		struct pollfd poll_fd;
+		poll_fd.fd = _fd;
+		poll_fd.events = POLLIN;
+		poll_fd.revents = 0;
+
+		int rv = ::poll(&poll_fd, 1, 1000); // timeout set to 1s
+		if (rv == 0) {
+			timeout = true;
+			return false;
+		}
+		if (rv < 0)
+			return false;
+
+		// all events queued so far with one read
+		struct gpio_v2_line_event events[EVENTS];
+		ssize_t len = ::read(_fd, events, sizeof(events));
+		if (len < (ssize_t)sizeof(events[0]))
+			return false;
+		_events_n = len / sizeof(events[0]);
+		_events_next = 0;
+
+		int64_t offset = 0;
+		if (_monotonic) {
+			struct timespec real, mono;
+			clock_gettime(CLOCK_REALTIME, &real);
+			clock_gettime(CLOCK_MONOTONIC, &mono);
+			offset = (real.tv_sec - mono.tv_sec) * 1000000000ll + (real.tv_nsec - mono.tv_nsec);
+		}
+		for (int i = 0; i < _events_n; i++)
+			_events_ns[i] = events[i].timestamp_ns + offset;
+	}
+
+	int64_t ns = _events_ns[_events_next++];
+	ts.tv_sec = ns / 1000000000ll;
+	ts.tv_nsec = ns % 1000000000ll;
+	return true;
+}
+
+#else // no GPIO v2 uapi, the constructor throws already
+
+bool MeterS0::HWIF_GPIOCHIP::_open() { return false; }
+
+bool MeterS0::HWIF_GPIOCHIP::_close() { return false; }
+
+int MeterS0::HWIF_GPIOCHIP::status() { return -1; }
+
+bool MeterS0::HWIF_GPIOCHIP::waitForEdge(bool &timeout, struct timespec &ts) {
+	timeout = false;
+	return false;
+}
+
+#endif
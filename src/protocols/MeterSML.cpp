@@ -57,7 +57,8 @@
 #define SML_BUFFER_LEN 8096
 
 MeterSML::MeterSML(std::list<Option> options)
-	: Protocol("sml"), _host(""), _device(""), BUFFER_LEN(SML_BUFFER_LEN) {
+	: Protocol("sml"), _host(""), _device(""), BUFFER_LEN(SML_BUFFER_LEN),
+	  _framer(SML_BUFFER_LEN), _rx_pos(0), _rx_len(0) {
 	OptionList optlist;
 
 	/* connection */
@@ -196,7 +197,9 @@ MeterSML::MeterSML(std::list<Option> options)
 	}
 }
 
-MeterSML::MeterSML(const MeterSML &proto) : Protocol(proto), _fd(ERR), BUFFER_LEN(SML_BUFFER_LEN) {}
+MeterSML::MeterSML(const MeterSML &proto)
+	: Protocol(proto), _fd(ERR), BUFFER_LEN(SML_BUFFER_LEN), _framer(SML_BUFFER_LEN), _rx_pos(0),
+	  _rx_len(0) {}
 
 MeterSML::~MeterSML() {}
 
@@ -241,11 +244,7 @@ bool MeterSML::reopen() {
 ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 
 	unsigned char buffer[SML_BUFFER_LEN];
-	size_t bytes, m = 0;
-
-	sml_file *file;
-	sml_get_list_response *body;
-	sml_list *entry;
+	size_t bytes;
 
 	if (_fd < 0) {
 		if (!reopen()) {
@@ -257,8 +256,8 @@ ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 
 	if (_pull.size()) {
 		int wlen = write(_fd, _pull.c_str(), _pull.size());
-		print(log_debug, "sending pullsequenz send (len:%d is:%d).", name().c_str(), _pull.size(),
-			  wlen);
+		VZ_PRINT(log_debug, "sending pullsequenz send (len:%d is:%d).", name().c_str(),
+				 _pull.size(), wlen);
 	}
 
 	/* wait until we receive a new datagram from the meter (blocking read) */
@@ -278,6 +277,69 @@ ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 		return (0);
 	}
 
+	return _parse_frame(buffer, bytes, rds, n);
+}
+
+ssize_t MeterSML::poll(std::vector<Reading> &rds, size_t n) {
+	if (_fd < 0) {
+		reopen(); // fd() changes, the caller registers the new one
+		return 0;
+	}
+
+	while (1) {
+		if (_rx_pos >= _rx_len) {
+			ssize_t bytes = ::read(_fd, _rx, sizeof(_rx));
+			if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				return 0; // wait for the next call
+			} else if (bytes <= 0) {
+				// connection lost, try to reopen. see issue #362
+				print(log_error, "reading failed (%d)", name().c_str(), bytes < 0 ? errno : 0);
+				_framer.reset();
+				_rx_pos = _rx_len = 0;
+				reopen();
+				return 0;
+			}
+			_rx_pos = 0;
+			_rx_len = bytes;
+		}
+
+		_rx_pos += _framer.feed(_rx + _rx_pos, _rx_len - _rx_pos);
+		if (_framer.complete()) {
+			// the rest of _rx is kept for the next call
+			size_t bytes = _framer.size();
+			unsigned char *buffer = const_cast<unsigned char *>(_framer.frame());
+			size_t m = _parse_frame(buffer, bytes, rds, n);
+			_framer.reset();
+			return m;
+		}
+	}
+}
+
+size_t MeterSML::_parse_frame(unsigned char *buffer, size_t bytes, std::vector<Reading> &rds,
+							  size_t n) {
+	size_t m = 0;
+
+	switch (_decoder.decode(buffer, bytes)) {
+	case SmlDecoder::OK:
+		for (std::vector<SmlDecoder::Entry>::const_iterator it = _decoder.entries().begin();
+			 m < n && it != _decoder.entries().end(); ++it) {
+			if (_parse(*it, &rds[m]))
+				m++;
+		}
+		return m;
+	case SmlDecoder::BAD_CRC:
+		print(log_warning, "CRC error, dropping telegram (len=%d)", name().c_str(), bytes);
+		return 0;
+	case SmlDecoder::UNSUPPORTED:
+		VZ_PRINT(log_debug, "Telegram not supported by the native decoder, using libsml",
+				 name().c_str());
+		break;
+	}
+
+	sml_file *file;
+	sml_get_list_response *body;
+	sml_list *entry;
+
 	/* parse SML file & stripping escape sequences */
 	file = sml_file_parse(buffer + 8, bytes - 16);
 
@@ -320,11 +382,10 @@ bool MeterSML::_parse(sml_list *entry, Reading *rd) {
 			// "3032323830383136" we don't even create a reading for this:
 			return false;
 		} else {
-			rd->value(sml_value_to_double(entry->value) * pow(10, scaler));
+			rd->value(sml_value_to_double(entry->value) * SmlDecoder::power_of_ten(scaler));
 		}
 
-		ReadingIdentifier *rid(new ObisIdentifier(obis));
-		rd->identifier(rid);
+		rd->identifier(ReadingIdentifier::intern(obis));
 
 		// TODO handle SML_TIME_SEC_INDEX or time by SML File/Message
 		struct timeval tv;
@@ -340,6 +401,26 @@ bool MeterSML::_parse(sml_list *entry, Reading *rd) {
 	return false;
 }
 
+bool MeterSML::_parse(const SmlDecoder::Entry &entry, Reading *rd) {
+	// same as above, but straight from the decoder
+	if (!entry.obis.isValid() || entry.is_string)
+		return false;
+
+	int scaler = entry.has_scaler ? entry.scaler : 1;
+	rd->value(entry.value * SmlDecoder::power_of_ten(scaler));
+	rd->identifier(ReadingIdentifier::intern(entry.obis));
+
+	struct timeval tv;
+	if (!_use_local_time && entry.has_time) { /* use time from meter */
+		tv.tv_sec = entry.time;
+		tv.tv_usec = 0;
+	} else {
+		gettimeofday(&tv, NULL); /* use local time */
+	}
+	rd->time(tv);
+	return true;
+}
+
 int MeterSML::_openSocket(const char *node, const char *service) {
 	struct sockaddr_in sin;
 	struct addrinfo *ais;
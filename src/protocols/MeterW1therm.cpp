@@ -15,7 +15,30 @@
 #include "threads.h"
 
 #include "protocols/MeterW1therm.hpp"
+#include <VZException.hpp>
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
 #include <glob.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+
+static time_t monotonic_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+MeterW1therm::W1sysHWif::~W1sysHWif() {
+	for (auto &s : _sensors) {
+		if (s.second.slave_fd >= 0)
+			::close(s.second.slave_fd);
+		if (s.second.temperature_fd >= 0)
+			::close(s.second.temperature_fd);
+	}
+}
 
 bool MeterW1therm::W1sysHWif::scanW1devices() {
 	// scan directory /sys/bus/w1/devices for all devices starting with the W1_THERM
@@ -57,56 +80,190 @@ bool MeterW1therm::W1sysHWif::scanW1devices() {
 		globfree(&glob_res);
 	}
 
+	// bus wide conversion, only used if all bus masters support it (kernel >= 5.10)
+	_bulk_read.clear();
+	if (0 == glob("/sys/bus/w1/devices/w1_bus_master*", 0, NULL, &glob_res)) {
+		for (unsigned int i = 0; i < glob_res.gl_pathc; ++i) {
+			std::string path(glob_res.gl_pathv[i]);
+			path.append("/therm_bulk_read");
+			if (access(path.c_str(), W_OK) != 0) {
+				_bulk_read.clear();
+				break;
+			}
+			_bulk_read.push_back(path);
+		}
+		globfree(&glob_res);
+	}
+
+	// close the files of removed sensors
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (std::map<std::string, Sensor>::iterator it = _sensors.begin(); it != _sensors.end();) {
+			if (std::find(_devices.begin(), _devices.end(), it->first) != _devices.end()) {
+				++it;
+				continue;
+			}
+			if (it->second.slave_fd >= 0)
+				::close(it->second.slave_fd);
+			if (it->second.temperature_fd >= 0)
+				::close(it->second.temperature_fd);
+			it = _sensors.erase(it);
+		}
+	}
+
 	// for now we return false is the list is empty
 	if (_devices.size() > 0)
 		return true;
 	return false;
 }
 
+ssize_t MeterW1therm::W1sysHWif::read_cached(const std::string &device, bool temperature,
+											  char *buf, size_t len) {
+	int fd;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		Sensor &sensor = _sensors[device];
+		int &cached = temperature ? sensor.temperature_fd : sensor.slave_fd;
+		if (cached < 0) {
+			// /sys/bus/w1/devices/<device>/w1_slave or temperature
+			std::string path("/sys/bus/w1/devices/");
+			path.append(device);
+			path.append(temperature ? "/temperature" : "/w1_slave");
+			cached = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (cached < 0) {
+				print(log_debug, "couldn't open %s for reading", "w1t", path.c_str());
+				return -1;
+			}
+		}
+		fd = cached;
+	}
+
+	ssize_t r = pread(fd, buf, len - 1, 0); // the driver reads the sensor again
+	if (r < 0) {
+		print(log_debug, "reading %s failed: %s", "w1t", device.c_str(), strerror(errno));
+		// e.g. the sensor was removed, open it again next time
+		std::lock_guard<std::mutex> lock(_mutex);
+		Sensor &sensor = _sensors[device];
+		int &cached = temperature ? sensor.temperature_fd : sensor.slave_fd;
+		if (cached == fd) {
+			::close(fd);
+			cached = -1;
+		}
+		return -1;
+	}
+	buf[r] = 0;
+	return r;
+}
+
 bool MeterW1therm::W1sysHWif::readTemp(const std::string &device, double &value) {
-	bool toret = false;
-	// read from /sys/bus/w1/devices/<device>/w1_slave
-	std::string dev("/sys/bus/w1/devices/");
-	dev.append(device);
-	dev.append("/w1_slave");
-
-	FILE *fp;
-	if ((fp = fopen(dev.c_str(), "r")) == NULL) {
-		print(log_debug, "couldn't open %s for reading", "w1t", dev.c_str());
+	// e.g. 07 01 55 00 7f ff 0c 10 18 : crc=18 YES
+	//      07 01 55 00 7f ff 0c 10 18 t=16437
+	char buffer[256];
+	if (read_cached(device, false, buffer, sizeof(buffer)) <= 0) {
+		print(log_debug, "couldn't read 1st line from %s", "w1t", device.c_str());
+		return false;
+	}
+
+	char *line2 = strchr(buffer, '\n');
+	if (!line2) {
+		print(log_debug, "couldn't read 2nd line from %s", "w1t", device.c_str());
 		return false;
 	}
+	*line2++ = 0;
 
 	// check for CRC ok
-	char buffer[100];
-	if (fgets(buffer, 100, fp)) {
-		if (!strstr(buffer, "YES")) { // e.g. 07 01 55 00 7f ff 0c 10 18 : crc=18 YES
-			print(log_debug, "CRC not ok from %s (%s)", "w1t", dev.c_str(), buffer);
-		} else {
-			// crc ok
-			// now parse t=<value>
-			if (fgets(buffer, 100, fp)) { // e.g. 07 01 55 00 7f ff 0c 10 18 t=16437
-				char *pos = strstr(buffer, "t=");
-				if (pos) {
-					pos += 2;
-					value = atof(pos) / 1000;
-					toret = true;
-					print(log_finest, "read %f from %s (%s)", "w1t", value, dev.c_str(), pos - 2);
-				}
-			} else {
-				print(log_debug, "couldn't read 2nd line from %s", "w1t", dev.c_str());
-			}
+	if (!strstr(buffer, "YES")) {
+		print(log_debug, "CRC not ok from %s (%s)", "w1t", device.c_str(), buffer);
+		return false;
+	}
+
+	// now parse t=<value>
+	char *pos = strstr(line2, "t=");
+	if (!pos)
+		return false;
+	value = atof(pos + 2) / 1000;
+	print(log_finest, "read %f from %s (%s)", "w1t", value, device.c_str(), pos);
+	return true;
+}
+
+bool MeterW1therm::W1sysHWif::bulkConvert() {
+	if (_bulk_read.empty())
+		return false;
+
+	for (std::list<std::string>::const_iterator it = _bulk_read.cbegin(); it != _bulk_read.cend();
+		 ++it) {
+		int fd = ::open(it->c_str(), O_WRONLY | O_CLOEXEC);
+		bool triggered = fd >= 0 && ::write(fd, "trigger\n", 8) == 8;
+		if (fd >= 0)
+			::close(fd);
+		if (!triggered) {
+			print(log_debug, "couldn't trigger %s", "w1t", it->c_str());
+			return false;
 		}
-	} else {
-		print(log_debug, "couldn't read 1st line from %s", "w1t", dev.c_str());
 	}
 
-	fclose(fp);
+	// therm_bulk_read is -1 while a sensor is still converting, ~750ms at 12 bit resolution
+	for (int i = 0; i < 40; i++) {
+		usleep(50000);
+		bool converting = false;
+		for (std::list<std::string>::const_iterator it = _bulk_read.cbegin();
+			 it != _bulk_read.cend(); ++it) {
+			char buf[8] = {0};
+			int fd = ::open(it->c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+			ssize_t r = ::read(fd, buf, sizeof(buf) - 1);
+			::close(fd);
+			if (r > 0 && atoi(buf) == -1)
+				converting = true;
+		}
+		if (!converting)
+			return true;
+	}
+	print(log_debug, "bulk conversion timed out", "w1t");
+	return false;
+}
 
-	return toret;
+bool MeterW1therm::W1sysHWif::readConverted(const std::string &device, double &value) {
+	// the result of the bulk conversion in millidegrees, empty if it failed
+	char buffer[32];
+	if (read_cached(device, true, buffer, sizeof(buffer)) <= 0)
+		return false;
+	char *end;
+	long t = strtol(buffer, &end, 10);
+	if (end == buffer) {
+		print(log_debug, "no temperature from %s", "w1t", device.c_str());
+		return false;
+	}
+	value = t / 1000.0;
+	print(log_finest, "read %f from %s", "w1t", value, device.c_str());
+	return true;
 }
 
 MeterW1therm::MeterW1therm(const std::list<Option> &options, W1HWif *hwif)
-	: Protocol("w1t"), _hwif(hwif) {
+	: Protocol("w1t"), _hwif(hwif), _parallel(false), _threads(4), _rescan(60), _scanned(0) {
+	OptionList optlist;
+
+	try {
+		_parallel = optlist.lookup_bool(options, "parallel");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	}
+	try {
+		_threads = optlist.lookup_int(options, "threads");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	}
+	if (_threads < 1) {
+		print(log_alert, "threads needs to be at least 1", name().c_str());
+		throw vz::VZException("w1therm threads invalid");
+	}
+	try {
+		_rescan = optlist.lookup_int(options, "rescan");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	}
+
 	if (!_hwif)
 		_hwif = new W1sysHWif();
 }
@@ -123,6 +280,7 @@ int MeterW1therm::open() {
 		print(log_alert, "scanW1devices failed!", name().c_str());
 		return ERR;
 	}
+	_scanned = monotonic_s();
 	print(log_info, "open found %d w1 devices", name().c_str(), _hwif->W1devices().size());
 	return SUCCESS;
 }
@@ -134,10 +292,35 @@ ssize_t MeterW1therm::read(std::vector<Reading> &rds, size_t n) {
 	if (!_hwif)
 		return 0;
 
-	// todo add a scanW1devices() e.g. each minute?
+	if (_rescan > 0 && monotonic_s() - _scanned >= _rescan) {
+		// pick up added and removed sensors, the others are read as usual
+		if (!_hwif->scanW1devices())
+			print(log_debug, "rescan found no w1 devices", name().c_str());
+		_scanned = monotonic_s();
+	}
 
 	const std::list<std::string> &list = _hwif->W1devices();
 
+	if (_parallel) {
+		std::vector<double> values(list.size());
+		std::vector<char> ok(list.size()); // not vector<bool>, written from several threads
+		read_parallel(list, values, ok);
+
+		size_t i = 0;
+		for (std::list<std::string>::const_iterator it = list.cbegin();
+			 it != list.cend() && static_cast<size_t>(ret) < n; ++it, ++i) {
+			if (ok[i]) {
+				rds[ret].identifier(ReadingIdentifier::intern(it->c_str()));
+				rds[ret].time();
+				rds[ret].value(values[i]);
+				++ret;
+			} else {
+				print(log_debug, "reading w1 device %s failed", name().c_str(), (*it).c_str());
+			}
+		}
+		return ret;
+	}
+
 	for (std::list<std::string>::const_iterator it = list.cbegin();
 		 it != list.cend() && static_cast<size_t>(ret) < n; ++it) {
 		_safe_to_cancel();
@@ -145,7 +328,7 @@ ssize_t MeterW1therm::read(std::vector<Reading> &rds, size_t n) {
 		if (_hwif->readTemp(*it, value)) {
 			print(log_finest, "reading w1 device %s returned %f", name().c_str(), (*it).c_str(),
 				  value);
-			rds[ret].identifier(new StringIdentifier(*it));
+			rds[ret].identifier(ReadingIdentifier::intern(it->c_str()));
 			rds[ret].time();
 			rds[ret].value(value);
 			++ret;
@@ -156,3 +339,31 @@ ssize_t MeterW1therm::read(std::vector<Reading> &rds, size_t n) {
 
 	return ret;
 }
+
+void MeterW1therm::read_parallel(const std::list<std::string> &list, std::vector<double> &values,
+								 std::vector<char> &ok) {
+	std::vector<const std::string *> devices;
+	for (std::list<std::string>::const_iterator it = list.cbegin(); it != list.cend(); ++it)
+		devices.push_back(&(*it));
+
+	if (_hwif->bulkConvert()) {
+		// one conversion for all sensors, fetching the results is quick
+		for (size_t i = 0; i < devices.size(); i++)
+			ok[i] = _hwif->readConverted(*devices[i], values[i]);
+		return;
+	}
+
+	// each read waits for the conversion of its sensor, so wait for several at once
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next++) < devices.size())
+			ok[i] = _hwif->readTemp(*devices[i], values[i]);
+	};
+	std::vector<std::thread> workers;
+	for (int t = 1; t < _threads && static_cast<size_t>(t) < devices.size(); t++)
+		workers.push_back(std::thread(worker));
+	worker(); // this thread is one of the workers
+	for (auto &w : workers)
+		w.join();
+}
@@ -0,0 +1,333 @@
+/**
+ * Native SML decoder for GetListResponse telegrams
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "protocols/SmlDecoder.hpp"
+
+// type field of the TL byte
+#define SML_TL_OCTET_STRING 0x00
+#define SML_TL_BOOLEAN 0x40
+#define SML_TL_INTEGER 0x50
+#define SML_TL_UNSIGNED 0x60
+#define SML_TL_LIST 0x70
+
+#define SML_GET_LIST_RESPONSE 0x00000701
+
+static const unsigned char start_seq[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x01, 0x01, 0x01, 0x01};
+
+static const uint16_t crc16_table[256] = {
+	0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+	0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+	0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+	0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+	0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+	0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+	0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+	0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+	0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+	0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+	0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+	0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+	0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+	0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+	0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+	0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+	0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+	0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+	0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+	0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+	0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+	0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+	0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+	0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+	0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+	0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+	0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+	0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+	0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+	0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+	0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+	0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78};
+
+namespace {
+
+struct PowerOfTen {
+	double v[256];
+	PowerOfTen() {
+		for (int i = 0; i < 256; i++)
+			v[i] = pow(10, i - 128);
+	}
+};
+const PowerOfTen power_of_ten_table;
+
+} // namespace
+
+uint16_t SmlDecoder::crc16(const unsigned char *data, size_t len) {
+	uint16_t crc = 0xffff;
+	while (len--)
+		crc = (crc >> 8) ^ crc16_table[(crc ^ *data++) & 0xff];
+	return crc ^ 0xffff;
+}
+
+double SmlDecoder::power_of_ten(int8_t scaler) { return power_of_ten_table.v[scaler + 128]; }
+
+SmlDecoder::Result SmlDecoder::decode(const unsigned char *frame, size_t len) {
+	_entries.clear();
+	if (len < 16 || memcmp(frame, start_seq, 8) != 0)
+		return UNSUPPORTED;
+	const unsigned char *end_seq = frame + len - 8; // 1b1b1b1b 1a, padding, checksum
+	if (memcmp(end_seq, start_seq, 4) != 0 || end_seq[4] != 0x1a)
+		return UNSUPPORTED;
+
+	// the checksum covers the whole frame up to the checksum itself, low byte first
+	if (crc16(frame, len - 2) != (frame[len - 2] | frame[len - 1] << 8))
+		return BAD_CRC;
+
+	_p = frame + 8;
+	_end = frame + len - 8;
+	while (_p < _end) {
+		if (*_p == 0x00) { // padding to a multiple of 4 bytes
+			_p++;
+			continue;
+		}
+		if (!message()) {
+			_entries.clear();
+			return UNSUPPORTED;
+		}
+	}
+	return OK;
+}
+
+bool SmlDecoder::message() {
+	int type;
+	size_t len;
+	uint64_t tag;
+
+	if (!tl(type, len) || type != SML_TL_LIST || len != 6)
+		return false;
+	if (!skip() || !skip() || !skip()) // transactionId, groupNo, abortOnError
+		return false;
+
+	// messageBody: tag and the body itself
+	if (!tl(type, len) || type != SML_TL_LIST || len != 2 || !unsigned_value(tag))
+		return false;
+	if (tag == SML_GET_LIST_RESPONSE) {
+		if (!get_list_response())
+			return false;
+	} else if (!skip()) {
+		return false;
+	}
+
+	if (!skip()) // crc16 of the message, covered by the one of the frame
+		return false;
+	return _p < _end && *_p++ == 0x00; // endOfSmlMsg
+}
+
+bool SmlDecoder::get_list_response() {
+	int type;
+	size_t len;
+
+	if (!tl(type, len) || type != SML_TL_LIST || len != 7)
+		return false;
+	if (!skip() || !skip() || !skip() || !skip()) // clientId, serverId, listName, actSensorTime
+		return false;
+
+	// valList
+	if (!tl(type, len) || type != SML_TL_LIST)
+		return false;
+	for (size_t i = 0; i < len; i++)
+		if (!list_entry())
+			return false;
+
+	return skip() && skip(); // listSignature, actGatewayTime
+}
+
+bool SmlDecoder::list_entry() {
+	int type;
+	size_t len;
+	Entry e = Entry();
+
+	if (!tl(type, len) || type != SML_TL_LIST || len != 7)
+		return false;
+
+	// objName, entries without a complete obis code are skipped
+	if (!tl(type, len) || type != SML_TL_OCTET_STRING)
+		return false;
+	bool valid = (len == 6);
+	if (valid)
+		e.obis = Obis(_p[0], _p[1], _p[2], _p[3], _p[4], _p[5]);
+	_p += len;
+
+	if (!skip() || !time(e) || !skip()) // status, valTime, unit
+		return false;
+
+	if (!optional()) {
+		double scaler;
+		if (!tl(type, len) || type != SML_TL_INTEGER || len != 1 || !number(type, len, scaler))
+			return false;
+		e.scaler = (int8_t)scaler;
+		e.has_scaler = true;
+	}
+
+	if (!value(e) || !skip()) // value, valueSignature
+		return false;
+
+	if (valid)
+		_entries.push_back(e);
+	return true;
+}
+
+bool SmlDecoder::time(Entry &e) {
+	int type;
+	size_t len;
+	uint64_t t;
+
+	if (optional())
+		return true;
+	if (!tl(type, len))
+		return false;
+	if (type == SML_TL_UNSIGNED) {
+		// a plain timestamp without the choice, as sent by some meters
+		double d;
+		if (!number(type, len, d))
+			return false;
+		t = (uint64_t)d;
+	} else {
+		uint64_t tag;
+		if (type != SML_TL_LIST || len != 2 || !unsigned_value(tag))
+			return false;
+		if (tag == 3) {
+			// localTimestamp: timestamp, localOffset, seasonTimeOffset
+			if (!tl(type, len) || type != SML_TL_LIST || len != 3 || !unsigned_value(t) ||
+				!skip() || !skip())
+				return false;
+		} else if (!unsigned_value(t)) { // secIndex or timestamp
+			return false;
+		}
+	}
+	e.has_time = true;
+	e.time = (uint32_t)t;
+	return true;
+}
+
+bool SmlDecoder::value(Entry &e) {
+	int type;
+	size_t len;
+
+	if (optional()) { // no value at all, treated like a string
+		e.is_string = true;
+		return true;
+	}
+	if (!tl(type, len) || type == SML_TL_LIST)
+		return false;
+	if (type == SML_TL_OCTET_STRING) {
+		e.is_string = true;
+		_p += len;
+		return true;
+	}
+	return number(type, len, e.value);
+}
+
+// reads a type-length field, len is the number of bytes or list elements that follow
+bool SmlDecoder::tl(int &type, size_t &len) {
+	if (_p >= _end)
+		return false;
+	unsigned char c = *_p++;
+	size_t tl_len = 1;
+	type = c & 0x70;
+	len = c & 0x0f;
+	while (c & 0x80) {
+		if (_p >= _end || tl_len >= 4)
+			return false;
+		c = *_p++;
+		len = (len << 4) | (c & 0x0f);
+		tl_len++;
+	}
+	if (type == SML_TL_LIST)
+		return true;
+	if (len < tl_len) // 0x00 is the end of a message, not a field
+		return false;
+	len -= tl_len; // the length of other fields includes the TL bytes
+	return len <= (size_t)(_end - _p);
+}
+
+bool SmlDecoder::unsigned_value(uint64_t &v) {
+	int type;
+	size_t len;
+	double d;
+	if (!tl(type, len) || type != SML_TL_UNSIGNED || !number(type, len, d))
+		return false;
+	v = (uint64_t)d;
+	return true;
+}
+
+// big endian integers of 1 to 8 bytes, the bytes have been checked by tl() already
+bool SmlDecoder::number(int type, size_t len, double &v) {
+	if (len < 1 || len > 8)
+		return false;
+	if (type == SML_TL_BOOLEAN) {
+		v = *_p != 0;
+		_p += len;
+		return true;
+	}
+
+	uint64_t u = 0;
+	for (size_t i = 0; i < len; i++)
+		u = (u << 8) | *_p++;
+	if (type == SML_TL_UNSIGNED) {
+		v = (double)u;
+	} else if (type == SML_TL_INTEGER) {
+		if (len < 8 && (u >> (len * 8 - 1)) & 1)
+			u |= ~(uint64_t)0 << (len * 8); // sign extension
+		v = (double)(int64_t)u;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool SmlDecoder::skip(int depth) {
+	int type;
+	size_t len;
+	if (depth > 8 || !tl(type, len))
+		return false;
+	if (type == SML_TL_LIST) {
+		for (size_t i = 0; i < len; i++)
+			if (!skip(depth + 1))
+				return false;
+		return true;
+	}
+	_p += len;
+	return true;
+}
+
+bool SmlDecoder::optional() {
+	if (_p < _end && *_p == 0x01) {
+		_p++;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,79 @@
+/**
+ * Incremental SML transport framing
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "protocols/SmlFramer.hpp"
+
+static const unsigned char esc_seq[] = {0x1b, 0x1b, 0x1b, 0x1b};
+
+SmlFramer::SmlFramer(size_t max_len)
+	: _buf(max_len < 16 ? 16 : max_len), _len(0), _complete(false) {}
+
+void SmlFramer::reset() {
+	_len = 0;
+	_complete = false;
+}
+
+size_t SmlFramer::feed(const unsigned char *data, size_t len) {
+	size_t i = 0;
+	if (_complete)
+		return 0; // reset() first
+
+	while (i < len) {
+		unsigned char c = data[i++];
+
+		if (_len < 8) {
+			// wait for the start sequence 1b1b1b1b 01010101
+			if ((c == 0x1b && _len < 4) || (c == 0x01 && _len >= 4)) {
+				_buf[_len++] = c;
+			} else if (c == 0x1b && _len == 4) {
+				// more than 4 escape bytes, the last ones start the frame
+			} else {
+				_len = (c == 0x1b) ? 1 : 0;
+				_buf[0] = c;
+			}
+			continue;
+		}
+
+		if (_len >= _buf.size()) {
+			reset(); // too long, wait for the next start
+			continue;
+		}
+		_buf[_len++] = c;
+		if (_len % 4)
+			continue;
+
+		// a block of 4 bytes is complete. The one after an escape sequence has to be the end:
+		size_t block = _len - 4;
+		if (block >= 12 && memcmp(&_buf[block - 4], esc_seq, 4) == 0) {
+			if (_buf[block] == 0x1a) {
+				_complete = true;
+				return i;
+			}
+			reset(); // other escaped sequences are not supported, as in libsml
+		}
+	}
+	return i;
+}
@@ -0,0 +1,169 @@
+/**
+ * YUV 4:2:2 (YUYV) to 32bpp RGB conversion for V4L2 frames
+ *
+ * Replaces the float version based on YUV422toRGB888 from v4l2grab 0.1
+ * (Copyright (C) 2009 by Tobias Mueller, licensed under gpl v2).
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "protocols/YuvConvert.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// coefficients * 512. A chroma term is ((c - 128) * 128 * K) >> 16 rounded, the rounded
+// high half of a 16 bit multiplication, so the vector code computes exactly the same
+static const int KR = 718;  // 1.402 V
+static const int KGU = 176; // 0.344 U
+static const int KGV = 366; // 0.714 V
+static const int KB = 907;  // 1.772 U
+
+static inline int chroma(int c, int k) { return ((c - 128) * 128 * k + 0x8000) >> 16; }
+
+static inline uint8_t clip(int v) { return v >= 0xff ? 0xff : (v <= 0 ? 0 : v); }
+
+// each 4 bytes Y0 U Y1 V are two pixels sharing U and V
+static void convert_pairs(const uint8_t *s, uint8_t *d, int pairs) {
+	for (int i = 0; i < pairs; ++i, s += 4, d += 8) {
+		int r = chroma(s[3], KR);
+		int g = chroma(s[1], KGU) + chroma(s[3], KGV);
+		int b = chroma(s[1], KB);
+		for (int p = 0; p < 2; ++p) {
+			int y = s[2 * p];
+			d[4 * p] = 0; // alpha, little endian like the rest of vzlogger
+			d[4 * p + 1] = clip(y + b);
+			d[4 * p + 2] = clip(y - g);
+			d[4 * p + 3] = clip(y + r);
+		}
+	}
+}
+
+#if defined(__SSE2__)
+// (a * k + 0x8000) >> 16: the high half plus bit 15 of the low half
+static inline __m128i mulhi_round(__m128i a, __m128i k) {
+	return _mm_add_epi16(_mm_mulhi_epi16(a, k), _mm_srli_epi16(_mm_mullo_epi16(a, k), 15));
+}
+#endif
+
+// returns the number of pixels converted, the rest is left to convert_pairs
+static int convert_simd(const uint8_t *s, uint8_t *d, int pixels) {
+	int done = 0;
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i kr = _mm_set1_epi16(KR), kgu = _mm_set1_epi16(KGU);
+	const __m128i kgv = _mm_set1_epi16(KGV), kb = _mm_set1_epi16(KB);
+	const __m128i zero = _mm_setzero_si128();
+	for (; done + 8 <= pixels; done += 8, s += 16, d += 32) {
+		__m128i in = _mm_loadu_si128((const __m128i *)s);
+		__m128i y = _mm_and_si128(in, mask);
+		__m128i uv = _mm_slli_epi16(_mm_sub_epi16(_mm_srli_epi16(in, 8), c128), 7);
+		// U0 V0 U1 V1 ... -> U0 U0 U1 U1 ... and V0 V0 V1 V1 ...
+		__m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)),
+										_MM_SHUFFLE(2, 2, 0, 0));
+		__m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)),
+										_MM_SHUFFLE(3, 3, 1, 1));
+
+		__m128i r = _mm_add_epi16(y, mulhi_round(v, kr));
+		__m128i g = _mm_sub_epi16(y, _mm_add_epi16(mulhi_round(u, kgu), mulhi_round(v, kgv)));
+		__m128i b = _mm_add_epi16(y, mulhi_round(u, kb));
+		r = _mm_packus_epi16(r, r); // saturates like clip()
+		g = _mm_packus_epi16(g, g);
+		b = _mm_packus_epi16(b, b);
+
+		__m128i ab = _mm_unpacklo_epi8(zero, b);
+		__m128i gr = _mm_unpacklo_epi8(g, r);
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(ab, gr));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(ab, gr));
+	}
+#elif defined(__ARM_NEON)
+	const int16x8_t c128 = vdupq_n_s16(128);
+	const int16x8_t kr = vdupq_n_s16(KR), kgu = vdupq_n_s16(KGU);
+	const int16x8_t kgv = vdupq_n_s16(KGV), kb = vdupq_n_s16(KB);
+	for (; done + 16 <= pixels; done += 16, s += 32, d += 64) {
+		// val[0]: Y of the even pixels, val[1]: U, val[2]: Y of the odd pixels, val[3]: V
+		uint8x8x4_t in = vld4_u8(s);
+		// vqrdmulh is (2 * a * b + 0x8000) >> 16, so shift by one less than the scalar code
+		int16x8_t u = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[1])), c128), 6);
+		int16x8_t v = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[3])), c128), 6);
+		int16x8_t dr = vqrdmulhq_s16(v, kr);
+		int16x8_t dg = vaddq_s16(vqrdmulhq_s16(u, kgu), vqrdmulhq_s16(v, kgv));
+		int16x8_t db = vqrdmulhq_s16(u, kb);
+		int16x8_t ye = vreinterpretq_s16_u16(vmovl_u8(in.val[0]));
+		int16x8_t yo = vreinterpretq_s16_u16(vmovl_u8(in.val[2]));
+
+		uint8x8x2_t r = vzip_u8(vqmovun_s16(vaddq_s16(ye, dr)), vqmovun_s16(vaddq_s16(yo, dr)));
+		uint8x8x2_t g = vzip_u8(vqmovun_s16(vsubq_s16(ye, dg)), vqmovun_s16(vsubq_s16(yo, dg)));
+		uint8x8x2_t b = vzip_u8(vqmovun_s16(vaddq_s16(ye, db)), vqmovun_s16(vaddq_s16(yo, db)));
+		uint8x16x4_t out;
+		out.val[0] = vdupq_n_u8(0);
+		out.val[1] = vcombine_u8(b.val[0], b.val[1]);
+		out.val[2] = vcombine_u8(g.val[0], g.val[1]);
+		out.val[3] = vcombine_u8(r.val[0], r.val[1]);
+		vst4q_u8(d, out);
+	}
+#else
+	(void)s;
+	(void)d;
+	(void)pixels;
+#endif
+	return done;
+}
+
+static void convert(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int x, int y,
+					int width, int height, bool simd) {
+	// U and V belong to pixel pairs starting at even x:
+	if (x & 1) {
+		--x;
+		++width;
+	}
+	if (width & 1)
+		++width;
+	// but not past the end of the lines, an unpaired last pixel has no V:
+	int line_len = std::min(src_stride, dst_stride);
+	if (x + width > line_len)
+		width = (line_len - x) & ~1;
+	if (width <= 0)
+		return;
+
+	for (int line = y; line < y + height; ++line) {
+		const uint8_t *s = src + 2 * (src_stride * line + x);
+		uint8_t *d = dst + 4 * (dst_stride * line + x);
+		int done = simd ? convert_simd(s, d, width) : 0;
+		convert_pairs(s + 2 * done, d + 4 * done, (width - done) / 2);
+	}
+}
+
+void YUV422toRGBA888(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int x, int y,
+					 int width, int height) {
+	convert(src, src_stride, dst, dst_stride, x, y, width, height, true);
+}
+
+void YUV422toRGBA888_scalar(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int x,
+							int y, int width, int height) {
+	convert(src, src_stride, dst, dst_stride, x, y, width, height, false);
+}
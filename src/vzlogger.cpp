@@ -43,10 +43,13 @@
 #include <mutex>
 #include <sstream>
 
+#include "AsyncLog.hpp"
 #include "Channel.hpp"
+#include "CurlMultiSender.hpp"
 #include "CurlSessionProvider.hpp"
 #include "Obis.hpp"
 #include "PushData.hpp"
+#include "Reactor.hpp"
 #include "threads.h"
 #include "vzlogger.h"
 #include <Config_Options.hpp>
@@ -69,6 +72,7 @@ size_t gSkippedFailed = 0; // disabled or failed meters
 std::stringbuf *gStartLogBuf = 0; // temporay buffer for print until logfile is opened
 std::mutex
 	m_log; // mutex for central log function, to prevent competed write access from the threads.
+static bool gLogConsole = true; // print to stdout/stderr as well, false if running as daemon
 
 /**
  * Command line options
@@ -143,6 +147,85 @@ void closeLogfile(bool skip_lock = false) {
 		m_log.unlock();
 }
 
+/**
+ * Format "[%b %d %H:%M:%S]" into buf, at least 18 chars
+ * localtime() and strftime() are done only once per second and thread.
+ * @return the length
+ */
+static size_t log_timestamp(char *buf) {
+	static thread_local time_t last = -1;
+	static thread_local char stamp[18];
+	static thread_local size_t len = 0;
+
+	time_t now = time(NULL);
+	if (now != last) {
+		struct tm timeinfo;
+		localtime_r(&now, &timeinfo);
+		len = strftime(stamp, sizeof(stamp), "[%b %d %H:%M:%S]", &timeinfo);
+		last = now;
+	}
+	memcpy(buf, stamp, len + 1);
+	return len;
+}
+
+/**
+ * Format a complete log line incl. the newline into line, reusing its capacity
+ */
+static void format_line(std::string &line, const char *prefix, const char *format,
+						va_list args) {
+	if (line.capacity() < 128)
+		line.reserve(128);
+	line.resize(line.capacity());
+	int pos = snprintf(&line[0], line.size(), "%-24s", prefix);
+	va_list copy;
+	va_copy(copy, args);
+	int len = vsnprintf(&line[pos], line.size() - pos, format, copy);
+	va_end(copy);
+	if (len < 0)
+		len = 0;
+	if ((size_t)(pos + len + 1) >= line.size()) { // +1 for the newline, vsnprintf needs the \0
+		line.resize(pos + len + 2);
+		vsnprintf(&line[pos], line.size() - pos, format, args);
+	}
+	line[pos + len] = '\n';
+	line.resize(pos + len + 1);
+}
+
+/**
+ * Write a batch of log lines, called from the asyncLog thread
+ */
+static void write_log_lines(std::vector<AsyncLog::Line> &lines, void *) {
+	bool out = false, err = false;
+	m_log.lock(); // the logfile might be reopened meanwhile
+	for (std::vector<AsyncLog::Line>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		if (it->flags & AsyncLog::CONSOLE) {
+			bool to_stderr = it->flags & AsyncLog::STDERR;
+			fwrite(it->text.data(), 1, it->text.size(), to_stderr ? stderr : stdout);
+			(to_stderr ? err : out) = true;
+		}
+		if (options.logfd())
+			fwrite(it->text.data(), 1, it->text.size(), options.logfd());
+	}
+	// once per batch instead of once per line:
+	if (out)
+		fflush(stdout);
+	if (err)
+		fflush(stderr);
+	if (options.logfd())
+		fflush(options.logfd());
+	m_log.unlock();
+}
+
+/**
+ * Stop logging from the writer thread, the queued lines are written. Registered with atexit()
+ */
+static void end_async_log() {
+	AsyncLog *log = asyncLog;
+	asyncLog = 0; // print() writes directly from now on
+	if (log)
+		log->stop();
+}
+
 /**
  * Print error/debug/info messages to stdout and/or logfile
  *
@@ -154,16 +237,11 @@ void print(log_level_t level, const char *format, const char *id, ...) {
 		return; /* skip message if its under the verbosity level */
 	}
 
-	struct timeval now;
-	struct tm *timeinfo;
 	char prefix[24];
 	size_t pos = 0;
 
-	gettimeofday(&now, NULL);
-	timeinfo = localtime(&now.tv_sec);
-
 	/* format timestamp */
-	pos += strftime(prefix + pos, 18, "[%b %d %H:%M:%S]", timeinfo);
+	pos += log_timestamp(prefix);
 
 	/* format section */
 	if (id) {
@@ -171,9 +249,20 @@ void print(log_level_t level, const char *format, const char *id, ...) {
 	}
 
 	va_list args;
+	if (asyncLog) {
+		// formatted here, written by the asyncLog thread
+		static thread_local std::string line;
+		va_start(args, id);
+		format_line(line, prefix, format, args);
+		va_end(args);
+		int flags = (gLogConsole ? AsyncLog::CONSOLE : 0) | (level > 0 ? 0 : AsyncLog::STDERR);
+		asyncLog->write(line, flags, level <= log_error);
+		return;
+	}
+
 	va_start(args, id);
 	/* print to stdout/stderr */
-	if (getppid() != 1) { /* running as fork in background? */
+	if (gLogConsole) { /* not running as fork in background? */
 		FILE *stream = (level > 0) ? stdout : stderr;
 
 		m_log.lock(); // safe write access for competed access from other thread
@@ -267,6 +356,7 @@ void daemonize() {
 	}
 
 	/* child (daemon) continues */
+	gLogConsole = false;
 	setsid(); /* obtain a new process group */
 
 	for (i = getdtablesize(); i >= 0; --i) {
@@ -439,6 +529,7 @@ int main(int argc, char *argv[]) {
 	// sigaction() follows in conditional below.
 
 	gStartLogBuf = new std::stringbuf;
+	gLogConsole = getppid() != 1; /* running as fork in background? */
 
 #ifdef LOCAL_SUPPORT
 	/* webserver for local interface */
@@ -502,13 +593,22 @@ int main(int argc, char *argv[]) {
 		delete temp;
 	}
 
+	if (options.log_async()) {
+		// from here on the meter threads don't wait for the console or logfile
+		asyncLog = new AsyncLog(write_log_lines, NULL, options.log_flush());
+		asyncLog->start();
+		atexit(end_async_log); // keeps the queued lines on exit()
+		print(log_debug, "Logging asynchronously, flushed every %dms", "main",
+			  options.log_flush());
+	}
+
 	if (mappings.size() <= 0) {
 		print(log_alert, "No meters found - quitting!", (char *)0);
 		return EXIT_FAILURE;
 	}
 
 	if (options.pushDataServer()) {
-		pushDataList = new PushDataList();
+		pushDataList = new PushDataList(4096, options.pushDataServer()->delay());
 		int ret = pthread_create(&_pushdata_thread, NULL, push_data_thread,
 								 (void *)options.pushDataServer()); // todo error handling?
 		if (ret)
@@ -529,6 +629,39 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
+	// the shared sender has to exist before the channels start, they decide on it
+	// whether they need a logging thread (started after daemonizing, threads don't fork)
+	if (options.sender_async()) {
+		try {
+			curlMultiSender = new CurlMultiSender(options.sender_connections());
+			curlMultiSender->start();
+		} catch (std::exception &e) {
+			print(log_alert, "Starting shared sender failed, using logging threads: %s", "",
+				  e.what());
+			delete curlMultiSender;
+			curlMultiSender = 0;
+		}
+	}
+
+	// meters that can be read without blocking share one event loop thread
+	if (options.reactor()) {
+		try {
+			reactor = new Reactor();
+			reactor->start();
+			// and the async channels send from there instead of from their reading threads
+			if (curlMultiSender) {
+				sendReactor = new Reactor();
+				sendReactor->start();
+			}
+		} catch (std::exception &e) {
+			print(log_alert, "Starting reactor failed, using reading threads: %s", "", e.what());
+			delete reactor;
+			reactor = 0;
+			delete sendReactor;
+			sendReactor = 0;
+		}
+	}
+
 	print(log_debug, "===> Start meters", "");
 	try {
 		// open connection meters & start threads
@@ -549,9 +682,9 @@ int main(int argc, char *argv[]) {
 		// start webserver for local interface
 		if (options.local()) {
 			print(log_info, "Starting local interface HTTPd on port %i", "http", options.port());
-			httpd_handle =
-				MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION, options.port(), NULL, NULL,
-								 &handle_request, (void *)&mappings, MHD_OPTION_END);
+			httpd_handle = local_start(options.port(), &mappings);
+			if (!httpd_handle)
+				print(log_alert, "Starting local interface HTTPd failed!", "http");
 		}
 #endif /* LOCAL_SUPPORT */
 	} catch (std::exception &e) {
@@ -605,11 +738,22 @@ int main(int argc, char *argv[]) {
 	}
 	print(log_debug, "Server stopped.", "");
 
+	if (reactor) {
+		print(log_finest, "Waiting for reactor to stop...", "");
+		delete reactor;
+		reactor = 0;
+		print(log_finest, "deleted reactor", "");
+	}
+	if (sendReactor) {
+		delete sendReactor;
+		sendReactor = 0;
+	}
+
 #ifdef LOCAL_SUPPORT
 	/* stop webserver */
 	if (httpd_handle) {
 		print(log_finest, "Waiting for httpd to stop...", "");
-		MHD_stop_daemon(httpd_handle);
+		local_stop(httpd_handle);
 		print(log_finest, "httpd stopped", "");
 	}
 #endif /* LOCAL_SUPPORT */
@@ -645,6 +789,13 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
+	if (curlMultiSender) {
+		print(log_finest, "Waiting for curlMultiSender to stop...", "");
+		delete curlMultiSender;
+		curlMultiSender = 0;
+		print(log_finest, "deleted curlMultiSender", "");
+	}
+
 	if (curlSessionProvider) {
 		print(log_finest, "Trying to delete curlSessionProvider...", "");
 		delete curlSessionProvider;
@@ -652,6 +803,12 @@ int main(int argc, char *argv[]) {
 		print(log_finest, "deleted curlSessionProvider", "");
 	}
 
+	if (asyncLog) {
+		AsyncLog *log = asyncLog;
+		end_async_log();
+		delete log;
+	}
+
 	closeLogfile();
 
 	return EXIT_SUCCESS;
@@ -83,15 +83,20 @@ TEST(MeterD0, basic_dump_fd_autoack) {
 	rds.resize(1);
 	// can't test for timeout here as the fdset... don't work for pipes. EXPECT_EQ(0, m.read(rds,
 	// 10)); // check for timeout
+	// the pullseq sent by read() comes back through the fifo and is read together with the
+	// telegram, so check the one sent by poll_request() first:
+	m.poll_request();
+	char buf[100];
+	ssize_t len = read(fd, buf, sizeof(buf));
+	EXPECT_EQ((ssize_t)strlen("/?!\r\n"), len) << "buf=[" << buf << "]";
 	writes(fd, "/HAg5eHZ010C_EHZ1vA02\r\n");      // small (HA)g to set reaction time to 20ms
 	writes(fd, "1-0:1.8.0*255(000001.2963)\r\n"); // works only with \r\n error (see ack handling)
 	writes(fd, "!");
 	EXPECT_EQ(1, m.read(rds, 1));
 
-	// now read from fd and check for pullseq and proper ackseq:
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	EXPECT_EQ((ssize_t)strlen("/?!\r\n\x06\x30\x35\x30\x0d\x0a"), len) << "buf=[" << buf << "]";
+	// now read from fd and check for proper ackseq:
+	len = read(fd, buf, sizeof(buf));
+	EXPECT_EQ((ssize_t)strlen("\x06\x30\x35\x30\x0d\x0a"), len) << "buf=[" << buf << "]";
 
 	ASSERT_EQ(0, m.close());
 	EXPECT_EQ(0, close(fd));
@@ -195,6 +200,129 @@ TEST(MeterD0, HagerEHZ_waitsync) {
 	EXPECT_EQ(0, unlink(tempfilename));
 }
 
+TEST(MeterD0, HagerEHZ_poll) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterD0 m(options);
+	ASSERT_TRUE(m.pollable());
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_GE(m.fd(), 0);
+	ASSERT_EQ(0, fcntl(m.fd(), F_SETFL, fcntl(m.fd(), F_GETFL) | O_NONBLOCK));
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+
+	// nothing there yet, doesn't block:
+	EXPECT_EQ(0, m.poll(rds, 10));
+
+	// a telegram split over several polls:
+	writes(fd, "/HAG5eHZ010C_EHZ1vA02\r\n");
+	writes(fd, "1-0:1.8.0*255(000001.2963)\r\n1-0:1.7");
+	EXPECT_EQ(0, m.poll(rds, 10));
+	writes(fd, ".0*255(000001.2964)\r\n!\n/HAG5eHZ010C_EHZ1vA02\r\n");
+	EXPECT_EQ(2, m.poll(rds, 10));
+	EXPECT_EQ(1.2963, rds[0].value());
+	EXPECT_EQ(1.2964, rds[1].value());
+	EXPECT_EQ(ReadingIdentifier::intern(Obis(1, 0, 1, 7, 0, 255)), rds[1].identifier_id());
+
+	// the start of the next telegram was kept:
+	writes(fd, "1-0:1.9.0*255(000001.2965)\r\n!\n");
+	EXPECT_EQ(1, m.poll(rds, 10));
+	EXPECT_EQ(1.2965, rds[0].value());
+	EXPECT_EQ(0, m.poll(rds, 10));
+
+	EXPECT_EQ(0, m.close());
+
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
+
+TEST(MeterD0, poll_autoack_deferred) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("pullseq", (char *)"2F3F210D0A"));
+	options.push_back(Option("ackseq", (char *)"auto"));
+	options.push_back(Option("baudrate", 300));
+	MeterD0 m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR | O_NONBLOCK);
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_EQ(0, fcntl(m.fd(), F_SETFL, fcntl(m.fd(), F_GETFL) | O_NONBLOCK));
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+	char buf[100];
+
+	m.poll_request();
+	EXPECT_EQ((ssize_t)strlen("/?!\r\n"), read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(-1, m.poll_timeout());
+
+	// the ack waits for the reaction time (20ms for the small g) without blocking poll():
+	writes(fd, "/HAg5eHZ010C_EHZ1vA02\r\n");
+	EXPECT_EQ(0, m.poll(rds, 10));
+	int ms = m.poll_timeout();
+	EXPECT_GE(ms, 0);
+	EXPECT_LE(ms, 20);
+	EXPECT_EQ(-1, read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(0, m.poll(rds, 10)); // too early
+	EXPECT_EQ(-1, read(fd, buf, sizeof(buf)));
+
+	usleep((ms + 5) * 1000);
+	EXPECT_EQ(0, m.poll(rds, 10));
+	ASSERT_EQ((ssize_t)strlen("\x06\x30\x35\x30\x0d\x0a"), read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(0, memcmp(buf, "\x06\x30\x35\x30\x0d\x0a", 6));
+	EXPECT_EQ(0, m.poll_timeout()); // then the baudrate change
+
+	writes(fd, "1-0:1.8.0*255(000001.2963)\r\n!");
+	EXPECT_EQ(1, m.poll(rds, 10));
+	EXPECT_EQ(1.2963, rds[0].value());
+	EXPECT_EQ(-1, m.poll_timeout());
+
+	EXPECT_EQ(0, m.close());
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
+
+TEST(MeterD0, HagerEHZ_read_timeout) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("read_timeout", 1));
+	MeterD0 m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(SUCCESS, m.open());
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+
+	// an incomplete telegram, read waits for the timeout only:
+	writes(fd, "/HAG5eHZ010C_EHZ1vA02\r\n");
+	time_t start = time(NULL);
+	EXPECT_EQ(0, m.read(rds, 10));
+	EXPECT_LE(time(NULL) - start, 3);
+
+	// the next telegram is read completely
+	writes(fd, "/HAG5eHZ010C_EHZ1vA02\r\n1-0:1.8.0*255(000001.2963)\r\n!\n");
+	EXPECT_EQ(1, m.read(rds, 10));
+	EXPECT_EQ(1.2963, rds[0].value());
+
+	EXPECT_EQ(0, m.close());
+
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
+
 TEST(MeterD0, LandisGyr_basic) {
 	char tempfilename[L_tmpnam + 1];
 	char str_pullseq[12] = "2f3f210d0a";
@@ -228,9 +356,13 @@ TEST(MeterD0, LandisGyr_basic) {
 	2.8.0(004329.6*kWh) <-- Summe Zählerstand Energieeinspeisung
 	!                   <-- Endesequenz
 	*/
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
+	// read() sends the pullseq itself and would get it back from the fifo together with the
+	// data, so check the pullseq sent by poll_request() before we put the data.
+	m.poll_request();
+	char buf[100];
+	ssize_t len = read(fd, buf, sizeof(buf));
+	ASSERT_EQ((ssize_t)strlen("/?!\r\n"), len);
+	EXPECT_EQ(0, memcmp(buf, "/?!\r\n", len));
 
 	writes(fd, "/?!\r\n/LGZ52ZMD120APt.G03\r\n");
 	writes(fd, "F.F(00000000)\r\n"); // works only with \r\n error (see ack handling)
@@ -245,10 +377,6 @@ TEST(MeterD0, LandisGyr_basic) {
 
 	// now perform one read call
 	EXPECT_EQ(8, m.read(rds, 10));
-	// check whether pullseq is remaining in the fifo:
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	ASSERT_EQ((ssize_t)strlen("/?!\r\n"), len) << "buf=[" << buf << "]";
 
 	// check obis data:
 	ReadingIdentifier *p = rds[2].identifier().get();
@@ -321,9 +449,13 @@ TEST(MeterD0, ACE3000_basic) {
 	1.8.0(013925.5*)    <-- Summe Zählerstand Energielieferung
 	Y<0x02><0x02><0x01><0x00>!<0x0d><0x0a><0x03>F<0x7f>    <-- Endesequenz and garbage?
 	*/
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
+	// read() sends the pullseq itself and would get it back from the fifo together with the
+	// data, so check the pullseq sent by poll_request() before we put the data.
+	m.poll_request();
+	char buf[100];
+	ssize_t len = read(fd, buf, sizeof(buf));
+	ASSERT_EQ((ssize_t)strlen("/?!\r\n"), len);
+	EXPECT_EQ(0, memcmp(buf, "/?!\r\n", len));
 
 	writes_hex(fd, "7f7f7f7f7f2f3f210d0a2f414345305c336b3236305630312e31390d0a");
 	writes_hex(fd, "02462e46283030290d0a432e31283131323631");
@@ -336,11 +468,10 @@ TEST(MeterD0, ACE3000_basic) {
 
 	// now perform one read call:
 	EXPECT_EQ(4, m.read(rds, 4));
-	// check whether garbage (after !) and pullseq is remaining in the fifo:
-	// will be ignored on next read call TODO add check
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	ASSERT_EQ((ssize_t)strlen("\x0d\x0a\x03\x46\x7f/?!\r\n"), len) << "buf=[" << buf << "]";
+	// the garbage (after !) and the pullseq were read with the telegram and stay buffered,
+	// the next read call drops them together with the serial input buffer.
+	ASSERT_EQ(0, fcntl(fd, F_SETFL, O_NONBLOCK));
+	EXPECT_EQ(-1, read(fd, buf, sizeof(buf)));
 
 	// check obis data:
 	ReadingIdentifier *p = rds[3].identifier().get();
@@ -421,9 +552,6 @@ TEST(MeterD0, LuG_E350) {
 	rds.resize(25);
 
 	// write data set
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
 
 	writes_hex(fd, "2f4c475a345a4d4631303041432e4d32370a0a"); //  /LGZ4ZMF100AC.M27
 	writes_hex(fd, "02462e46283030290a0a302e30282020");       //    F.F(00)  0.0(
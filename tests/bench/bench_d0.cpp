@@ -0,0 +1,123 @@
+/**
+ * D0 parsing of the telegrams recorded in tests/MeterD0.cpp through a fifo:
+ * buffered MeterD0::read() vs. reading the same bytes with one syscall per byte
+ * (what the parser did before, without any parsing).
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Options.hpp"
+#include "protocols/MeterD0.hpp"
+
+void print(log_level_t l, char const *s1, char const *s2, ...) {
+	if (l <= log_error) {
+		fprintf(stderr, "%s: ", s2);
+		va_list argp;
+		va_start(argp, s2);
+		vfprintf(stderr, s1, argp);
+		va_end(argp);
+		fprintf(stderr, "\n");
+	}
+}
+
+namespace {
+
+const char *hager_ehz = "/HAG5eHZ010C_EHZ1vA02\r\n"
+						"1-0:1.7.0*255(000001.2964)\r\n"
+						"1-0:1.9.0*255(000001.2965)\r\n"
+						"!\n";
+
+const char *lug_e350_hex = "2f4c475a345a4d4631303041432e4d32370a0a02462e46283030290a0a302e30"
+						   "2820202020202020203138343338363336290a0a432e312e3028313834333836"
+						   "3336290a0a432e312e31282020202020202020290a0a312e382e312830303030"
+						   "30302e3030302a6b5768290a0a312e382e32283030303231392e3235312a6b57"
+						   "68290a0a322e382e31283030303030302e3030302a6b5768290a0a322e382e32"
+						   "283030303030302e3030302a6b5768290a0a312e382e30283030303231392e32"
+						   "35322a6b5768290a0a322e382e30283030303030302e3030302a6b5768290a0a"
+						   "31352e382e30283030303231392e3235322a6b5768290a0a432e372e30283030"
+						   "3034290a0a33322e37283233332a56290a0a35322e37283233332a56290a0a37"
+						   "322e37283233342a56290a0a33312e37283030322e33302a41290a0a35312e37"
+						   "283030322e33322a41290a0a37312e37283030322e39372a41290a0a31362e37"
+						   "283030312e36362a6b57290a0a38322e382e312830303030290a0a38322e382e"
+						   "322830303030290a0a302e322e30284d3237290a0a432e352e30283134323029"
+						   "0a0a21";
+
+std::string unhex(const char *hex) {
+	std::string r;
+	for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+		unsigned int c;
+		sscanf(&hex[i], "%2x", &c);
+		r += (char)c;
+	}
+	return r;
+}
+
+std::string telegram(int which) { return which ? unhex(lug_e350_hex) : std::string(hager_ehz); }
+
+struct Fifo {
+	char name[32];
+	int fd;
+	Fifo() {
+		snprintf(name, sizeof(name), "/tmp/bench_d0_%d", (int)getpid());
+		unlink(name);
+		mkfifo(name, S_IRUSR | S_IWUSR);
+		fd = open(name, O_RDWR);
+	}
+	~Fifo() {
+		close(fd);
+		unlink(name);
+	}
+};
+
+void BM_d0_read(benchmark::State &state) {
+	std::string data = telegram(state.range(0));
+	Fifo fifo;
+	std::list<Option> options;
+	options.push_back(Option("device", fifo.name));
+	MeterD0 m(options);
+	if (m.open() != SUCCESS) {
+		state.SkipWithError("open failed");
+		return;
+	}
+	std::vector<Reading> rds(32);
+	size_t n = 0;
+	for (auto _ : state) {
+		if (write(fifo.fd, data.data(), data.size()) != (ssize_t)data.size())
+			state.SkipWithError("write failed");
+		n = m.read(rds, rds.size());
+	}
+	m.close();
+	state.SetBytesProcessed(state.iterations() * data.size());
+	state.counters["readings"] = n;
+}
+
+// lower bound for the old parser: one read() per byte
+void BM_d0_bytewise_syscalls(benchmark::State &state) {
+	std::string data = telegram(state.range(0));
+	Fifo fifo;
+	for (auto _ : state) {
+		if (write(fifo.fd, data.data(), data.size()) != (ssize_t)data.size())
+			state.SkipWithError("write failed");
+		char byte;
+		for (size_t i = 0; i < data.size(); i++)
+			benchmark::DoNotOptimize(read(fifo.fd, &byte, 1));
+	}
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+} // namespace
+
+// 0: Hager eHZ, 1: L&G E350
+BENCHMARK(BM_d0_read)->Arg(0)->Arg(1);
+BENCHMARK(BM_d0_bytewise_syscalls)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
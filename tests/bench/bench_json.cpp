@@ -0,0 +1,109 @@
+/**
+ * Encoding of middleware tuples: json-c object tree vs. std::string concatenation
+ * vs. JsonWriter, for 10k and 100k tuples.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <json-c/json.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "api/JsonWriter.hpp"
+
+namespace {
+
+struct Tuple {
+	int64_t t;
+	double v;
+};
+
+std::vector<Tuple> tuples(size_t n) {
+	std::vector<Tuple> r(n);
+	for (size_t i = 0; i < n; i++) {
+		r[i].t = 1700000000000LL + (int64_t)i * 1000;
+		r[i].v = 230.0 + (double)(i % 1000) * 0.017;
+	}
+	return r;
+}
+
+// as PushDataServer::generateJson and local.cpp did before
+void BM_json_c(benchmark::State &state) {
+	std::vector<Tuple> data = tuples(state.range(0));
+	size_t bytes = 0;
+	for (auto _ : state) {
+		json_object *jso = json_object_new_object();
+		json_object *jsa = json_object_new_array();
+		json_object *jsu = json_object_new_object();
+		json_object_object_add(jsu, "uuid", json_object_new_string("0123-4567"));
+		json_object *jst = json_object_new_array();
+		for (const Tuple &t : data) {
+			json_object *jsv = json_object_new_array();
+			json_object_array_add(jsv, json_object_new_int64(t.t));
+			json_object_array_add(jsv, json_object_new_double(t.v));
+			json_object_array_add(jst, jsv);
+		}
+		json_object_object_add(jsu, "tuples", jst);
+		json_object_array_add(jsa, jsu);
+		json_object_object_add(jso, "data", jsa);
+		const char *s = json_object_to_json_string(jso);
+		bytes = strlen(s);
+		benchmark::DoNotOptimize(s);
+		json_object_put(jso);
+	}
+	state.SetItemsProcessed(state.iterations() * data.size());
+	state.counters["bytes"] = bytes;
+}
+
+// as Volkszaehler::api_json_tuples did before
+void BM_to_string(benchmark::State &state) {
+	std::vector<Tuple> data = tuples(state.range(0));
+	std::string out;
+	for (auto _ : state) {
+		out = "[";
+		bool first = true;
+		for (const Tuple &t : data) {
+			if (!first)
+				out += ",";
+			first = false;
+			out += "[";
+			out += std::to_string(t.t);
+			out += ",";
+			out += std::to_string(t.v);
+			out += "]";
+		}
+		out += "]";
+		benchmark::DoNotOptimize(out.data());
+	}
+	state.SetItemsProcessed(state.iterations() * data.size());
+	state.counters["bytes"] = out.size();
+}
+
+void BM_JsonWriter(benchmark::State &state) {
+	std::vector<Tuple> data = tuples(state.range(0));
+	JsonWriter w;
+	for (auto _ : state) {
+		w.clear();
+		w.begin_object();
+		w.key("data").begin_array();
+		w.begin_object();
+		w.key("uuid").value("0123-4567");
+		w.key("tuples").begin_array();
+		for (const Tuple &t : data)
+			w.tuple(t.t, t.v);
+		w.end_array().end_object();
+		w.end_array().end_object();
+		benchmark::DoNotOptimize(w.c_str());
+	}
+	state.SetItemsProcessed(state.iterations() * data.size());
+	state.counters["bytes"] = w.size();
+}
+
+} // namespace
+
+BENCHMARK(BM_json_c)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_to_string)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_JsonWriter)->Arg(10000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
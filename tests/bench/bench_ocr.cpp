@@ -0,0 +1,121 @@
+/**
+ * YUYV to RGBA conversion of V4L2 frames for MeterOCR, with the recorded image
+ * tests/meterOCR/img2.png converted to YUYV as the camera would deliver it:
+ * the old float conversion vs. the integer one (scalar and SIMD), full frame and
+ * only the rectangle the recognizers of ut_MeterOCR's basic2_needle_autofix use.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include <allheaders.h> // from leptonica
+
+#include "protocols/YuvConvert.hpp"
+#include <test_config.hpp>
+
+namespace {
+
+struct Frame {
+	int w, h;
+	std::vector<uint8_t> yuyv;
+	std::vector<uint8_t> rgba;
+};
+
+const Frame &frame() {
+	static Frame f;
+	if (!f.yuyv.empty())
+		return f;
+	PIX *pix = pixRead(ocrTestImage("img2.png").c_str());
+	if (!pix) {
+		fprintf(stderr, "can't read img2.png\n");
+		exit(1);
+	}
+	f.w = pixGetWidth(pix) & ~1;
+	f.h = pixGetHeight(pix);
+	f.yuyv.resize(2 * f.w * f.h);
+	f.rgba.resize(4 * f.w * f.h);
+	for (int y = 0; y < f.h; y++)
+		for (int x = 0; x < f.w; x += 2) {
+			int u = 0, v = 0;
+			for (int p = 0; p < 2; p++) {
+				l_int32 r, g, b;
+				pixGetRGBPixel(pix, x + p, y, &r, &g, &b);
+				int l = (77 * r + 150 * g + 29 * b) >> 8;
+				f.yuyv[2 * (y * f.w + x + p)] = l;
+				u += 128 + (((b - l) * 144) >> 8);
+				v += 128 + (((r - l) * 183) >> 8);
+			}
+			f.yuyv[2 * (y * f.w + x) + 1] = u / 2;
+			f.yuyv[2 * (y * f.w + x) + 3] = v / 2;
+		}
+	pixDestroy(&pix);
+	return f;
+}
+
+// what MeterOCR did before
+void YUV422toRGBA888_float(int stride_s_w, int stride_d_w, int s_x, int s_y, int width, int height,
+						   const uint8_t *src, uint8_t *dst) {
+	uint8_t *tmp = dst + (4 * ((stride_d_w * s_y) + s_x));
+	const uint8_t *py = src + (2 * ((stride_s_w * s_y) + s_x));
+	const uint8_t *pu = py + 1, *pv = py + 3;
+#define CLIP(x) ((x) >= 0xFF ? 0xFF : ((x) <= 0x00 ? 0x00 : (x)))
+	for (int line = 0; line < height; ++line) {
+		for (int column = 0; column < width; ++column) {
+			*tmp++ = 0;
+			*tmp++ = CLIP((float)*py + 1.772 * ((float)*pu - 128.0));
+			*tmp++ =
+				CLIP((float)*py - 0.344 * ((float)*pu - 128.0) - 0.714 * ((float)*pv - 128.0));
+			*tmp++ = CLIP((float)*py + 1.402 * ((float)*pv - 128.0));
+			py += 2;
+			if ((column & 1) == 1) {
+				pu += 4;
+				pv += 4;
+			}
+		}
+		py += 2 * (stride_s_w - width);
+		pu += 2 * (stride_s_w - width);
+		pv += 2 * (stride_s_w - width);
+		tmp += 4 * (stride_d_w - width);
+	}
+#undef CLIP
+}
+
+// the needles and the autofix area of basic2_needle_autofix
+const int ROI[4] = {444, 375, 734, 621};
+
+enum Mode { FLOAT, SCALAR, SIMD };
+
+void run(benchmark::State &state, Mode mode, bool roi) {
+	Frame f = frame(); // copy, rgba is written
+	int x = roi ? ROI[0] : 0, y = roi ? ROI[1] : 0;
+	int w = roi ? ROI[2] - ROI[0] : f.w, h = roi ? ROI[3] - ROI[1] : f.h;
+	for (auto _ : state) {
+		if (mode == FLOAT)
+			YUV422toRGBA888_float(f.w, f.w, x, y, w, h, f.yuyv.data(), f.rgba.data());
+		else if (mode == SCALAR)
+			YUV422toRGBA888_scalar(f.yuyv.data(), f.w, f.rgba.data(), f.w, x, y, w, h);
+		else
+			YUV422toRGBA888(f.yuyv.data(), f.w, f.rgba.data(), f.w, x, y, w, h);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * w * h); // pixels
+}
+
+void BM_yuv_float(benchmark::State &state) { run(state, FLOAT, false); }
+void BM_yuv_scalar(benchmark::State &state) { run(state, SCALAR, false); }
+void BM_yuv_simd(benchmark::State &state) { run(state, SIMD, false); }
+void BM_yuv_float_roi(benchmark::State &state) { run(state, FLOAT, true); }
+void BM_yuv_simd_roi(benchmark::State &state) { run(state, SIMD, true); }
+
+} // namespace
+
+BENCHMARK(BM_yuv_float);
+BENCHMARK(BM_yuv_scalar);
+BENCHMARK(BM_yuv_simd);
+BENCHMARK(BM_yuv_float_roi);
+BENCHMARK(BM_yuv_simd_roi);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,96 @@
+/**
+ * SML parsing of the telegram recorded in tests/MeterSML.cpp:
+ * MeterSML with the native decoder vs. building and freeing the libsml object graph
+ * (what the parser did before, without converting the entries to readings).
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <sml/sml_file.h>
+
+#include "Options.hpp"
+#include "protocols/MeterSML.hpp"
+#include "protocols/SmlDecoder.hpp"
+
+void print(log_level_t l, char const *s1, char const *s2, ...) {
+	if (l <= log_error) {
+		fprintf(stderr, "%s: ", s2);
+		va_list argp;
+		va_start(argp, s2);
+		vfprintf(stderr, s1, argp);
+		va_end(argp);
+		fprintf(stderr, "\n");
+	}
+}
+
+namespace {
+
+// EMH eHZ, one GetListResponse with six entries
+const char *emh_hex = "1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+					  "01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+					  "77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+					  "010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+					  "0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+					  "010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+
+std::string unhex(const char *hex) {
+	std::string r;
+	for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+		unsigned int c;
+		sscanf(&hex[i], "%2x", &c);
+		r += (char)c;
+	}
+	return r;
+}
+
+class BenchMeterSML : public MeterSML {
+  public:
+	BenchMeterSML(std::list<Option> options) : MeterSML(options) {}
+	using MeterSML::_parse_frame;
+};
+
+void BM_sml_parse_frame(benchmark::State &state) {
+	std::string data = unhex(emh_hex);
+	std::list<Option> options;
+	options.push_back(Option("device", "/dev/null"));
+	BenchMeterSML m(options);
+	std::vector<Reading> rds(16);
+	size_t n = 0;
+	for (auto _ : state)
+		n = m._parse_frame((unsigned char *)&data[0], data.size(), rds, rds.size());
+	state.SetBytesProcessed(state.iterations() * data.size());
+	state.counters["readings"] = n;
+}
+
+void BM_sml_decode(benchmark::State &state) {
+	std::string data = unhex(emh_hex);
+	SmlDecoder d;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(d.decode((const unsigned char *)data.data(), data.size()));
+	state.SetBytesProcessed(state.iterations() * data.size());
+	state.counters["entries"] = d.entries().size();
+}
+
+// lower bound for the old parser: libsml without any conversion
+void BM_sml_libsml(benchmark::State &state) {
+	std::string data = unhex(emh_hex);
+	for (auto _ : state) {
+		sml_file *file = sml_file_parse((unsigned char *)&data[8], data.size() - 16);
+		benchmark::DoNotOptimize(file);
+		sml_file_free(file);
+	}
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_sml_parse_frame);
+BENCHMARK(BM_sml_decode);
+BENCHMARK(BM_sml_libsml);
+
+BENCHMARK_MAIN();
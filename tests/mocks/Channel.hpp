@@ -4,6 +4,7 @@
 #include <gmock/gmock.h>
 
 #include "Buffer.hpp"
+#include "Metrics.hpp"
 #include "Options.hpp"
 #include "Reading.hpp"
 
@@ -31,6 +32,12 @@ class Channel {
 	MOCK_METHOD0(wait, void());
 	MOCK_METHOD0(uuid, const char *());
 	MOCK_CONST_METHOD0(duplicates, int());
+	MOCK_METHOD1(sendData, void(Channel::Ptr));
+	MOCK_CONST_METHOD0(async, bool());
+	MOCK_CONST_METHOD0(send_shared, bool());
+	MOCK_CONST_METHOD0(push_slot, int());
+	MOCK_METHOD1(push_slot, void(int));
+	MOCK_CONST_METHOD0(depth, Metrics::Gauge *());
 
 	ReadingIdentifier::Ptr &real_id() { return mock_id; }
 	ReadingIdentifier::Ptr mock_id;
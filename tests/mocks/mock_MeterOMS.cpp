@@ -12,6 +12,7 @@ using ::testing::Test;
 
 #include "Meter.hpp"
 #include "protocols/MeterOMS.hpp"
+#include <json-c/json.h>
 
 namespace mock_MeterOMS {
 
@@ -48,6 +49,23 @@ class mock_OMShwif : public MeterOMS::OMSHWif {
 	unsigned char *data;
 };
 
+// SND_NKE and two SND_UD from meter SAM 00000000 (key 0078580E79544B145D1A96D0F7E777FA)
+const unsigned char first_packets_data[300] = {
+	0x10, 0x40, 0xF0, 0x30, 0x16, 0x68, 0x5F, 0x5F, 0x68, 0x73, 0xF0, 0x5B, 0x00, 0x00, 0x00,
+	0x00, 0x2D, 0x4C, 0x01, 0x0E, 0x00, 0x00, 0x50, 0x05, 0x81, 0xA0, 0x00, 0xA0, 0xD2, 0x41,
+	0xD0, 0xE1, 0xA8, 0xB6, 0xF4, 0xF8, 0xD0, 0x3C, 0x21, 0x2E, 0x60, 0x99, 0xFA, 0x3B, 0x4A,
+	0x36, 0xD8, 0x1B, 0x8D, 0x01, 0x86, 0x3F, 0x58, 0x38, 0x81, 0x09, 0x33, 0x54, 0xF7, 0xAD,
+	0xD2, 0xEC, 0x10, 0x12, 0x3C, 0xBB, 0xFE, 0x86, 0x8C, 0x14, 0xFF, 0xF0, 0x87, 0x59, 0x46,
+	0x91, 0xB4, 0xD7, 0x95, 0xC1, 0x2E, 0x85, 0x34, 0x01, 0xB2, 0xDC, 0x08, 0x5C, 0xFB, 0x1A,
+	0xEE, 0xD0, 0x00, 0xA1, 0x9E, 0x9D, 0xCE, 0xA6, 0x50, 0x15, 0x39, 0x2D, 0x15, 0x3B, 0x98,
+	0x16, 0x68, 0x5F, 0x5F, 0x68, 0x53, 0xF0, 0x5B, 0x00, 0x00, 0x00, 0x00, 0x2D, 0x4C, 0x01,
+	0x0E, 0x01, 0x00, 0x50, 0x05, 0xFB, 0xF5, 0x82, 0xB2, 0x97, 0x27, 0x5D, 0x1A, 0x6A, 0x20,
+	0x8B, 0xB1, 0x61, 0xFD, 0xB4, 0xF1, 0x7E, 0xEC, 0xCA, 0x54, 0xDD, 0x3A, 0x1D, 0x42, 0xFB,
+	0xFE, 0xF4, 0xB5, 0xF5, 0x0E, 0xF9, 0x0B, 0x96, 0xFD, 0xB5, 0xFC, 0xF0, 0x07, 0x84, 0xF8,
+	0xDC, 0xD1, 0xA6, 0xB7, 0x7D, 0x17, 0x42, 0x7A, 0xB2, 0xC9, 0x85, 0xE2, 0x73, 0x8B, 0x6B,
+	0x4E, 0x60, 0x3D, 0x57, 0x30, 0xF3, 0x4C, 0x5B, 0xC4, 0x02, 0x08, 0x97, 0x2B, 0x99, 0x4C,
+	0x9D, 0x29, 0xD8, 0x78, 0xA6, 0x2C, 0x18, 0x71, 0x7E, 0x18, 0x29, 0x16};
+
 TEST(mock_MeterOMS, basic_nokey) {
 	mock_OMShwif *hwif = new mock_OMShwif();
 	std::list<Option> opt;
@@ -102,22 +120,7 @@ TEST(mock_MeterOMS, first_packets) {
 	// 0x33, 0x28, 0xBE, 0x61, 0x77, 0xDC, 0xA5, 0x94, 0xC1, 0x28, 0x00, 0x24, 0xA8,
 	// 0x35, 0xF1, 0xD6, 0x55, 0xBA, 0x71, 0x82, 0xB2, 0x56, 0xE9, 0x4B, 0xD3, 0x3A,
 	// 0xC0, 0xA6, 0xB0, 0x8D, 0xA4, 0x67, 0x81, 0xEB, 0x4E, 0x91, 0xE0, 0x12, 0x16 };
-	unsigned char data[300] = {
-		0x10, 0x40, 0xF0, 0x30, 0x16, 0x68, 0x5F, 0x5F, 0x68, 0x73, 0xF0, 0x5B, 0x00, 0x00, 0x00,
-		0x00, 0x2D, 0x4C, 0x01, 0x0E, 0x00, 0x00, 0x50, 0x05, 0x81, 0xA0, 0x00, 0xA0, 0xD2, 0x41,
-		0xD0, 0xE1, 0xA8, 0xB6, 0xF4, 0xF8, 0xD0, 0x3C, 0x21, 0x2E, 0x60, 0x99, 0xFA, 0x3B, 0x4A,
-		0x36, 0xD8, 0x1B, 0x8D, 0x01, 0x86, 0x3F, 0x58, 0x38, 0x81, 0x09, 0x33, 0x54, 0xF7, 0xAD,
-		0xD2, 0xEC, 0x10, 0x12, 0x3C, 0xBB, 0xFE, 0x86, 0x8C, 0x14, 0xFF, 0xF0, 0x87, 0x59, 0x46,
-		0x91, 0xB4, 0xD7, 0x95, 0xC1, 0x2E, 0x85, 0x34, 0x01, 0xB2, 0xDC, 0x08, 0x5C, 0xFB, 0x1A,
-		0xEE, 0xD0, 0x00, 0xA1, 0x9E, 0x9D, 0xCE, 0xA6, 0x50, 0x15, 0x39, 0x2D, 0x15, 0x3B, 0x98,
-		0x16, 0x68, 0x5F, 0x5F, 0x68, 0x53, 0xF0, 0x5B, 0x00, 0x00, 0x00, 0x00, 0x2D, 0x4C, 0x01,
-		0x0E, 0x01, 0x00, 0x50, 0x05, 0xFB, 0xF5, 0x82, 0xB2, 0x97, 0x27, 0x5D, 0x1A, 0x6A, 0x20,
-		0x8B, 0xB1, 0x61, 0xFD, 0xB4, 0xF1, 0x7E, 0xEC, 0xCA, 0x54, 0xDD, 0x3A, 0x1D, 0x42, 0xFB,
-		0xFE, 0xF4, 0xB5, 0xF5, 0x0E, 0xF9, 0x0B, 0x96, 0xFD, 0xB5, 0xFC, 0xF0, 0x07, 0x84, 0xF8,
-		0xDC, 0xD1, 0xA6, 0xB7, 0x7D, 0x17, 0x42, 0x7A, 0xB2, 0xC9, 0x85, 0xE2, 0x73, 0x8B, 0x6B,
-		0x4E, 0x60, 0x3D, 0x57, 0x30, 0xF3, 0x4C, 0x5B, 0xC4, 0x02, 0x08, 0x97, 0x2B, 0x99, 0x4C,
-		0x9D, 0x29, 0xD8, 0x78, 0xA6, 0x2C, 0x18, 0x71, 0x7E, 0x18, 0x29, 0x16};
-	hwif->set_transmitdata(data, 300);
+	hwif->set_transmitdata((void *)first_packets_data, 300);
 
 	EXPECT_CALL(*hwif, read(_, _))
 		.Times(AtLeast(1))
@@ -140,6 +143,57 @@ TEST(mock_MeterOMS, first_packets) {
 	ASSERT_EQ(rds[7].time_s(), mktime(&t));
 }
 
+TEST(mock_MeterOMS, devices) {
+	mock_OMShwif *hwif = new mock_OMShwif();
+	std::list<Option> opt;
+	struct json_object *devices = json_tokener_parse(
+		"[{\"id\": \"12345678\", \"key\": \"00000000000000000000000000000000\"},"
+		" {\"id\": \"00000000\", \"manufacturer\": \"SAM\", \"channel\": 2,"
+		"  \"key\": \"0078580E79544B145D1A96D0F7E777FA\"}]");
+	opt.push_back(Option("devices", devices));
+	json_object_put(devices);
+
+	hwif->set_transmitdata((void *)first_packets_data, 300);
+	EXPECT_CALL(*hwif, read(_, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke(hwif, &mock_MeterOMS::mock_OMShwif::p_read));
+	EXPECT_CALL(*hwif, write(_, _)).Times(3).WillRepeatedly(Return(1));
+	MeterOMS m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(10);
+	ASSERT_EQ(m.read(rds, 10), 8);
+	m.close();
+	// the readings are identified by the channel of the device:
+	for (size_t i = 0; i < 8; i++) {
+		ObisIdentifier *o = dynamic_cast<ObisIdentifier *>(rds[i].identifier().get());
+		ASSERT_NE((ObisIdentifier *)0, o);
+		const Obis &obis = o->obis();
+		ASSERT_TRUE(obis == Obis("2:1.8.0") || obis == Obis("2:2.8.0") ||
+					obis == Obis("2:1.7.0") || obis == Obis("2:2.7.0"));
+	}
+}
+
+TEST(mock_MeterOMS, devices_unknown) {
+	mock_OMShwif *hwif = new mock_OMShwif();
+	std::list<Option> opt;
+	struct json_object *devices = json_tokener_parse(
+		"[{\"id\": \"00000000\", \"manufacturer\": \"ABC\","
+		"  \"key\": \"0078580E79544B145D1A96D0F7E777FA\"}]");
+	opt.push_back(Option("devices", devices));
+	json_object_put(devices);
+
+	hwif->set_transmitdata((void *)first_packets_data, 300);
+	EXPECT_CALL(*hwif, read(_, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke(hwif, &mock_MeterOMS::mock_OMShwif::p_read));
+	EXPECT_CALL(*hwif, write(_, _)).Times(3).WillRepeatedly(Return(1)); // still acked
+	MeterOMS m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(10);
+	ASSERT_EQ(m.read(rds, 10), 0);
+	m.close();
+}
+
 } // namespace mock_MeterOMS
 
 void print(log_level_t l, char const *s1, char const *s2, ...) {
@@ -10,6 +10,9 @@ using ::testing::ReturnRef;
 #include <gtest/gtest.h>
 using ::testing::Test;
 
+#include <functional>
+#include <unistd.h>
+
 #include "Meter.hpp"
 #include "protocols/MeterS0.hpp"
 
@@ -28,6 +31,39 @@ class mock_S0hwif : public MeterS0::HWIF {
   protected:
 };
 
+// hwif with kernel timestamped edges like HWIF_GPIOCHIP
+class mock_S0edges : public mock_S0hwif {
+  public:
+	MOCK_METHOD2(waitForEdge, bool(bool &, struct timespec &));
+	virtual bool has_timestamps() const { return true; }
+};
+
+// returns an edge at base + each of offsets_ms, then timeouts
+struct Edges {
+	struct timespec base;
+	std::vector<int> offsets_ms;
+	size_t next;
+
+	Edges(std::vector<int> offsets) : offsets_ms(offsets), next(0) {
+		clock_gettime(CLOCK_REALTIME, &base);
+	}
+	bool operator()(bool &timeout, struct timespec &ts) {
+		if (next >= offsets_ms.size()) {
+			usleep(10000);
+			timeout = true;
+			return false;
+		}
+		ts = base;
+		timespec_add_ms(ts, offsets_ms[next++]);
+		timeout = false;
+		return true;
+	}
+};
+
+std::string identifier(const Reading &r) {
+	return static_cast<StringIdentifier *>(r.identifier().get())->string();
+}
+
 TEST(mock_MeterS0, timespec_add_ms) {
 	struct timespec a;
 	a.tv_sec = 1;
@@ -176,6 +212,58 @@ TEST(mock_MeterS0, basic_blocking_send_zero_2reads) {
 	m.close(); // this might be called and should not cause problems
 }
 
+TEST(mock_MeterS0, power_impulses) {
+	mock_S0edges *hwif = new mock_S0edges();
+	std::list<Option> opt;
+	opt.push_back(Option("power_impulses", 1));
+
+	Edges edges({0, 100, 200, 400});
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, status()).Times(AtLeast(0)).WillRepeatedly(Return(0));
+	EXPECT_CALL(*hwif, waitForEdge(_, _)).WillRepeatedly(Invoke(std::ref(edges)));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(64);
+	ASSERT_EQ(4, m.read(rds, 64)); // no Power for the first impulse
+	m.close();
+
+	EXPECT_EQ("Impulse", identifier(rds[0]));
+	EXPECT_EQ(4, rds[0].value());
+	// each Power at the time of its impulse, from the exact distance to the one before:
+	const double power[] = {36000, 36000, 18000};
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ("Power", identifier(rds[i + 1]));
+		EXPECT_NEAR(power[i], rds[i + 1].value(), 0.01);
+	}
+	struct timespec t = edges.base;
+	timespec_add_ms(t, 400);
+	EXPECT_EQ(t.tv_sec * 1000ll + t.tv_nsec / 1000000, rds[3].time_ms());
+}
+
+TEST(mock_MeterS0, power_impulses_2) {
+	mock_S0edges *hwif = new mock_S0edges();
+	std::list<Option> opt;
+	opt.push_back(Option("power_impulses", 2));
+
+	Edges edges({0, 100, 300, 400, 800, 900});
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, status()).Times(AtLeast(0)).WillRepeatedly(Return(0));
+	EXPECT_CALL(*hwif, waitForEdge(_, _)).WillRepeatedly(Invoke(std::ref(edges)));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(64);
+	ASSERT_EQ(3, m.read(rds, 64)); // the impulse at 900 waits for the next one
+	m.close();
+
+	EXPECT_EQ(6, rds[0].value());
+	EXPECT_NEAR(24000, rds[1].value(), 0.01); // 2 impulses in 300ms
+	EXPECT_NEAR(14400, rds[2].value(), 0.01); // 2 impulses in 500ms
+}
+
 /* time out -> endless waiting for first impulse
 TEST(mock_MeterS0, basic_non_blocking_read_no_send_zero)
 {
@@ -3,8 +3,10 @@ using ::testing::_;
 using ::testing::AtLeast;
 using ::testing::Eq;
 using ::testing::InSequence;
+using ::testing::DoAll;
 using ::testing::Return;
 using ::testing::ReturnRef;
+using ::testing::SetArgReferee;
 
 #include <gtest/gtest.h>
 using ::testing::Test;
@@ -21,6 +23,8 @@ class mock_W1hwif : public MeterW1therm::W1HWif {
 	MOCK_METHOD0(scanW1devices, bool());
 	MOCK_CONST_METHOD0(W1devices, const std::list<std::string> &());
 	MOCK_METHOD2(readTemp, bool(const std::string &dev, double &value));
+	MOCK_METHOD0(bulkConvert, bool());
+	MOCK_METHOD2(readConverted, bool(const std::string &dev, double &value));
 };
 
 TEST(mock_MeterW1therm, basic_fail_scanW1devices) {
@@ -138,6 +142,55 @@ TEST(mock_MeterW1therm, basic_scanW1devices_2ok) {
 	ASSERT_EQ(SUCCESS, m.close());
 }
 
+TEST(mock_MeterW1therm, parallel) {
+	mock_W1hwif *hwif = new mock_W1hwif();
+	std::list<Option> opt;
+	opt.push_back(Option("parallel", true));
+	opt.push_back(Option("threads", 2));
+
+	EXPECT_CALL(*hwif, scanW1devices()).Times(1).WillRepeatedly(Return(true));
+	std::list<std::string> devs;
+	devs.push_back(std::string("dev1"));
+	devs.push_back(std::string("dev2"));
+	devs.push_back(std::string("dev3"));
+	EXPECT_CALL(*hwif, W1devices()).Times(AtLeast(1)).WillRepeatedly(ReturnRef(devs));
+	MeterW1therm m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	EXPECT_CALL(*hwif, bulkConvert()).Times(1).WillOnce(Return(false));
+	EXPECT_CALL(*hwif, readTemp("dev1", _)).WillOnce(DoAll(SetArgReferee<1>(1.0), Return(true)));
+	EXPECT_CALL(*hwif, readTemp("dev2", _)).WillOnce(Return(false));
+	EXPECT_CALL(*hwif, readTemp("dev3", _)).WillOnce(DoAll(SetArgReferee<1>(3.0), Return(true)));
+	EXPECT_CALL(*hwif, readConverted(_, _)).Times(0);
+	std::vector<Reading> rds(3);
+	ASSERT_EQ(2, m.read(rds, 3));
+	// in the order of the devices:
+	EXPECT_EQ(1.0, rds[0].value());
+	EXPECT_EQ(3.0, rds[1].value());
+
+	ASSERT_EQ(SUCCESS, m.close());
+}
+
+TEST(mock_MeterW1therm, parallel_bulk) {
+	mock_W1hwif *hwif = new mock_W1hwif();
+	std::list<Option> opt;
+	opt.push_back(Option("parallel", true));
+
+	EXPECT_CALL(*hwif, scanW1devices()).Times(1).WillRepeatedly(Return(true));
+	std::list<std::string> devs;
+	devs.push_back(std::string("dev1"));
+	devs.push_back(std::string("dev2"));
+	EXPECT_CALL(*hwif, W1devices()).Times(AtLeast(1)).WillRepeatedly(ReturnRef(devs));
+	MeterW1therm m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	EXPECT_CALL(*hwif, bulkConvert()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, readConverted(_, _)).Times(2).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, readTemp(_, _)).Times(0);
+	std::vector<Reading> rds(2);
+	ASSERT_EQ(2, m.read(rds, 2));
+
+	ASSERT_EQ(SUCCESS, m.close());
+}
+
 } // namespace mock_MeterW1therm
 
 void print(log_level_t l, char const *s1, char const *s2, ...) {
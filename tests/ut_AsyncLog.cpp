@@ -0,0 +1,109 @@
+#include "gtest/gtest.h"
+
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "AsyncLog.hpp"
+
+namespace {
+
+struct Capture {
+	std::mutex mutex;
+	std::vector<std::string> lines;
+	size_t batches = 0;
+};
+
+void capture(std::vector<AsyncLog::Line> &lines, void *arg) {
+	Capture *c = static_cast<Capture *>(arg);
+	std::lock_guard<std::mutex> lock(c->mutex);
+	for (auto &l : lines)
+		c->lines.push_back(l.text);
+	c->batches++;
+}
+
+size_t captured(Capture &c) {
+	std::lock_guard<std::mutex> lock(c.mutex);
+	return c.lines.size();
+}
+
+} // namespace
+
+TEST(AsyncLog, batches) {
+	Capture c;
+	AsyncLog log(capture, &c, 10000); // no timed flush during the test
+	log.start();
+
+	std::string line;
+	for (int i = 0; i < 100; i++) {
+		line = "line " + std::to_string(i) + "\n";
+		ASSERT_TRUE(log.write(line, AsyncLog::CONSOLE));
+	}
+	usleep(50000);
+	ASSERT_EQ(0u, captured(c)); // waits for the flush interval
+
+	line = "error\n";
+	ASSERT_TRUE(log.write(line, 0, true)); // urgent, wakes the writer
+	for (int i = 0; i < 100 && captured(c) < 101; i++)
+		usleep(10000);
+	ASSERT_EQ(101u, captured(c));
+	ASSERT_EQ(1u, c.batches);
+	ASSERT_EQ("line 0\n", c.lines[0]);
+	ASSERT_EQ("error\n", c.lines[100]);
+
+	// the buffers are recycled:
+	line = "x";
+	log.write(line, 0);
+	ASSERT_GT(line.capacity(), 0u);
+	ASSERT_TRUE(line.empty());
+
+	log.stop(); // writes the rest
+	ASSERT_EQ(102u, captured(c));
+}
+
+TEST(AsyncLog, full) {
+	Capture c;
+	AsyncLog log(capture, &c, 10000, 16); // not started, nothing is written
+	std::string line;
+	for (int i = 0; i < 16; i++) {
+		line = "x\n";
+		ASSERT_TRUE(log.write(line, 0));
+	}
+	line = "x\n";
+	ASSERT_FALSE(log.write(line, 0));
+
+	log.start();
+	log.stop();
+	ASSERT_EQ(16u, captured(c));
+}
+
+TEST(AsyncLog, producers) {
+	Capture c;
+	const int threads = 4, n = 1000;
+	{
+		AsyncLog log(capture, &c, 1, 1024);
+		log.start();
+		std::vector<std::thread> producers;
+		for (int t = 0; t < threads; t++)
+			producers.push_back(std::thread([&log, t]() {
+				std::string line;
+				for (int i = 0; i < n; i++) {
+					line = std::to_string(t) + ":" + std::to_string(i) + "\n";
+					while (!log.write(line, 0))
+						usleep(100); // the queue is small, wait for the writer
+				}
+			}));
+		for (auto &p : producers)
+			p.join();
+	}
+	ASSERT_EQ((size_t)threads * n, c.lines.size());
+
+	// each thread's lines stay in order:
+	std::vector<int> next(threads, 0);
+	for (auto &l : c.lines) {
+		int t = std::stoi(l);
+		ASSERT_EQ(next[t], std::stoi(l.substr(l.find(':') + 1)));
+		next[t]++;
+	}
+}
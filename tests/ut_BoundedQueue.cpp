@@ -0,0 +1,68 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+
+TEST(BoundedQueue, fifo) {
+	BoundedQueue<int> q(3);
+	ASSERT_EQ(4u, q.capacity()); // rounded up to a power of 2
+
+	int v = -1;
+	ASSERT_FALSE(q.pop(v));
+	for (int round = 0; round < 3; round++) { // wraps around
+		for (int i = 0; i < 4; i++)
+			ASSERT_TRUE(q.push(int(i)));
+		ASSERT_FALSE(q.push(4)); // full
+		for (int i = 0; i < 4; i++) {
+			ASSERT_TRUE(q.pop(v));
+			ASSERT_EQ(i, v);
+		}
+		ASSERT_FALSE(q.pop(v));
+	}
+}
+
+TEST(BoundedQueue, releases_popped) {
+	BoundedQueue<std::shared_ptr<int>> q(2);
+	std::shared_ptr<int> p(new int(42));
+	ASSERT_TRUE(q.push(std::shared_ptr<int>(p)));
+	ASSERT_EQ(2, p.use_count());
+	std::shared_ptr<int> out;
+	ASSERT_TRUE(q.pop(out));
+	ASSERT_EQ(42, *out);
+	out.reset();
+	ASSERT_EQ(1, p.use_count()); // the queue doesn't keep a reference
+}
+
+TEST(BoundedQueue, producers) {
+	const int producers = 4;
+	const int per_producer = 100000;
+	BoundedQueue<int> q(64);
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++)
+		threads.emplace_back([&q, p] {
+			for (int i = 0; i < per_producer; i++)
+				while (!q.push(p * per_producer + i))
+					std::this_thread::yield();
+		});
+
+	// each producer's values have to arrive complete and in order:
+	std::vector<int> next(producers, 0);
+	int v;
+	for (int n = 0; n < producers * per_producer;) {
+		if (!q.pop(v)) {
+			std::this_thread::yield();
+			continue;
+		}
+		int p = v / per_producer;
+		ASSERT_EQ(next[p], v % per_producer);
+		next[p]++;
+		n++;
+	}
+	for (auto &t : threads)
+		t.join();
+	ASSERT_FALSE(q.pop(v));
+}
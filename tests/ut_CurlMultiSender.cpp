@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+
+#include "CurlMultiSender.hpp"
+
+static bool wait_done(CurlRequest::Ptr req, int ms) {
+	for (int i = 0; i < ms / 10 && !req->done(); ++i)
+		usleep(10000);
+	return req->done();
+}
+
+TEST(CurlMultiSender, start_stop) {
+	ASSERT_EQ(0, curlMultiSender);
+	CurlMultiSender s(2);
+	s.start();
+	s.start(); // 2nd start is ignored
+	s.stop();
+	s.stop();
+	ASSERT_EQ(0u, s.pending());
+}
+
+TEST(CurlMultiSender, connect_failed) {
+	CurlMultiSender s;
+	s.start();
+
+	// nobody listens on port 1, the request completes with an error but without blocking:
+	CurlRequest::Ptr req(new CurlRequest("http://127.0.0.1:1/data.json", "[]", NULL, 5));
+	s.submit(req);
+	ASSERT_TRUE(wait_done(req, 5000));
+	ASSERT_EQ(CURLE_COULDNT_CONNECT, req->curlCode());
+	ASSERT_EQ(0, req->httpCode());
+	ASSERT_EQ(0u, s.pending());
+
+	// the handle gets reused:
+	CurlRequest::Ptr req2(new CurlRequest("http://127.0.0.1:1/data.json", "[]", NULL, 5));
+	s.submit(req2);
+	ASSERT_TRUE(wait_done(req2, 5000));
+	ASSERT_EQ(CURLE_COULDNT_CONNECT, req2->curlCode());
+	s.stop();
+}
+
+TEST(CurlMultiSender, stop_aborts_queued) {
+	CurlMultiSender s;
+	// not started, so the request stays queued
+	CurlRequest::Ptr req(new CurlRequest("http://127.0.0.1:1/data.json", "[]", NULL, 5));
+	s.submit(req);
+	ASSERT_EQ(1u, s.pending());
+	ASSERT_FALSE(req->done());
+	s.start();
+	s.stop();
+	ASSERT_TRUE(req->done());
+	ASSERT_EQ(0u, s.pending());
+}
+
+static void count_timer(void *arg) { (*static_cast<int *>(arg))++; }
+
+TEST(CurlMultiSender, every) {
+	CurlMultiSender s;
+	int count = 0;
+	s.every(10, count_timer, &count);
+	s.start();
+	usleep(200000);
+	s.stop();
+	ASSERT_GE(count, 5);
+	ASSERT_LE(count, 25);
+}
+
+TEST(CurlMultiSender, after) {
+	CurlMultiSender s;
+	int count = 0;
+	int removed = 0;
+	s.after(10, count_timer, &count);
+	s.after(20, count_timer, &count); // replaces the first one
+	s.after(10, count_timer, &removed);
+	s.remove_timers(&removed);
+	s.start();
+	usleep(200000);
+	s.stop();
+	ASSERT_EQ(1, count);
+	ASSERT_EQ(0, removed);
+}
+
+struct DoneArg {
+	CurlMultiSender *sender;
+	CurlRequest::Ptr req;
+	std::atomic<int> calls;
+};
+
+static void resubmit_once(void *arg) {
+	DoneArg *d = static_cast<DoneArg *>(arg);
+	ASSERT_TRUE(d->req->done());
+	if (d->calls++ == 0) {
+		// submitting from the callback doesn't block the event loop
+		d->req = CurlRequest::Ptr(new CurlRequest("http://127.0.0.1:1/data.json", "[]", NULL, 5));
+		d->req->on_done(resubmit_once, d);
+		d->sender->submit(d->req);
+	}
+}
+
+TEST(CurlMultiSender, on_done) {
+	CurlMultiSender s;
+	DoneArg d;
+	d.sender = &s;
+	d.req = CurlRequest::Ptr(new CurlRequest("http://127.0.0.1:1/data.json", "[]", NULL, 5));
+	d.calls = 0;
+	d.req->on_done(resubmit_once, &d);
+	s.submit(d.req);
+	s.start();
+	for (int i = 0; i < 500 && d.calls < 2; ++i)
+		usleep(10000);
+	ASSERT_EQ(2, d.calls);
+
+	// no callback anymore after cancel_on_done():
+	CurlRequest::Ptr req(new CurlRequest("http://127.0.0.1:1/data.json", "[]", NULL, 5));
+	req->on_done(resubmit_once, &d);
+	req->cancel_on_done();
+	s.submit(req);
+	ASSERT_TRUE(wait_done(req, 5000));
+	s.stop();
+	ASSERT_EQ(2, d.calls);
+	ASSERT_EQ(CURLE_COULDNT_CONNECT, d.req->curlCode());
+}
+
+TEST(RetryBackoff, doubles_up_to_max) {
+	RetryBackoff b;
+	ASSERT_FALSE(b.waiting());
+	ASSERT_EQ(0, b.remaining_ms());
+	ASSERT_EQ(15, b.failed(15));
+	ASSERT_TRUE(b.waiting());
+	ASSERT_GT(b.remaining_ms(), 14000);
+	ASSERT_EQ(30, b.failed(15));
+	ASSERT_EQ(60, b.failed(15));
+	ASSERT_EQ(120, b.failed(15));
+	ASSERT_EQ(240, b.failed(15));
+	ASSERT_EQ(240, b.failed(15));
+	ASSERT_EQ(240, b.pause());
+
+	b.reset();
+	ASSERT_FALSE(b.waiting());
+	ASSERT_EQ(15, b.failed(15));
+
+	// no pause configured:
+	RetryBackoff b0;
+	ASSERT_EQ(0, b0.failed(0));
+	ASSERT_EQ(0, b0.failed(0));
+	ASSERT_FALSE(b0.waiting());
+}
@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+
+#include "api/JsonWriter.hpp"
+
+TEST(JsonWriter, empty) {
+	JsonWriter w;
+	ASSERT_TRUE(w.empty());
+	ASSERT_STREQ("", w.c_str());
+	w.begin_array().end_array();
+	ASSERT_STREQ("[]", w.c_str());
+	w.clear();
+	w.begin_object().end_object();
+	ASSERT_STREQ("{}", w.c_str());
+}
+
+TEST(JsonWriter, nested) {
+	JsonWriter w;
+	w.begin_object();
+	w.key("version").value("0.8");
+	w.key("data").begin_array();
+	w.begin_object().key("uuid").value("a").key("tuples").begin_array();
+	w.tuple((int64_t)1, 1.5).tuple((int64_t)2, (int64_t)-3);
+	w.end_array().end_object();
+	w.begin_object().key("uuid").value("b").end_object();
+	w.end_array();
+	w.key("ok").value(true);
+	w.key("code").value(0);
+	w.key("none").null();
+	w.end_object();
+	ASSERT_EQ("{\"version\":\"0.8\",\"data\":[{\"uuid\":\"a\",\"tuples\":[[1,1.5],[2,-3]]},"
+			  "{\"uuid\":\"b\"}],\"ok\":true,\"code\":0,\"none\":null}",
+			  std::string(w.c_str(), w.size()));
+}
+
+TEST(JsonWriter, escape) {
+	JsonWriter w;
+	w.value("a\"b\\c\nd\x01");
+	ASSERT_STREQ("\"a\\\"b\\\\c\\nd\\u0001\"", w.c_str());
+}
+
+TEST(JsonWriter, numbers) {
+	char buf[32];
+	buf[JsonWriter::format_int(buf, 0)] = 0;
+	ASSERT_STREQ("0", buf);
+	buf[JsonWriter::format_int(buf, INT64_MIN)] = 0;
+	ASSERT_STREQ("-9223372036854775808", buf);
+	buf[JsonWriter::format_int(buf, 1700000000123LL)] = 0;
+	ASSERT_STREQ("1700000000123", buf);
+
+	buf[JsonWriter::format_double(buf, 0.1)] = 0;
+	ASSERT_STREQ("0.1", buf);
+	buf[JsonWriter::format_double(buf, NAN)] = 0;
+	ASSERT_STREQ("null", buf);
+
+	// few decimals, written the same with every toolchain:
+	const char *decimals[] = {"230.5", "-0.001", "1234567.125", "0", "-0", "100000", "0.3"};
+	for (size_t i = 0; i < sizeof(decimals) / sizeof(decimals[0]); i++) {
+		buf[JsonWriter::format_double(buf, strtod(decimals[i], NULL))] = 0;
+		ASSERT_STREQ(decimals[i], buf);
+	}
+
+	// shortest form, but reads back exactly:
+	double values[] = {1.0 / 3, 1e-300, -2.5e300, 230.123456789, 4.9e-324, 123456789012345678.0,
+					   0.1 + 0.2, 9007199254740993.0, 1e15 + 0.3};
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		size_t len = JsonWriter::format_double(buf, values[i]);
+		ASSERT_LE(len, 24u);
+		buf[len] = 0;
+		ASSERT_EQ(values[i], strtod(buf, NULL)) << buf;
+	}
+}
+
+TEST(JsonWriter, grow_and_reuse) {
+	JsonWriter w(16);
+	w.begin_array();
+	for (int i = 0; i < 1000; i++)
+		w.tuple((int64_t)i, i * 0.5);
+	w.end_array();
+	ASSERT_GE(w.capacity(), w.size() + 1);
+	ASSERT_EQ("[[0,0],[1,0.5],", std::string(w.c_str(), 15));
+	ASSERT_EQ(",[999,499.5]]", std::string(w.c_str() + w.size() - 13));
+
+	size_t capacity = w.capacity();
+	w.clear();
+	w.begin_array().tuple((int64_t)1, 2.0).end_array();
+	ASSERT_STREQ("[[1,2]]", w.c_str());
+	ASSERT_EQ(capacity, w.capacity());
+}
+
+TEST(JsonWriter, rollback) {
+	JsonWriter w;
+	w.begin_array();
+	JsonWriter::Mark m = w.mark();
+	w.begin_object().key("uuid").value("x");
+	w.rollback(m);
+	w.tuple((int64_t)1, 1.0);
+	m = w.mark();
+	w.tuple((int64_t)2, 2.0);
+	w.rollback(m);
+	w.tuple((int64_t)3, 3.0);
+	w.end_array();
+	ASSERT_STREQ("[[1,1],[3,3]]", w.c_str());
+}
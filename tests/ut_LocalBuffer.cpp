@@ -0,0 +1,141 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "LocalBuffer.hpp"
+
+namespace {
+
+std::vector<int64_t> times(const LocalBuffer &b, int64_t from = INT64_MIN, int64_t to = INT64_MAX) {
+	std::vector<int64_t> r;
+	b.for_each(from, to, [&r](int64_t t, double) { r.push_back(t); });
+	return r;
+}
+
+// n tuples, 1s apart, value == index
+void fill(LocalBuffer &b, int n) {
+	for (int i = 0; i < n; i++)
+		b.push(1000LL * i, i);
+}
+
+} // namespace
+
+TEST(LocalBuffer, range) {
+	LocalBuffer b;
+	ASSERT_EQ(0u, b.range(INT64_MIN, INT64_MAX));
+	ASSERT_EQ(0u, times(b).size());
+
+	const int n = 3 * LocalBuffer::CHUNK + 10;
+	fill(b, n);
+	ASSERT_EQ((size_t)n, b.size());
+	ASSERT_EQ(0, b.front_time());
+	ASSERT_EQ(1000LL * (n - 1), b.back_time());
+
+	int64_t first, last;
+	ASSERT_EQ((size_t)n, b.range(INT64_MIN, INT64_MAX, &first, &last));
+	ASSERT_EQ(0, first);
+	ASSERT_EQ(1000LL * (n - 1), last);
+
+	// across chunk borders, bounds included:
+	ASSERT_EQ(2001u, b.range(500000, 2500000, &first, &last));
+	ASSERT_EQ(500000, first);
+	ASSERT_EQ(2500000, last);
+	std::vector<int64_t> t = times(b, 500000, 2500000);
+	ASSERT_EQ(2001u, t.size());
+	ASSERT_EQ(500000, t.front());
+	ASSERT_EQ(2500000, t.back());
+
+	// ends at the last tuple of a chunk:
+	int64_t end = 1000LL * (LocalBuffer::CHUNK - 1);
+	ASSERT_EQ(2u, b.range(end - 1500, end + 500, &first, &last));
+	ASSERT_EQ(end - 1000, first);
+	ASSERT_EQ(end, last);
+
+	ASSERT_EQ(0u, b.range(1500, 1999)); // between tuples
+	ASSERT_EQ(0u, b.range(1000LL * n, INT64_MAX));
+	ASSERT_EQ(0u, b.range(5000, 4000));
+}
+
+TEST(LocalBuffer, erase) {
+	LocalBuffer b;
+	const int n = 2 * LocalBuffer::CHUNK + 10;
+	fill(b, n);
+
+	b.erase_before(1500);
+	ASSERT_EQ((size_t)n - 2, b.size());
+	ASSERT_EQ(2000, b.front_time());
+	ASSERT_EQ((size_t)n - 2, b.range(INT64_MIN, INT64_MAX));
+
+	b.erase_before(1000LL * (LocalBuffer::CHUNK + 5)); // frees the first chunk
+	ASSERT_EQ((size_t)n - LocalBuffer::CHUNK - 5, b.size());
+	ASSERT_EQ(1000LL * (LocalBuffer::CHUNK + 5), b.front_time());
+	ASSERT_EQ(b.size(), times(b).size());
+
+	b.keep_last(LocalBuffer::CHUNK + 1);
+	ASSERT_EQ(LocalBuffer::CHUNK + 1, b.size());
+	ASSERT_EQ(1000LL * (n - LocalBuffer::CHUNK - 1), b.front_time());
+	ASSERT_EQ(b.size(), times(b).size());
+
+	b.keep_last(3);
+	ASSERT_EQ(3u, b.size());
+	ASSERT_EQ(1000LL * (n - 3), b.front_time());
+
+	b.erase_before(INT64_MAX);
+	ASSERT_TRUE(b.empty());
+	b.push(1, 1);
+	ASSERT_EQ(1u, b.range(INT64_MIN, INT64_MAX));
+}
+
+TEST(LocalBuffer, out_of_order) {
+	LocalBuffer b;
+	fill(b, 10);
+	b.erase_before(3000);
+	b.push(4500, 0);
+	b.push(2000, 0); // before the first one
+	b.push(9000, 0); // same time as the last one
+	std::vector<int64_t> expected = {2000, 3000, 4000, 4500, 5000, 6000, 7000, 8000, 9000, 9000};
+	ASSERT_EQ(expected, times(b));
+	ASSERT_EQ(expected.size(), b.size());
+}
+
+TEST(LocalBuffer, groups) {
+	LocalBuffer b;
+	fill(b, 100); // values 0..99 at 0s..99s
+
+	std::vector<LocalBuffer::Group> g;
+	auto collect = [&g](const LocalBuffer::Group &x) { g.push_back(x); };
+
+	b.for_each_group(INT64_MIN, INT64_MAX, 10000, 0, collect);
+	ASSERT_EQ(10u, g.size());
+	for (size_t i = 0; i < g.size(); i++) {
+		EXPECT_EQ(10000LL * i, g[i].time_ms);
+		EXPECT_EQ(10u, g[i].count);
+		EXPECT_EQ(10.0 * i, g[i].min);
+		EXPECT_EQ(10.0 * i + 9, g[i].max);
+		EXPECT_DOUBLE_EQ(10.0 * i + 4.5, g[i].avg);
+	}
+
+	// range and origin not aligned to the groups:
+	g.clear();
+	b.for_each_group(15000, 44000, 20000, 5000, collect);
+	ASSERT_EQ(2u, g.size());
+	EXPECT_EQ(5000, g[0].time_ms); // 15..24
+	EXPECT_EQ(10u, g[0].count);
+	EXPECT_EQ(15.0, g[0].min);
+	EXPECT_EQ(24.0, g[0].max);
+	EXPECT_EQ(25000, g[1].time_ms); // 25..44
+	EXPECT_EQ(20u, g[1].count);
+	EXPECT_DOUBLE_EQ(34.5, g[1].avg);
+
+	// decreasing values:
+	LocalBuffer d;
+	d.push(0, 3);
+	d.push(1, 2);
+	d.push(2, 1);
+	g.clear();
+	d.for_each_group(INT64_MIN, INT64_MAX, 1000, 0, collect);
+	ASSERT_EQ(1u, g.size());
+	EXPECT_EQ(1.0, g[0].min);
+	EXPECT_EQ(3.0, g[0].max);
+	EXPECT_EQ(2.0, g[0].avg);
+}
@@ -0,0 +1,174 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "LocalStore.hpp"
+
+namespace {
+
+std::string tmpdir() {
+	char tmpl[] = "/tmp/vzstoreXXXXXX";
+	char *d = mkdtemp(tmpl);
+	EXPECT_TRUE(d != NULL);
+	return std::string(d) + "/store";
+}
+
+void cleanup(const std::string &dir) {
+	std::string cmd = "rm -rf " + dir.substr(0, dir.rfind('/'));
+	EXPECT_EQ(0, system(cmd.c_str()));
+}
+
+std::vector<std::string> segments(const std::string &dir) {
+	std::vector<std::string> r;
+	DIR *d = opendir(dir.c_str());
+	struct dirent *de;
+	while (d && (de = readdir(d)))
+		if (strstr(de->d_name, ".tsdb"))
+			r.push_back(dir + "/" + de->d_name);
+	if (d)
+		closedir(d);
+	std::sort(r.begin(), r.end());
+	return r;
+}
+
+struct Tuples {
+	std::vector<int64_t> t;
+	std::vector<double> v;
+};
+
+Tuples all(const LocalStore &s, int64_t from = INT64_MIN, int64_t to = INT64_MAX) {
+	Tuples r;
+	s.for_each(from, to, [&r](int64_t t, double v) {
+		r.t.push_back(t);
+		r.v.push_back(v);
+	});
+	return r;
+}
+
+// a meter counter in Wh read every second, with some jitter
+double value(int i) { return 1234567 + i / 4; }
+
+void fill(LocalStore &s, int64_t start, int n) {
+	for (int i = 0; i < n; i++)
+		s.push(start + 1000LL * i + (i * 7) % 13, value(i));
+}
+
+} // namespace
+
+TEST(LocalStore, encode_decode) {
+	std::vector<int64_t> t;
+	std::vector<double> v;
+	srand(1);
+	int64_t time = 1700000000000LL;
+	for (int i = 0; i < 1000; i++) {
+		time += i % 100 == 0 ? 86400000LL * 365 : i % 10 == 0 ? 0 : 1000 + rand() % 100 - 50;
+		t.push_back(time);
+		double d = i % 3 == 0 ? 230.5 : (double)rand() / RAND_MAX * 1e6 - 5e5;
+		if (i == 500)
+			d = NAN;
+		if (i == 501)
+			d = -INFINITY;
+		v.push_back(d);
+	}
+
+	std::vector<uint8_t> buf;
+	LocalStore::encode(&t[0], &v[0], t.size(), buf);
+	std::vector<int64_t> t2;
+	std::vector<double> v2;
+	ASSERT_TRUE(LocalStore::decode(buf.data(), buf.size(), t[0], t.size(), t2, v2));
+	ASSERT_EQ(t, t2);
+	ASSERT_EQ(0, memcmp(&v[0], &v2[0], v.size() * sizeof(double))); // bit exact, incl. nan
+
+	// truncated data is detected:
+	ASSERT_FALSE(LocalStore::decode(buf.data(), buf.size() / 2, t[0], t.size(), t2, v2));
+}
+
+TEST(LocalStore, persist) {
+	std::string dir = tmpdir();
+	const int n = 3 * LocalStore::CHUNK + 100;
+	const int64_t start = 1700000000000LL;
+	{
+		LocalStore s(dir, 86400000LL * 30);
+		fill(s, start, n);
+		ASSERT_EQ((size_t)n, s.size());
+		ASSERT_FALSE(s.push(start, 0)); // append only
+		ASSERT_EQ((size_t)n, all(s).t.size());
+		// a few bytes per tuple:
+		ASSERT_LT(s.bytes(), (size_t)n * 4);
+	}
+	{
+		LocalStore s(dir, 86400000LL * 30);
+		ASSERT_EQ((size_t)n, s.size());
+		Tuples r = all(s);
+		ASSERT_EQ((size_t)n, r.t.size());
+		for (int i = 0; i < n; i++) {
+			ASSERT_EQ(start + 1000LL * i + (i * 7) % 13, r.t[i]);
+			ASSERT_EQ(value(i), r.v[i]);
+		}
+
+		int64_t first, last;
+		int64_t from = start + 1000LL * 1500, to = start + 1000LL * 2500 + 500;
+		ASSERT_EQ(1001u, s.range(from, to, &first, &last));
+		ASSERT_EQ(start + 1000LL * 1500 + (1500 * 7) % 13, first);
+		ASSERT_EQ(start + 1000LL * 2500 + (2500 * 7) % 13, last);
+		ASSERT_EQ(1001u, all(s, from, to).t.size());
+		ASSERT_EQ((size_t)n, s.range(INT64_MIN, INT64_MAX));
+
+		// appending continues after the restart:
+		s.push(start + 1000LL * n, 1);
+		ASSERT_EQ((size_t)n + 1, all(s).t.size());
+	}
+	cleanup(dir);
+}
+
+TEST(LocalStore, torn_write) {
+	std::string dir = tmpdir();
+	const int n = 2 * LocalStore::CHUNK;
+	{
+		LocalStore s(dir, 86400000LL);
+		fill(s, 1700000000000LL, n);
+	}
+	std::vector<std::string> segs = segments(dir);
+	ASSERT_EQ(1u, segs.size());
+	int fd = open(segs[0].c_str(), O_WRONLY | O_APPEND);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(20, write(fd, "VZTS a partial chunk", 20));
+	close(fd);
+	{
+		LocalStore s(dir, 86400000LL);
+		ASSERT_EQ((size_t)n, s.size());
+		ASSERT_EQ((size_t)n, all(s).t.size());
+		s.push(1800000000000LL, 1);
+	}
+	{
+		LocalStore s(dir, 86400000LL);
+		ASSERT_EQ((size_t)n + 1, all(s).t.size());
+	}
+	cleanup(dir);
+}
+
+TEST(LocalStore, retention) {
+	std::string dir = tmpdir();
+	const int64_t hour = 3600000;
+	{
+		LocalStore s(dir, 4 * hour); // segments of one hour
+		for (int64_t t = 0; t < 10 * hour; t += 60000)
+			s.push(t, 1);
+		ASSERT_EQ(9u, segments(dir).size()); // the last hour is still open
+		ASSERT_EQ(600u, s.size());
+
+		s.expire(10 * hour);
+		ASSERT_EQ(3u, segments(dir).size()); // 6h..9h, and the open chunk
+		ASSERT_EQ(6 * hour, s.front_time());
+		ASSERT_EQ(240u, s.size());
+		ASSERT_EQ(240u, all(s).t.size());
+	}
+	cleanup(dir);
+}
@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+#include "Metrics.hpp"
+
+TEST(Metrics, counter) {
+	Metrics m;
+	Metrics::Counter *c = m.counter("test_total", "a counter", Metrics::label("api", "a\"b"));
+	ASSERT_EQ(c, m.counter("test_total", "a counter", Metrics::label("api", "a\"b")));
+	ASSERT_NE(c, m.counter("test_total", "a counter", Metrics::label("api", "c")));
+	c->inc();
+	c->inc(2);
+
+	std::string out;
+	m.write(out);
+	ASSERT_EQ("# HELP test_total a counter\n"
+			  "# TYPE test_total counter\n"
+			  "test_total{api=\"a\\\"b\"} 3\n"
+			  "test_total{api=\"c\"} 0\n",
+			  out);
+}
+
+TEST(Metrics, histogram) {
+	Metrics m;
+	Metrics::Histogram *h = m.durations("test_seconds", "durations");
+	h->observe(50);       // <= 100us
+	h->observe(100);      // <= 100us
+	h->observe(3000);     // <= 5ms
+	h->observe(2000000);  // <= 2.5s
+	h->observe(20000000); // +Inf
+	ASSERT_EQ(5u, h->count());
+
+	std::string out;
+	m.write(out);
+	ASSERT_NE(std::string::npos, out.find("# TYPE test_seconds histogram\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_bucket{le=\"0.0001\"} 2\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_bucket{le=\"0.0025\"} 2\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_bucket{le=\"0.005\"} 3\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_bucket{le=\"2.5\"} 4\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_bucket{le=\"10\"} 4\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_bucket{le=\"+Inf\"} 5\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_sum 22.00315\n"));
+	ASSERT_NE(std::string::npos, out.find("test_seconds_count 5\n"));
+}
+
+TEST(Metrics, threads) {
+	Metrics m;
+	const int n = 100000;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+		threads.push_back(std::thread([&m]() {
+			// registering from several threads returns the same metrics:
+			Metrics::Counter *c = m.counter("test_total", "a counter");
+			Metrics::Histogram *h = m.sizes("test_depth", "sizes", Metrics::label("uuid", "x"));
+			for (int i = 0; i < n; i++) {
+				c->inc();
+				h->observe(i % 100);
+			}
+		}));
+	for (auto &t : threads)
+		t.join();
+	ASSERT_EQ(4u * n, m.counter("test_total", "a counter")->value());
+	ASSERT_EQ(4u * n, m.sizes("test_depth", "sizes", Metrics::label("uuid", "x"))->count());
+}
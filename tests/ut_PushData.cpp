@@ -1,5 +1,10 @@
 #include "PushData.hpp"
 #include "gtest/gtest.h"
+#include <arpa/inet.h>
+#include <map>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
 
 // dirty hack until we find a better solution:
 #include "../src/PushData.cpp"
@@ -64,13 +69,81 @@ TEST(PushData, PDL_basic_waitForData4) {
 	delete dm;
 }
 
+TEST(PushData, PDL_slots) {
+	PushDataList pdl;
+	ASSERT_EQ(0u, pdl.slot("a"));
+	ASSERT_EQ(1u, pdl.slot("b"));
+	ASSERT_EQ(0u, pdl.slot("a"));
+	pdl.add(1, 1, 1.0);
+	pdl.add(0, 2, 2.0);
+	pdl.add(1, 3, 3.0);
+	PushDataList::DataMap *dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	ASSERT_EQ(2ul, dm->size());
+	ASSERT_EQ(2ul, dm->operator[]("b").size());
+	ASSERT_EQ(3, dm->operator[]("b").back().first);
+	delete dm;
+}
+
+TEST(PushData, PDL_full) {
+	PushDataList pdl(4);
+	unsigned s = pdl.slot("0");
+	for (int i = 0; i < 4; i++)
+		ASSERT_TRUE(pdl.add(s, i, i));
+	ASSERT_FALSE(pdl.add(s, 4, 4)); // dropped, never blocks
+	PushDataList::DataMap *dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	ASSERT_EQ(4ul, dm->operator[]("0").size());
+	delete dm;
+	ASSERT_TRUE(pdl.add(s, 5, 5));
+	dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	ASSERT_EQ(5, dm->operator[]("0").front().first);
+	delete dm;
+}
+
+TEST(PushData, PDL_producers) {
+	PushDataList pdl(1024, 1);
+	const int n = 10000;
+	std::vector<std::thread> producers;
+	for (int p = 0; p < 4; p++)
+		producers.push_back(std::thread([&pdl, p]() {
+			unsigned s = pdl.slot(std::to_string(p));
+			for (int i = 0; i < n;)
+				if (pdl.add(s, i, p))
+					i++; // retry if the ring is full
+		}));
+
+	std::map<std::string, int64_t> next;
+	size_t received = 0;
+	while (received < 4 * n) {
+		PushDataList::DataMap *dm = pdl.waitForData();
+		ASSERT_TRUE(0 != dm);
+		for (auto &q : *dm) {
+			for (; !q.second.empty(); q.second.pop(), received++)
+				ASSERT_EQ(next[q.first]++, q.second.front().first); // in order per channel
+		}
+		delete dm;
+	}
+	for (auto &t : producers)
+		t.join();
+}
+
 // todo if we'd provide a timeout to waitForData we could test here the case with empty data
 
 class PushDataServerTest {
   public:
 	PushDataServerTest(PushDataServer &pds) : _pds(pds){};
 	std::string generateJson(PushDataList::DataMap &dataMap) { return _pds.generateJson(dataMap); }
-	size_t size() { return _pds._middlewareList.size(); };
+	size_t size() { return _pds._targets.size(); };
+	PushDataServer::Target &target(size_t i) { return _pds._targets[i]; }
+	// sends until middleware i is done with its request, false if one failed meanwhile
+	bool sendUntilIdle(size_t i) {
+		bool ok = _pds.waitAndSendOnceToAll();
+		for (int n = 0; n < 50 && _pds._targets[i].busy; n++)
+			ok = _pds.waitAndSendOnceToAll() && ok;
+		return ok;
+	}
 	PushDataServer &_pds;
 };
 
@@ -85,14 +158,11 @@ TEST(PushData, PDS_constructor) {
 	PushDataList::DataMap *dm = pdl.waitForData();
 	ASSERT_TRUE(0 != dm);
 	std::string str = pt.generateJson(*dm);
-	// todo fix the comparision! 1.10000 vs. 1.10000001, ... ASSERT_EQ("{ \"data\": [ { \"uuid\":
-	// \"0\", \"tuples\": [ [ 1, 1.100000 ] ] } ] }", str);
+	ASSERT_EQ("{\"data\":[{\"uuid\":\"0\",\"tuples\":[[1,1.1]]}]}", str);
+	delete dm;
 }
 
 TEST(PushData, PDS_fail_middleware) {
-	ASSERT_EQ(0, curlSessionProvider);
-	curlSessionProvider = new CurlSessionProvider();
-
 	struct json_object *jso =
 		json_tokener_parse("[{\"url\": \"http://127.0.0.1:45431/unit_test/push.json\"}]");
 	PushDataServer pds(jso);
@@ -102,10 +172,66 @@ TEST(PushData, PDS_fail_middleware) {
 	PushDataList pdl;
 	pdl.add("0", 1, 1.1);
 	pushDataList = &pdl;
-	ASSERT_FALSE(pds.waitAndSendOnceToAll()); // we assume that localhost:45431/unit_test/push.json
-											  // can't be connected to
+	ASSERT_FALSE(pt.sendUntilIdle(0)); // we assume that localhost:45431/unit_test/push.json
+									   // can't be connected to
 	pushDataList = 0;
+	ASSERT_EQ(1ul, pt.target(0).failed);
+	ASSERT_EQ(1ul, pt.target(0).queue.size()); // kept for the retry
+}
 
-	delete curlSessionProvider;
-	curlSessionProvider = 0;
+TEST(PushData, PDS_circuit_breaker) {
+	struct json_object *jso = json_tokener_parse(
+		"[{\"url\": \"http://127.0.0.1:45431/unit_test/push.json\", \"timeout\": 2}]");
+	PushDataServer pds(jso);
+	json_object_put(jso);
+	PushDataServerTest pt(pds);
+	ASSERT_EQ(2000, pt.target(0).timeout_ms);
+	PushDataList pdl;
+	pushDataList = &pdl;
+	for (int i = 0; i < PushDataServer::BREAKER_FAILURES + 2; i++) {
+		pdl.add("0", i, 1.1);
+		ASSERT_FALSE(pt.sendUntilIdle(0));
+	}
+	pushDataList = 0;
+	ASSERT_EQ((unsigned long)PushDataServer::BREAKER_FAILURES, pt.target(0).failed);
+	ASSERT_EQ(2ul, pt.target(0).skipped); // not tried while the breaker is open
+	ASSERT_EQ((size_t)PushDataServer::BREAKER_FAILURES + 2, pt.target(0).queue.size());
+}
+
+TEST(PushData, PDS_slow_middleware) {
+	// accepts connections but never answers
+	int srv = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_GE(srv, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(0, bind(srv, (struct sockaddr *)&addr, sizeof(addr)));
+	ASSERT_EQ(0, listen(srv, 4));
+	socklen_t len = sizeof(addr);
+	ASSERT_EQ(0, getsockname(srv, (struct sockaddr *)&addr, &len));
+
+	std::string conf = "[{\"url\": \"http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) +
+					   "/slow\", \"timeout\": 30}, "
+					   "{\"url\": \"http://127.0.0.1:45431/unit_test/push.json\"}]";
+	struct json_object *jso = json_tokener_parse(conf.c_str());
+	{
+		PushDataServer pds(jso);
+		PushDataServerTest pt(pds);
+		PushDataList pdl;
+		pushDataList = &pdl;
+
+		// the second middleware gets each data while the first one still waits for its answer
+		for (int i = 1; i <= 2; i++) {
+			pdl.add("0", i, 1.1);
+			ASSERT_FALSE(pt.sendUntilIdle(1));
+			EXPECT_EQ((unsigned long)i, pt.target(1).failed);
+			EXPECT_TRUE(pt.target(0).busy);
+		}
+		EXPECT_EQ(0ul, pt.target(0).failed);
+		EXPECT_EQ(2ul, pt.target(0).queue.size()); // the second one waits for the first
+		pushDataList = 0;
+	}
+	json_object_put(jso);
+	close(srv);
 }
@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <unistd.h>
+
+#include "Reactor.hpp"
+
+namespace {
+
+struct Counter {
+	std::atomic<int> calls;
+	std::atomic<int> bytes;
+	Counter() : calls(0), bytes(0) {}
+};
+
+void readable(int fd, void *arg) {
+	Counter *c = static_cast<Counter *>(arg);
+	char buf[16];
+	ssize_t n = read(fd, buf, sizeof(buf));
+	if (n > 0)
+		c->bytes += n;
+	c->calls++;
+}
+
+void tick(void *arg) { static_cast<Counter *>(arg)->calls++; }
+
+bool wait_for(std::atomic<int> &v, int expected) {
+	for (int i = 0; i < 200 && v < expected; i++)
+		usleep(10000);
+	return v >= expected;
+}
+
+} // namespace
+
+TEST(Reactor, readable) {
+	int p[2];
+	ASSERT_EQ(0, pipe(p));
+	Counter c;
+	Reactor r;
+	r.add(p[0], &readable, &c);
+	ASSERT_EQ(1u, r.size());
+	r.start();
+
+	ASSERT_EQ(3, write(p[1], "abc", 3));
+	ASSERT_TRUE(wait_for(c.bytes, 3));
+	ASSERT_EQ(4, write(p[1], "defg", 4));
+	ASSERT_TRUE(wait_for(c.bytes, 7));
+
+	r.remove(p[0]);
+	ASSERT_EQ(0u, r.size());
+	int calls = c.calls;
+	ASSERT_EQ(1, write(p[1], "h", 1));
+	usleep(50000);
+	ASSERT_EQ(calls, c.calls); // not called after remove()
+
+	r.stop();
+	close(p[0]);
+	close(p[1]);
+}
+
+TEST(Reactor, timer) {
+	Counter c;
+	Reactor r;
+	r.start();
+	r.every(10, &tick, &c);
+	ASSERT_TRUE(wait_for(c.calls, 3));
+	r.remove_timers(&c);
+	int calls = c.calls;
+	usleep(50000);
+	ASSERT_EQ(calls, c.calls);
+	r.stop();
+}
+
+TEST(Reactor, after) {
+	Counter c;
+	Reactor r;
+	r.start();
+	r.after(20, &tick, &c);
+	r.after(30, &tick, &c); // replaces the first one
+	ASSERT_TRUE(wait_for(c.calls, 1));
+	usleep(50000);
+	ASSERT_EQ(1, c.calls);
+
+	r.after(10, &tick, &c);
+	r.remove_timers(&c);
+	usleep(50000);
+	ASSERT_EQ(1, c.calls);
+	r.stop();
+}
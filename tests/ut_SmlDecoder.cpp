@@ -0,0 +1,125 @@
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <string>
+
+#include "protocols/SmlDecoder.hpp"
+
+namespace {
+
+// the EMH telegram from MeterSML.cpp, see there for the decoded structure
+const char *emh_hex = "1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+					  "01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+					  "77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+					  "010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+					  "0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+					  "010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+
+std::string unhex(const char *hex) {
+	std::string r;
+	for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+		unsigned int c;
+		sscanf(&hex[i], "%2x", &c);
+		r += (char)c;
+	}
+	return r;
+}
+
+// wraps one message into a transport frame with padding and a valid checksum
+std::string frame(const std::string &message) {
+	std::string f = unhex("1B1B1B1B01010101") + message;
+	char pad = 0;
+	while (f.size() % 4) {
+		f += '\0';
+		pad++;
+	}
+	f += unhex("1B1B1B1B1A");
+	f += pad;
+	uint16_t crc = SmlDecoder::crc16((const unsigned char *)f.data(), f.size());
+	f += (char)(crc & 0xff);
+	f += (char)(crc >> 8);
+	return f;
+}
+
+SmlDecoder::Result decode(SmlDecoder &d, const std::string &f) {
+	return d.decode((const unsigned char *)f.data(), f.size());
+}
+
+} // namespace
+
+TEST(SmlDecoder, crc16) {
+	// CRC-16/X-25 check value
+	ASSERT_EQ(0x906e, SmlDecoder::crc16((const unsigned char *)"123456789", 9));
+}
+
+TEST(SmlDecoder, emh) {
+	SmlDecoder d;
+	ASSERT_EQ(SmlDecoder::OK, decode(d, unhex(emh_hex)));
+	const std::vector<SmlDecoder::Entry> &e = d.entries();
+	ASSERT_EQ(6u, e.size());
+
+	EXPECT_TRUE(e[0].is_string); // 129-129:199.130.3*255, "EMH"
+	EXPECT_TRUE(e[1].is_string);
+
+	EXPECT_TRUE(Obis(1, 0, 1, 8, 1, 255) == e[2].obis);
+	EXPECT_FALSE(e[2].is_string);
+	EXPECT_EQ(147967771.0, e[2].value);
+	EXPECT_TRUE(e[2].has_scaler);
+	EXPECT_EQ(-1, e[2].scaler);
+	EXPECT_FALSE(e[2].has_time);
+
+	EXPECT_TRUE(Obis(1, 0, 1, 8, 2, 255) == e[3].obis);
+	EXPECT_EQ(20124.0, e[3].value);
+	EXPECT_TRUE(e[4].is_string);
+	EXPECT_TRUE(Obis(1, 0, 1, 7, 0, 255) == e[5].obis);
+	EXPECT_EQ(112.0, e[5].value);
+
+	// the entries are replaced by the next telegram
+	ASSERT_EQ(SmlDecoder::OK, decode(d, unhex(emh_hex)));
+	ASSERT_EQ(6u, d.entries().size());
+}
+
+TEST(SmlDecoder, bad_crc) {
+	SmlDecoder d;
+	std::string f = unhex(emh_hex);
+	f[100] ^= 0x01;
+	ASSERT_EQ(SmlDecoder::BAD_CRC, decode(d, f));
+	ASSERT_EQ(0u, d.entries().size());
+}
+
+TEST(SmlDecoder, unsupported) {
+	SmlDecoder d;
+	ASSERT_EQ(SmlDecoder::UNSUPPORTED, decode(d, "too short"));
+
+	// a list entry cut off in the middle:
+	std::string msg = unhex("760700000000000162006200726307017701010101017171070100010800FF");
+	ASSERT_EQ(SmlDecoder::UNSUPPORTED, decode(d, frame(msg)));
+	ASSERT_EQ(0u, d.entries().size());
+}
+
+TEST(SmlDecoder, values_and_time) {
+	// GetListResponse with a negative int24 value and a valTime timestamp, and a bool value
+	std::string msg = unhex("76070000000000016200620072630701"
+							"7701010101" // clientId .. actSensorTime
+							"72"
+							"77070100100700FF01"
+							"72620265000F4240" // valTime: timestamp 1000000
+							"621B52FE54FF8300"
+							"01"
+							"77070100600100FF0101620101" // no scaler
+							"420101"
+							"01016300000000");
+	SmlDecoder d;
+	ASSERT_EQ(SmlDecoder::OK, decode(d, frame(msg)));
+	const std::vector<SmlDecoder::Entry> &e = d.entries();
+	ASSERT_EQ(2u, e.size());
+	EXPECT_EQ(-32000.0, e[0].value);
+	EXPECT_EQ(-2, e[0].scaler);
+	EXPECT_TRUE(e[0].has_time);
+	EXPECT_EQ(1000000u, e[0].time);
+	EXPECT_EQ(1.0, e[1].value);
+	EXPECT_FALSE(e[1].has_scaler);
+
+	EXPECT_DOUBLE_EQ(0.01, SmlDecoder::power_of_ten(-2));
+	EXPECT_DOUBLE_EQ(1e127, SmlDecoder::power_of_ten(127));
+}
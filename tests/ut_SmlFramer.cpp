@@ -0,0 +1,67 @@
+#include "gtest/gtest.h"
+
+#include <string.h>
+#include <string>
+
+#include "protocols/SmlFramer.hpp"
+
+namespace {
+
+const unsigned char frame[] = {0x1b, 0x1b, 0x1b, 0x1b, 0x01, 0x01, 0x01, 0x01, 0x76, 0x05,
+							   0x01, 0x02, 0x03, 0x04, 0x62, 0x00, 0x1b, 0x1b, 0x1b, 0x1b,
+							   0x1a, 0x02, 0xab, 0xcd};
+
+std::string str(const unsigned char *d, size_t len) { return std::string((const char *)d, len); }
+
+} // namespace
+
+TEST(SmlFramer, complete_frame) {
+	SmlFramer f(1024);
+	ASSERT_EQ(sizeof(frame), f.feed(frame, sizeof(frame)));
+	ASSERT_TRUE(f.complete());
+	ASSERT_EQ(str(frame, sizeof(frame)), str(f.frame(), f.size()));
+	f.reset();
+	ASSERT_FALSE(f.complete());
+}
+
+TEST(SmlFramer, split_and_garbage) {
+	SmlFramer f(1024);
+	const unsigned char garbage[] = {0x00, 0x1b, 0x1b, 0x42, 0x1b};
+	ASSERT_EQ(sizeof(garbage), f.feed(garbage, sizeof(garbage)));
+	for (size_t i = 0; i < sizeof(frame) - 1; i++) {
+		ASSERT_EQ(1u, f.feed(frame + i, 1));
+		ASSERT_FALSE(f.complete());
+	}
+	ASSERT_EQ(1u, f.feed(frame + sizeof(frame) - 1, 1));
+	ASSERT_TRUE(f.complete());
+	ASSERT_EQ(str(frame, sizeof(frame)), str(f.frame(), f.size()));
+}
+
+TEST(SmlFramer, two_frames) {
+	std::string two = str(frame, sizeof(frame)) + str(frame, sizeof(frame));
+	const unsigned char *data = (const unsigned char *)two.data();
+	SmlFramer f(1024);
+	size_t used = f.feed(data, two.size());
+	ASSERT_EQ(sizeof(frame), used); // stops after the first one
+	ASSERT_TRUE(f.complete());
+	ASSERT_EQ(0u, f.feed(data + used, two.size() - used)); // until reset
+	f.reset();
+	ASSERT_EQ(sizeof(frame), f.feed(data + used, two.size() - used));
+	ASSERT_TRUE(f.complete());
+}
+
+TEST(SmlFramer, too_long) {
+	SmlFramer f(16);
+	ASSERT_EQ(sizeof(frame), f.feed(frame, sizeof(frame)));
+	ASSERT_FALSE(f.complete());
+
+	// unsupported escape sequence
+	unsigned char bad[sizeof(frame)];
+	memcpy(bad, frame, sizeof(frame));
+	bad[20] = 0x02;
+	SmlFramer g(1024);
+	g.feed(bad, sizeof(bad));
+	ASSERT_FALSE(g.complete());
+	g.feed(frame, sizeof(frame));
+	ASSERT_TRUE(g.complete());
+}
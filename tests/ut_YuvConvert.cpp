@@ -0,0 +1,104 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "protocols/YuvConvert.hpp"
+
+namespace {
+
+const int W = 64, H = 8;
+
+std::vector<uint8_t> random_frame(int w, int h) {
+	std::vector<uint8_t> f(2 * w * h);
+	srand(42);
+	for (auto &b : f)
+		b = rand() & 0xff;
+	return f;
+}
+
+// the float formula the converter replaced
+int reference(int y, int c1, int c2, double k1, double k2) {
+	double v = y + k1 * (c1 - 128.0) + k2 * (c2 - 128.0);
+	return v >= 255 ? 255 : (v <= 0 ? 0 : (int)v);
+}
+
+} // namespace
+
+TEST(YuvConvert, colors) {
+	// Y U Y V: white and black, two red pixels, two blue pixels
+	const uint8_t yuyv[] = {255, 128, 0, 128, 76, 85, 76, 255, 29, 255, 29, 107};
+	uint8_t rgba[24];
+	YUV422toRGBA888(yuyv, 6, rgba, 6, 0, 0, 6, 1);
+	const uint8_t white[] = {0, 255, 255, 255}, black[] = {0, 0, 0, 0};
+	EXPECT_EQ(0, memcmp(white, rgba, 4));
+	EXPECT_EQ(0, memcmp(black, rgba + 4, 4));
+	EXPECT_GT(rgba[8 + 3], 250); // R of red
+	EXPECT_LT(rgba[8 + 1], 10);
+	EXPECT_GT(rgba[16 + 1], 250); // B of blue
+	EXPECT_LT(rgba[16 + 3], 10);
+}
+
+TEST(YuvConvert, float_formula) {
+	std::vector<uint8_t> src = random_frame(W, H);
+	std::vector<uint8_t> dst(4 * W * H);
+	YUV422toRGBA888(src.data(), W, dst.data(), W, 0, 0, W, H);
+
+	for (int p = 0; p < W * H; p++) {
+		const uint8_t *s = &src[2 * (p & ~1)];
+		int y = src[2 * p], u = s[1], v = s[3];
+		EXPECT_EQ(0, dst[4 * p]);
+		EXPECT_NEAR(reference(y, u, 0, 1.772, 0), dst[4 * p + 1], 1) << p;
+		EXPECT_NEAR(reference(y, u, v, -0.344, -0.714), dst[4 * p + 2], 1) << p;
+		EXPECT_NEAR(reference(y, v, 0, 1.402, 0), dst[4 * p + 3], 1) << p;
+	}
+}
+
+TEST(YuvConvert, simd_equals_scalar) {
+	std::vector<uint8_t> src = random_frame(W, H);
+	// windows with SIMD blocks and a scalar rest, odd coordinates included
+	const int windows[][4] = {{0, 0, W, H}, {2, 1, 34, 5}, {3, 2, 17, 3}, {W - 6, 0, 6, H}};
+	for (auto &w : windows) {
+		std::vector<uint8_t> simd(4 * W * H, 0xaa), scalar(4 * W * H, 0xaa);
+		YUV422toRGBA888(src.data(), W, simd.data(), W, w[0], w[1], w[2], w[3]);
+		YUV422toRGBA888_scalar(src.data(), W, scalar.data(), W, w[0], w[1], w[2], w[3]);
+		EXPECT_EQ(scalar, simd) << w[0] << "," << w[1];
+	}
+}
+
+TEST(YuvConvert, window_only) {
+	std::vector<uint8_t> src = random_frame(W, H);
+	std::vector<uint8_t> dst(4 * W * H, 0xaa);
+	YUV422toRGBA888(src.data(), W, dst.data(), W, 3, 2, 17, 3); // widened to x 2..19
+
+	for (int y = 0; y < H; y++)
+		for (int x = 0; x < W; x++) {
+			bool inside = y >= 2 && y < 5 && x >= 2 && x < 20;
+			EXPECT_EQ(inside, dst[4 * (y * W + x)] == 0) << x << "," << y; // alpha 0 if written
+		}
+}
+
+TEST(YuvConvert, frame_edge) {
+	// the widened window ends at the last pixel pair of the frame
+	std::vector<uint8_t> src = random_frame(W, H);
+	std::vector<uint8_t> simd(4 * W * H, 0xaa), scalar(4 * W * H, 0xaa);
+	YUV422toRGBA888(src.data(), W, simd.data(), W, W - 7, H - 3, 7, 3);
+	YUV422toRGBA888_scalar(src.data(), W, scalar.data(), W, W - 7, H - 3, 7, 3);
+	EXPECT_EQ(scalar, simd);
+	for (int p = 0; p < W * H; p++) {
+		bool inside = p / W >= H - 3 && p % W >= W - 8;
+		EXPECT_EQ(inside, simd[4 * p] == 0) << p;
+	}
+
+	// an odd stride has no pair for its last pixel, nothing past the lines is read or written
+	const int w = W - 1;
+	std::vector<uint8_t> odd = random_frame(w, H);
+	std::vector<uint8_t> dst(4 * w * H + 16, 0xaa);
+	YUV422toRGBA888(odd.data(), w, dst.data(), w, w - 4, H - 2, 4, 2);
+	for (int p = 0; p < w * H + 4; p++) {
+		bool inside = p < w * H && p / w >= H - 2 && p % w >= w - 5 && p % w < w - 1;
+		EXPECT_EQ(inside, dst[4 * p] == 0) << p;
+	}
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <math.h>
+
+#include <Channel.hpp>
+#include <CurlMultiSender.hpp>
+#include <api/InfluxDB.hpp>
+
+#include "gtest/gtest.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace vz {
+namespace api {
+class InfluxDB_Test {
+  public:
+	// batch mode without the curlMultiSender thread, responses are faked
+	static void batch(InfluxDB &i) {
+		i._batch = InfluxDBBatch::get(i._url, i._headers, i._username, i._password,
+									  i._curl_timeout, i._ssl_verifypeer, false);
+		i._batch->add(&i);
+	}
+	static std::list<Reading> &values(InfluxDB &i) { return i._values; }
+	static size_t inflight(InfluxDB &i) { return i._inflight; }
+	static bool pending(InfluxDB &i) { return i._batch->_request != NULL; }
+	static void flush(InfluxDB &i) {
+		i._batch->_retry_after = 0;
+		i._batch->flush();
+	}
+	static void flush_in_pause(InfluxDB &i) { i._batch->flush(); }
+	static void response(InfluxDB &i, CURLcode curl_code, long http_code) {
+		i._batch->_request.reset();
+		i._batch->processResponse(curl_code, http_code, "");
+	}
+};
+} // namespace api
+} // namespace vz
+
+static Channel::Ptr channel(const std::list<Option> &options) {
+	ReadingIdentifier::Ptr pRid;
+	return Channel::Ptr(new Channel(options, std::string("influx_api"),
+									std::string("influx_uuid"), pRid));
+}
+
+TEST(api_InfluxDB, no_host) {
+	std::list<Option> options;
+	ASSERT_THROW(vz::api::InfluxDB i(channel(options), options), vz::VZException);
+}
+
+TEST(api_InfluxDB, append_line) {
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"http://127.0.0.1:1"));
+	options.push_back(Option("measurement_name", (char *)"power"));
+	options.push_back(Option("tags", (char *)"room=cellar"));
+	vz::api::InfluxDB i(channel(options), options);
+
+	std::string body;
+	ASSERT_TRUE(i.append_line(body, 1700000000123LL, 230.5));
+	ASSERT_TRUE(i.append_line(body, 1700000001123LL, -2.0));
+	EXPECT_EQ("power,uuid=influx_uuid,room=cellar value=230.5 1700000000123\n"
+			  "power,uuid=influx_uuid,room=cellar value=-2 1700000001123\n",
+			  body);
+
+	// not representable, nothing appended:
+	ASSERT_FALSE(i.append_line(body, 1700000002123LL, NAN));
+	ASSERT_FALSE(i.append_line(body, 1700000002123LL, INFINITY));
+	EXPECT_EQ(2, std::count(body.begin(), body.end(), '\n'));
+
+	options.push_back(Option("send_uuid", false));
+	vz::api::InfluxDB j(channel(options), options);
+	body.clear();
+	ASSERT_TRUE(j.append_line(body, 1, 0.1));
+	EXPECT_EQ("power,room=cellar value=0.1 1\n", body);
+}
+
+#ifdef HAVE_ZLIB
+TEST(api_InfluxDB, gzip) {
+	std::string body;
+	for (int n = 0; n < 1000; n++)
+		body.append("vzlogger,uuid=0123-4567 value=230.5 1700000000123\n");
+
+	std::string gz;
+	ASSERT_TRUE(vz::api::InfluxDB::gzip(body, gz));
+	ASSERT_LT(gz.size(), body.size() / 10);
+	ASSERT_EQ('\x1f', gz[0]); // gzip magic
+	ASSERT_EQ('\x8b', gz[1]);
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	ASSERT_EQ(Z_OK, inflateInit2(&zs, 15 + 16));
+	std::string out(body.size() + 16, '\0');
+	zs.next_in = (Bytef *)gz.data();
+	zs.avail_in = gz.size();
+	zs.next_out = (Bytef *)&out[0];
+	zs.avail_out = out.size();
+	EXPECT_EQ(Z_STREAM_END, inflate(&zs, Z_FINISH));
+	out.resize(zs.total_out);
+	inflateEnd(&zs);
+	EXPECT_EQ(body, out);
+}
+#endif
+
+static void push(Channel::Ptr ch, time_t sec, double value) {
+	struct timeval t;
+	t.tv_sec = sec;
+	t.tv_usec = 0;
+	ReadingIdentifier::Ptr pRid;
+	ch->push(Reading(value, t, pRid));
+}
+
+TEST(api_InfluxDB, batch) {
+	using namespace vz::api;
+	CurlMultiSender sender; // not started, requests just queue up
+	curlMultiSender = &sender;
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"http://influx_batch:8086"));
+	ReadingIdentifier::Ptr pRid;
+	Channel::Ptr ch1(new Channel(options, "influxdb", "uuid-1", pRid));
+	Channel::Ptr ch2(new Channel(options, "influxdb", "uuid-2", pRid));
+	{
+		InfluxDB i1(ch1, options), i2(ch2, options);
+		InfluxDB_Test::batch(i1);
+		InfluxDB_Test::batch(i2);
+		std::list<Reading> &values1 = InfluxDB_Test::values(i1);
+		std::list<Reading> &values2 = InfluxDB_Test::values(i2);
+
+		// any 2xx acknowledges what was sent, InfluxDB answers 204
+		push(ch1, 1, 1.0);
+		push(ch2, 1, 2.0);
+		i1.send();
+		i2.send();
+		InfluxDB_Test::flush(i1);
+		EXPECT_TRUE(InfluxDB_Test::pending(i1));
+		EXPECT_EQ(1u, InfluxDB_Test::inflight(i1));
+		EXPECT_EQ(1u, InfluxDB_Test::inflight(i2));
+		push(ch1, 2, 1.5); // arrives while the request is pending
+		i1.send();
+		InfluxDB_Test::response(i1, CURLE_OK, 204);
+		EXPECT_EQ(1u, values1.size());
+		EXPECT_EQ(0u, values2.size());
+		EXPECT_EQ(0u, InfluxDB_Test::inflight(i1));
+
+		// an error keeps everything and waits for the retry pause
+		InfluxDB_Test::flush(i1);
+		EXPECT_EQ(1u, InfluxDB_Test::inflight(i1));
+		InfluxDB_Test::response(i1, CURLE_OK, 400);
+		EXPECT_EQ(1u, values1.size());
+		EXPECT_EQ(0u, InfluxDB_Test::inflight(i1));
+		push(ch2, 2, 2.5);
+		i2.send();
+		InfluxDB_Test::flush_in_pause(i1);
+		EXPECT_FALSE(InfluxDB_Test::pending(i1));
+		EXPECT_EQ(0u, InfluxDB_Test::inflight(i1));
+		EXPECT_EQ(0u, InfluxDB_Test::inflight(i2));
+
+		// so does a failed transfer, whatever the status
+		InfluxDB_Test::flush(i1);
+		EXPECT_EQ(1u, InfluxDB_Test::inflight(i1));
+		EXPECT_EQ(1u, InfluxDB_Test::inflight(i2));
+		InfluxDB_Test::response(i1, CURLE_COULDNT_CONNECT, 200);
+		EXPECT_EQ(1u, values1.size());
+		EXPECT_EQ(1u, values2.size());
+		EXPECT_EQ(0u, InfluxDB_Test::inflight(i1));
+		EXPECT_EQ(0u, InfluxDB_Test::inflight(i2));
+		InfluxDB_Test::flush_in_pause(i1);
+		EXPECT_FALSE(InfluxDB_Test::pending(i1));
+
+		// after the pause both are sent again
+		InfluxDB_Test::flush(i1);
+		InfluxDB_Test::response(i1, CURLE_OK, 200);
+		EXPECT_EQ(0u, values1.size());
+		EXPECT_EQ(0u, values2.size());
+	}
+	curlMultiSender = 0;
+}
@@ -1,8 +1,10 @@
 #include <regex>
+#include <unistd.h>
 
 #include <Buffer.hpp>
 #include <Channel.hpp>
 #include <Config_Options.hpp>
+#include <CurlMultiSender.hpp>
 #include <api/Volkszaehler.hpp>
 // #include <api/CurlResponse.hpp>
 
@@ -19,9 +21,38 @@ class Volkszaehler_Test {
 		v.api_parse_exception(r, err, n);
 	}
 	static std::list<Reading> &values(Volkszaehler &v) { return v._values; }
-	static json_object *api_json_tuples(Volkszaehler &v, Buffer::Ptr buf) {
+	static size_t &sent(Volkszaehler &v) { return v._sent; }
+	static JsonWriter &outputData(Volkszaehler &v) { return v.outputData; }
+	static bool api_json_tuples(Volkszaehler &v, Buffer::Ptr buf) {
 		return v.api_json_tuples(buf);
 	};
+
+	// batch mode without the curlMultiSender thread, responses are faked
+	static void batch(Volkszaehler &v, const std::string &middleware) {
+		v._batch = VolkszaehlerBatch::get(middleware, v._api.headers, 1);
+		v._batch->add(&v);
+	}
+	static void flush(Volkszaehler &v) {
+		v._batch->_backoff.reset();
+		v._batch->flush();
+	}
+	static size_t inflight(Volkszaehler &v) { return v._inflight; }
+	static void response(Volkszaehler &v, long http_code, const std::string &body) {
+		v._batch->_request.reset();
+		v._batch->processResponse(CURLE_OK, http_code, body);
+	}
+	static int retry_pause(Volkszaehler &v) {
+		pthread_mutex_lock(&v._mutex);
+		int pause = v._backoff.pause();
+		pthread_mutex_unlock(&v._mutex);
+		return pause;
+	}
+	static size_t nr_values(Volkszaehler &v) {
+		pthread_mutex_lock(&v._mutex);
+		size_t n = v._values.size();
+		pthread_mutex_unlock(&v._mutex);
+		return n;
+	}
 };
 } // namespace api
 } // namespace vz
@@ -137,10 +168,29 @@ TEST(api_Volkszaehler, api_parse_exception) {
 	// Volkszaehler_Test::api_parse_exception(v, resp, err, n);
 	// ASSERT_STREQ("'UniqueConstraintViolationException': '2 Duplicate entry'", err);
 	Volkszaehler_Test::values(v).push_front(Reading());
+	Volkszaehler_Test::sent(v) = 1;
 	Volkszaehler_Test::api_parse_exception(v, resp, err, n);
 	ASSERT_TRUE(0 == Volkszaehler_Test::values(v).size());
 	ASSERT_STREQ("'UniqueConstraintViolationException': '2 Duplicate entry'", err);
 
+	// only the value the middleware names is dropped:
+	struct timeval t = {1, 0};
+	for (int i = 0; i < 3; i++, t.tv_sec++)
+		Volkszaehler_Test::values(v).push_back(Reading(i, t, pRid));
+	Volkszaehler_Test::sent(v) = 3;
+	resp.data = (char *)"{\"exception\": { \"type\":\"UniqueConstraintViolationException\", "
+						"\"message\":\"Duplicate entry '1-2000' for key 'ts_uniq'\"  } }";
+	resp.size = strlen(resp.data);
+	Volkszaehler_Test::api_parse_exception(v, resp, err, n);
+	ASSERT_EQ(3u, Volkszaehler_Test::values(v).size());
+	int deleted = 0;
+	for (auto &r : Volkszaehler_Test::values(v))
+		if (r.deleted()) {
+			deleted++;
+			EXPECT_EQ(2000, r.time_ms());
+		}
+	EXPECT_EQ(1, deleted);
+
 	delete[] err;
 }
 
@@ -154,26 +204,25 @@ TEST(api_Volkszaehler, api_json_tuples_no_duplicates) {
 	Volkszaehler v(chp, options);
 
 	// test using empty data:
-	json_object *j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j == 0);
+	bool j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
+	ASSERT_FALSE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 0);
 
 	struct timeval t1;
 	t1.tv_sec = 1;
-	t1.tv_usec = 1;
+	t1.tv_usec = 1000;
 	struct timeval t2;
 	t2.tv_sec = 2;
-	t2.tv_usec = 1;
+	t2.tv_usec = 1000;
 	Reading r1(1.0, t1, pRid);
 	Reading r2(1.0, t2, pRid);
 	ch->push(r1);
 
 	// expect one data returned in values:
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 1);
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r1);
-	json_object_put(j);
 	ch->buffer()->clean(); // remove deleted
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 
@@ -181,12 +230,11 @@ TEST(api_Volkszaehler, api_json_tuples_no_duplicates) {
 	ch->push(r2);
 	// expect only two data returned in values: (r1 ignored as timestamp same as previous) and r2)
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 2);
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r1);
 	ASSERT_EQ(Volkszaehler_Test::values(v).back(), r2);
 
-	json_object_put(j);
 	ch->buffer()->clean(); // remove deleted
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 }
@@ -202,26 +250,25 @@ TEST(api_Volkszaehler, api_json_tuples_duplicates) {
 	Volkszaehler v(chp, options);
 
 	// test using empty data:
-	json_object *j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j == 0);
+	bool j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
+	ASSERT_FALSE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 0);
 
 	struct timeval t1;
 	t1.tv_sec = 1;
-	t1.tv_usec = 1;
+	t1.tv_usec = 1000;
 	struct timeval t2;
 	t2.tv_sec = 2;
-	t2.tv_usec = 1;
+	t2.tv_usec = 1000;
 	Reading r1(1.0, t1, pRid);
 	Reading r2(1.0, t2, pRid);
 	ch->push(r1);
 
 	// expect one data returned in values:
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 1);
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r1);
-	json_object_put(j);
 	ch->buffer()->clean(); // remove deleted
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 
@@ -229,30 +276,28 @@ TEST(api_Volkszaehler, api_json_tuples_duplicates) {
 	ch->push(r2);
 	// expect one data returned in values: (r1 same timestamp, r2 ignored)
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 1);
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r1);
 
-	json_object_put(j);
 	ch->buffer()->clean(); // remove deleted
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 
 	struct timeval t3;
 	t3.tv_sec = 2;
-	t3.tv_usec = 1 + 1000; // at least one ms distance
+	t3.tv_usec = 2000; // at least one ms distance
 	Reading r3(2.0, t3, pRid);
 	ch->push(r3);
 
 	// now add one with a different value:
 	// then we should get r1 and the new value r3:
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 2);
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r1);
 	Volkszaehler_Test::values(v).pop_front();
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r3);
 
-	json_object_put(j);
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 
 	// now try timeout:
@@ -263,14 +308,13 @@ TEST(api_Volkszaehler, api_json_tuples_duplicates) {
 	ch->push(r4);
 	// now there should be r3 and r4:
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 2) << Volkszaehler_Test::values(v).size();
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r3);
 	Volkszaehler_Test::values(v).pop_front();
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r4);
 	Volkszaehler_Test::values(v).pop_front();
 
-	json_object_put(j);
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 
 	// now try timeout and value change:
@@ -279,12 +323,11 @@ TEST(api_Volkszaehler, api_json_tuples_duplicates) {
 	Reading r5(5.0, t1, pRid);
 	ch->push(r5);
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 1) << Volkszaehler_Test::values(v).size();
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r5);
 	Volkszaehler_Test::values(v).pop_front();
 
-	json_object_put(j);
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 
 	// now ignore one
@@ -292,7 +335,8 @@ TEST(api_Volkszaehler, api_json_tuples_duplicates) {
 	Reading r6(5.0, t1, pRid);
 	ch->push(r6);
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j == 0);
+	ASSERT_FALSE(j);
+	ASSERT_EQ(0u, Volkszaehler_Test::outputData(v).size()); // the previous body isn't sent again
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 0) << Volkszaehler_Test::values(v).size();
 
 	ASSERT_TRUE(ch->buffer()->size() == 0);
@@ -304,11 +348,149 @@ TEST(api_Volkszaehler, api_json_tuples_duplicates) {
 	Reading r7(7.0, t1, pRid);
 	ch->push(r7);
 	j = Volkszaehler_Test::api_json_tuples(v, ch->buffer());
-	ASSERT_TRUE(j != 0);
+	ASSERT_TRUE(j);
 	ASSERT_TRUE(Volkszaehler_Test::values(v).size() == 1) << Volkszaehler_Test::values(v).size();
 	ASSERT_EQ(Volkszaehler_Test::values(v).front(), r7);
 	Volkszaehler_Test::values(v).pop_front();
 
-	json_object_put(j);
 	ASSERT_TRUE(ch->buffer()->size() == 0);
 }
+
+static void push(Channel::Ptr ch, time_t sec, double value) {
+	struct timeval t;
+	t.tv_sec = sec;
+	t.tv_usec = 0;
+	ReadingIdentifier::Ptr pRid;
+	ch->push(Reading(value, t, pRid));
+}
+
+static const char *duplicate(int64_t ts) {
+	static char body[200];
+	snprintf(body, sizeof(body),
+			 "{\"exception\": {\"type\":\"UniqueConstraintViolationException\", \"message\":"
+			 "\"SQLSTATE[23000]: Duplicate entry '7-%lld' for key 'ts_uniq'\"}}",
+			 (long long)ts);
+	return body;
+}
+
+TEST(api_Volkszaehler, batch) {
+	using namespace vz::api;
+	CurlMultiSender sender; // not started, requests just queue up
+	curlMultiSender = &sender;
+	std::list<Option> options;
+	options.push_front(Option("middleware", (char *)"http://batch_middleware"));
+	ReadingIdentifier::Ptr pRid;
+	Channel::Ptr ch1(new Channel(options, "vz", "uuid-1", pRid));
+	Channel::Ptr ch2(new Channel(options, "vz", "uuid-2", pRid));
+	{
+		Volkszaehler v1(ch1, options), v2(ch2, options);
+		Volkszaehler_Test::batch(v1, "http://batch_middleware");
+		Volkszaehler_Test::batch(v2, "http://batch_middleware");
+		std::list<Reading> &values1 = Volkszaehler_Test::values(v1);
+		std::list<Reading> &values2 = Volkszaehler_Test::values(v2);
+
+		// success acknowledges what was sent
+		push(ch1, 1, 1.0);
+		push(ch2, 1, 2.0);
+		v1.send();
+		v2.send();
+		Volkszaehler_Test::flush(v1);
+		EXPECT_EQ(1u, Volkszaehler_Test::inflight(v1));
+		EXPECT_EQ(1u, Volkszaehler_Test::inflight(v2));
+		push(ch1, 2, 1.5); // arrives while the request is pending
+		v1.send();
+		Volkszaehler_Test::response(v1, 200, "");
+		EXPECT_EQ(1u, values1.size());
+		EXPECT_EQ(0u, values2.size());
+
+		// an error keeps everything
+		push(ch2, 2, 2.5);
+		v2.send();
+		Volkszaehler_Test::flush(v1);
+		Volkszaehler_Test::response(
+			v1, 500, "{\"exception\": {\"type\":\"Exception\", \"message\":\"broken\"}}");
+		EXPECT_EQ(1u, values1.size());
+		EXPECT_EQ(1u, values2.size());
+		EXPECT_EQ(0u, Volkszaehler_Test::inflight(v1));
+
+		// a duplicate only one channel sent drops just that value
+		push(ch1, 3, 1.0);
+		v1.send();
+		Volkszaehler_Test::flush(v1);
+		EXPECT_EQ(2u, Volkszaehler_Test::inflight(v1));
+		Volkszaehler_Test::response(v1, 500, duplicate(3000));
+		ASSERT_EQ(2u, values1.size());
+		EXPECT_EQ(2000, values1.front().time_ms());
+		EXPECT_FALSE(values1.front().deleted());
+		EXPECT_TRUE(values1.back().deleted());
+		EXPECT_EQ(1u, values2.size());
+
+		// both sent 2000: the channels are sent one by one until the culprit is known
+		Volkszaehler_Test::flush(v1);
+		Volkszaehler_Test::response(v1, 500, duplicate(2000));
+		EXPECT_EQ(2u, values1.size());
+		EXPECT_EQ(1u, values2.size());
+
+		Volkszaehler_Test::flush(v1);
+		EXPECT_EQ(2u, Volkszaehler_Test::inflight(v1)); // 2000 and the deleted 3000
+		EXPECT_EQ(0u, Volkszaehler_Test::inflight(v2));
+		Volkszaehler_Test::response(v1, 200, "");
+		EXPECT_EQ(0u, values1.size());
+		EXPECT_EQ(1u, values2.size());
+
+		Volkszaehler_Test::flush(v1);
+		EXPECT_EQ(1u, Volkszaehler_Test::inflight(v2));
+		Volkszaehler_Test::response(v1, 500, duplicate(2000));
+		EXPECT_EQ(0u, values2.size());
+
+		// batched again once the rest of the culprit got through
+		push(ch1, 4, 1.0);
+		push(ch2, 4, 2.0);
+		v1.send();
+		v2.send();
+		Volkszaehler_Test::flush(v1);
+		EXPECT_EQ(0u, Volkszaehler_Test::inflight(v1));
+		EXPECT_EQ(1u, Volkszaehler_Test::inflight(v2));
+		Volkszaehler_Test::response(v1, 200, "");
+		EXPECT_EQ(1u, values1.size());
+		EXPECT_EQ(0u, values2.size());
+		push(ch2, 5, 2.0);
+		v2.send();
+		Volkszaehler_Test::flush(v1);
+		EXPECT_EQ(1u, Volkszaehler_Test::inflight(v1));
+		EXPECT_EQ(1u, Volkszaehler_Test::inflight(v2));
+	}
+	curlMultiSender = 0;
+}
+
+TEST(api_Volkszaehler, async_retry) {
+	using namespace vz::api;
+	CurlMultiSender sender;
+	sender.start();
+	curlMultiSender = &sender;
+	std::list<Option> options;
+	options.push_front(Option("middleware", (char *)"http://127.0.0.1:1")); // refused
+	ReadingIdentifier::Ptr pRid;
+	Channel::Ptr ch(new Channel(options, "vz", "uuid-1", pRid));
+	{
+		Volkszaehler v(ch, options);
+		push(ch, 1, 1.0);
+		v.send();
+
+		// the failure is handled from the sender thread, without another send()
+		for (int i = 0; i < 500 && Volkszaehler_Test::retry_pause(v) == 0; ++i)
+			usleep(10000);
+		EXPECT_EQ(::options.retry_pause(), Volkszaehler_Test::retry_pause(v));
+		EXPECT_FALSE(v.isBusy());
+		EXPECT_EQ(1u, Volkszaehler_Test::nr_values(v));
+
+		// nothing is sent during the pause, the new value stays in the buffer
+		push(ch, 2, 2.0);
+		v.send();
+		EXPECT_FALSE(v.isBusy());
+		EXPECT_EQ(1u, Volkszaehler_Test::nr_values(v));
+		EXPECT_EQ(1u, ch->buffer()->size());
+	} // with the retry timer pending
+	sender.stop();
+	curlMultiSender = 0;
+}
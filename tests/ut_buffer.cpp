@@ -22,7 +22,7 @@ TEST(buffer, buffer_agg_avg) {
 		buf.aggregate(0, false);
 		// now assert exact one, not deleted:
 		ASSERT_EQ(buf.size(), (size_t)1);
-		Reading &r = *buf.begin();
+		Sample &r = *buf.begin();
 		ASSERT_TRUE(!r.deleted());
 		// first case: no prev. value, just one data -> return value as AVG.
 		ASSERT_EQ(r.value(), 1.0);
@@ -36,7 +36,7 @@ TEST(buffer, buffer_agg_avg) {
 		buf.aggregate(0, false);
 		buf.clean();
 		ASSERT_EQ(buf.size(), (size_t)1);
-		Reading &r = *buf.begin();
+		Sample &r = *buf.begin();
 		ASSERT_TRUE(!r.deleted());
 		// 2nd case: prev. value (1.0 at 1s), just one new data (2.0 at 2s)-> return 1.0 as AVG (2.0
 		// has no time yet!)
@@ -55,7 +55,7 @@ TEST(buffer, buffer_agg_avg) {
 		buf.aggregate(0, false);
 		buf.clean();
 		ASSERT_EQ(buf.size(), (size_t)1);
-		Reading &r = *buf.begin();
+		Sample &r = *buf.begin();
 		ASSERT_TRUE(!r.deleted());
 		// 3rd case: prev. value (2.0 at 2s), two new data (3.0 at 4s and 4.0 at 7s)-> return
 		// (2*2+3*3)/5 as AVG (4.0 has no time yet!)
@@ -96,3 +96,123 @@ TEST(buffer, clean) {
 	buf.clean(false);
 	ASSERT_EQ(0ul, buf.size());
 }
+
+TEST(buffer, ring_spill) {
+	// default policy grows the ring, nothing gets lost
+	Buffer buf(2);
+	ReadingIdentifier::Ptr pRid;
+	struct timeval t1;
+	t1.tv_usec = 0;
+	for (int i = 0; i < 5; i++) {
+		t1.tv_sec = i;
+		buf.push(Reading(i, t1, pRid));
+	}
+	ASSERT_EQ(5ul, buf.size());
+	ASSERT_TRUE(buf.capacity() >= 5);
+	ASSERT_EQ(0ul, buf.dropped());
+	int i = 0;
+	for (Buffer::iterator it = buf.begin(); it != buf.end(); it++, i++) {
+		ASSERT_EQ((double)i, it->value());
+		ASSERT_EQ(i * 1000ll, it->time_ms());
+	}
+}
+
+TEST(buffer, ring_drop_oldest) {
+	Buffer buf(3, Buffer::DROP_OLDEST);
+	ReadingIdentifier::Ptr pRid;
+	struct timeval t1;
+	t1.tv_usec = 0;
+	for (int i = 0; i < 5; i++) {
+		t1.tv_sec = i;
+		buf.push(Reading(i, t1, pRid));
+	}
+	ASSERT_EQ(3ul, buf.size());
+	ASSERT_EQ(3ul, buf.capacity());
+	ASSERT_EQ(2ul, buf.dropped());
+	ASSERT_EQ(2.0, buf.begin()->value());
+
+	// clean a wrapped ring and keep the order:
+	Buffer::iterator it = buf.begin();
+	it++;
+	it->mark_delete();
+	buf.clean();
+	ASSERT_EQ(2ul, buf.size());
+	it = buf.begin();
+	ASSERT_EQ(2.0, it->value());
+	it++;
+	ASSERT_EQ(4.0, it->value());
+
+	t1.tv_sec = 5;
+	buf.push(Reading(5, t1, pRid));
+	ASSERT_EQ(3ul, buf.size());
+	ASSERT_EQ(2ul, buf.dropped());
+
+	// shrinking keeps the most recent ones:
+	buf.set_capacity(1);
+	ASSERT_EQ(1ul, buf.size());
+	ASSERT_EQ(5.0, buf.begin()->value());
+}
+
+static double agg_result(Buffer::aggmode mode, const double *values, int n) {
+	Buffer buf;
+	buf.set_aggmode(mode);
+	ReadingIdentifier::Ptr pRid;
+	struct timeval t1;
+	t1.tv_usec = 0;
+	for (int i = 0; i < n; i++) {
+		t1.tv_sec = 10 + i;
+		buf.push(Reading(values[i], t1, pRid));
+	}
+	// readings are not kept, only the running values:
+	EXPECT_EQ(0ul, buf.size());
+	buf.aggregate(0, false);
+	EXPECT_EQ(1ul, buf.size());
+	EXPECT_EQ((10 + n - 1) * 1000ll, buf.begin()->time_ms());
+	return buf.begin()->value();
+}
+
+TEST(buffer, buffer_agg_modes) {
+	const double values[] = {2.0, 4.0, 4.0, 4.0, 5.0, 5.0, 7.0, 9.0};
+	const int n = sizeof(values) / sizeof(values[0]);
+
+	ASSERT_EQ(9.0, agg_result(Buffer::MAX, values, n));
+	ASSERT_EQ(2.0, agg_result(Buffer::MIN, values, n));
+	ASSERT_EQ(40.0, agg_result(Buffer::SUM, values, n));
+	ASSERT_EQ(2.0, agg_result(Buffer::FIRST, values, n));
+	ASSERT_EQ(9.0, agg_result(Buffer::LAST, values, n));
+	ASSERT_EQ(8.0, agg_result(Buffer::COUNT, values, n));
+	ASSERT_DOUBLE_EQ(2.0, agg_result(Buffer::STDDEV, values, n));
+	// equidistant, so the last value has no time yet: avg of first 7
+	ASSERT_DOUBLE_EQ(31.0 / 7.0, agg_result(Buffer::AVG, values, n));
+}
+
+TEST(buffer, buffer_agg_periods) {
+	Buffer buf;
+	buf.set_aggmode(Buffer::SUM);
+	ReadingIdentifier::Ptr pRid;
+	struct timeval t1;
+	t1.tv_usec = 0;
+
+	// empty period emits nothing:
+	buf.aggregate(0, false);
+	ASSERT_EQ(0ul, buf.size());
+
+	t1.tv_sec = 61;
+	buf.push(Reading(1.0, t1, pRid));
+	t1.tv_sec = 119;
+	buf.push(Reading(2.0, t1, pRid));
+	buf.aggregate(60, true);
+	ASSERT_EQ(1ul, buf.size());
+	ASSERT_EQ(3.0, buf.begin()->value());
+	ASSERT_EQ(60000ll, buf.begin()->time_ms());
+
+	// unsent result stays, next period starts from scratch:
+	t1.tv_sec = 125;
+	buf.push(Reading(5.0, t1, pRid));
+	buf.aggregate(60, true);
+	ASSERT_EQ(2ul, buf.size());
+	Buffer::iterator it = buf.begin();
+	it++;
+	ASSERT_EQ(5.0, it->value());
+	ASSERT_EQ(120000ll, it->time_ms());
+}
@@ -122,3 +122,11 @@ TEST(Obis, Obis_parse_LuG_E350) // all known codes from Landis+Gyr E350
 	//	0.2.0     M23
 	//	C.5.0     0433
 }
+
+TEST(Obis, Obis_hash) {
+	// used to index channels, so equal Obis need equal hashes:
+	ASSERT_EQ(Obis("1-0:1.8.0").hash(), Obis(1, 0, 1, 8, 0, 0xff).hash());
+	ASSERT_NE(Obis("1-0:1.8.0").hash(), Obis("1-0:2.8.0").hash());
+	ASSERT_NE(Obis("1-0:1.8.1").hash(), Obis("1-0:1.8.2").hash());
+	ASSERT_NE(Obis("1-0:1.8.0*1").hash(), Obis("1-0:1.8.0*2").hash());
+}
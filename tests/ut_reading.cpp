@@ -0,0 +1,78 @@
+#include "gtest/gtest.h"
+
+#include <set>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "Reading.hpp"
+
+// Reading.cpp gets included by MeterD0.cpp
+
+TEST(Reading, intern_identifier) {
+	ReadingIdentifier::Id a = ReadingIdentifier::intern(Obis("1-0:1.8.0"));
+	ASSERT_NE(0u, a);
+	ASSERT_EQ(a, ReadingIdentifier::intern(Obis(1, 0, 1, 8, 0, 0xff)));
+	ASSERT_EQ(a, ReadingIdentifier::intern(
+					 ReadingIdentifier::Ptr(new ObisIdentifier(Obis("1-0:1.8.0")))));
+	ASSERT_NE(a, ReadingIdentifier::intern(Obis("1-0:2.8.0")));
+
+	ReadingIdentifier::Id s = ReadingIdentifier::intern("Power");
+	ASSERT_EQ(s, ReadingIdentifier::intern(ReadingIdentifier::Ptr(new StringIdentifier("Power"))));
+	ASSERT_NE(s, ReadingIdentifier::intern("Impulse"));
+	ASSERT_NE(s, a);
+
+	ASSERT_EQ(0u, ReadingIdentifier::intern(ReadingIdentifier::Ptr()));
+	ASSERT_FALSE(ReadingIdentifier::lookup(0));
+
+	ReadingIdentifier::Ptr p = ReadingIdentifier::lookup(a);
+	ObisIdentifier *o = dynamic_cast<ObisIdentifier *>(p.get());
+	ASSERT_TRUE(o != NULL);
+	ASSERT_EQ(Obis("1-0:1.8.0"), o->obis());
+}
+
+TEST(Reading, identifier_is_copied_by_id) {
+	Reading r1(ReadingIdentifier::Ptr(new StringIdentifier("abc")));
+	Reading r2(r1);
+	Reading r3;
+	ASSERT_EQ(0u, r3.identifier_id());
+	r3 = r1;
+	ASSERT_EQ(r1.identifier_id(), r2.identifier_id());
+	ASSERT_EQ(r1.identifier_id(), r3.identifier_id());
+	ASSERT_EQ(r1.identifier().get(), r2.identifier().get()); // the same interned object
+
+	char buf[10];
+	ASSERT_EQ(3u, r1.unparse(buf, sizeof(buf)));
+	ASSERT_STREQ("abc", buf);
+	ASSERT_EQ(0u, Reading().unparse(buf, sizeof(buf)));
+}
+
+TEST(Reading, intern_concurrently) {
+	// more than the lock-free index holds, from several threads at once
+	const int N = 2000, THREADS = 4;
+	std::vector<std::vector<ReadingIdentifier::Id> > ids(THREADS);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++)
+		threads.push_back(std::thread([&ids, t]() {
+			char name[32];
+			for (int i = 0; i < N; i++) {
+				snprintf(name, sizeof(name), "concurrent %d", (i * 7 + t * 13) % N);
+				ids[t].push_back(ReadingIdentifier::intern(name));
+			}
+		}));
+	for (auto &th : threads)
+		th.join();
+
+	std::set<ReadingIdentifier::Id> distinct;
+	for (int i = 0; i < N; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "concurrent %d", (i * 7) % N);
+		ReadingIdentifier::Id id = ReadingIdentifier::intern(name);
+		ASSERT_EQ(id, ids[0][i]);
+		distinct.insert(id);
+		StringIdentifier *s = dynamic_cast<StringIdentifier *>(ReadingIdentifier::lookup(id).get());
+		ASSERT_TRUE(s != NULL);
+		ASSERT_EQ(std::string(name), s->string());
+	}
+	ASSERT_EQ((size_t)N, distinct.size());
+}
@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Spool.hpp"
+
+namespace {
+
+const size_t REC = 24; // bytes per record on disk
+
+std::string tmpdir() {
+	char tmpl[] = "/tmp/vzspoolXXXXXX";
+	char *d = mkdtemp(tmpl);
+	EXPECT_TRUE(d != NULL);
+	return std::string(d) + "/spool";
+}
+
+void cleanup(const std::string &dir) {
+	std::string cmd = "rm -rf " + dir.substr(0, dir.rfind('/'));
+	EXPECT_EQ(0, system(cmd.c_str()));
+}
+
+std::list<Reading> readings(int from, int n) {
+	std::list<Reading> l;
+	for (int i = from; i < from + n; i++) {
+		struct timeval tv;
+		tv.tv_sec = 1000 + i;
+		tv.tv_usec = 0;
+		l.push_back(Reading((double)i, tv, ReadingIdentifier::Ptr()));
+	}
+	return l;
+}
+
+int segments(const std::string &dir) {
+	int n = 0;
+	DIR *d = opendir(dir.c_str());
+	struct dirent *de;
+	while (d && (de = readdir(d)))
+		if (strstr(de->d_name, ".spool"))
+			n++;
+	if (d)
+		closedir(d);
+	return n;
+}
+
+} // namespace
+
+TEST(spool, append_load_ack_replay) {
+	std::string dir = tmpdir();
+	{
+		Spool s(dir, 1024 * REC, 1024 * 1024, Spool::FSYNC_NEVER);
+		s.append(readings(0, 10));
+		ASSERT_EQ(10u, s.size());
+
+		std::list<Reading> v;
+		ASSERT_EQ(4u, s.load(v, 4));
+		ASSERT_EQ(4u, v.size());
+		ASSERT_EQ(0.0, v.front().value());
+		ASSERT_EQ(1000000, v.front().time_ms());
+		ASSERT_EQ(4u, s.loaded());
+
+		s.ack(3);
+		ASSERT_EQ(7u, s.size());
+		ASSERT_EQ(1u, s.loaded());
+	}
+	{
+		// restart replays all not acknowledged:
+		Spool s(dir, 1024 * REC, 1024 * 1024, Spool::FSYNC_NEVER);
+		ASSERT_EQ(7u, s.size());
+		std::list<Reading> v;
+		ASSERT_EQ(7u, s.load(v, 100));
+		ASSERT_EQ(3.0, v.front().value());
+		ASSERT_EQ(9.0, v.back().value());
+		ASSERT_FALSE(v.front().deleted());
+		s.ack(7);
+		ASSERT_EQ(0u, s.size());
+	}
+	{
+		Spool s(dir, 1024 * REC, 1024 * 1024, Spool::FSYNC_NEVER);
+		ASSERT_EQ(0u, s.size());
+	}
+	cleanup(dir);
+}
+
+TEST(spool, rotate) {
+	std::string dir = tmpdir();
+	Spool s(dir, 4 * REC, 1024 * 1024, Spool::FSYNC_SEGMENT);
+	s.append(readings(0, 10));
+	ASSERT_EQ(3, segments(dir)); // 4 + 4 + 2
+
+	std::list<Reading> v;
+	ASSERT_EQ(10u, s.load(v, 100));
+	for (int i = 0; i < 10; i++) {
+		ASSERT_EQ((double)i, v.front().value());
+		v.pop_front();
+	}
+	s.ack(9);
+	ASSERT_EQ(1, segments(dir));
+	ASSERT_EQ(1u, s.size());
+	cleanup(dir);
+}
+
+TEST(spool, torn_write) {
+	std::string dir = tmpdir();
+	{
+		Spool s(dir, 1024 * REC, 1024 * 1024, Spool::FSYNC_NEVER);
+		s.append(readings(0, 3));
+	}
+	// simulate power loss during the next append:
+	int fd = open((dir + "/0000000000000000.spool").c_str(), O_WRONLY | O_APPEND);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(30, write(fd, "partial record, no valid crc..", 30));
+	close(fd);
+
+	Spool s(dir, 1024 * REC, 1024 * 1024, Spool::FSYNC_NEVER);
+	ASSERT_EQ(3u, s.size());
+	s.append(readings(3, 1));
+	std::list<Reading> v;
+	ASSERT_EQ(4u, s.load(v, 100));
+	ASSERT_EQ(3.0, v.back().value());
+	cleanup(dir);
+}
+
+TEST(spool, max_size) {
+	std::string dir = tmpdir();
+	Spool s(dir, 4 * REC, 12 * REC, Spool::FSYNC_NEVER);
+	std::list<Reading> v;
+	s.append(readings(0, 2));
+	ASSERT_EQ(2u, s.load(v, 2)); // keeps the first segment
+
+	s.append(readings(2, 30));
+	ASSERT_LE(s.size(), 12u);
+	ASSERT_GT(s.dropped(), 0u);
+	ASSERT_EQ(32u, s.size() + s.dropped());
+
+	// the loaded ones are still in order, then the newest
+	ASSERT_EQ(s.size() - 2, s.load(v, 100));
+	ASSERT_EQ(0.0, v.front().value());
+	ASSERT_EQ(31.0, v.back().value());
+	cleanup(dir);
+}